@@ -0,0 +1,229 @@
+#include <new>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif  // defined(_MSC_VER)
+#include "ToolBox.h"
+#include "AddressPool.h"
+
+#define BITS_PER_WORD (64)
+
+static inline uint32_t CountTrailingZeros(const uint64_t qw)
+{
+	ASSERT(0 != qw);
+#if defined(_MSC_VER)
+	unsigned long ulIndex;
+#if defined(_M_X64) || defined(_M_ARM64)
+	_BitScanForward64(&ulIndex, qw);
+	return ulIndex;
+#else  // defined(_M_X64) || defined(_M_ARM64)
+	if (_BitScanForward(&ulIndex, (unsigned long)qw))
+	{
+		return ulIndex;
+	}
+	_BitScanForward(&ulIndex, (unsigned long)(qw >> 32));
+	return 32 + ulIndex;
+#endif  // defined(_M_X64) || defined(_M_ARM64)
+#else  // defined(_MSC_VER)
+	return (uint32_t)__builtin_ctzll(qw);
+#endif  // defined(_MSC_VER)
+}
+
+static inline uint32_t CountBits(uint64_t qw)
+{
+#if defined(_MSC_VER)
+	qw = qw - ((qw >> 1) & 0x5555555555555555ull);
+	qw = (qw & 0x3333333333333333ull) + ((qw >> 2) & 0x3333333333333333ull);
+	qw = (qw + (qw >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (uint32_t)((qw * 0x0101010101010101ull) >> 56);
+#else  // defined(_MSC_VER)
+	return (uint32_t)__builtin_popcountll(qw);
+#endif  // defined(_MSC_VER)
+}
+
+// The offset a client prefers under AddressPool_HASHED. Shards are picked by
+// the high bits of the same hash, so it is mixed again before being scaled to
+// the range (by multiplication, which needs no division).
+static inline uint32_t PreferredOffset(uint32_t dwClientHash, const uint32_t dwSize)
+{
+	dwClientHash ^= dwClientHash >> 16;
+	dwClientHash *= 0x7feb352du;
+	dwClientHash ^= dwClientHash >> 15;
+	dwClientHash *= 0x846ca68bu;
+	dwClientHash ^= dwClientHash >> 16;
+	return (uint32_t)(((uint64_t)dwClientHash * dwSize) >> 32);
+}
+
+AddressPool::AddressPool()
+	: m_dwMinAddrValue(1), m_dwMaxAddrValue(0), m_dwFreeCount(0), m_dwLastAllocatedOffset(0), m_appPolicy(AddressPool_ROUND_ROBIN)
+{
+}
+
+bool AddressPool::Initialize(const uint32_t dwMinAddrValue, const uint32_t dwMaxAddrValue)
+{
+	ASSERT(dwMinAddrValue <= dwMaxAddrValue);
+	const uint32_t dwCount = dwMaxAddrValue - dwMinAddrValue + 1;
+	ASSERT(0 != dwCount);  // The full 32-bit range is not supported
+	const size_t stWords = ((size_t)dwCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	const size_t stSummaryWords = (stWords + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	try
+	{
+		m_vqwFree.assign(stWords, ~(uint64_t)0);
+		m_vqwSummary.assign(stSummaryWords, ~(uint64_t)0);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	// Bits past the end of the range are never free
+	if (0 != (dwCount % BITS_PER_WORD))
+	{
+		m_vqwFree[stWords - 1] = (((uint64_t)1) << (dwCount % BITS_PER_WORD)) - 1;
+	}
+	if (0 != (stWords % BITS_PER_WORD))
+	{
+		m_vqwSummary[stSummaryWords - 1] = (((uint64_t)1) << (stWords % BITS_PER_WORD)) - 1;
+	}
+	m_dwMinAddrValue = dwMinAddrValue;
+	m_dwMaxAddrValue = dwMaxAddrValue;
+	m_dwFreeCount = dwCount;
+	m_dwLastAllocatedOffset = dwCount - 1;  // Initialize to max to wrap and offer min first
+	return true;
+}
+
+bool AddressPool::IsFree(const uint32_t dwAddrValue) const
+{
+	if (!Contains(dwAddrValue))
+	{
+		return false;
+	}
+	const uint32_t dwOffset = dwAddrValue - m_dwMinAddrValue;
+	return 0 != (m_vqwFree[dwOffset / BITS_PER_WORD] & (((uint64_t)1) << (dwOffset % BITS_PER_WORD)));
+}
+
+void AddressPool::MarkInUse(const uint32_t dwAddrValue)
+{
+	if (!IsFree(dwAddrValue))
+	{
+		return;
+	}
+	const uint32_t dwOffset = dwAddrValue - m_dwMinAddrValue;
+	const size_t stWord = dwOffset / BITS_PER_WORD;
+	m_vqwFree[stWord] &= ~(((uint64_t)1) << (dwOffset % BITS_PER_WORD));
+	if (0 == m_vqwFree[stWord])
+	{
+		m_vqwSummary[stWord / BITS_PER_WORD] &= ~(((uint64_t)1) << (stWord % BITS_PER_WORD));
+	}
+	m_dwFreeCount--;
+}
+
+void AddressPool::MarkFree(const uint32_t dwAddrValue)
+{
+	if (!Contains(dwAddrValue) || IsFree(dwAddrValue))
+	{
+		return;
+	}
+	const uint32_t dwOffset = dwAddrValue - m_dwMinAddrValue;
+	const size_t stWord = dwOffset / BITS_PER_WORD;
+	m_vqwFree[stWord] |= ((uint64_t)1) << (dwOffset % BITS_PER_WORD);
+	m_vqwSummary[stWord / BITS_PER_WORD] |= ((uint64_t)1) << (stWord % BITS_PER_WORD);
+	m_dwFreeCount++;
+}
+
+void AddressPool::MarkRangeInUse(const uint32_t dwFirstAddrValue, const uint32_t dwLastAddrValue)
+{
+	ASSERT(dwFirstAddrValue <= dwLastAddrValue);
+	if ((dwLastAddrValue < m_dwMinAddrValue) || (m_dwMaxAddrValue < dwFirstAddrValue))
+	{
+		return;
+	}
+	const uint32_t dwFirstOffset = ((dwFirstAddrValue < m_dwMinAddrValue) ? m_dwMinAddrValue : dwFirstAddrValue) - m_dwMinAddrValue;
+	const uint32_t dwLastOffset = ((m_dwMaxAddrValue < dwLastAddrValue) ? m_dwMaxAddrValue : dwLastAddrValue) - m_dwMinAddrValue;
+	const size_t stFirstWord = dwFirstOffset / BITS_PER_WORD;
+	const size_t stLastWord = dwLastOffset / BITS_PER_WORD;
+	for (size_t stWord = stFirstWord; stWord <= stLastWord; stWord++)
+	{
+		// Whole words in the middle; only the first and last are partial
+		uint64_t qwMask = ~(uint64_t)0;
+		if (stFirstWord == stWord)
+		{
+			qwMask &= ~(uint64_t)0 << (dwFirstOffset % BITS_PER_WORD);
+		}
+		if (stLastWord == stWord)
+		{
+			qwMask &= ~(uint64_t)0 >> (BITS_PER_WORD - 1 - (dwLastOffset % BITS_PER_WORD));
+		}
+		const uint64_t qwClearing = m_vqwFree[stWord] & qwMask;
+		if (0 != qwClearing)
+		{
+			m_vqwFree[stWord] &= ~qwClearing;
+			m_dwFreeCount -= CountBits(qwClearing);
+			if (0 == m_vqwFree[stWord])
+			{
+				m_vqwSummary[stWord / BITS_PER_WORD] &= ~(((uint64_t)1) << (stWord % BITS_PER_WORD));
+			}
+		}
+	}
+}
+
+bool AddressPool::Allocate(const uint32_t dwClientHash, uint32_t* const pdwAddrValue)
+{
+	ASSERT(0 != pdwAddrValue);
+	if (IsExhausted())
+	{
+		return false;
+	}
+	// Round robin searches (last, max] and then wraps to [min, last]. Hashed
+	// starts at the client's preferred address instead: the rest of its
+	// 64-address word is probed with one read, and only when that is full
+	// (a dense part of the pool) does the summary look further, so a client
+	// gets the same address every time unless a neighbour got there first.
+	const uint32_t dwStartOffset = (AddressPool_HASHED == m_appPolicy) ? PreferredOffset(dwClientHash, Size()) : (m_dwLastAllocatedOffset + 1);
+	uint32_t dwOffset;
+	if (!FindFree(dwStartOffset, Size(), &dwOffset))
+	{
+		VERIFY(FindFree(0, dwStartOffset, &dwOffset));
+	}
+	m_dwLastAllocatedOffset = dwOffset;
+	*pdwAddrValue = m_dwMinAddrValue + dwOffset;
+	MarkInUse(*pdwAddrValue);
+	return true;
+}
+
+bool AddressPool::FindFree(const uint32_t dwBeginOffset, const uint32_t dwEndOffset, uint32_t* const pdwOffset) const
+{
+	ASSERT((dwEndOffset <= Size()) && (0 != pdwOffset));
+	if (dwEndOffset <= dwBeginOffset)
+	{
+		return false;
+	}
+	// Remainder of the first word
+	size_t stWord = dwBeginOffset / BITS_PER_WORD;
+	const uint64_t qwBits = m_vqwFree[stWord] & (~(uint64_t)0 << (dwBeginOffset % BITS_PER_WORD));
+	if (0 == qwBits)
+	{
+		// Let the summary skip full words
+		stWord++;
+		for (;;)
+		{
+			if ((uint64_t)dwEndOffset <= (uint64_t)stWord * BITS_PER_WORD)
+			{
+				return false;
+			}
+			const size_t stSummaryWord = stWord / BITS_PER_WORD;
+			const uint64_t qwSummaryBits = m_vqwSummary[stSummaryWord] & (~(uint64_t)0 << (stWord % BITS_PER_WORD));
+			if (0 != qwSummaryBits)
+			{
+				stWord = stSummaryWord * BITS_PER_WORD + CountTrailingZeros(qwSummaryBits);
+				break;
+			}
+			stWord = (stSummaryWord + 1) * BITS_PER_WORD;
+		}
+		ASSERT(0 != m_vqwFree[stWord]);
+		*pdwOffset = (uint32_t)(stWord * BITS_PER_WORD) + CountTrailingZeros(m_vqwFree[stWord]);
+	}
+	else
+	{
+		*pdwOffset = (uint32_t)(stWord * BITS_PER_WORD) + CountTrailingZeros(qwBits);
+	}
+	return *pdwOffset < dwEndOffset;
+}
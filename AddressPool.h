@@ -0,0 +1,57 @@
+#if !defined(ADDRESS_POOL_HEADER)
+#define ADDRESS_POOL_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// How Allocate picks an address for a new client
+enum AddressPoolPolicy
+{
+	AddressPool_ROUND_ROBIN,  // The first free address after the last one allocated, so it depends on arrival order
+	AddressPool_HASHED,  // The first free address at or after one derived from the client's hash, so it survives restarts
+};
+
+// Free-address allocator over [dwMinAddrValue, dwMaxAddrValue] (host order values)
+// Level 0 has one bit per address (set = free), level 1 has one bit per level 0
+// word (set = that word has a free address), so finding the next free address
+// touches at most a few words instead of probing address by address.
+class AddressPool
+{
+public:
+	AddressPool();
+
+	bool Initialize(const uint32_t dwMinAddrValue, const uint32_t dwMaxAddrValue);
+
+	bool Contains(const uint32_t dwAddrValue) const { return (m_dwMinAddrValue <= dwAddrValue) && (dwAddrValue <= m_dwMaxAddrValue); }
+	bool IsFree(const uint32_t dwAddrValue) const;
+	bool IsExhausted() const { return 0 == m_dwFreeCount; }
+	uint32_t FreeCount() const { return m_dwFreeCount; }
+	uint32_t Size() const { return m_dwMaxAddrValue - m_dwMinAddrValue + 1; }
+
+	// Marking an address outside the range is ignored
+	void MarkInUse(const uint32_t dwAddrValue);
+	void MarkFree(const uint32_t dwAddrValue);
+	// Every address of [dwFirstAddrValue, dwLastAddrValue] inside the range,
+	// a bitmap word at a time (for excluded ranges)
+	void MarkRangeInUse(const uint32_t dwFirstAddrValue, const uint32_t dwLastAddrValue);
+
+	void SetPolicy(const AddressPoolPolicy appPolicy) { m_appPolicy = appPolicy; }
+	// Claims a free address for a client whose identifier hashes to
+	// dwClientHash (only AddressPool_HASHED uses it), wrapping from max to
+	// min; false when the pool is exhausted
+	bool Allocate(const uint32_t dwClientHash, uint32_t* const pdwAddrValue);
+
+private:
+	bool FindFree(const uint32_t dwBeginOffset, const uint32_t dwEndOffset, uint32_t* const pdwOffset) const;
+
+	std::vector<uint64_t> m_vqwFree;
+	std::vector<uint64_t> m_vqwSummary;
+	uint32_t m_dwMinAddrValue;
+	uint32_t m_dwMaxAddrValue;
+	uint32_t m_dwFreeCount;
+	uint32_t m_dwLastAllocatedOffset;
+	AddressPoolPolicy m_appPolicy;
+};
+
+#endif  // !defined(ADDRESS_POOL_HEADER)
@@ -0,0 +1,156 @@
+#include <string.h>
+#include <new>
+#include "ToolBox.h"
+#include "AdmissionControl.h"
+
+// Link keys: the relay agent's address or the interface index, tagged so the two never meet
+#define LINK_KEY_RELAYED (((uint64_t)1) << 32)
+#define LINK_KEY_INTERFACE (((uint64_t)2) << 32)
+// A counter halved this many times is 0 whatever it held
+#define SKETCH_COUNTER_BITS (16)
+
+static inline uint64_t MixKey(uint64_t qwKey)
+{
+	qwKey = (qwKey ^ (qwKey >> 33)) * 0xff51afd7ed558ccdull;
+	qwKey = (qwKey ^ (qwKey >> 33)) * 0xc4ceb9fe1a85ec53ull;
+	return qwKey ^ (qwKey >> 33);
+}
+
+// All 16 bytes of chaddr: hlen is as much the sender's choice as the rest
+static inline uint64_t HashClientHardwareAddress(const uint8_t* const pbChaddr)
+{
+	uint64_t qwLow;
+	uint64_t qwHigh;
+	memcpy(&qwLow, &pbChaddr[0], sizeof(qwLow));
+	memcpy(&qwHigh, &pbChaddr[sizeof(qwLow)], sizeof(qwHigh));
+	return MixKey(MixKey(qwLow ^ 0x9e3779b97f4a7c15ull) ^ qwHigh);
+}
+
+AdmissionControl::AdmissionControl()
+	: m_qwSketchTime(0)
+{
+}
+
+bool AdmissionControl::Initialize()
+{
+	TokenBucket tbEmpty;
+	tbEmpty.qwKey = 0;
+	tbEmpty.qwLastRefill = 0;
+	tbEmpty.dwTokens = 0;
+	try
+	{
+		m_vwSketch.assign((size_t)SKETCH_DEPTH * SKETCH_WIDTH, 0);
+		m_vtbClients.assign(CLIENT_BUCKET_COUNT, tbEmpty);
+		m_vtbLinks.assign(LINK_BUCKET_COUNT, tbEmpty);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	m_qwSketchTime = 0;
+	return true;
+}
+
+void AdmissionControl::Decay(const uint64_t qwNow)
+{
+	// Halving once per second keeps a client's count near twice its rate
+	// over the last second or two, and forgets a quiet client in seconds
+	if (qwNow <= m_qwSketchTime)
+	{
+		return;
+	}
+	const unsigned int iShift = (SKETCH_COUNTER_BITS < qwNow - m_qwSketchTime) ? SKETCH_COUNTER_BITS : (unsigned int)(qwNow - m_qwSketchTime);
+	m_qwSketchTime = qwNow;
+	for (size_t i = 0; i < m_vwSketch.size(); i++)
+	{
+		m_vwSketch[i] = (uint16_t)(m_vwSketch[i] >> iShift);
+	}
+}
+
+uint32_t AdmissionControl::CountClient(const uint64_t qwClientHash)
+{
+	// Conservative update: only the counters at the minimum (the estimate) are
+	// incremented, so a row shared with a heavy hitter does not inflate further
+	uint16_t* pwCounters[SKETCH_DEPTH];
+	uint16_t wEstimate = 0xffff;
+	for (unsigned int i = 0; i < SKETCH_DEPTH; i++)
+	{
+		pwCounters[i] = &m_vwSketch[((size_t)i * SKETCH_WIDTH) + (size_t)((qwClientHash >> (i * SKETCH_WIDTH_BITS)) & (SKETCH_WIDTH - 1))];
+		if (*pwCounters[i] < wEstimate)
+		{
+			wEstimate = *pwCounters[i];
+		}
+	}
+	if (0xffff == wEstimate)
+	{
+		return wEstimate;  // Saturated
+	}
+	for (unsigned int i = 0; i < SKETCH_DEPTH; i++)
+	{
+		if (*pwCounters[i] == wEstimate)
+		{
+			(*pwCounters[i])++;
+		}
+	}
+	return (uint32_t)wEstimate + 1;
+}
+
+bool AdmissionControl::Take(TokenBucket* const ptb, const uint64_t qwKey, const uint64_t qwNow, const uint32_t dwRate, const uint32_t dwBurst, const uint32_t dwInitialTokens)
+{
+	// Refilled once per second, so the bucket holds at least a second's worth (also while a worker
+	// sees half of a change of limits), and a new key starts with at least that much
+	const uint32_t dwCapacity = (dwBurst < dwRate) ? dwRate : dwBurst;
+	if ((ptb->qwKey != qwKey) && ((0 == ptb->qwKey) || (ptb->qwLastRefill + 1 < qwNow)))
+	{
+		// A new key, in a bucket unused for over a second
+		ptb->qwKey = qwKey;
+		ptb->qwLastRefill = qwNow;
+		ptb->dwTokens = (dwInitialTokens < dwRate) ? dwRate : ((dwInitialTokens < dwCapacity) ? dwInitialTokens : dwCapacity);
+	}
+	else if (ptb->qwLastRefill < qwNow)
+	{
+		// Keys colliding in a busy bucket share its tokens, so taking turns does not reset them
+		ptb->qwKey = qwKey;
+		const uint64_t qwTokens = ptb->dwTokens + ((qwNow - ptb->qwLastRefill) * dwRate);
+		ptb->dwTokens = (qwTokens < dwCapacity) ? (uint32_t)qwTokens : dwCapacity;
+		ptb->qwLastRefill = qwNow;
+	}
+	if (0 == ptb->dwTokens)
+	{
+		return false;
+	}
+	ptb->dwTokens--;
+	return true;
+}
+
+AdmissionVerdict AdmissionControl::Admit(const DHCPMessage& rdhcpmRequest, const unsigned int iInterfaceIndex, const uint64_t qwNow, const DhcpAdmissionLimits& rdal)
+{
+	ASSERT(!m_vwSketch.empty());
+	if (0 != rdal.dwClientRate)
+	{
+		Decay(qwNow);
+		const uint64_t qwClientHash = HashClientHardwareAddress(rdhcpmRequest.chaddr);
+		// Counters saturate, so a larger burst would never be exceeded
+		const uint32_t dwHeavyCount = (rdal.dwClientBurst < 0xffff) ? rdal.dwClientBurst : 0xfffe;
+		if (dwHeavyCount < CountClient(qwClientHash))
+		{
+			// A heavy hitter starts with a second's worth of tokens: a client
+			// within the rate is never dropped, whatever its count
+			TokenBucket* const ptb = &m_vtbClients[(size_t)(qwClientHash >> 48) & (CLIENT_BUCKET_COUNT - 1)];
+			if (!Take(ptb, qwClientHash | 1, qwNow, rdal.dwClientRate, rdal.dwClientBurst, rdal.dwClientRate))
+			{
+				return Admission_CLIENT_LIMITED;
+			}
+		}
+	}
+	if (0 != rdal.dwLinkRate)
+	{
+		const uint64_t qwLinkKey = (0 != rdhcpmRequest.giaddr) ? (LINK_KEY_RELAYED | rdhcpmRequest.giaddr) : (LINK_KEY_INTERFACE | iInterfaceIndex);
+		TokenBucket* const ptb = &m_vtbLinks[(size_t)(MixKey(qwLinkKey) >> 32) & (LINK_BUCKET_COUNT - 1)];
+		if (!Take(ptb, qwLinkKey, qwNow, rdal.dwLinkRate, rdal.dwLinkBurst, rdal.dwLinkBurst))
+		{
+			return Admission_LINK_LIMITED;
+		}
+	}
+	return Admission_ADMIT;
+}
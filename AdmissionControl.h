@@ -0,0 +1,75 @@
+#if !defined(ADMISSION_CONTROL_HEADER)
+#define ADMISSION_CONTROL_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "DHCPMessage.h"
+
+// Request rate limits; a rate of 0 turns that limit off, and a burst below the
+// rate is taken as the rate (buckets hold at least a second's worth)
+struct DhcpAdmissionLimits
+{
+	uint32_t dwClientRate;  // Requests per second from one chaddr once it is a heavy hitter
+	uint32_t dwClientBurst;  // Requests a chaddr sends (its decayed count) before it is a heavy hitter
+	uint32_t dwLinkRate;  // Requests per second through one relay agent (giaddr), or from one interface
+	uint32_t dwLinkBurst;  // Token bucket depth of a link
+};
+
+enum AdmissionVerdict
+{
+	Admission_ADMIT,
+	Admission_CLIENT_LIMITED,
+	Admission_LINK_LIMITED,
+};
+
+// Drops floods before they reach the lease state, in fixed memory. Clients
+// (chaddr) are counted in a count-min sketch whose counters halve every
+// second; a client whose estimate goes past the burst is a heavy hitter and
+// gets a token bucket in a small direct-mapped table, so a flood of random
+// chaddrs (each one light) never evicts the buckets of the heavy ones. A
+// flood of random chaddrs is caught by the link's token bucket instead: one
+// per relay agent (giaddr) for relayed requests, per ingress interface for
+// the rest. Time is in whole seconds (DhcpRequestInfo::qwNow). Not thread
+// safe: each worker has its own.
+class AdmissionControl
+{
+public:
+	AdmissionControl();
+
+	bool Initialize();
+
+	// Counts the request and decides whether it may go on; only reads the fixed header
+	AdmissionVerdict Admit(const DHCPMessage& rdhcpmRequest, const unsigned int iInterfaceIndex, const uint64_t qwNow, const DhcpAdmissionLimits& rdal);
+
+private:
+	enum
+	{
+		SKETCH_DEPTH = 4,
+		SKETCH_WIDTH_BITS = 12,  // SKETCH_DEPTH rows of this many hash bits fit in 48 bits
+		SKETCH_WIDTH = 1 << SKETCH_WIDTH_BITS,
+		CLIENT_BUCKET_COUNT = 1024,
+		LINK_BUCKET_COUNT = 256,
+	};
+
+	struct TokenBucket
+	{
+		uint64_t qwKey;  // 0 for an empty bucket
+		uint64_t qwLastRefill;
+		uint32_t dwTokens;
+	};
+
+	void Decay(const uint64_t qwNow);
+	uint32_t CountClient(const uint64_t qwClientHash);
+	static bool Take(TokenBucket* const ptb, const uint64_t qwKey, const uint64_t qwNow, const uint32_t dwRate, const uint32_t dwBurst, const uint32_t dwInitialTokens);
+
+	AdmissionControl(const AdmissionControl&);
+	AdmissionControl& operator=(const AdmissionControl&);
+
+	std::vector<uint16_t> m_vwSketch;  // SKETCH_DEPTH rows of SKETCH_WIDTH counters
+	std::vector<TokenBucket> m_vtbClients;  // Heavy hitters only
+	std::vector<TokenBucket> m_vtbLinks;
+	uint64_t m_qwSketchTime;  // When the counters were last halved
+};
+
+#endif  // !defined(ADMISSION_CONTROL_HEADER)
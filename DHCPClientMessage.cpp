@@ -0,0 +1,97 @@
+#include <string.h>
+#include "ToolBox.h"
+#include "DHCPClientMessage.h"
+
+static inline uint8_t* AppendOption(uint8_t* pb, const uint8_t bOption, const void* const pvData, const size_t stSize)
+{
+	ASSERT(stSize <= 255);
+	pb[0] = bOption;
+	pb[1] = (uint8_t)stSize;
+	memcpy(pb + 2, pvData, stSize);
+	return pb + 2 + stSize;
+}
+
+size_t BuildDHCPClientMessage(const DHCPClientMessageFields& rdcmf, uint8_t* const pbMessage, const size_t stSize)
+{
+	ASSERT(0 != pbMessage);
+	const size_t stHostNameSize = (0 != rdcmf.pcsHostName) ? strlen(rdcmf.pcsHostName) : 0;
+	// Message type, client identifier, host name, requested address, server identifier, rapid commit, END
+	const size_t stNeeded = sizeof(DHCPMessage) + 3 +
+		((0 != rdcmf.pbClientIdentifier) ? 2 + rdcmf.stClientIdentifierSize : 0) +
+		((0 != rdcmf.pcsHostName) ? 2 + stHostNameSize : 0) +
+		((0 != rdcmf.dwRequestedAddr) ? 6 : 0) +
+		((0 != rdcmf.dwServerIdentifier) ? 6 : 0) +
+		(rdcmf.bRapidCommit ? 2 : 0) +
+		1;
+	if ((stSize < stNeeded) || (255 < rdcmf.stClientIdentifierSize) || (255 < stHostNameSize))
+	{
+		return 0;
+	}
+	memset(pbMessage, 0, sizeof(DHCPMessage));
+	DHCPMessage* const pdhcpm = (DHCPMessage*)pbMessage;
+	pdhcpm->op = op_BOOTREQUEST;
+	pdhcpm->htype = 1;  // Ethernet
+	pdhcpm->hlen = sizeof(rdcmf.pbChaddr);
+	pdhcpm->xid = rdcmf.dwXid;
+	if (rdcmf.bBroadcast)
+	{
+		((uint8_t*)&pdhcpm->flags)[0] = BROADCAST_FLAG;
+	}
+	pdhcpm->ciaddr = rdcmf.dwCiaddr;
+	memcpy(pdhcpm->chaddr, rdcmf.pbChaddr, sizeof(rdcmf.pbChaddr));
+	memcpy(pdhcpm->magicCookie, pbDHCPMagicCookie, sizeof(pdhcpm->magicCookie));
+	uint8_t* pb = pdhcpm->options;
+	const uint8_t bMessageType = (uint8_t)rdcmf.dhcpmtMessageType;
+	pb = AppendOption(pb, option_DHCPMESSAGETYPE, &bMessageType, sizeof(bMessageType));
+	if (0 != rdcmf.pbClientIdentifier)
+	{
+		pb = AppendOption(pb, option_CLIENTIDENTIFIER, rdcmf.pbClientIdentifier, rdcmf.stClientIdentifierSize);
+	}
+	if (0 != rdcmf.pcsHostName)
+	{
+		pb = AppendOption(pb, option_HOSTNAME, rdcmf.pcsHostName, stHostNameSize);
+	}
+	if (0 != rdcmf.dwRequestedAddr)
+	{
+		pb = AppendOption(pb, option_REQUESTEDIPADDRESS, &rdcmf.dwRequestedAddr, sizeof(rdcmf.dwRequestedAddr));
+	}
+	if (0 != rdcmf.dwServerIdentifier)
+	{
+		pb = AppendOption(pb, option_SERVERIDENTIFIER, &rdcmf.dwServerIdentifier, sizeof(rdcmf.dwServerIdentifier));
+	}
+	if (rdcmf.bRapidCommit)
+	{
+		pb = AppendOption(pb, option_RAPIDCOMMIT, "", 0);
+	}
+	*pb++ = option_END;
+	ASSERT((size_t)(pb - pbMessage) == stNeeded);
+	return (size_t)(pb - pbMessage);
+}
+
+bool ParseDHCPServerReply(const uint8_t* const pbReply, const size_t stSize, DHCPMessageTypes* const pdhcpmtMessageType, uint32_t* const pdwXid, uint32_t* const pdwYiaddr, uint32_t* const pdwServerIdentifier)
+{
+	ASSERT((0 != pdhcpmtMessageType) && (0 != pdwXid) && (0 != pdwYiaddr) && (0 != pdwServerIdentifier));
+	const DHCPMessage* const pdhcpm = (const DHCPMessage*)pbReply;
+	if ((stSize < sizeof(DHCPMessage)) || (op_BOOTREPLY != pdhcpm->op) ||
+		(0 != memcmp(pbDHCPMagicCookie, pdhcpm->magicCookie, sizeof(pbDHCPMagicCookie))))
+	{
+		return false;
+	}
+	// Server replies are short and never overloaded, so a plain scan is enough
+	const int iOptionsSize = (int)(stSize - sizeof(DHCPMessage));
+	const uint8_t* pbData;
+	unsigned int iDataSize;
+	if (!FindOptionData(option_DHCPMESSAGETYPE, pdhcpm->options, iOptionsSize, &pbData, &iDataSize) || (1 != iDataSize))
+	{
+		return false;
+	}
+	*pdhcpmtMessageType = (DHCPMessageTypes)pbData[0];
+	*pdwServerIdentifier = 0;
+	if (FindOptionData(option_SERVERIDENTIFIER, pdhcpm->options, iOptionsSize, &pbData, &iDataSize) && (sizeof(*pdwServerIdentifier) == iDataSize))
+	{
+		memcpy(pdwServerIdentifier, pbData, sizeof(*pdwServerIdentifier));
+	}
+	*pdwXid = pdhcpm->xid;
+	*pdwYiaddr = pdhcpm->yiaddr;
+	return true;
+}
@@ -0,0 +1,37 @@
+#if !defined(DHCP_CLIENT_MESSAGE_HEADER)
+#define DHCP_CLIENT_MESSAGE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DHCPMessage.h"
+#include "DHCPOptions.h"
+
+// The client side of RFC 2131, as needed by the benchmark and load generator
+// to play synthetic clients (it is not part of the server)
+
+// Room for any message BuildDHCPClientMessage produces
+#define DHCP_CLIENT_MESSAGE_MAX_SIZE (sizeof(DHCPMessage) + 512)
+
+struct DHCPClientMessageFields
+{
+	DHCPMessageTypes dhcpmtMessageType;
+	uint32_t dwXid;
+	uint8_t pbChaddr[6];  // Ethernet hardware address
+	const uint8_t* pbClientIdentifier;  // Option 61; omitted when 0
+	size_t stClientIdentifierSize;
+	const char* pcsHostName;  // Option 12; omitted when 0
+	uint32_t dwCiaddr;  // The remaining addresses are in network order
+	uint32_t dwRequestedAddr;  // Option 50; omitted when 0
+	uint32_t dwServerIdentifier;  // Option 54; omitted when 0
+	bool bBroadcast;  // Sets the broadcast flag
+	bool bRapidCommit;  // Option 80 (RFC 4039), for a DISCOVER
+};
+
+// Returns the message size, or 0 if the fields do not fit in stSize bytes
+size_t BuildDHCPClientMessage(const DHCPClientMessageFields& rdcmf, uint8_t* const pbMessage, const size_t stSize);
+
+// Extracts what a client needs from a server reply; false if it is not a
+// well-formed BOOTREPLY with a message type
+bool ParseDHCPServerReply(const uint8_t* const pbReply, const size_t stSize, DHCPMessageTypes* const pdhcpmtMessageType, uint32_t* const pdwXid, uint32_t* const pdwYiaddr, uint32_t* const pdwServerIdentifier);
+
+#endif  // !defined(DHCP_CLIENT_MESSAGE_HEADER)
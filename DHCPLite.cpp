@@ -1,12 +1,64 @@
+#if defined(_WIN32)
 #include <windows.h>
 #include <iphlpapi.h>
 #include <iprtrmib.h>
+#else  // defined(_WIN32)
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif  // defined(_WIN32)
 #include <stdio.h>
 #include <vector>
-#include <string>
-#include "toolbox.h"
+#if !defined(_WIN32)
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#endif  // !defined(_WIN32)
+#include "ToolBox.h"
+#include "DhcpEngine.h"
+#include "EventLog.h"
+#if !defined(_WIN32)
+#include "IcmpProber.h"
+#include "LeaseDatabase.h"
+#include "PacketRing.h"
+#include "StatsServer.h"
+#endif  // !defined(_WIN32)
 
+#if !defined(_WIN32)
+// Win32 names used below, so the protocol handling is shared by both platforms
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int SOCKET;
+typedef char TCHAR;
+typedef struct sockaddr SOCKADDR;
+typedef struct sockaddr_in SOCKADDR_IN;
+#define TEXT(s) s
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket(s) close(s)
+#define ZeroMemory(pv, cb) memset((pv), 0, (cb))
+#endif  // !defined(_WIN32)
+
+#if defined(_WIN32)
 const TCHAR ptsCRLF[] = TEXT("\r\n");
+#else  // defined(_WIN32)
+const TCHAR ptsCRLF[] = TEXT("\n");
+#endif  // defined(_WIN32)
 const TCHAR ptsERRORPrefix[] = TEXT("ERROR %d: ");
 #define OUTPUT(x) printf x; printf(ptsCRLF)
 #define OUTPUT_ERROR(x) printf(ptsERRORPrefix, __LINE__); printf x; printf(ptsCRLF);
@@ -18,128 +70,68 @@ const TCHAR ptsERRORPrefix[] = TEXT("ERROR %d: ");
 #define DWIPtoValue(dw) ((DWIP0(dw)<<24) | (DWIP1(dw)<<16) | (DWIP2(dw)<<8) | DWIP3(dw))
 #define DWValuetoIP(dw) ((DWIP0(dw)<<24) | (DWIP1(dw)<<16) | (DWIP2(dw)<<8) | DWIP3(dw))
 
-const char pcsServerName[] = "DHCPLite DHCP server";
-
 // Maximum size of a UDP datagram (see RFC 768)
 #define MAX_UDP_MESSAGE_SIZE ((65536)-8)
-// DHCP constants (see RFC 2131 section 4.1)
-#define DHCP_SERVER_PORT (67)
-#define DHCP_CLIENT_PORT (68)
-// Broadcast bit for flags field (RFC 2131 section 2)
-#define BROADCAST_FLAG (0x80)
+// Size of each receive buffer in the Linux batch ring (Ethernet MTU); larger datagrams are dropped
+#define RECEIVE_BUFFER_SIZE (1500)
+// Datagrams drained per recvmmsg/replies flushed per sendmmsg (UIO_MAXIOV bounds the maximum)
+#define DEFAULT_RECEIVE_BATCH_SIZE (64)
+#define MAX_RECEIVE_BATCH_SIZE (1024)
+// Upper bound for --workers (one socket, thread and lease shard each)
+#define MAX_WORKER_COUNT (256)
+// Replies each worker keeps for answering retransmissions (--reply-cache)
+#define DEFAULT_REPLY_CACHE_SIZE (4096)
+#define MAX_REPLY_CACHE_SIZE (1 << 20)
+// Upper bound for the rates and bursts of --client-limit and --link-limit (requests per second)
+#define MAX_ADMISSION_LIMIT (1000000)
+// Default burst of --client-limit, in seconds at the rate: a client's count, halved every second, settles near twice its rate
+#define DEFAULT_CLIENT_BURST_FACTOR (2)
+#define DEFAULT_LINK_BURST_FACTOR (1)
+// How often an idle Linux receive loop wakes up to expire leases and check for shutdown (seconds)
+#define WORKER_STOP_POLL_INTERVAL (1)
 // For display of host name information
 #define MAX_HOSTNAME_LENGTH (256)
-// RFC 2131 section 2
-enum op_values
-{
-	op_BOOTREQUEST = 1,
-	op_BOOTREPLY = 2,
-};
-// RFC 2132 section 9.6
-enum option_values
-{
-	option_PAD = 0,
-	option_SUBNETMASK = 1,
-	option_HOSTNAME = 12,
-	option_REQUESTEDIPADDRESS = 50,
-	option_IPADDRESSLEASETIME = 51,
-	option_DHCPMESSAGETYPE = 53,
-	option_SERVERIDENTIFIER = 54,
-	option_CLIENTIDENTIFIER = 61,
-	option_END = 255,
-};
-enum DHCPMessageTypes
-{
-	DHCPMessageType_DISCOVER = 1,
-	DHCPMessageType_OFFER = 2,
-	DHCPMessageType_REQUEST = 3,
-	DHCPMessageType_DECLINE = 4,
-	DHCPMessageType_ACK = 5,
-	DHCPMessageType_NAK = 6,
-	DHCPMessageType_RELEASE = 7,
-	DHCPMessageType_INFORM = 8,
-};
-
-// DHCP magic cookie values
-const BYTE pbDHCPMagicCookie[] = { 99, 130, 83, 99 };
-
-struct AddressInUseInformation
-{
-	DWORD dwAddrValue;
-	BYTE* pbClientIdentifier;
-	DWORD dwClientIdentifierSize;
-	// SYSTEMTIME stExpireTime;  // If lease timeouts are needed
-};
-typedef std::vector<AddressInUseInformation> VectorAddressInUseInformation;
-
-typedef bool(*FindIndexOfFilter)(const AddressInUseInformation& raiui, const void* const pvFilterData);
-int FindIndexOf(const VectorAddressInUseInformation* const pvAddressesInUse, const FindIndexOfFilter pFilter, const void* const pvFilterData)
+// Derives the range of addresses to serve from the server's address and mask
+bool UseIPAddress(const DWORD dwAddr, const DWORD dwMask, DWORD* const pdwAddr, DWORD* const pdwMask, DWORD* const pdwMinAddr, DWORD* const pdwMaxAddr)
 {
-	ASSERT((0 != pvAddressesInUse) && (0 != pFilter) && (0 != pvFilterData));
-	for (size_t i = 0; i < pvAddressesInUse->size(); i++)
+	ASSERT((0 != pdwAddr) && (0 != pdwMask) && (0 != pdwMinAddr) && (0 != pdwMaxAddr));
+	bool bSuccess = false;
+	OUTPUT((TEXT("IP Address being used:")));
+	if (0 != dwAddr)
 	{
-		if (pFilter(pvAddressesInUse->at(i), pvFilterData))
+		const DWORD dwAddrValue = DWIPtoValue(dwAddr);
+		const DWORD dwMaskValue = DWIPtoValue(dwMask);
+		const DWORD dwMinAddrValue = ((dwAddrValue&dwMaskValue) | 2);  // Skip x.x.x.1 (default router address)
+		const DWORD dwMaxAddrValue = ((dwAddrValue&dwMaskValue) | (~(dwMaskValue | 1)));
+		const DWORD dwMinAddr = DWValuetoIP(dwMinAddrValue);
+		const DWORD dwMaxAddr = DWValuetoIP(dwMaxAddrValue);
+		OUTPUT((TEXT("%d.%d.%d.%d - Subnet:%d.%d.%d.%d - Range:[%d.%d.%d.%d-%d.%d.%d.%d]"),
+			DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr),
+			DWIP0(dwMask), DWIP1(dwMask), DWIP2(dwMask), DWIP3(dwMask),
+			DWIP0(dwMinAddr), DWIP1(dwMinAddr), DWIP2(dwMinAddr), DWIP3(dwMinAddr),
+			DWIP0(dwMaxAddr), DWIP1(dwMaxAddr), DWIP2(dwMaxAddr), DWIP3(dwMaxAddr)));
+		if (dwMinAddrValue <= dwMaxAddrValue)
 		{
-			return (int)i;
+			*pdwAddr = dwAddr;
+			*pdwMask = dwMask;
+			*pdwMinAddr = dwMinAddr;
+			*pdwMaxAddr = dwMaxAddr;
+			bSuccess = true;
+		}
+		else
+		{
+			OUTPUT_ERROR((TEXT("Not enough IP addresses available in the current subnet.")));
 		}
 	}
-	return -1;
-}
-bool PushBack(VectorAddressInUseInformation* const pvAddressesInUse, const AddressInUseInformation* const paiui)
-{
-	ASSERT((0 != pvAddressesInUse) && (0 != paiui));
-	try
-	{
-		pvAddressesInUse->push_back(*paiui);
-	}
-	catch (const std::bad_alloc)
+	else
 	{
-		return false;
+		OUTPUT_ERROR((TEXT("IP Address is 0.0.0.0 - no network is available on this machine.")));
+		OUTPUT_ERROR((TEXT("[APIPA (Auto-IP) may not have assigned an IP address yet.]")));
 	}
-	return true;
+	return bSuccess;
 }
 
-// RFC 2131 section 2
-#pragma warning(push)
-#pragma warning(disable : 4200)
-#pragma pack(push, 1)
-struct DHCPMessage
-{
-	BYTE op;
-	BYTE htype;
-	BYTE hlen;
-	BYTE hops;
-	DWORD xid;
-	WORD secs;
-	WORD flags;
-	DWORD ciaddr;
-	DWORD yiaddr;
-	DWORD siaddr;
-	DWORD giaddr;
-	BYTE chaddr[16];
-	BYTE sname[64];
-	BYTE file[128];
-	BYTE magicCookie[4];
-	BYTE options[];
-};
-
-struct DHCPOptionsData {
-	BYTE messageType;
-	BYTE length;
-	BYTE data[];
-};
-
-struct DHCPServerOptions
-{
-	BYTE pbMessageType[3];
-	BYTE pbLeaseTime[6];
-	BYTE pbSubnetMask[6];
-	BYTE pbServerID[6];
-	BYTE bEND;
-};
-#pragma pack(pop)
-#pragma warning(pop)
-
+#if defined(_WIN32)
 bool GetIPAddressInformation(DWORD* const pdwAddr, DWORD* const pdwMask, DWORD* const pdwMinAddr, DWORD* const pdwMaxAddr)
 {
 	ASSERT((0 != pdwAddr) && (0 != pdwMask) && (0 != pdwMinAddr) && (0 != pdwMaxAddr));
@@ -164,40 +156,7 @@ bool GetIPAddressInformation(DWORD* const pdwAddr, DWORD* const pdwMask, DWORD*
 					if (loopbackAtIndex0 ^ loopbackAtIndex1)
 					{
 						const int tableIndex = loopbackAtIndex1 ? 0 : 1;
-						OUTPUT((TEXT("IP Address being used:")));
-						const DWORD dwAddr = pmiatIpAddrTable->table[tableIndex].dwAddr;
-						if (0 != dwAddr)
-						{
-							const DWORD dwMask = pmiatIpAddrTable->table[tableIndex].dwMask;
-							const DWORD dwAddrValue = DWIPtoValue(dwAddr);
-							const DWORD dwMaskValue = DWIPtoValue(dwMask);
-							const DWORD dwMinAddrValue = ((dwAddrValue&dwMaskValue) | 2);  // Skip x.x.x.1 (default router address)
-							const DWORD dwMaxAddrValue = ((dwAddrValue&dwMaskValue) | (~(dwMaskValue | 1)));
-							const DWORD dwMinAddr = DWValuetoIP(dwMinAddrValue);
-							const DWORD dwMaxAddr = DWValuetoIP(dwMaxAddrValue);
-							OUTPUT((TEXT("%d.%d.%d.%d - Subnet:%d.%d.%d.%d - Range:[%d.%d.%d.%d-%d.%d.%d.%d]"),
-								DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr),
-								DWIP0(dwMask), DWIP1(dwMask), DWIP2(dwMask), DWIP3(dwMask),
-								DWIP0(dwMinAddr), DWIP1(dwMinAddr), DWIP2(dwMinAddr), DWIP3(dwMinAddr),
-								DWIP0(dwMaxAddr), DWIP1(dwMaxAddr), DWIP2(dwMaxAddr), DWIP3(dwMaxAddr)));
-							if (dwMinAddrValue <= dwMaxAddrValue)
-							{
-								*pdwAddr = dwAddr;
-								*pdwMask = dwMask;
-								*pdwMinAddr = dwMinAddr;
-								*pdwMaxAddr = dwMaxAddr;
-								bSuccess = true;
-							}
-							else
-							{
-								OUTPUT_ERROR((TEXT("Not enough IP addresses available in the current subnet.")));
-							}
-						}
-						else
-						{
-							OUTPUT_ERROR((TEXT("IP Address is 0.0.0.0 - no network is available on this machine.")));
-							OUTPUT_ERROR((TEXT("[APIPA (Auto-IP) may not have assigned an IP address yet.]")));
-						}
+						bSuccess = UseIPAddress(pmiatIpAddrTable->table[tableIndex].dwAddr, pmiatIpAddrTable->table[tableIndex].dwMask, pdwAddr, pdwMask, pdwMinAddr, pdwMaxAddr);
 					}
 					else
 					{
@@ -228,8 +187,90 @@ bool GetIPAddressInformation(DWORD* const pdwAddr, DWORD* const pdwMask, DWORD*
 	}
 	return bSuccess;
 }
+#else  // defined(_WIN32)
+// One scope per interface with an IPv4 address (the first, if it has several),
+// except loopback; when ppcsInterfaces is not empty, only for the interfaces named
+bool GetInterfaceScopes(const std::vector<const char*>& rvpcsInterfaces, std::vector<DhcpScopeConfig>* const pvdscScopes)
+{
+	ASSERT((0 != pvdscScopes) && pvdscScopes->empty());
+	struct ifaddrs* pifaAddresses;
+	if (0 != getifaddrs(&pifaAddresses))
+	{
+		OUTPUT_ERROR((TEXT("Unable to query IP address table.")));
+		return false;
+	}
+	bool bSuccess = true;
+	std::vector<bool> vbNamed(rvpcsInterfaces.size(), false);
+	for (const struct ifaddrs* pifa = pifaAddresses; bSuccess && (0 != pifa); pifa = pifa->ifa_next)
+	{
+		if ((0 == pifa->ifa_addr) || (AF_INET != pifa->ifa_addr->sa_family) || (0 == pifa->ifa_netmask) ||
+			(0 != (IFF_LOOPBACK & pifa->ifa_flags)) || (0 == (IFF_UP & pifa->ifa_flags)))
+		{
+			continue;
+		}
+		bool bNamed = rvpcsInterfaces.empty();
+		for (size_t i = 0; i < rvpcsInterfaces.size(); i++)
+		{
+			if (0 == strcmp(rvpcsInterfaces[i], pifa->ifa_name))
+			{
+				vbNamed[i] = true;
+				bNamed = true;
+			}
+		}
+		const unsigned int iInterfaceIndex = if_nametoindex(pifa->ifa_name);
+		if (!bNamed || (0 == iInterfaceIndex))
+		{
+			continue;
+		}
+		bool bSeen = false;
+		for (size_t i = 0; i < pvdscScopes->size(); i++)
+		{
+			bSeen = bSeen || ((*pvdscScopes)[i].iInterfaceIndex == iInterfaceIndex);
+		}
+		if (bSeen)
+		{
+			OUTPUT((TEXT("Ignoring additional address %s on interface %s."), inet_ntoa(((const SOCKADDR_IN*)pifa->ifa_addr)->sin_addr), pifa->ifa_name));
+			continue;
+		}
+		OUTPUT((TEXT("Interface %s (index %u):"), pifa->ifa_name, iInterfaceIndex));
+		DhcpScopeConfig dscScope;
+		memset(&dscScope, 0, sizeof(dscScope));
+		dscScope.iInterfaceIndex = iInterfaceIndex;
+		bSuccess = UseIPAddress(((const SOCKADDR_IN*)pifa->ifa_addr)->sin_addr.s_addr, ((const SOCKADDR_IN*)pifa->ifa_netmask)->sin_addr.s_addr, &dscScope.dwServerAddr, &dscScope.dwMask, &dscScope.dwMinAddr, &dscScope.dwMaxAddr);
+		try
+		{
+			if (bSuccess)
+			{
+				pvdscScopes->push_back(dscScope);
+			}
+		}
+		catch (const std::bad_alloc)
+		{
+			OUTPUT_ERROR((TEXT("Insufficient memory for IP address table.")));
+			bSuccess = false;
+		}
+	}
+	freeifaddrs(pifaAddresses);
+	for (size_t i = 0; bSuccess && (i < rvpcsInterfaces.size()); i++)
+	{
+		if (!vbNamed[i])
+		{
+			OUTPUT_ERROR((TEXT("Interface %s is not up or has no IPv4 address."), rvpcsInterfaces[i]));
+			bSuccess = false;
+		}
+	}
+	if (bSuccess && pvdscScopes->empty())
+	{
+		OUTPUT_ERROR((TEXT("No network interface with an IPv4 address is up on this machine.")));
+		OUTPUT_ERROR((TEXT("[APIPA (Auto-IP) may not have assigned an IP address yet.]")));
+		bSuccess = false;
+	}
+	return bSuccess;
+}
+#endif  // defined(_WIN32)
 
-bool InitializeDHCPServer(SOCKET* const psServerSocket, const DWORD dwServerAddr, char* const pcsServerHostName, const size_t stServerHostNameLength)
+// bShared lets several worker sockets bind the server port (SO_REUSEPORT, Linux only)
+bool InitializeDHCPServer(SOCKET* const psServerSocket, const DWORD dwServerAddr, const bool bShared, char* const pcsServerHostName, const size_t stServerHostNameLength)
 {
 	ASSERT((0 != psServerSocket) && (0 != dwServerAddr) && (0 != pcsServerHostName) && (1 <= stServerHostNameLength));
 	// Determine server hostname
@@ -245,19 +286,48 @@ bool InitializeDHCPServer(SOCKET* const psServerSocket, const DWORD dwServerAddr
 		OUTPUT_ERROR((TEXT("Unable to open server socket (port %d)."), DHCP_SERVER_PORT));
 		return false;
 	}
+#if defined(_WIN32)
+	ASSERT(!bShared);
+#else  // defined(_WIN32)
+	// The kernel hashes unicast datagrams across the sockets of a SO_REUSEPORT
+	// group but delivers broadcasts to all of them; IP_PKTINFO tells the two apart
+	int iOption = 1;
+	if ((bShared && (0 != setsockopt(*psServerSocket, SOL_SOCKET, SO_REUSEPORT, &iOption, sizeof(iOption)))) ||
+		(0 != setsockopt(*psServerSocket, IPPROTO_IP, IP_PKTINFO, &iOption, sizeof(iOption))))
+	{
+		OUTPUT_ERROR((TEXT("Unable to set socket options.")));
+		return false;
+	}
+	// Leases expire even when no requests arrive, and workers do not receive
+	// the stop signal, so the receive loop wakes up periodically
+	struct timeval tvTimeout;
+	tvTimeout.tv_sec = WORKER_STOP_POLL_INTERVAL;
+	tvTimeout.tv_usec = 0;
+	if (0 != setsockopt(*psServerSocket, SOL_SOCKET, SO_RCVTIMEO, &tvTimeout, sizeof(tvTimeout)))
+	{
+		OUTPUT_ERROR((TEXT("Unable to set socket options.")));
+		return false;
+	}
+#endif  // defined(_WIN32)
 	// 确定服务器主机IP、端口
 	SOCKADDR_IN saServerAddress;
 	saServerAddress.sin_family = AF_INET;
+#if defined(_WIN32)
 	saServerAddress.sin_addr.s_addr = dwServerAddr;  // Already in network byte order
-	saServerAddress.sin_port = htons((u_short)DHCP_SERVER_PORT);
+#else  // defined(_WIN32)
+	// Linux only delivers broadcast datagrams to sockets bound to the wildcard address
+	(void)dwServerAddr;
+	saServerAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+#endif  // defined(_WIN32)
+	saServerAddress.sin_port = htons((WORD)DHCP_SERVER_PORT);
 	const int iServerAddressSize = sizeof(saServerAddress);
 	if (SOCKET_ERROR == bind(*psServerSocket, (SOCKADDR*)(&saServerAddress), iServerAddressSize))
 	{
 		OUTPUT_ERROR((TEXT("Unable to bind to server socket (port %d)."), DHCP_SERVER_PORT));
 		return false;
 	}
-	char iBroadcastOption = TRUE;
-	if (!setsockopt(*psServerSocket, SOL_SOCKET, SO_BROADCAST, &iBroadcastOption, sizeof(iBroadcastOption)))
+	int iBroadcastOption = 1;
+	if (!setsockopt(*psServerSocket, SOL_SOCKET, SO_BROADCAST, (const char*)&iBroadcastOption, sizeof(iBroadcastOption)))
 		return true;
 	else
 		OUTPUT_ERROR((TEXT("Unable to set socket options.")));
@@ -265,443 +335,159 @@ bool InitializeDHCPServer(SOCKET* const psServerSocket, const DWORD dwServerAddr
 	return false;
 }
 
-bool FindOptionData(const BYTE bOption, const BYTE* const pbOptions, const int iOptionsSize, const BYTE** const ppbOptionData, unsigned int* const piOptionDataSize)
+// Clock for lease expiry: seconds that never go backwards (unaffected by changes to the wall clock)
+uint64_t MonotonicSeconds()
 {
-	ASSERT(((0 == iOptionsSize) || (0 != pbOptions)) && (0 != ppbOptionData) && (0 != piOptionDataSize) &&
-		(option_PAD != bOption) && (option_END != bOption));
-	// RFC 2132
-	const BYTE* pbCurrentOption = pbOptions;
-	while (((pbCurrentOption - pbOptions) < iOptionsSize))
-	{
-		const DHCPOptionsData* optData = (DHCPOptionsData*)pbCurrentOption;
-		switch (optData->messageType)
-		{
-		case option_PAD:
-			pbCurrentOption++;
-			continue;
-		case option_END:
-			return false;
-		default:
-			// code(1字节):Length(1字节):Data(Length字节)
-			if ((pbCurrentOption - pbOptions) >= iOptionsSize) {
-				OUTPUT_WARNING((TEXT("Invalid option data (not enough room for required length byte).")));
-				continue;
-			}
+#if defined(_WIN32)
+	return GetTickCount64() / 1000;
+#else  // defined(_WIN32)
+	struct timespec tsNow;
+	VERIFY(0 == clock_gettime(CLOCK_MONOTONIC, &tsNow));
+	return (uint64_t)tsNow.tv_sec;
+#endif  // defined(_WIN32)
+}
 
-			if (bOption == optData->messageType)
-			{
-				*ppbOptionData = optData->data;
-				*piOptionDataSize = optData->length;
-				pbCurrentOption += sizeof(DHCPOptionsData) + optData->length;
-				return true;
-			}
-			break;
-		}
+#if !defined(_WIN32)
+// Saves binding changes. Expiry times move from the monotonic clock to the
+// wall clock, which keeps counting while the server (or machine) is down.
+void PersistEngineEvent(LeaseDatabase* const pldbLeases, const DhcpEngineEvent& rdee)
+{
+	ASSERT(0 != pldbLeases);
+	const DWORD dwAddrValue = DWIPtoValue(rdee.dwAddr);
+	const uint64_t qwWallExpireTime = (uint64_t)time(0) + (rdee.qwExpireTime - MonotonicSeconds());
+	switch (rdee.detType)
+	{
+	case DhcpEngineEvent_ACK:
+		pldbLeases->Record(dwAddrValue, LeaseRecordState_BOUND, rdee.pbClientIdentifier, rdee.stClientIdentifierSize, qwWallExpireTime);
+		break;
+	case DhcpEngineEvent_DECLINE:
+	case DhcpEngineEvent_CONFLICT:
+		pldbLeases->Record(dwAddrValue, LeaseRecordState_QUARANTINED, 0, 0, qwWallExpireTime);
+		break;
+	case DhcpEngineEvent_RELEASE:
+	case DhcpEngineEvent_EXPIRED:
+	case DhcpEngineEvent_QUARANTINE_ENDED:
+		pldbLeases->Record(dwAddrValue, LeaseRecordState_FREE, 0, 0, 0);
+		break;
+	default:
+		// Offers are not bindings; the rest involve no address
+		break;
 	}
-	return false;
 }
 
-bool GetDHCPMessageType(const BYTE* const pbOptions, const int iOptionsSize, DHCPMessageTypes* const pdhcpmtMessageType)
+struct RestoreContext
 {
-	ASSERT(((0 == iOptionsSize) || (0 != pbOptions)) && (0 != pdhcpmtMessageType));
-	const BYTE* pbDHCPMessageTypeData;
-	unsigned int iDHCPMessageTypeDataSize;
-
-	if (!FindOptionData(option_DHCPMESSAGETYPE, pbOptions, iOptionsSize, &pbDHCPMessageTypeData, &iDHCPMessageTypeDataSize))
-		return false;
-	/*
-	* 验证option的正确性
-	*/
-	if (iDHCPMessageTypeDataSize != 1)
-		return false;
-	if (*pbDHCPMessageTypeData <= 1)
-		return false;
-	if (*pbDHCPMessageTypeData > 8)
-		return false;
-
-	*pdhcpmtMessageType = (DHCPMessageTypes)(*pbDHCPMessageTypeData);
-	return true;
-}
+	DhcpEngine* pdeEngine;
+	uint64_t qwNow;  // MonotonicSeconds
+	uint64_t qwWallNow;
+	unsigned int iRestored;
+};
 
-bool AddressInUseInformationAddrValueFilter(const AddressInUseInformation& raiui, const void* const pvFilterData)
+void RestoreLeaseRecord(const LeaseRecord& rlr, void* pvContext)
 {
-	const DWORD* const pdwAddrValue = (DWORD*)pvFilterData;
-	return (*pdwAddrValue == raiui.dwAddrValue);
+	RestoreContext* const prc = (RestoreContext*)pvContext;
+	if (rlr.qwExpireTime <= prc->qwWallNow)
+	{
+		return;  // Expired while the server was down
+	}
+	if (prc->pdeEngine->RestoreLease(DWValuetoIP(rlr.dwAddrValue), rlr.pbClientIdentifier, rlr.bClientIdentifierSize, prc->qwNow + (rlr.qwExpireTime - prc->qwWallNow)))
+	{
+		prc->iRestored++;
+	}
 }
+#endif  // !defined(_WIN32)
 
-struct ClientIdentifierData
+// Where engine events go: the log, and on Linux the lease database (if any)
+struct EngineEventContext
 {
-	const BYTE* pbClientIdentifier;
-	DWORD dwClientIdentifierSize;
+	EventLog* pelLog;
+#if !defined(_WIN32)
+	LeaseDatabase* pldbLeases;
+#endif  // !defined(_WIN32)
 };
-bool AddressInUseInformationClientIdentifierFilter(const AddressInUseInformation& raiui, const void* const pvFilterData)
+
+LogLevel LevelOfEngineEvent(const DhcpEngineEventType detType)
 {
-	const ClientIdentifierData* const pcid = (ClientIdentifierData*)pvFilterData;
-	ASSERT(0 != pcid);
-	return ((0 != raiui.dwClientIdentifierSize) && (pcid->dwClientIdentifierSize == raiui.dwClientIdentifierSize) && (0 == memcmp(pcid->pbClientIdentifier, raiui.pbClientIdentifier, pcid->dwClientIdentifierSize)));
+	switch (detType)
+	{
+	case DhcpEngineEvent_POOL_EXHAUSTED:
+	case DhcpEngineEvent_DECLINE:
+	case DhcpEngineEvent_CONFLICT:
+		return LogLevel_WARNING;
+	case DhcpEngineEvent_OUT_OF_MEMORY:
+		return LogLevel_ERROR;
+	default:
+		return LogLevel_INFO;
+	}
 }
 
-void ProcessDHCPClientRequest(const SOCKET sServerSocket, const char* const pcsServerHostName, const BYTE* const pbData, const int iDataSize, VectorAddressInUseInformation* const pvAddressesInUse, const DWORD dwServerAddr, const DWORD dwMask, const DWORD dwMinAddr, const DWORD dwMaxAddr)
+// Logs the engine's lease decisions (the engine itself does no output). Only
+// a binary record is queued here; FormatEngineEvent runs on the log's thread.
+void OutputEngineEvent(const DhcpEngineEvent& rdee, void* pvContext)
 {
-	ASSERT(
-		(INVALID_SOCKET != sServerSocket) &&
-		(0 != pcsServerHostName) &&
-		((0 == iDataSize) ||
-			(0 != pbData)) &&
-		(0 != pvAddressesInUse) &&
-		(0 != dwServerAddr) &&
-		(0 != dwMask) &&
-		(0 != dwMinAddr) &&
-		(0 != dwMaxAddr)
-	);
-	// pbData直接转换为DHCPMessage
-	const DHCPMessage* const pdhcpmRequest = (DHCPMessage*)pbData;
-	//字节不匹配
-	if ((sizeof(DHCPMessage) > iDataSize))
-		goto errMsg;
-	//opcode不匹配
-	if (pdhcpmRequest->op != op_BOOTREQUEST)
-		goto errMsg;
-	//MagicCookie不匹配,options是DHCPMessage尾部
-	if (!memcmp(pbDHCPMagicCookie, pdhcpmRequest->magicCookie, sizeof(pbDHCPMagicCookie)))
-		goto errMsg;
-	const BYTE* const pbOptions = pdhcpmRequest->options;
-	const int iOptionsSize = iDataSize - sizeof(DHCPMessage);
-	DHCPMessageTypes dhcpmtMessageType;
-	if (!GetDHCPMessageType(pbOptions, iOptionsSize, &dhcpmtMessageType))
-		goto errMsg;
-	// Determine client host name
-	std::string pcsClientHostName;
-	const char* pbRequestHostNameData;
-	unsigned int iRequestHostNameDataSize;
-	if (FindOptionData(option_HOSTNAME, pbOptions, iOptionsSize, (const BYTE**)&pbRequestHostNameData, &iRequestHostNameDataSize))
-		pcsClientHostName = std::string(pbRequestHostNameData, iRequestHostNameDataSize);
-
-	if (pcsClientHostName.empty())
-		return;
-
-	// Ignore attempts by the DHCP server to obtain a DHCP address (possible if its current address was obtained by auto-IP) because this would invalidate dwServerAddr
-	if (pcsClientHostName == pcsServerHostName)
-		return;
-
-	// Determine client identifier in proper RFC 2131 order (client identifier option then chaddr)
-	const BYTE* pbRequestClientIdentifierData;
-	unsigned int iRequestClientIdentifierDataSize;
-	if (!FindOptionData(option_CLIENTIDENTIFIER, pbOptions, iOptionsSize, &pbRequestClientIdentifierData, &iRequestClientIdentifierDataSize))
-	{
-		pbRequestClientIdentifierData = pdhcpmRequest->chaddr;
-		iRequestClientIdentifierDataSize = sizeof(pdhcpmRequest->chaddr);
-	}
-	// Determine if we've seen this client before
-	bool bSeenClientBefore = false;
-	DWORD dwClientPreviousOfferAddr = (DWORD)INADDR_BROADCAST;  // Invalid IP address for later comparison
-	const ClientIdentifierData cid = { pbRequestClientIdentifierData, (DWORD)iRequestClientIdentifierDataSize };
-	//这里有优化空间，通过键值对和数组查找
-	//应该有多组表（由DHCP管理的IP，不由DHCP管理的IP），并且要对冲突进行检测
-	const int iIndex = FindIndexOf(pvAddressesInUse, AddressInUseInformationClientIdentifierFilter, &cid);
-	if (-1 != iIndex)
-	{
-		const AddressInUseInformation aiui = pvAddressesInUse->at((size_t)iIndex);
-		dwClientPreviousOfferAddr = DWValuetoIP(aiui.dwAddrValue);
-		bSeenClientBefore = true;
-	}
-	// Server message handling
-	// RFC 2131 section 4.3
-	BYTE bDHCPMessageBuffer[sizeof(DHCPMessage) + sizeof(DHCPServerOptions)];
-	memset(bDHCPMessageBuffer, 0, sizeof(bDHCPMessageBuffer));
-
-	DHCPMessage* const pdhcpmReply = (DHCPMessage*)&bDHCPMessageBuffer;
-	pdhcpmReply->op = op_BOOTREPLY;
-	pdhcpmReply->htype = pdhcpmRequest->htype;
-	pdhcpmReply->hlen = pdhcpmRequest->hlen;
-	// pdhcpmReply->hops = 0;
-	pdhcpmReply->xid = pdhcpmRequest->xid;
-	// pdhcpmReply->ciaddr = 0;
-	// pdhcpmReply->yiaddr = 0;  Or changed below
-	// pdhcpmReply->siaddr = 0;
-	pdhcpmReply->flags = pdhcpmRequest->flags;
-	pdhcpmReply->giaddr = pdhcpmRequest->giaddr;
-
-	memcpy(pdhcpmReply->chaddr, pdhcpmRequest->chaddr, sizeof(pdhcpmReply->chaddr));
-	strncpy_s((char*)(pdhcpmReply->sname), sizeof(pdhcpmReply->sname), pcsServerName, _TRUNCATE);
-	// pdhcpmReply->file = 0;
-	// pdhcpmReply->options below
-	DHCPServerOptions* const pdhcpsoServerOptions = (DHCPServerOptions*)(pdhcpmReply->options);
-	memcpy(pdhcpmReply->magicCookie, pbDHCPMagicCookie, sizeof(pdhcpmReply->magicCookie));
-	// DHCP Message Type - RFC 2132 section 9.6
-	pdhcpsoServerOptions->pbMessageType[0] = option_DHCPMESSAGETYPE;
-	pdhcpsoServerOptions->pbMessageType[1] = 1;
-	// pdhcpsoServerOptions->pbMessageType[2] set below
-	// IP Address Lease Time - RFC 2132 section 9.2
-	pdhcpsoServerOptions->pbLeaseTime[0] = option_IPADDRESSLEASETIME;
-	pdhcpsoServerOptions->pbLeaseTime[1] = 4;
-	C_ASSERT(sizeof(u_long) == 4);
-	*((u_long*)(&(pdhcpsoServerOptions->pbLeaseTime[2]))) = htonl(1 * 60 * 60);  // One hour
-	// Subnet Mask - RFC 2132 section 3.3
-	pdhcpsoServerOptions->pbSubnetMask[0] = option_SUBNETMASK;
-	pdhcpsoServerOptions->pbSubnetMask[1] = 4;
-	C_ASSERT(sizeof(u_long) == 4);
-	*((u_long*)(&(pdhcpsoServerOptions->pbSubnetMask[2]))) = dwMask;  // Already in network order
-	// Server Identifier - RFC 2132 section 9.7
-	pdhcpsoServerOptions->pbServerID[0] = option_SERVERIDENTIFIER;
-	pdhcpsoServerOptions->pbServerID[1] = 4;
-	C_ASSERT(sizeof(u_long) == 4);
-	*((u_long*)(&(pdhcpsoServerOptions->pbServerID[2]))) = dwServerAddr;  // Already in network order
-	pdhcpsoServerOptions->bEND = option_END;
-	bool bSendDHCPMessage = false;
-	switch (dhcpmtMessageType)
-	{
-	//为请求者找到一个可用的IP
-	case DHCPMessageType_DISCOVER:
-	{
-		// RFC 2131 section 4.3.1
-		// UNSUPPORTED: Requested IP Address option
-		static DWORD dwServerLastOfferAddrValue = DWIPtoValue(dwMaxAddr);  // Initialize to max to wrap and offer min first
-		const DWORD dwMinAddrValue = DWIPtoValue(dwMinAddr);
-		const DWORD dwMaxAddrValue = DWIPtoValue(dwMaxAddr);
-		DWORD dwOfferAddrValue;
-		bool bOfferAddrValueValid = false;
-		// 如果有之前的，给之前的ip
-		if (bSeenClientBefore)
-		{
-			dwOfferAddrValue = DWIPtoValue(dwClientPreviousOfferAddr);
-			bOfferAddrValueValid = true;
-		}
-		else
-		{
-			dwOfferAddrValue = dwServerLastOfferAddrValue + 1;
-		}
-		// Search for an available address if necessary
-		const DWORD dwInitialOfferAddrValue = dwOfferAddrValue;
-		bool bOfferedInitialValue = false;//遍历一圈用的
-		//遍历一圈，没有找到就跳出
-		while (!(bOfferedInitialValue && (dwInitialOfferAddrValue == dwOfferAddrValue)))  // Detect address exhaustion
-		{
-			if (dwMaxAddrValue < dwOfferAddrValue)
-			{
-				ASSERT(dwMaxAddrValue + 1 == dwOfferAddrValue);
-				dwOfferAddrValue = dwMinAddrValue;
-			}
-			bOfferAddrValueValid = (-1 == FindIndexOf(pvAddressesInUse, AddressInUseInformationAddrValueFilter, &dwOfferAddrValue));
-			bOfferedInitialValue = true;
-			if (!bOfferAddrValueValid)
-			{
-				dwOfferAddrValue++;
-			}
-			else
-				break;
-		}
-		//发送dwOfferAddrValue
-		if (bOfferAddrValueValid)
-		{
-			dwServerLastOfferAddrValue = dwOfferAddrValue;
-			const DWORD dwOfferAddr = DWValuetoIP(dwOfferAddrValue);
-			ASSERT((0 != iRequestClientIdentifierDataSize) && (0 != pbRequestClientIdentifierData));
-			AddressInUseInformation aiuiClientAddress;
-			aiuiClientAddress.dwAddrValue = dwOfferAddrValue;
-			aiuiClientAddress.pbClientIdentifier = (BYTE*)LocalAlloc(LMEM_FIXED, iRequestClientIdentifierDataSize);
-			if (0 != aiuiClientAddress.pbClientIdentifier)
-			{
-				CopyMemory(aiuiClientAddress.pbClientIdentifier, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize);
-				aiuiClientAddress.dwClientIdentifierSize = iRequestClientIdentifierDataSize;
-				if (bSeenClientBefore || PushBack(pvAddressesInUse, &aiuiClientAddress))
-				{
-					pdhcpmReply->yiaddr = dwOfferAddr;
-					pdhcpsoServerOptions->pbMessageType[2] = DHCPMessageType_OFFER;
-					bSendDHCPMessage = true;
-					OUTPUT((TEXT("Offering client \"%hs\" IP address %d.%d.%d.%d"), pcsClientHostName, DWIP0(dwOfferAddr), DWIP1(dwOfferAddr), DWIP2(dwOfferAddr), DWIP3(dwOfferAddr)));
-				}
-				else
-				{
-					VERIFY(0 == LocalFree(aiuiClientAddress.pbClientIdentifier));
-					OUTPUT_ERROR((TEXT("Insufficient memory to add client address.")));
-				}
-				if (bSeenClientBefore)
-				{
-					VERIFY(0 == LocalFree(aiuiClientAddress.pbClientIdentifier));
-				}
-			}
-			else
-			{
-				OUTPUT_ERROR((TEXT("Insufficient memory to add client address.")));
-			}
-		}
-		else
-		{
-			OUTPUT_ERROR((TEXT("No more IP addresses available for client \"%hs\""), pcsClientHostName));
-		}
+	const EngineEventContext* const peec = (const EngineEventContext*)pvContext;
+	const LogLevel llLevel = LevelOfEngineEvent(rdee.detType);
+	if (peec->pelLog->IsEnabled(llLevel))
+	{
+		peec->pelLog->Write(rdee.iWorkerIndex, llLevel, (uint16_t)rdee.detType, rdee.dwAddr, rdee.pbClientHostName, rdee.stClientHostNameSize);
 	}
-	break;
-	// 接受或拒绝请求，建立并维护IP-MAC映射
-	case DHCPMessageType_REQUEST:
+#if !defined(_WIN32)
+	if (0 != peec->pldbLeases)
 	{
-		// RFC 2131 section 4.3.2
-		// Determine requested IP address
-		DWORD dwRequestedIPAddress = INADDR_BROADCAST;  // Invalid IP address for later comparison
-		const BYTE* pbRequestRequestedIPAddressData = 0;
-		unsigned int iRequestRequestedIPAddressDataSize = 0;
-		if (FindOptionData(option_REQUESTEDIPADDRESS, pbOptions, iOptionsSize, &pbRequestRequestedIPAddressData, &iRequestRequestedIPAddressDataSize) && (sizeof(dwRequestedIPAddress) == iRequestRequestedIPAddressDataSize))
-		{
-			dwRequestedIPAddress = *((DWORD*)pbRequestRequestedIPAddressData);
-		}
-		// Determine server identifier
-		const BYTE* pbRequestServerIdentifierData = 0;
-		unsigned int iRequestServerIdentifierDataSize = 0;
-		if (FindOptionData(option_SERVERIDENTIFIER, pbOptions, iOptionsSize, &pbRequestServerIdentifierData, &iRequestServerIdentifierDataSize) &&
-			(sizeof(dwServerAddr) == iRequestServerIdentifierDataSize) && (dwServerAddr == *((DWORD*)pbRequestServerIdentifierData)))
-		{
-			// Response to OFFER
-			// DHCPREQUEST generated during SELECTING state
-			ASSERT(0 == pdhcpmRequest->ciaddr);
-			if (bSeenClientBefore)
-			{
-				// Already have an IP address for this client - ACK it
-				pdhcpsoServerOptions->pbMessageType[2] = DHCPMessageType_ACK;
-				// Will set other options below
-			}
-			else
-			{
-				// Haven't seen this client before - NAK it
-				pdhcpsoServerOptions->pbMessageType[2] = DHCPMessageType_NAK;
-				// Will clear invalid options and prepare to send message below
-			}
-		}
-		else
-		{
-			// Request to verify or extend
-			if (((INADDR_BROADCAST != dwRequestedIPAddress) /*&& (0 == pdhcpmRequest->ciaddr)*/) ||  // DHCPREQUEST generated during INIT-REBOOT state - Some clients set ciaddr in this case, so deviate from the spec by allowing it
-				((INADDR_BROADCAST == dwRequestedIPAddress) && (0 != pdhcpmRequest->ciaddr)))  // Unicast -> DHCPREQUEST generated during RENEWING state / Broadcast -> DHCPREQUEST generated during REBINDING state
-			{
-				if (bSeenClientBefore && ((dwClientPreviousOfferAddr == dwRequestedIPAddress) || (dwClientPreviousOfferAddr == pdhcpmRequest->ciaddr)))
-				{
-					// Already have an IP address for this client - ACK it
-					pdhcpsoServerOptions->pbMessageType[2] = DHCPMessageType_ACK;
-					// Will set other options below
-				}
-				else
-				{
-					// 之前没有过请求（可能是静态IP，或者DHCP服务器重启），需要将这个IP纳入DHCP中维护
-					// Haven't seen this client before or requested IP address is invalid
-					pdhcpsoServerOptions->pbMessageType[2] = DHCPMessageType_NAK;
-					// Will clear invalid options and prepare to send message below
-				}
-			}
-			else
-			{
-				OUTPUT_WARNING((TEXT("Invalid DHCP message (invalid data).")));
-			}
-		}
-		switch (pdhcpsoServerOptions->pbMessageType[2])
-		{
-		case DHCPMessageType_ACK:
-			ASSERT(INADDR_BROADCAST != dwClientPreviousOfferAddr);
-			pdhcpmReply->ciaddr = dwClientPreviousOfferAddr;
-			pdhcpmReply->yiaddr = dwClientPreviousOfferAddr;
-			bSendDHCPMessage = true;
-			OUTPUT((TEXT("Acknowledging client \"%hs\" has IP address %d.%d.%d.%d"), pcsClientHostName, DWIP0(dwClientPreviousOfferAddr), DWIP1(dwClientPreviousOfferAddr), DWIP2(dwClientPreviousOfferAddr), DWIP3(dwClientPreviousOfferAddr)));
-			break;
-		case DHCPMessageType_NAK:
-			C_ASSERT(0 == option_PAD);
-			ZeroMemory(pdhcpsoServerOptions->pbLeaseTime, sizeof(pdhcpsoServerOptions->pbLeaseTime));
-			ZeroMemory(pdhcpsoServerOptions->pbSubnetMask, sizeof(pdhcpsoServerOptions->pbSubnetMask));
-			bSendDHCPMessage = true;
-			OUTPUT((TEXT("Denying client \"%hs\" unoffered IP address."), pcsClientHostName));
-			break;
-		default:
-			// Nothing to do
-			break;
-		}
+		PersistEngineEvent(peec->pldbLeases, rdee);
 	}
-	break;
-	// 维护IP-MAC映射，及时删除映射或者临时禁用IP分配
-	case DHCPMessageType_DECLINE:
-		// Fall-through
-		// 获取option 50并记录为static占用
-	// 维护IP-MAC映射，删除映射
-	case DHCPMessageType_RELEASE:
-		// UNSUPPORTED: Mark address as unused
+#endif  // !defined(_WIN32)
+}
+
+size_t FormatEngineEvent(const LogRecord& rlr, char* const pcsBuffer, const size_t stBufferSize)
+{
+	const int iNameLength = (int)rlr.bTextSize;
+	const char* const pcsName = rlr.pcsText;
+	const DWORD dwAddr = rlr.dwArgument;
+	int iLength = 0;
+	switch (rlr.wEvent)
+	{
+	case DhcpEngineEvent_OFFER:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Offering client \"%.*s\" IP address %d.%d.%d.%d", iNameLength, pcsName, DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
+		break;
+	case DhcpEngineEvent_ACK:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Acknowledging client \"%.*s\" has IP address %d.%d.%d.%d", iNameLength, pcsName, DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
+		break;
+	case DhcpEngineEvent_NAK:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Denying client \"%.*s\" unoffered IP address.", iNameLength, pcsName);
+		break;
+	case DhcpEngineEvent_POOL_EXHAUSTED:
+		iLength = snprintf(pcsBuffer, stBufferSize, "No more IP addresses available for client \"%.*s\"", iNameLength, pcsName);
+		break;
+	case DhcpEngineEvent_OUT_OF_MEMORY:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Insufficient memory to add client address.");
+		break;
+	case DhcpEngineEvent_EXPIRED:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Lease of IP address %d.%d.%d.%d expired", DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
+		break;
+	case DhcpEngineEvent_RELEASE:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Client \"%.*s\" released IP address %d.%d.%d.%d", iNameLength, pcsName, DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
+		break;
+	case DhcpEngineEvent_DECLINE:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Client \"%.*s\" declined IP address %d.%d.%d.%d (in use by another host?); quarantined", iNameLength, pcsName, DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
 		break;
-	// 废止
-	case DHCPMessageType_INFORM:
-		// Unsupported DHCP message type - fail silently
+	case DhcpEngineEvent_QUARANTINE_ENDED:
+		iLength = snprintf(pcsBuffer, stBufferSize, "Quarantine of declined IP address %d.%d.%d.%d ended", DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
 		break;
-	case DHCPMessageType_OFFER:
-	case DHCPMessageType_ACK:
-	case DHCPMessageType_NAK:
-		OUTPUT_WARNING((TEXT("Unexpected DHCP message type.")));
+	case DhcpEngineEvent_CONFLICT:
+		iLength = snprintf(pcsBuffer, stBufferSize, "IP address %d.%d.%d.%d answered a probe (in use by another host); quarantined", DWIP0(dwAddr), DWIP1(dwAddr), DWIP2(dwAddr), DWIP3(dwAddr));
 		break;
 	default:
-		ASSERT(!"Invalid DHCPMessageType");
+		ASSERT(!"Invalid DhcpEngineEventType");
 		break;
 	}
-	if (bSendDHCPMessage)
-	{
-		ASSERT(0 != pdhcpsoServerOptions->pbMessageType[2]);  // Must have set an option if we're going to be sending this message
-		// Determine how to send the reply
-		// RFC 2131 section 4.1
-		u_long ulAddr = INADDR_LOOPBACK;  // Invalid value
-		if (0 == pdhcpmRequest->giaddr)
-		{
-			switch (pdhcpsoServerOptions->pbMessageType[2])
-			{
-			case DHCPMessageType_OFFER:
-				// Fall-through
-			case DHCPMessageType_ACK:
-			{
-				if (0 == pdhcpmRequest->ciaddr)
-				{
-					if (0 != (BROADCAST_FLAG & pdhcpmRequest->flags))
-					{
-						ulAddr = INADDR_BROADCAST;
-					}
-					else
-					{
-						ulAddr = pdhcpmRequest->yiaddr;  // Already in network order
-						if (0 == ulAddr)
-						{
-							// UNSUPPORTED: Unicast to hardware address
-							// Instead, broadcast the response and rely on other DHCP clients to ignore it
-							ulAddr = INADDR_BROADCAST;
-						}
-					}
-				}
-				else
-				{
-					ulAddr = pdhcpmRequest->ciaddr;  // Already in network order
-				}
-			}
-			break;
-			case DHCPMessageType_NAK:
-			{
-				ulAddr = INADDR_BROADCAST;
-			}
-			break;
-			default:
-				ASSERT(!"Invalid DHCPMessageType");
-				break;
-			}
-		}
-		else
-		{
-			ulAddr = pdhcpmRequest->giaddr;  // Already in network order
-			pdhcpmReply->flags |= BROADCAST_FLAG;  // Indicate to the relay agent that it must broadcast
-		}
-		ASSERT((INADDR_LOOPBACK != ulAddr) && (0 != ulAddr));
-		SOCKADDR_IN saClientAddress;
-		saClientAddress.sin_family = AF_INET;
-		saClientAddress.sin_addr.s_addr = ulAddr;
-		saClientAddress.sin_port = htons((u_short)DHCP_CLIENT_PORT);
-		VERIFY(SOCKET_ERROR != sendto(sServerSocket, (char*)pdhcpmReply, sizeof(bDHCPMessageBuffer), 0, (SOCKADDR*)&saClientAddress, sizeof(saClientAddress)));
-	}
-
-
-errMsg:
-	OUTPUT_WARNING((TEXT("Invalid DHCP message (failed initial checks).")));
+	return (0 < iLength) ? (size_t)iLength : 0;
 }
 
-bool ReadDHCPClientRequests(const SOCKET sServerSocket, const char* const pcsServerHostName, VectorAddressInUseInformation* const pvAddressesInUse, const DWORD dwServerAddr, const DWORD dwMask, const DWORD dwMinAddr, const DWORD dwMaxAddr)
+#if defined(_WIN32)
+bool ReadDHCPClientRequests(const SOCKET sServerSocket, DhcpEngine* const pdeEngine)
 {
-	ASSERT((INVALID_SOCKET != sServerSocket) && (0 != pcsServerHostName) && (0 != pvAddressesInUse) && (0 != dwServerAddr) && (0 != dwMask) && (0 != dwMinAddr) && (0 != dwMaxAddr));
+	ASSERT((INVALID_SOCKET != sServerSocket) && (0 != pdeEngine) && (1 == pdeEngine->ShardCount()));
 	static BYTE pbReadBuffer[MAX_UDP_MESSAGE_SIZE];
 
 	if (!pbReadBuffer) {
@@ -728,96 +514,1042 @@ bool ReadDHCPClientRequests(const SOCKET sServerSocket, const char* const pcsSer
 				continue;
 			}
 
-		ProcessDHCPClientRequest(sServerSocket, pcsServerHostName, pbReadBuffer, iBytesReceived, pvAddressesInUse, dwServerAddr, dwMask, dwMinAddr, dwMaxAddr);
+		// Expire due leases first so their addresses can be offered to this request
+		const uint64_t qwNow = MonotonicSeconds();
+		pdeEngine->ExpireLeases(0, qwNow);
+		BYTE pbReplyBuffer[DHCP_REPLY_SIZE];
+		DhcpRequestInfo driRequest;
+		driRequest.dwDestinationAddr = INADDR_BROADCAST;  // Single shard, so it does not matter
+		driRequest.iInterfaceIndex = 0;  // The single scope serves any interface
+		driRequest.iWorkerIndex = 0;
+		driRequest.qwNow = qwNow;
+		driRequest.bUnicastToHardwareAddress = false;  // Sockets only reach configured addresses
+		DhcpReplyInfo driReply;
+		if (pdeEngine->ProcessRequest(pbReadBuffer, (size_t)iBytesReceived, driRequest, pbReplyBuffer, sizeof(pbReplyBuffer), &driReply))
+		{
+			saClientAddress.sin_family = AF_INET;
+			saClientAddress.sin_addr.s_addr = driReply.dwDestinationAddr;
+			saClientAddress.sin_port = htons((u_short)driReply.wDestinationPort);
+			VERIFY(SOCKET_ERROR != sendto(sServerSocket, (char*)pbReplyBuffer, (int)driReply.stSize, 0, (SOCKADDR*)&saClientAddress, sizeof(saClientAddress)));
+		}
 	}
 	return true;
 }
+#else  // defined(_WIN32)
+std::atomic<bool> bStopRequested(false);  // Set by SignalHandlerRoutine (and by a failing worker)
 
-SOCKET sServerSocket = INVALID_SOCKET;  // Global to allow ConsoleCtrlHandlerRoutine access to it
-
-BOOL WINAPI ConsoleCtrlHandlerRoutine(DWORD dwCtrlType)
+// Linux backend: drains the socket in batches with recvmmsg into a ring of
+// MTU-sized buffers, processes the batch, then flushes the replies with sendmmsg.
+// One socket serves every interface: IP_PKTINFO tells which one a request
+// came in on, and pins the reply's interface and source address. With
+// pipProber (--probe), the worker also wakes for answers to its probes, so
+// each is seen before the probe's deadline.
+bool ReadDHCPClientRequests(const SOCKET sServerSocket, DhcpEngine* const pdeEngine, const unsigned int iWorkerIndex, const unsigned int iBatchSize, IcmpProber* const pipProber)
 {
-	BOOL bReturn = FALSE;
-	if ((CTRL_C_EVENT == dwCtrlType) || (CTRL_BREAK_EVENT == dwCtrlType))
+	ASSERT((INVALID_SOCKET != sServerSocket) && (0 != pdeEngine) && (iWorkerIndex < pdeEngine->ShardCount()) &&
+		(1 <= iBatchSize) && (iBatchSize <= MAX_RECEIVE_BATCH_SIZE));
+	// Destination address and interface of each datagram (IP_PKTINFO), so the
+	// engine can recognize broadcasts and pick the scope
+	const size_t stControlSize = CMSG_SPACE(sizeof(struct in_pktinfo));
+	std::vector<BYTE> vbReadBuffers;
+	std::vector<BYTE> vbControlBuffers;
+	std::vector<BYTE> vbReplyBuffers;
+	std::vector<BYTE> vbReplyControlBuffers;
+	std::vector<struct mmsghdr> vmmhRequests;
+	std::vector<struct mmsghdr> vmmhReplies;
+	std::vector<struct iovec> vioRequests;
+	std::vector<struct iovec> vioReplies;
+	std::vector<SOCKADDR_IN> vsaReplyAddresses;
+	try
 	{
-		if (INVALID_SOCKET != sServerSocket)
-		{
-			VERIFY(0 == closesocket(sServerSocket));
-			sServerSocket = INVALID_SOCKET;
-		}
-		bReturn = TRUE;
+		vbReadBuffers.resize((size_t)iBatchSize * RECEIVE_BUFFER_SIZE);
+		vbControlBuffers.resize((size_t)iBatchSize * stControlSize);
+		vbReplyBuffers.resize((size_t)iBatchSize * DHCP_REPLY_SIZE);
+		vbReplyControlBuffers.resize((size_t)iBatchSize * stControlSize);
+		vmmhRequests.resize(iBatchSize);
+		vmmhReplies.resize(iBatchSize);
+		vioRequests.resize(iBatchSize);
+		vioReplies.resize(iBatchSize);
+		vsaReplyAddresses.resize(iBatchSize);
 	}
-	return bReturn;
-}
-
-int main(int /*argc*/, char** /*argv*/)
-{
-	OUTPUT((TEXT("")));
-	OUTPUT((TEXT("DHCPLite")));
-	OUTPUT((TEXT("2016-04-02")));
-	OUTPUT((TEXT("Copyright (c) 2001-2016 by David Anson (http://dlaa.me/)")));
-	OUTPUT((TEXT("")));
-	/*
-	* ConsoleCtrlHandlerRoutine 捕捉Ctrl-C信号，退出程序
-	*/
-	if (!SetConsoleCtrlHandler(ConsoleCtrlHandlerRoutine, TRUE)) {
-		OUTPUT_ERROR((TEXT("Unable to set Ctrl-C handler.")));
-		return -1;
+	catch (const std::bad_alloc)
+	{
+		OUTPUT_ERROR((TEXT("Unable to allocate memory for client datagram read buffer.")));
+		return false;
 	}
-
-	DWORD dwServerAddr;
-	DWORD dwMask;
-	DWORD dwMinAddr;
-	DWORD dwMaxAddr;
+	for (unsigned int i = 0; i < iBatchSize; i++)
+	{
+		vioRequests[i].iov_base = &vbReadBuffers[(size_t)i * RECEIVE_BUFFER_SIZE];
+		vioRequests[i].iov_len = RECEIVE_BUFFER_SIZE;
+		memset(&vmmhRequests[i], 0, sizeof(vmmhRequests[i]));
+		vmmhRequests[i].msg_hdr.msg_iov = &vioRequests[i];
+		vmmhRequests[i].msg_hdr.msg_iovlen = 1;
+	}
+	DhcpMetrics* const pdmMetrics = pdeEngine->Metrics();
+
+	while (true)
+	{
+		if (0 != pipProber)
+		{
+			struct pollfd ppfdInputs[2];
+			ppfdInputs[0].fd = sServerSocket;
+			ppfdInputs[0].events = POLLIN;
+			ppfdInputs[1].fd = pipProber->Descriptor(iWorkerIndex);
+			ppfdInputs[1].events = POLLIN;
+			if ((-1 == poll(ppfdInputs, ARRAY_LENGTH(ppfdInputs), WORKER_STOP_POLL_INTERVAL * 1000)) && (EINTR != errno))
+			{
+				OUTPUT_ERROR((TEXT("Call to poll returned error")));
+				return false;
+			}
+			if (0 == (POLLIN & ppfdInputs[0].revents))
+			{
+				if (bStopRequested)
+				{
+					OUTPUT((TEXT("Stopping server request handler.")));
+					return true;
+				}
+				const uint64_t qwNow = MonotonicSeconds();
+				pipProber->ReadAnswers(iWorkerIndex, pdeEngine, qwNow);
+				pdeEngine->ExpireLeases(iWorkerIndex, qwNow);
+				continue;
+			}
+		}
+		// Block for the first datagram, then take whatever else is already queued
+		for (unsigned int i = 0; i < iBatchSize; i++)
+		{
+			// recvmmsg overwrites the lengths
+			vmmhRequests[i].msg_hdr.msg_control = &vbControlBuffers[(size_t)i * stControlSize];
+			vmmhRequests[i].msg_hdr.msg_controllen = stControlSize;
+		}
+		const int iReceived = recvmmsg(sServerSocket, &vmmhRequests[0], iBatchSize, MSG_WAITFORONE, 0);
+		if (SOCKET_ERROR == iReceived)
+		{
+			switch (errno)
+			{
+			case EAGAIN:
+				// Receive timeout: idle for WORKER_STOP_POLL_INTERVAL
+				if (bStopRequested)
+				{
+					OUTPUT((TEXT("Stopping server request handler.")));
+					return true;
+				}
+				pdeEngine->ExpireLeases(iWorkerIndex, MonotonicSeconds());
+				continue;
+			case EINTR:
+				if (bStopRequested)
+				{
+					OUTPUT((TEXT("Stopping server request handler.")));
+					return true;
+				}
+				OUTPUT((TEXT("Socket operation was cancelled.")));
+				continue;
+			case EBADF:
+			case ENOTSOCK:
+				OUTPUT((TEXT("Stopping server request handler.")));
+				return true;
+			default:
+				OUTPUT_ERROR((TEXT("Call to recvmmsg returned error")));
+				continue;
+			}
+		}
+
+		// Expire due leases first so their addresses can be offered to this batch
+		const uint64_t qwNow = MonotonicSeconds();
+		pdeEngine->ExpireLeases(iWorkerIndex, qwNow);
+		// A retransmitted DISCOVER in this batch is answered according to what its probe found
+		if (0 != pipProber)
+		{
+			pipProber->ReadAnswers(iWorkerIndex, pdeEngine, qwNow);
+		}
+		unsigned int iReplies = 0;
+		for (int i = 0; i < iReceived; i++)
+		{
+			DhcpRequestInfo driRequest;
+			driRequest.dwDestinationAddr = INADDR_BROADCAST;  // Without the destination address, leave the request to its owner
+			driRequest.iInterfaceIndex = 0;
+			driRequest.iWorkerIndex = iWorkerIndex;
+			driRequest.qwNow = qwNow;
+			driRequest.bUnicastToHardwareAddress = false;  // Sockets only reach configured addresses
+			for (struct cmsghdr* pcmh = CMSG_FIRSTHDR(&vmmhRequests[i].msg_hdr); 0 != pcmh; pcmh = CMSG_NXTHDR(&vmmhRequests[i].msg_hdr, pcmh))
+			{
+				if ((IPPROTO_IP == pcmh->cmsg_level) && (IP_PKTINFO == pcmh->cmsg_type))
+				{
+					struct in_pktinfo ipiInfo;
+					memcpy(&ipiInfo, CMSG_DATA(pcmh), sizeof(ipiInfo));
+					driRequest.dwDestinationAddr = ipiInfo.ipi_addr.s_addr;
+					driRequest.iInterfaceIndex = (unsigned int)ipiInfo.ipi_ifindex;
+				}
+			}
+			if (0 != (MSG_TRUNC & vmmhRequests[i].msg_hdr.msg_flags))
+			{
+				pdeEngine->CountDrop(driRequest, DhcpDrop_TRUNCATED);
+				continue;  // Larger than a receive buffer
+			}
+			BYTE* const pbReplyBuffer = &vbReplyBuffers[(size_t)iReplies * DHCP_REPLY_SIZE];
+			DhcpReplyInfo driReply;
+			// Only timed when someone reads the metrics (two clock reads per request); a
+			// broadcast left to its owner would swamp the histogram, so only replies count
+			std::chrono::steady_clock::time_point tpStart;
+			if (0 != pdmMetrics)
+			{
+				tpStart = std::chrono::steady_clock::now();
+			}
+			const bool bReply = pdeEngine->ProcessRequest((const BYTE*)vioRequests[i].iov_base, vmmhRequests[i].msg_len, driRequest, pbReplyBuffer, DHCP_REPLY_SIZE, &driReply);
+			if (bReply && (0 != pdmMetrics))
+			{
+				pdmMetrics->RecordLatency(iWorkerIndex, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tpStart).count());
+			}
+			if (bReply)
+			{
+				SOCKADDR_IN& rsaClientAddress = vsaReplyAddresses[iReplies];
+				memset(&rsaClientAddress, 0, sizeof(rsaClientAddress));
+				rsaClientAddress.sin_family = AF_INET;
+				rsaClientAddress.sin_addr.s_addr = driReply.dwDestinationAddr;
+				rsaClientAddress.sin_port = htons((WORD)driReply.wDestinationPort);
+				vioReplies[iReplies].iov_base = pbReplyBuffer;
+				vioReplies[iReplies].iov_len = driReply.stSize;
+				memset(&vmmhReplies[iReplies], 0, sizeof(vmmhReplies[iReplies]));
+				vmmhReplies[iReplies].msg_hdr.msg_name = &rsaClientAddress;
+				vmmhReplies[iReplies].msg_hdr.msg_namelen = sizeof(rsaClientAddress);
+				vmmhReplies[iReplies].msg_hdr.msg_iov = &vioReplies[iReplies];
+				vmmhReplies[iReplies].msg_hdr.msg_iovlen = 1;
+				// A broadcast would otherwise leave by whichever interface the routing table picks
+				BYTE* const pbControl = &vbReplyControlBuffers[(size_t)iReplies * stControlSize];
+				memset(pbControl, 0, stControlSize);
+				vmmhReplies[iReplies].msg_hdr.msg_control = pbControl;
+				vmmhReplies[iReplies].msg_hdr.msg_controllen = stControlSize;
+				struct cmsghdr* const pcmh = CMSG_FIRSTHDR(&vmmhReplies[iReplies].msg_hdr);
+				pcmh->cmsg_level = IPPROTO_IP;
+				pcmh->cmsg_type = IP_PKTINFO;
+				pcmh->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+				struct in_pktinfo ipiInfo;
+				memset(&ipiInfo, 0, sizeof(ipiInfo));
+				ipiInfo.ipi_ifindex = (int)driReply.iInterfaceIndex;
+				ipiInfo.ipi_spec_dst.s_addr = driReply.dwSourceAddr;
+				memcpy(CMSG_DATA(pcmh), &ipiInfo, sizeof(ipiInfo));
+				iReplies++;
+			}
+		}
+
+		// sendmmsg can stop early; resume after the last datagram it sent
+		unsigned int iSent = 0;
+		while (iSent < iReplies)
+		{
+			const int iResult = sendmmsg(sServerSocket, &vmmhReplies[iSent], iReplies - iSent, 0);
+			if (SOCKET_ERROR == iResult)
+			{
+				if (EINTR == errno)
+				{
+					continue;
+				}
+				OUTPUT_ERROR((TEXT("Call to sendmmsg returned error")));
+				iSent++;  // Drop the datagram that failed
+			}
+			else
+			{
+				iSent += (unsigned int)iResult;
+			}
+		}
+	}
+	return true;
+}
+
+// With --raw the UDP sockets only hold the server port, so the kernel does not
+// answer requests with ICMP port unreachable; a filter that accepts nothing
+// keeps them from queueing a copy of every request
+bool IgnoreSocketInput(const SOCKET sServerSocket)
+{
+	struct sock_filter sfDropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct sock_fprog sfpFilter;
+	sfpFilter.len = 1;
+	sfpFilter.filter = &sfDropAll;
+	return 0 == setsockopt(sServerSocket, SOL_SOCKET, SO_ATTACH_FILTER, &sfpFilter, sizeof(sfpFilter));
+}
+
+// Raw backend (--raw): a PacketRing (AF_PACKET socket with mmap'd TPACKET_V3
+// rings) per served interface. Requests are processed where the kernel wrote
+// them and replies are written straight into TX slots, headers and all, so an
+// OFFER or ACK to a client without an address can be unicast to its chaddr
+// (RFC 2131 section 4.1) instead of broadcast. Every worker's rings see every
+// request, so each one is treated as a broadcast and only its owner answers.
+bool ReadRawClientRequests(PacketRing* const pprRings, const size_t stRingCount, DhcpEngine* const pdeEngine, const unsigned int iWorkerIndex, IcmpProber* const pipProber)
+{
+	ASSERT((0 != pprRings) && (1 <= stRingCount) && (0 != pdeEngine) && (iWorkerIndex < pdeEngine->ShardCount()));
+	C_ASSERT(DHCP_REPLY_SIZE <= PACKET_RING_MAX_PAYLOAD_SIZE);
+	static const BYTE pbBroadcastHardwareAddr[PACKET_RING_HARDWARE_ADDRESS_SIZE] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	std::vector<struct pollfd> vpfdRings;
+	try
+	{
+		vpfdRings.resize(stRingCount + ((0 != pipProber) ? 1 : 0));
+	}
+	catch (const std::bad_alloc)
+	{
+		OUTPUT_ERROR((TEXT("Unable to allocate memory for the packet rings.")));
+		return false;
+	}
+	for (size_t i = 0; i < stRingCount; i++)
+	{
+		vpfdRings[i].fd = pprRings[i].Descriptor();
+		vpfdRings[i].events = POLLIN;
+	}
+	if (0 != pipProber)
+	{
+		// Answers to this worker's probes wake it too
+		vpfdRings[stRingCount].fd = pipProber->Descriptor(iWorkerIndex);
+		vpfdRings[stRingCount].events = POLLIN;
+	}
+	DhcpMetrics* const pdmMetrics = pdeEngine->Metrics();
+
+	while (true)
+	{
+		// Wakes when a ring hands over a block; leases expire and the stop flag is checked at least every WORKER_STOP_POLL_INTERVAL
+		if (-1 == poll(&vpfdRings[0], (nfds_t)vpfdRings.size(), WORKER_STOP_POLL_INTERVAL * 1000))
+		{
+			if (EINTR != errno)
+			{
+				OUTPUT_ERROR((TEXT("Call to poll returned error")));
+				return false;
+			}
+		}
+		if (bStopRequested)
+		{
+			OUTPUT((TEXT("Stopping server request handler.")));
+			return true;
+		}
+
+		// Expire due leases first so their addresses can be offered to this batch
+		const uint64_t qwNow = MonotonicSeconds();
+		pdeEngine->ExpireLeases(iWorkerIndex, qwNow);
+		// A retransmitted DISCOVER in this batch is answered according to what its probe found
+		if (0 != pipProber)
+		{
+			pipProber->ReadAnswers(iWorkerIndex, pdeEngine, qwNow);
+		}
+		// Checking a ring with nothing handed over reads one word, so every ring is drained
+		for (size_t i = 0; i < stRingCount; i++)
+		{
+			PacketRing& rprRing = pprRings[i];
+			DhcpRequestInfo driRequest;
+			driRequest.dwDestinationAddr = INADDR_BROADCAST;  // Every worker sees every request: leave it to its owner
+			driRequest.iInterfaceIndex = rprRing.InterfaceIndex();
+			driRequest.iWorkerIndex = iWorkerIndex;
+			driRequest.qwNow = qwNow;
+			driRequest.bUnicastToHardwareAddress = true;
+			PacketRingDatagram prdRequest;
+			while (rprRing.Receive(&prdRequest))
+			{
+				BYTE* pbReplyBuffer = rprRing.TransmitBuffer();
+				if (0 == pbReplyBuffer)
+				{
+					// Every TX slot is queued: send them to make room
+					if (!rprRing.Flush())
+					{
+						OUTPUT_ERROR((TEXT("Call to send returned error")));
+					}
+					pbReplyBuffer = rprRing.TransmitBuffer();
+					if (0 == pbReplyBuffer)
+					{
+						continue;  // Treated like a lost datagram
+					}
+				}
+				DhcpReplyInfo driReply;
+				// Only timed when someone reads the metrics, like the socket backend
+				std::chrono::steady_clock::time_point tpStart;
+				if (0 != pdmMetrics)
+				{
+					tpStart = std::chrono::steady_clock::now();
+				}
+				const bool bReply = pdeEngine->ProcessRequest(prdRequest.pbPayload, prdRequest.stPayloadSize, driRequest, pbReplyBuffer, PACKET_RING_MAX_PAYLOAD_SIZE, &driReply);
+				if (bReply && (0 != pdmMetrics))
+				{
+					pdmMetrics->RecordLatency(iWorkerIndex, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tpStart).count());
+				}
+				if (bReply)
+				{
+					// A relay agent, or a client that has its address, is answered through the hop its request came from
+					const BYTE* pbHardwareAddr = prdRequest.pbSourceHardwareAddr;
+					if (driReply.bToHardwareAddress)
+					{
+						pbHardwareAddr = ((const DHCPMessage*)prdRequest.pbPayload)->chaddr;
+					}
+					else if (INADDR_BROADCAST == driReply.dwDestinationAddr)
+					{
+						pbHardwareAddr = pbBroadcastHardwareAddr;
+					}
+					rprRing.Transmit(driReply.stSize, pbHardwareAddr, driReply.dwSourceAddr, driReply.dwDestinationAddr, DHCP_SERVER_PORT, driReply.wDestinationPort);
+				}
+			}
+			// One system call for the replies to everything the ring held
+			if (!rprRing.Flush())
+			{
+				OUTPUT_ERROR((TEXT("Call to send returned error")));
+			}
+		}
+	}
+	return true;
+}
+#endif  // defined(_WIN32)
+
+#if defined(_WIN32)
+SOCKET sServerSocket = INVALID_SOCKET;  // Global to allow ConsoleCtrlHandlerRoutine access to it
+
+BOOL WINAPI ConsoleCtrlHandlerRoutine(DWORD dwCtrlType)
+{
+	BOOL bReturn = FALSE;
+	if ((CTRL_C_EVENT == dwCtrlType) || (CTRL_BREAK_EVENT == dwCtrlType))
+	{
+		if (INVALID_SOCKET != sServerSocket)
+		{
+			VERIFY(0 == closesocket(sServerSocket));
+			sServerSocket = INVALID_SOCKET;
+		}
+		bReturn = TRUE;
+	}
+	return bReturn;
+}
+#else  // defined(_WIN32)
+// Closing the socket here would not wake recvmmsg; the signal interrupts it instead (no SA_RESTART)
+void SignalHandlerRoutine(int /*iSignal*/)
+{
+	bStopRequested = true;
+}
+
+// Pins a worker thread to the iWorkerIndex-th CPU this process may run on (wrapping)
+void PinWorker(const pthread_t thWorker, const unsigned int iWorkerIndex)
+{
+	cpu_set_t csAllowed;
+	if (0 != sched_getaffinity(0, sizeof(csAllowed), &csAllowed))
+	{
+		return;
+	}
+	int iTarget = (int)(iWorkerIndex % (unsigned int)CPU_COUNT(&csAllowed));
+	for (int iCpu = 0; iCpu < CPU_SETSIZE; iCpu++)
+	{
+		if (CPU_ISSET(iCpu, &csAllowed) && (0 == iTarget--))
+		{
+			cpu_set_t csWorker;
+			CPU_ZERO(&csWorker);
+			CPU_SET(iCpu, &csWorker);
+			if (0 != pthread_setaffinity_np(thWorker, sizeof(csWorker), &csWorker))
+			{
+				OUTPUT((TEXT("Unable to pin worker %u to CPU %d."), iWorkerIndex, iCpu));
+			}
+			return;
+		}
+	}
+}
+
+// pprRings (stRingCount of them) replaces the socket with the raw backend
+void RunWorker(const SOCKET sServerSocket, DhcpEngine* const pdeEngine, const unsigned int iWorkerIndex, const unsigned int iBatchSize, PacketRing* const pprRings, const size_t stRingCount, IcmpProber* const pipProber)
+{
+	const bool bSuccess = (0 != pprRings) ? ReadRawClientRequests(pprRings, stRingCount, pdeEngine, iWorkerIndex, pipProber) : ReadDHCPClientRequests(sServerSocket, pdeEngine, iWorkerIndex, iBatchSize, pipProber);
+	if (!bSuccess)
+	{
+		// Losing a worker would silently orphan its shard, so stop the server
+		bStopRequested = true;
+		kill(getpid(), SIGTERM);
+	}
+}
+
+// Runs one pinned thread per worker socket and waits for SIGINT/SIGTERM; with
+// the raw backend, worker i serves pprRings[i * stRingsPerWorker] and the ones after it
+bool RunWorkers(const std::vector<SOCKET>& rvsServerSockets, DhcpEngine* const pdeEngine, const unsigned int iBatchSize, PacketRing* const pprRings, const size_t stRingsPerWorker, IcmpProber* const pipProber)
+{
+	ASSERT((0 != pdeEngine) && (rvsServerSockets.size() == pdeEngine->ShardCount()));
+	// Workers inherit a mask blocking the stop signals, so they are only ever delivered to this thread
+	sigset_t ssStop;
+	sigset_t ssPrevious;
+	sigemptyset(&ssStop);
+	sigaddset(&ssStop, SIGINT);
+	sigaddset(&ssStop, SIGTERM);
+	VERIFY(0 == pthread_sigmask(SIG_BLOCK, &ssStop, &ssPrevious));
+	bool bSuccess = true;
+	std::vector<std::thread> vthWorkers;
+	try
+	{
+		vthWorkers.reserve(rvsServerSockets.size());
+		for (unsigned int i = 0; i < rvsServerSockets.size(); i++)
+		{
+			vthWorkers.push_back(std::thread(RunWorker, rvsServerSockets[i], pdeEngine, i, iBatchSize, (0 != pprRings) ? &pprRings[i * stRingsPerWorker] : (PacketRing*)0, stRingsPerWorker, pipProber));
+			PinWorker(vthWorkers.back().native_handle(), i);
+		}
+	}
+	catch (const std::exception&)
+	{
+		OUTPUT_ERROR((TEXT("Unable to start worker threads.")));
+		bStopRequested = true;
+		bSuccess = false;
+	}
+	while (!bStopRequested)
+	{
+		sigsuspend(&ssPrevious);
+	}
+	// Idle workers notice within WORKER_STOP_POLL_INTERVAL
+	for (size_t i = 0; i < vthWorkers.size(); i++)
+	{
+		vthWorkers[i].join();
+	}
+	VERIFY(0 == pthread_sigmask(SIG_SETMASK, &ssPrevious, 0));
+	return bSuccess;
+}
+#endif  // defined(_WIN32)
+
+#if !defined(_WIN32)
+// Parses "A[,B...]" (dotted quads) into at most stMaxCount network order addresses
+bool ParseAddressList(const char* const pcsList, uint32_t* const pdwAddrs, const size_t stMaxCount, unsigned int* const piCount)
+{
+	*piCount = 0;
+	const char* pcs = pcsList;
+	while (true)
+	{
+		const char* const pcsEnd = strchr(pcs, ',');
+		const size_t stLength = (0 != pcsEnd) ? (size_t)(pcsEnd - pcs) : strlen(pcs);
+		char pcsAddr[INET_ADDRSTRLEN];
+		if ((stMaxCount == *piCount) || (sizeof(pcsAddr) <= stLength))
+		{
+			return false;
+		}
+		memcpy(pcsAddr, pcs, stLength);
+		pcsAddr[stLength] = '\0';
+		if (1 != inet_pton(AF_INET, pcsAddr, &pdwAddrs[*piCount]))
+		{
+			return false;
+		}
+		(*piCount)++;
+		if (0 == pcsEnd)
+		{
+			return true;
+		}
+		pcs = pcsEnd + 1;
+	}
+}
+
+// Parses "RATE[/BURST]" (requests per second); the burst defaults to iBurstFactor seconds at the rate,
+// and must be at least the rate (the least a bucket holds)
+bool ParseAdmissionLimit(const char* const pcsLimit, const unsigned int iBurstFactor, uint32_t* const pdwRate, uint32_t* const pdwBurst)
+{
+	char* pcsEnd;
+	const unsigned long ulRate = strtoul(pcsLimit, &pcsEnd, 10);
+	if ((pcsLimit == pcsEnd) || (MAX_ADMISSION_LIMIT < ulRate))
+	{
+		return false;
+	}
+	unsigned long ulBurst = ulRate * iBurstFactor;
+	if ('/' == *pcsEnd)
+	{
+		const char* const pcsBurst = pcsEnd + 1;
+		ulBurst = strtoul(pcsBurst, &pcsEnd, 10);
+		if ((pcsBurst == pcsEnd) || (MAX_ADMISSION_LIMIT < ulBurst))
+		{
+			return false;
+		}
+	}
+	if (('\0' != *pcsEnd) || (ulBurst < ulRate))
+	{
+		return false;
+	}
+	*pdwRate = (uint32_t)ulRate;
+	*pdwBurst = (uint32_t)ulBurst;
+	return true;
+}
+
+// Stats endpoint handler: GET /admission shows the admission limits and
+// POST /admission?client=RATE[/BURST]&link=RATE[/BURST] changes them (a rate of 0 lifts the limit)
+bool HandleAdmissionRequest(const bool bChange, const char* const pcsQuery, std::string* const pstrBody, void* const pvContext)
+{
+	DhcpEngine* const pdeEngine = (DhcpEngine*)pvContext;
+	DhcpAdmissionLimits dalLimits = pdeEngine->AdmissionLimits();
+	// A GET (which a web page can make a browser send) never changes anything
+	bool bValid = bChange || ('\0' == *pcsQuery);
+	const char* pcs = pcsQuery;
+	while (bValid && ('\0' != *pcs))
+	{
+		const size_t stLength = strcspn(pcs, "&");
+		char pcsParameter[64];
+		bValid = (stLength < sizeof(pcsParameter));
+		if (bValid)
+		{
+			memcpy(pcsParameter, pcs, stLength);
+			pcsParameter[stLength] = '\0';
+			if (0 == strncmp(pcsParameter, "client=", 7))
+			{
+				bValid = ParseAdmissionLimit(pcsParameter + 7, DEFAULT_CLIENT_BURST_FACTOR, &dalLimits.dwClientRate, &dalLimits.dwClientBurst);
+			}
+			else if (0 == strncmp(pcsParameter, "link=", 5))
+			{
+				bValid = ParseAdmissionLimit(pcsParameter + 5, DEFAULT_LINK_BURST_FACTOR, &dalLimits.dwLinkRate, &dalLimits.dwLinkBurst);
+			}
+			else
+			{
+				bValid = false;
+			}
+		}
+		pcs += stLength;
+		if ('&' == *pcs)
+		{
+			pcs++;
+		}
+	}
+	if (bValid)
+	{
+		pdeEngine->SetAdmissionLimits(dalLimits);
+	}
+	else
+	{
+		dalLimits = pdeEngine->AdmissionLimits();
+	}
+	char pcsLimits[160];
+	snprintf(pcsLimits, sizeof(pcsLimits), "%sclient %u/%u\nlink %u/%u\n", bValid ? "" : "Usage: POST /admission?client=RATE[/BURST]&link=RATE[/BURST]\n",
+		dalLimits.dwClientRate, dalLimits.dwClientBurst, dalLimits.dwLinkRate, dalLimits.dwLinkBurst);
+	try
+	{
+		pstrBody->assign(pcsLimits);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	return bValid;
+}
+
+// Parses "A.B.C.D/N" into a scope for a subnet behind relay agents; like a
+// local subnet, x.x.x.1 is left to the router and the rest is served
+bool ParseRelayScope(const char* const pcsSubnet, DhcpScopeConfig* const pdscScope)
+{
+	const char* const pcsSlash = strchr(pcsSubnet, '/');
+	char pcsAddr[INET_ADDRSTRLEN];
+	if ((0 == pcsSlash) || (sizeof(pcsAddr) <= (size_t)(pcsSlash - pcsSubnet)))
+	{
+		return false;
+	}
+	memcpy(pcsAddr, pcsSubnet, (size_t)(pcsSlash - pcsSubnet));
+	pcsAddr[pcsSlash - pcsSubnet] = '\0';
+	char* pcsEnd;
+	const unsigned long ulPrefixLength = strtoul(pcsSlash + 1, &pcsEnd, 10);
+	uint32_t dwAddr;
+	if ((1 != inet_pton(AF_INET, pcsAddr, &dwAddr)) || (pcsSlash + 1 == pcsEnd) || ('\0' != *pcsEnd) || (ulPrefixLength < 1) || (30 < ulPrefixLength))
+	{
+		return false;
+	}
+	const DWORD dwMaskValue = 0xffffffffu << (32 - ulPrefixLength);
+	const DWORD dwNetworkValue = DWIPtoValue(dwAddr) & dwMaskValue;
+	pdscScope->dwServerAddr = 0;  // The server's own address, known once the interfaces are
+	pdscScope->dwMask = DWValuetoIP(dwMaskValue);
+	pdscScope->dwMinAddr = DWValuetoIP(dwNetworkValue | 2);
+	pdscScope->dwMaxAddr = DWValuetoIP(dwNetworkValue | (~(dwMaskValue | 1)));
+	pdscScope->iInterfaceIndex = DHCP_SCOPE_RELAYED;
+	DhcpReplyTemplate::ClearScopeOptions(&pdscScope->dsoOptions);
+	return true;
+}
+
+// Parses "XX:XX:..." (hex bytes) into at most stMaxSize bytes
+bool ParseHexBytes(const char* const pcsBytes, uint8_t* const pbBytes, const size_t stMaxSize, size_t* const pstSize)
+{
+	*pstSize = 0;
+	const char* pcs = pcsBytes;
+	while (true)
+	{
+		char* pcsEnd;
+		const unsigned long ulByte = strtoul(pcs, &pcsEnd, 16);
+		if ((stMaxSize == *pstSize) || (pcs + 2 != pcsEnd) || !isxdigit((unsigned char)pcs[0]))
+		{
+			return false;
+		}
+		pbBytes[(*pstSize)++] = (uint8_t)ulByte;
+		if ('\0' == *pcsEnd)
+		{
+			return true;
+		}
+		if (':' != *pcsEnd)
+		{
+			return false;
+		}
+		pcs = pcsEnd + 1;
+	}
+}
+
+// Reads the reservations file (--reservations): one entry per line, and '#' starts a comment
+//   hardware-address 00:11:22:33:44:55 192.168.1.50  (chaddr, hlen bytes)
+//   client-id 01:00:11:22:33:44:55 192.168.1.51  (Client Identifier option)
+//   exclude 192.168.1.100[-192.168.1.119]  (never handed out dynamically)
+bool LoadReservations(const char* const pcsPath, ReservationTable* const prtReservations)
+{
+	FILE* const pfReservations = fopen(pcsPath, "r");
+	if (0 == pfReservations)
+	{
+		OUTPUT_ERROR((TEXT("Unable to open reservations file %s."), pcsPath));
+		return false;
+	}
+	char pcsLine[1024];
+	unsigned int iLine = 0;
+	bool bSuccess = true;
+	while (bSuccess && (0 != fgets(pcsLine, sizeof(pcsLine), pfReservations)))
+	{
+		iLine++;
+		if ((0 == strchr(pcsLine, '\n')) && !feof(pfReservations))
+		{
+			OUTPUT_ERROR((TEXT("%s line %u is too long."), pcsPath, iLine));
+			bSuccess = false;
+			break;
+		}
+		char* const pcsComment = strchr(pcsLine, '#');
+		if (0 != pcsComment)
+		{
+			*pcsComment = '\0';
+		}
+		char pcsType[32];
+		char pcsKey[RESERVATION_MAX_KEY_SIZE * 3];
+		char pcsAddr[2 * INET_ADDRSTRLEN];
+		char pcsExtra[2];
+		const int iFields = sscanf(pcsLine, "%31s %764s %31s %1s", pcsType, pcsKey, pcsAddr, pcsExtra);
+		if (iFields <= 0)
+		{
+			continue;  // Blank
+		}
+		if ((0 == strcmp(pcsType, "exclude")) && (2 == iFields))
+		{
+			// A single address, or a range
+			char* const pcsDash = strchr(pcsKey, '-');
+			if (0 != pcsDash)
+			{
+				*pcsDash = '\0';
+			}
+			uint32_t dwFirstAddr;
+			uint32_t dwLastAddr;
+			bSuccess = (1 == inet_pton(AF_INET, pcsKey, &dwFirstAddr)) && (1 == inet_pton(AF_INET, (0 != pcsDash) ? (pcsDash + 1) : pcsKey, &dwLastAddr)) &&
+				(DWIPtoValue(dwFirstAddr) <= DWIPtoValue(dwLastAddr)) && prtReservations->AddExclusion(dwFirstAddr, dwLastAddr);
+		}
+		else if (((0 == strcmp(pcsType, "hardware-address")) || (0 == strcmp(pcsType, "client-id"))) && (3 == iFields))
+		{
+			const bool bHardwareAddress = ('h' == pcsType[0]);
+			uint8_t pbKey[RESERVATION_MAX_KEY_SIZE];
+			size_t stKeySize;
+			uint32_t dwAddr;
+			bSuccess = ParseHexBytes(pcsKey, pbKey, bHardwareAddress ? sizeof(((const DHCPMessage*)0)->chaddr) : sizeof(pbKey), &stKeySize) && (1 == inet_pton(AF_INET, pcsAddr, &dwAddr)) &&
+				prtReservations->AddReservation(bHardwareAddress ? ReservationKey_HARDWARE_ADDRESS : ReservationKey_CLIENT_IDENTIFIER, pbKey, stKeySize, dwAddr);
+		}
+		else
+		{
+			bSuccess = false;
+		}
+		if (!bSuccess)
+		{
+			OUTPUT_ERROR((TEXT("%s line %u: expected \"hardware-address XX:XX:... A.B.C.D\", \"client-id XX:XX:... A.B.C.D\" or \"exclude A.B.C.D[-A.B.C.D]\"."), pcsPath, iLine));
+		}
+	}
+	VERIFY(0 == fclose(pfReservations));
+	return bSuccess;
+}
+#endif  // !defined(_WIN32)
+
+int main(int argc, char** argv)
+{
+	OUTPUT((TEXT("")));
+	OUTPUT((TEXT("DHCPLite")));
+	OUTPUT((TEXT("2016-04-02")));
+	OUTPUT((TEXT("Copyright (c) 2001-2016 by David Anson (http://dlaa.me/)")));
+	OUTPUT((TEXT("")));
+#if defined(_WIN32)
+	(void)argc;
+	(void)argv;
+	const unsigned int iWorkerCount = 1;
+	const LogLevel llLogLevel = LogLevel_INFO;
 	/*
-	* GetIPAddressInformation 获取本机IP、子网掩码、DHCP作用域
+	* ConsoleCtrlHandlerRoutine 捕捉Ctrl-C信号，退出程序
 	*/
-	if (!GetIPAddressInformation(&dwServerAddr, &dwMask, &dwMinAddr, &dwMaxAddr))
+	if (!SetConsoleCtrlHandler(ConsoleCtrlHandlerRoutine, TRUE)) {
+		OUTPUT_ERROR((TEXT("Unable to set Ctrl-C handler.")));
+		return -1;
+	}
+#else  // defined(_WIN32)
+	// --batch N: datagrams handled per recvmmsg/sendmmsg
+	// --workers N: sockets/threads/lease shards (one per core scales best)
+	// --lease-file PATH: keep leases across restarts (PATH and PATH.log)
+	// --stats-port N: serve Prometheus metrics on 127.0.0.1:N
+	// --log-level debug|info|warning|error|off: least severe lease event logged (default info)
+	// --router A, --dns A[,B,C], --domain NAME, --mtu N: options sent with every lease
+	// --rapid-commit: answer DISCOVERs carrying Rapid Commit with an ACK (RFC 4039)
+	// --reservations PATH: fixed addresses for known clients and excluded ranges (see LoadReservations)
+	// --allocation round-robin|hashed: how a new client's address is picked (hashed: from its client identifier, stable across restarts)
+	// --interface NAME (repeatable): serve only these interfaces (default: every one with an IPv4 address)
+	// --relay-scope A.B.C.D/N (repeatable): also serve this subnet to clients behind relay agents
+	// --reply-cache N: replies each worker keeps to resend to retransmissions (0 turns the cache off)
+	// --client-limit RATE[/BURST]: requests per second from one chaddr once it sent BURST (default off)
+	// --link-limit RATE[/BURST]: requests per second through one relay agent or from one interface (default off)
+	// --raw: AF_PACKET rings instead of UDP sockets, unicasting replies to chaddr (Ethernet interfaces only)
+	// --probe: ping an address before offering it, and offer another if something answers
+	std::vector<const char*> vpcsInterfaces;
+	std::vector<DhcpScopeConfig> vdscRelayScopes;
+	unsigned int iBatchSize = DEFAULT_RECEIVE_BATCH_SIZE;
+	unsigned int iWorkerCount = 1;
+	const char* pcsLeaseFile = 0;
+	const char* pcsReservationsFile = 0;
+	unsigned int iStatsPort = 0;
+	unsigned int iReplyCacheSize = DEFAULT_REPLY_CACHE_SIZE;
+	bool bRaw = false;
+	bool bProbe = false;
+	bool bAdmissionWritable = false;
+	DhcpAdmissionLimits dalLimits;
+	memset(&dalLimits, 0, sizeof(dalLimits));
+	LogLevel llLogLevel = LogLevel_INFO;
+	DhcpScopeOptions dsoOptions;
+	DhcpReplyTemplate::ClearScopeOptions(&dsoOptions);
+	bool bUsage = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if ((0 == strcmp(argv[i], "--batch")) && (i + 1 < argc))
+		{
+			iBatchSize = (unsigned int)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--workers")) && (i + 1 < argc))
+		{
+			iWorkerCount = (unsigned int)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--lease-file")) && (i + 1 < argc))
+		{
+			pcsLeaseFile = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i], "--reservations")) && (i + 1 < argc))
+		{
+			pcsReservationsFile = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i], "--stats-port")) && (i + 1 < argc))
+		{
+			iStatsPort = (unsigned int)strtoul(argv[++i], 0, 10);
+			if ((0 == iStatsPort) || (0xffff < iStatsPort))
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--log-level")) && (i + 1 < argc))
+		{
+			static const char* const ppcsLevels[] = { "debug", "info", "warning", "error", "off" };
+			C_ASSERT(LogLevel_OFF + 1 == ARRAY_LENGTH(ppcsLevels));
+			const char* const pcsLevel = argv[++i];
+			bUsage = true;
+			for (unsigned int j = 0; j < ARRAY_LENGTH(ppcsLevels); j++)
+			{
+				if (0 == strcmp(pcsLevel, ppcsLevels[j]))
+				{
+					llLogLevel = (LogLevel)j;
+					bUsage = false;
+				}
+			}
+			if (bUsage)
+			{
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--router")) && (i + 1 < argc))
+		{
+			if (1 != inet_pton(AF_INET, argv[++i], &dsoOptions.dwRouter))
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--dns")) && (i + 1 < argc))
+		{
+			if (!ParseAddressList(argv[++i], dsoOptions.pdwDnsServers, DHCP_SCOPE_MAX_DNS_SERVERS, &dsoOptions.iDnsServerCount))
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--domain")) && (i + 1 < argc))
+		{
+			const char* const pcsDomainName = argv[++i];
+			if (sizeof(dsoOptions.pcsDomainName) <= strlen(pcsDomainName))
+			{
+				bUsage = true;
+				break;
+			}
+			strcpy(dsoOptions.pcsDomainName, pcsDomainName);
+		}
+		else if ((0 == strcmp(argv[i], "--mtu")) && (i + 1 < argc))
+		{
+			// RFC 2132 section 5.1: at least 68
+			const unsigned long ulMtu = strtoul(argv[++i], 0, 10);
+			if ((ulMtu < 68) || (0xffff < ulMtu))
+			{
+				bUsage = true;
+				break;
+			}
+			dsoOptions.wInterfaceMtu = (uint16_t)ulMtu;
+		}
+		else if (0 == strcmp(argv[i], "--rapid-commit"))
+		{
+			dsoOptions.bRapidCommit = true;
+		}
+		else if ((0 == strcmp(argv[i], "--allocation")) && (i + 1 < argc))
+		{
+			static const char* const ppcsPolicies[] = { "round-robin", "hashed" };
+			C_ASSERT(AddressPool_HASHED + 1 == ARRAY_LENGTH(ppcsPolicies));
+			const char* const pcsPolicy = argv[++i];
+			bUsage = true;
+			for (unsigned int j = 0; j < ARRAY_LENGTH(ppcsPolicies); j++)
+			{
+				if (0 == strcmp(pcsPolicy, ppcsPolicies[j]))
+				{
+					dsoOptions.appAllocationPolicy = (AddressPoolPolicy)j;
+					bUsage = false;
+				}
+			}
+			if (bUsage)
+			{
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--interface")) && (i + 1 < argc))
+		{
+			vpcsInterfaces.push_back(argv[++i]);
+		}
+		else if ((0 == strcmp(argv[i], "--relay-scope")) && (i + 1 < argc))
+		{
+			DhcpScopeConfig dscScope;
+			if (!ParseRelayScope(argv[++i], &dscScope))
+			{
+				bUsage = true;
+				break;
+			}
+			vdscRelayScopes.push_back(dscScope);
+		}
+		else if ((0 == strcmp(argv[i], "--reply-cache")) && (i + 1 < argc))
+		{
+			iReplyCacheSize = (unsigned int)strtoul(argv[++i], 0, 10);
+			if (MAX_REPLY_CACHE_SIZE < iReplyCacheSize)
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--client-limit")) && (i + 1 < argc))
+		{
+			if (!ParseAdmissionLimit(argv[++i], DEFAULT_CLIENT_BURST_FACTOR, &dalLimits.dwClientRate, &dalLimits.dwClientBurst))
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--link-limit")) && (i + 1 < argc))
+		{
+			if (!ParseAdmissionLimit(argv[++i], DEFAULT_LINK_BURST_FACTOR, &dalLimits.dwLinkRate, &dalLimits.dwLinkBurst))
+			{
+				bUsage = true;
+				break;
+			}
+		}
+		else if (0 == strcmp(argv[i], "--admission-control-writable"))
+		{
+			bAdmissionWritable = true;
+		}
+		else if (0 == strcmp(argv[i], "--raw"))
+		{
+			bRaw = true;
+		}
+		else if (0 == strcmp(argv[i], "--probe"))
+		{
+			bProbe = true;
+		}
+		else
+		{
+			bUsage = true;
+			break;
+		}
+	}
+	if (bUsage || (iBatchSize < 1) || (MAX_RECEIVE_BATCH_SIZE < iBatchSize) || (iWorkerCount < 1) || (MAX_WORKER_COUNT < iWorkerCount)) {
+		OUTPUT_ERROR((TEXT("Usage: %s [--batch 1-%d] [--workers 1-%d] [--lease-file PATH] [--stats-port 1-65535] [--log-level debug|info|warning|error|off] [--router A] [--dns A[,B,C]] [--domain NAME] [--mtu 68-65535] [--rapid-commit] [--reservations PATH] [--allocation round-robin|hashed] [--interface NAME]... [--relay-scope A.B.C.D/1-30]... [--reply-cache 0-%d] [--client-limit RATE[/BURST]] [--link-limit RATE[/BURST]] [--admission-control-writable] [--raw] [--probe]"), argv[0], MAX_RECEIVE_BATCH_SIZE, MAX_WORKER_COUNT, MAX_REPLY_CACHE_SIZE));
+		return -1;
+	}
+	struct sigaction saStop;
+	memset(&saStop, 0, sizeof(saStop));
+	saStop.sa_handler = SignalHandlerRoutine;
+	sigemptyset(&saStop.sa_mask);
+	if ((0 != sigaction(SIGINT, &saStop, 0)) || (0 != sigaction(SIGTERM, &saStop, 0))) {
+		OUTPUT_ERROR((TEXT("Unable to set Ctrl-C handler.")));
 		return -1;
+	}
+#endif  // defined(_WIN32)
 
-	printf("serverAddr = %s\n", inet_ntoa(*(in_addr*)&dwServerAddr));
-	printf("dwMask = %s\n", inet_ntoa(*(in_addr*)&dwMask));
-	printf("dwMinAddr = %s\n", inet_ntoa(*(in_addr*)&dwMinAddr));
-	printf("dwMaxAddr = %s\n", inet_ntoa(*(in_addr*)&dwMaxAddr));
-	//开一个这么大的数组作为映射
-	//开一个字典作为value-key的键值对
-	
-	ASSERT((DWValuetoIP(dwMinAddr) <= DWValuetoIP(dwServerAddr)) && (DWValuetoIP(dwServerAddr) <= DWValuetoIP(dwMaxAddr)));
-	// VectorAddressInUseInformation 接入用户地址-标识对
-	VectorAddressInUseInformation vAddressesInUse;
-	AddressInUseInformation aiuiServerAddress;
-	// DWIPtoValue 大小端序转换
-	aiuiServerAddress.dwAddrValue = DWIPtoValue(dwServerAddr);
-	aiuiServerAddress.pbClientIdentifier = 0;  // Server entry is only entry without a client ID
-	aiuiServerAddress.dwClientIdentifierSize = 0;
-
-	//PushBack封装了vector::push_back，把异常转换成条件语句
-	if (!PushBack(&vAddressesInUse, &aiuiServerAddress)) {
-		OUTPUT_ERROR((TEXT("Insufficient memory to add server address.")));
+	/*
+	* GetIPAddressInformation 获取本机IP、子网掩码、DHCP作用域 (on Linux, one per interface)
+	*/
+	std::vector<DhcpScopeConfig> vdscScopes;
+#if defined(_WIN32)
+	DhcpScopeConfig dscScope;
+	if (!GetIPAddressInformation(&dscScope.dwServerAddr, &dscScope.dwMask, &dscScope.dwMinAddr, &dscScope.dwMaxAddr))
+		return -1;
+	dscScope.iInterfaceIndex = 0;  // The socket is bound to the one address, so any interface
+	DhcpReplyTemplate::ClearScopeOptions(&dscScope.dsoOptions);
+	vdscScopes.push_back(dscScope);
+#else  // defined(_WIN32)
+	if (!GetInterfaceScopes(vpcsInterfaces, &vdscScopes))
 		return -1;
+	// Replies to relay agents come from (and name as server identifier) the first interface's address
+	for (size_t i = 0; i < vdscRelayScopes.size(); i++)
+	{
+		vdscRelayScopes[i].dwServerAddr = vdscScopes[0].dwServerAddr;
+		vdscScopes.push_back(vdscRelayScopes[i]);
+	}
+#endif  // defined(_WIN32)
+
+	for (size_t i = 0; i < vdscScopes.size(); i++)
+	{
+		const DhcpScopeConfig& rdscScope = vdscScopes[i];
+		printf("serverAddr = %s\n", inet_ntoa(*(in_addr*)&rdscScope.dwServerAddr));
+		printf("dwMask = %s\n", inet_ntoa(*(in_addr*)&rdscScope.dwMask));
+		printf("dwMinAddr = %s\n", inet_ntoa(*(in_addr*)&rdscScope.dwMinAddr));
+		printf("dwMaxAddr = %s\n", inet_ntoa(*(in_addr*)&rdscScope.dwMaxAddr));
+		//开一个这么大的数组作为映射
+		//开一个字典作为value-key的键值对
+
+		ASSERT((DHCP_SCOPE_RELAYED == rdscScope.iInterfaceIndex) || ((DWValuetoIP(rdscScope.dwMinAddr) <= DWValuetoIP(rdscScope.dwServerAddr)) && (DWValuetoIP(rdscScope.dwServerAddr) <= DWValuetoIP(rdscScope.dwMaxAddr))));
+		// Each worker owns a lease shard with its own slice of each range
+		if (DWIPtoValue(rdscScope.dwMaxAddr) - DWIPtoValue(rdscScope.dwMinAddr) + 1 < iWorkerCount) {
+			OUTPUT_ERROR((TEXT("Not enough IP addresses available for %u workers."), iWorkerCount));
+			return -1;
+		}
 	}
 
+#if defined(_WIN32)
 	WSADATA wsaData;
 	if (WSAStartup(MAKEWORD(1, 1), &wsaData)) {
 		OUTPUT_ERROR((TEXT("Unable to initialize WinSock.")));
 		return -1;
 	}
+#endif  // defined(_WIN32)
 
 	OUTPUT((TEXT("")));
 	OUTPUT((TEXT("Server is running...  (Press Ctrl+C to shutdown.)")));
 	OUTPUT((TEXT("")));
 
 	char pcsServerHostName[MAX_HOSTNAME_LENGTH];
+	DhcpEngine deEngine;
+	EventLog elLog;
+	EngineEventContext eecEvents;
+	eecEvents.pelLog = &elLog;
+#if !defined(_WIN32)
+	eecEvents.pldbLeases = 0;
+#endif  // !defined(_WIN32)
+	deEngine.SetEventHandler(OutputEngineEvent, &eecEvents);
 	/**
 	 * @brief 初始化socket为IP数据报，并设置option为广播（setsockopt）
 	 * @param sServerSocket 用以监听广播的socket
 	 * @param dwServerAddr 主机IP
+	 * @param bShared 多个worker共享端口
 	 * @param pcsServerHostName buffer
 	 * @param MAX_HOSTNAME_LENGTH bufferSize
 	 * @return 
 	 */
-	if (!InitializeDHCPServer(&sServerSocket, dwServerAddr, pcsServerHostName, MAX_HOSTNAME_LENGTH))
+#if defined(_WIN32)
+	if (!InitializeDHCPServer(&sServerSocket, vdscScopes[0].dwServerAddr, false, pcsServerHostName, MAX_HOSTNAME_LENGTH))
+		return -1;
+	// LeaseTable 接入用户地址-标识对
+	if (!deEngine.Initialize(pcsServerHostName, iWorkerCount) || !deEngine.AddScope(vdscScopes[0]) || !deEngine.EnableReplyCache(DEFAULT_REPLY_CACHE_SIZE)) {
+		OUTPUT_ERROR((TEXT("Insufficient memory for lease table.")));
 		return -1;
+	}
 
 	// 主任务循环
 	/**
@@ -826,7 +1558,12 @@ int main(int /*argc*/, char** /*argv*/)
 	 * \param 
 	 * \return 
 	 */
-	VERIFY(ReadDHCPClientRequests(sServerSocket, pcsServerHostName, &vAddressesInUse, dwServerAddr, dwMask, dwMinAddr, dwMaxAddr));
+	if (!elLog.Start(iWorkerCount, llLogLevel, FormatEngineEvent, stdout)) {
+		OUTPUT_ERROR((TEXT("Unable to start the event log.")));
+		return -1;
+	}
+	VERIFY(ReadDHCPClientRequests(sServerSocket, &deEngine));
+	elLog.Stop();
 	
 	// 在sigint之后的尾处理
 	if (INVALID_SOCKET != sServerSocket)
@@ -836,15 +1573,181 @@ int main(int /*argc*/, char** /*argv*/)
 	}
 
 	VERIFY(0 == WSACleanup());
+#else  // defined(_WIN32)
+	std::vector<SOCKET> vsServerSockets(iWorkerCount, INVALID_SOCKET);
+	for (unsigned int i = 0; i < iWorkerCount; i++)
+	{
+		if (!InitializeDHCPServer(&vsServerSockets[i], vdscScopes[0].dwServerAddr, 1 < iWorkerCount, pcsServerHostName, MAX_HOSTNAME_LENGTH))
+			return -1;
+	}
+	// Raw backend: each worker gets a ring on every interface with a scope (relayed requests must come in on one of them)
+	std::unique_ptr<PacketRing[]> pprRings;
+	size_t stRingsPerWorker = 0;
+	if (bRaw)
+	{
+		for (size_t i = 0; i < vdscScopes.size(); i++)
+		{
+			stRingsPerWorker += (DHCP_SCOPE_RELAYED != vdscScopes[i].iInterfaceIndex) ? 1 : 0;
+		}
+		try
+		{
+			pprRings.reset(new PacketRing[iWorkerCount * stRingsPerWorker]);
+		}
+		catch (const std::bad_alloc)
+		{
+			OUTPUT_ERROR((TEXT("Insufficient memory for packet rings.")));
+			return -1;
+		}
+		for (unsigned int i = 0; i < iWorkerCount; i++)
+		{
+			size_t stRing = i * stRingsPerWorker;
+			for (size_t j = 0; j < vdscScopes.size(); j++)
+			{
+				if (DHCP_SCOPE_RELAYED == vdscScopes[j].iInterfaceIndex)
+				{
+					continue;
+				}
+				if (!pprRings[stRing++].Open(vdscScopes[j].iInterfaceIndex, DHCP_SERVER_PORT)) {
+					OUTPUT_ERROR((TEXT("Unable to open a packet ring on interface index %u (needs root and an Ethernet interface)."), vdscScopes[j].iInterfaceIndex));
+					return -1;
+				}
+			}
+			if (!IgnoreSocketInput(vsServerSockets[i])) {
+				OUTPUT_ERROR((TEXT("Unable to set socket options.")));
+				return -1;
+			}
+		}
+	}
+	// LeaseTable 接入用户地址-标识对 (a scope per interface, a shard per worker in each)
+	if (!deEngine.Initialize(pcsServerHostName, iWorkerCount)) {
+		OUTPUT_ERROR((TEXT("Insufficient memory for lease table.")));
+		return -1;
+	}
+	std::vector<LeaseRange> vlrRanges(vdscScopes.size());
+	for (size_t i = 0; i < vdscScopes.size(); i++)
+	{
+		// The same options go to every interface; a relayed subnet's router is its x.x.x.1
+		vdscScopes[i].dsoOptions = dsoOptions;
+		if (DHCP_SCOPE_RELAYED == vdscScopes[i].iInterfaceIndex)
+		{
+			vdscScopes[i].dsoOptions.dwRouter = DWValuetoIP((DWIPtoValue(vdscScopes[i].dwMinAddr) & DWIPtoValue(vdscScopes[i].dwMask)) | 1);
+		}
+		if (!deEngine.AddScope(vdscScopes[i])) {
+			OUTPUT_ERROR((TEXT("Unable to serve %s (overlapping subnets, insufficient memory, or options that do not fit in a DHCP reply)."), inet_ntoa(*(in_addr*)&vdscScopes[i].dwMinAddr)));
+			return -1;
+		}
+		vlrRanges[i].dwMinAddrValue = DWIPtoValue(vdscScopes[i].dwMinAddr);
+		vlrRanges[i].dwMaxAddrValue = DWIPtoValue(vdscScopes[i].dwMaxAddr);
+	}
+	// Before the leases are restored, so none lands on a reserved or excluded address
+	ReservationTable rtReservations;
+	if (0 != pcsReservationsFile)
+	{
+		const std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+		if (!LoadReservations(pcsReservationsFile, &rtReservations))
+			return -1;
+		if (!rtReservations.Build()) {
+			OUTPUT_ERROR((TEXT("Unable to compile the reservations in %s (a client or an address reserved twice, or insufficient memory)."), pcsReservationsFile));
+			return -1;
+		}
+		if (!deEngine.SetReservations(&rtReservations)) {
+			OUTPUT_ERROR((TEXT("%s reserves a server, network or broadcast address."), pcsReservationsFile));
+			return -1;
+		}
+		const double dMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tpStart).count();
+		OUTPUT((TEXT("Loaded %u reservations and %u excluded ranges from %s in %.1f ms."), (unsigned int)rtReservations.ReservationCount(), (unsigned int)rtReservations.ExclusionCount(), pcsReservationsFile, dMilliseconds));
+	}
+	if ((0 != iReplyCacheSize) && !deEngine.EnableReplyCache(iReplyCacheSize)) {
+		OUTPUT_ERROR((TEXT("Insufficient memory for the reply cache.")));
+		return -1;
+	}
+	// Always on, so the limits can be set while serving (with both rates 0 it only costs two tests per request)
+	if (!deEngine.EnableAdmissionControl(dalLimits)) {
+		OUTPUT_ERROR((TEXT("Insufficient memory for admission control.")));
+		return -1;
+	}
+	IcmpProber ipProber;
+	if (bProbe)
+	{
+		if (!ipProber.Open(iWorkerCount)) {
+			OUTPUT_ERROR((TEXT("Unable to open ICMP sockets for probing (needs root).")));
+			return -1;
+		}
+		deEngine.SetProber(IcmpProber::SendProbe, &ipProber);
+	}
+	LeaseDatabase ldbLeases;
+	if (0 != pcsLeaseFile)
+	{
+		const std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+		if (!ldbLeases.Open(pcsLeaseFile, &vlrRanges[0], vlrRanges.size())) {
+			OUTPUT_ERROR((TEXT("Unable to open lease file %s."), pcsLeaseFile));
+			return -1;
+		}
+		RestoreContext rcRestore;
+		rcRestore.pdeEngine = &deEngine;
+		rcRestore.qwNow = MonotonicSeconds();
+		rcRestore.qwWallNow = (uint64_t)time(0);
+		rcRestore.iRestored = 0;
+		const size_t stSaved = ldbLeases.ForEachLease(RestoreLeaseRecord, &rcRestore);
+		const double dMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tpStart).count();
+		OUTPUT((TEXT("Restored %u of %u saved leases from %s in %.1f ms."), rcRestore.iRestored, (unsigned int)stSaved, pcsLeaseFile, dMilliseconds));
+		eecEvents.pldbLeases = &ldbLeases;
+	}
+	if (!elLog.Start(iWorkerCount, llLogLevel, FormatEngineEvent, stdout)) {
+		OUTPUT_ERROR((TEXT("Unable to start the event log.")));
+		return -1;
+	}
+	if ((LogLevel_OFF == llLogLevel) && (0 == pcsLeaseFile))
+	{
+		// Nothing consumes events, so the engine skips building them
+		deEngine.SetEventHandler(0, 0);
+	}
+	DhcpMetrics dmMetrics;
+	StatsServer ssStats;
+	if (0 != iStatsPort)
+	{
+		if (!dmMetrics.Initialize(iWorkerCount, deEngine.ScopeCount())) {
+			OUTPUT_ERROR((TEXT("Insufficient memory for metrics.")));
+			return -1;
+		}
+		deEngine.SetMetrics(&dmMetrics);
+		ssStats.SetHandler("/admission", HandleAdmissionRequest, &deEngine, bAdmissionWritable);
+		if (!ssStats.Start(&dmMetrics, (uint16_t)iStatsPort)) {
+			OUTPUT_ERROR((TEXT("Unable to serve metrics on 127.0.0.1:%u."), iStatsPort));
+			return -1;
+		}
+		OUTPUT((TEXT("Serving metrics on http://127.0.0.1:%u/metrics"), iStatsPort));
+	}
 
-	for (size_t i = 0; i < vAddressesInUse.size(); i++)
+	// 主任务循环 (a single worker runs on this thread)
+	if (1 == iWorkerCount)
 	{
-		aiuiServerAddress = vAddressesInUse.at(i);
-		if (0 != aiuiServerAddress.pbClientIdentifier)
+		if (bRaw)
 		{
-			// LocalAlloc/LocalFree相当于malloc/free
-			VERIFY(0 == LocalFree(aiuiServerAddress.pbClientIdentifier));
+			VERIFY(ReadRawClientRequests(&pprRings[0], stRingsPerWorker, &deEngine, 0, bProbe ? &ipProber : 0));
 		}
+		else
+		{
+			VERIFY(ReadDHCPClientRequests(vsServerSockets[0], &deEngine, 0, iBatchSize, bProbe ? &ipProber : 0));
+		}
+	}
+	else
+	{
+		VERIFY(RunWorkers(vsServerSockets, &deEngine, iBatchSize, pprRings.get(), stRingsPerWorker, bProbe ? &ipProber : 0));
 	}
+
+	// 在sigint之后的尾处理
+	for (unsigned int i = 0; i < iWorkerCount; i++)
+	{
+		VERIFY(0 == closesocket(vsServerSockets[i]));
+	}
+	ssStats.Stop();
+	// Writes out the events still queued
+	elLog.Stop();
+	// Writes the last queued changes and compacts the log
+	ldbLeases.Close();
+#endif  // defined(_WIN32)
+
+	// Lease records and client identifiers are released with deEngine
 	return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
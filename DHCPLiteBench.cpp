@@ -0,0 +1,762 @@
+// Microbenchmarks for the packet-processing hot path
+//
+// Usage: DHCPLiteBench [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N] [--out FILE]
+//
+// Results are written as JSON in the layout Google Benchmark uses (one entry
+// per repetition plus mean/median/min aggregates), so two runs can be
+// compared with its tools/compare.py or any JSON-aware script.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ToolBox.h"
+#include "DHCPOptions.h"
+#include "DHCPClientMessage.h"
+#include "DhcpEngine.h"
+#include "AddressPool.h"
+#include "LeaseTable.h"
+#include "ScopeTable.h"
+#include "AdmissionControl.h"
+#include "ReservationTable.h"
+
+// Runs qwIterations operations and returns the nanoseconds spent on them
+// (setup done inside the function is excluded from the figure)
+typedef std::function<double(const uint64_t qwIterations)> BenchmarkFunction;
+
+struct Benchmark
+{
+	std::string strName;
+	BenchmarkFunction bfRun;
+};
+
+struct BenchmarkResult
+{
+	std::string strName;
+	uint64_t qwIterations;
+	std::vector<double> vdNsPerOp;  // One per repetition
+};
+
+static volatile uint64_t qwSink;  // Keeps the compiler from discarding measured work
+
+typedef std::chrono::steady_clock Clock;
+static inline double ElapsedNs(const Clock::time_point& rtpStart)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - rtpStart).count();
+}
+
+// xorshift32: deterministic across runs so every run sees the same layouts
+static inline uint32_t NextRandom(uint32_t* const pdwState)
+{
+	uint32_t dw = *pdwState;
+	dw ^= dw << 13;
+	dw ^= dw >> 17;
+	dw ^= dw << 5;
+	*pdwState = dw;
+	return dw;
+}
+
+// Network order address for a host order value
+static inline uint32_t ValueToAddr(const uint32_t dwValue)
+{
+	uint32_t dwAddr;
+	uint8_t* const pb = (uint8_t*)&dwAddr;
+	pb[0] = (uint8_t)(dwValue >> 24);
+	pb[1] = (uint8_t)(dwValue >> 16);
+	pb[2] = (uint8_t)(dwValue >> 8);
+	pb[3] = (uint8_t)dwValue;
+	return dwAddr;
+}
+
+// The options of a typical Windows DISCOVER: type, client identifier,
+// requested address, host name, FQDN, vendor class, parameter request list
+static const uint8_t pbTypicalOptions[] =
+{
+	option_DHCPMESSAGETYPE, 1, DHCPMessageType_DISCOVER,
+	option_CLIENTIDENTIFIER, 7, 1, 0x00, 0x15, 0x5d, 0x01, 0x02, 0x03,
+	option_REQUESTEDIPADDRESS, 4, 192, 168, 1, 100,
+	option_HOSTNAME, 8, 'w', 'o', 'r', 'k', 's', 't', 'n', '1',
+	81, 12, 0, 0, 0, 'w', 'o', 'r', 'k', 's', 't', 'n', '1', '.',
+	60, 8, 'M', 'S', 'F', 'T', ' ', '5', '.', '0',
+	55, 14, 1, 3, 6, 15, 31, 33, 43, 44, 46, 47, 119, 121, 249, 252,
+	option_END,
+};
+
+// Server test network: 10.0.0.0/16 served from 10.0.0.1
+#define BENCH_SERVER_VALUE (0x0a000001)
+#define BENCH_MASK_VALUE (0xffff0000)
+#define BENCH_MIN_VALUE (0x0a000002)
+#define BENCH_MAX_VALUE (0x0a00fffe)
+#define BENCH_CLIENT_COUNT (10000)
+// New clients per virtual second in the churn benchmark; about
+// BENCH_CHURN_RATE * DHCP_LEASE_TIME leases are bound at any time
+#define BENCH_CHURN_RATE (10)
+
+static void MakeClient(const uint32_t dwClient, DHCPClientMessageFields* const pdcmf, const DHCPMessageTypes dhcpmtMessageType)
+{
+	memset(pdcmf, 0, sizeof(*pdcmf));
+	pdcmf->dhcpmtMessageType = dhcpmtMessageType;
+	pdcmf->dwXid = dwClient * 2654435761u;
+	pdcmf->pbChaddr[0] = 0x02;  // Locally administered
+	pdcmf->pbChaddr[2] = (uint8_t)(dwClient >> 24);
+	pdcmf->pbChaddr[3] = (uint8_t)(dwClient >> 16);
+	pdcmf->pbChaddr[4] = (uint8_t)(dwClient >> 8);
+	pdcmf->pbChaddr[5] = (uint8_t)dwClient;
+	pdcmf->pcsHostName = "benchclient";
+}
+
+// Turns a message built by MakeClient into one from another client
+static void SetClient(uint8_t* const pbMessage, const uint32_t dwClient)
+{
+	DHCPMessage* const pdhcpm = (DHCPMessage*)pbMessage;
+	pdhcpm->chaddr[2] = (uint8_t)(dwClient >> 24);
+	pdhcpm->chaddr[3] = (uint8_t)(dwClient >> 16);
+	pdhcpm->chaddr[4] = (uint8_t)(dwClient >> 8);
+	pdhcpm->chaddr[5] = (uint8_t)dwClient;
+}
+
+// One scope serving every interface; pdso (0 for none) adds options to its replies
+static bool InitializeBenchEngine(DhcpEngine* const pdeEngine, const DhcpScopeOptions* const pdso)
+{
+	DhcpScopeConfig dscScope;
+	dscScope.dwServerAddr = ValueToAddr(BENCH_SERVER_VALUE);
+	dscScope.dwMask = ValueToAddr(BENCH_MASK_VALUE);
+	dscScope.dwMinAddr = ValueToAddr(BENCH_MIN_VALUE);
+	dscScope.dwMaxAddr = ValueToAddr(BENCH_MAX_VALUE);
+	dscScope.iInterfaceIndex = 0;
+	if (0 != pdso)
+	{
+		dscScope.dsoOptions = *pdso;
+	}
+	else
+	{
+		DhcpReplyTemplate::ClearScopeOptions(&dscScope.dsoOptions);
+	}
+	return pdeEngine->Initialize("benchserver", 1) && pdeEngine->AddScope(dscScope);
+}
+
+static void AddOptionBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	struct OptionCase
+	{
+		const char* pcsName;
+		uint8_t bOption;
+	};
+	static const OptionCase ocCases[] =
+	{
+		{ "FindOptionData/first", option_DHCPMESSAGETYPE },
+		{ "FindOptionData/last", 55 },
+		{ "FindOptionData/absent", option_SERVERIDENTIFIER },
+	};
+	for (size_t i = 0; i < ARRAY_LENGTH(ocCases); i++)
+	{
+		const uint8_t bOption = ocCases[i].bOption;
+		pvbBenchmarks->push_back({ ocCases[i].pcsName, [bOption](const uint64_t qwIterations)
+		{
+			const uint8_t* pbData;
+			unsigned int iDataSize;
+			uint64_t qwFound = 0;
+			const Clock::time_point tpStart = Clock::now();
+			for (uint64_t q = 0; q < qwIterations; q++)
+			{
+				qwFound += FindOptionData(bOption, pbTypicalOptions, (int)sizeof(pbTypicalOptions), &pbData, &iDataSize) ? iDataSize : 0;
+			}
+			const double dNs = ElapsedNs(tpStart);
+			qwSink = qwSink + qwFound;
+			return dNs;
+		} });
+	}
+
+	pvbBenchmarks->push_back({ "DHCPOptionTable::Decode", [](const uint64_t qwIterations)
+	{
+		uint8_t pbFile[128] = { 0 };
+		uint8_t pbSname[64] = { 0 };
+		DHCPOptionTable dotOptions;
+		uint64_t qwDecoded = 0;
+		const Clock::time_point tpStart = Clock::now();
+		for (uint64_t q = 0; q < qwIterations; q++)
+		{
+			qwDecoded += dotOptions.Decode(pbTypicalOptions, sizeof(pbTypicalOptions), pbFile, sizeof(pbFile), pbSname, sizeof(pbSname)) ? 1 : 0;
+		}
+		const double dNs = ElapsedNs(tpStart);
+		qwSink = qwSink + qwDecoded;
+		return dNs;
+	} });
+
+	pvbBenchmarks->push_back({ "GetDHCPMessageType", [](const uint64_t qwIterations)
+	{
+		uint8_t pbFile[128] = { 0 };
+		uint8_t pbSname[64] = { 0 };
+		DHCPOptionTable dotOptions;
+		VERIFY(dotOptions.Decode(pbTypicalOptions, sizeof(pbTypicalOptions), pbFile, sizeof(pbFile), pbSname, sizeof(pbSname)));
+		uint64_t qwTypes = 0;
+		const Clock::time_point tpStart = Clock::now();
+		for (uint64_t q = 0; q < qwIterations; q++)
+		{
+			DHCPMessageTypes dhcpmtMessageType;
+			qwTypes += GetDHCPMessageType(dotOptions, &dhcpmtMessageType) ? dhcpmtMessageType : 0;
+		}
+		const double dNs = ElapsedNs(tpStart);
+		qwSink = qwSink + qwTypes;
+		return dNs;
+	} });
+}
+
+// Prebuilt messages for BENCH_CLIENT_COUNT clients
+static bool BuildClientMessages(const DHCPMessageTypes dhcpmtMessageType, const uint32_t dwServerIdentifier, std::vector<uint8_t>* const pvbMessages, std::vector<size_t>* const pvstSizes)
+{
+	pvbMessages->assign((size_t)BENCH_CLIENT_COUNT * DHCP_CLIENT_MESSAGE_MAX_SIZE, 0);
+	pvstSizes->assign(BENCH_CLIENT_COUNT, 0);
+	for (uint32_t i = 0; i < BENCH_CLIENT_COUNT; i++)
+	{
+		DHCPClientMessageFields dcmf;
+		MakeClient(i, &dcmf, dhcpmtMessageType);
+		dcmf.dwServerIdentifier = dwServerIdentifier;
+		(*pvstSizes)[i] = BuildDHCPClientMessage(dcmf, &(*pvbMessages)[(size_t)i * DHCP_CLIENT_MESSAGE_MAX_SIZE], DHCP_CLIENT_MESSAGE_MAX_SIZE);
+		if (0 == (*pvstSizes)[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Pushes every prebuilt message through the engine once (outside any timing)
+static void ProcessAll(DhcpEngine* const pdeEngine, const std::vector<uint8_t>& rvbMessages, const std::vector<size_t>& rvstSizes)
+{
+	DhcpRequestInfo driRequest = { 0xffffffff, 0, 0, 0, false };
+	uint8_t pbReply[DHCP_REPLY_SIZE];
+	DhcpReplyInfo driReply;
+	for (size_t i = 0; i < rvstSizes.size(); i++)
+	{
+		pdeEngine->ProcessRequest(&rvbMessages[i * DHCP_CLIENT_MESSAGE_MAX_SIZE], rvstSizes[i], driRequest, pbReply, sizeof(pbReply), &driReply);
+	}
+}
+
+static double TimeEngine(DhcpEngine* const pdeEngine, const std::vector<uint8_t>& rvbMessages, const std::vector<size_t>& rvstSizes, const uint64_t qwIterations, const DHCPMessageTypes dhcpmtExpected)
+{
+	DhcpRequestInfo driRequest = { 0xffffffff, 0, 0, 0, false };
+	uint8_t pbReply[DHCP_REPLY_SIZE];
+	DhcpReplyInfo driReply;
+	uint64_t qwReplies = 0;
+	size_t i = 0;
+	const Clock::time_point tpStart = Clock::now();
+	for (uint64_t q = 0; q < qwIterations; q++)
+	{
+		if (pdeEngine->ProcessRequest(&rvbMessages[i * DHCP_CLIENT_MESSAGE_MAX_SIZE], rvstSizes[i], driRequest, pbReply, sizeof(pbReply), &driReply))
+		{
+			qwReplies += pbReply[sizeof(DHCPMessage) + 2];
+		}
+		if (rvstSizes.size() == ++i)
+		{
+			i = 0;
+		}
+	}
+	const double dNs = ElapsedNs(tpStart);
+	// Every request must have produced the expected reply type
+	if ((uint64_t)dhcpmtExpected * qwIterations != qwReplies)
+	{
+		fprintf(stderr, "Unexpected replies from the engine.\n");
+		exit(1);
+	}
+	qwSink = qwSink + qwReplies;
+	return dNs;
+}
+
+static void AddEngineBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	// Clients the engine has already seen get their previous address back
+	pvbBenchmarks->push_back({ "DhcpEngine/DISCOVER->OFFER/known-client", [](const uint64_t qwIterations)
+	{
+		std::vector<uint8_t> vbMessages;
+		std::vector<size_t> vstSizes;
+		DhcpEngine deEngine;
+		VERIFY(BuildClientMessages(DHCPMessageType_DISCOVER, 0, &vbMessages, &vstSizes) && InitializeBenchEngine(&deEngine, 0));
+		ProcessAll(&deEngine, vbMessages, vstSizes);
+		return TimeEngine(&deEngine, vbMessages, vstSizes, qwIterations, DHCPMessageType_OFFER);
+	} });
+
+	// Each DISCOVER comes from a new client, so every one allocates an address
+	// and adds a lease; the engine is reset (untimed) before the pool runs out
+	pvbBenchmarks->push_back({ "DhcpEngine/DISCOVER->OFFER/new-client", [](const uint64_t qwIterations)
+	{
+		std::vector<uint8_t> vbMessages;
+		std::vector<size_t> vstSizes;
+		VERIFY(BuildClientMessages(DHCPMessageType_DISCOVER, 0, &vbMessages, &vstSizes));
+		double dNs = 0;
+		uint64_t qwRemaining = qwIterations;
+		while (0 != qwRemaining)
+		{
+			const uint64_t qwBatch = std::min<uint64_t>(qwRemaining, BENCH_CLIENT_COUNT);
+			DhcpEngine deEngine;
+			VERIFY(InitializeBenchEngine(&deEngine, 0));
+			dNs += TimeEngine(&deEngine, vbMessages, vstSizes, qwBatch, DHCPMessageType_OFFER);
+			qwRemaining -= qwBatch;
+		}
+		return dNs;
+	} });
+
+	// DHCPREQUEST in SELECTING state for an address the engine offered
+	pvbBenchmarks->push_back({ "DhcpEngine/REQUEST->ACK", [](const uint64_t qwIterations)
+	{
+		std::vector<uint8_t> vbDiscovers;
+		std::vector<size_t> vstDiscoverSizes;
+		std::vector<uint8_t> vbRequests;
+		std::vector<size_t> vstRequestSizes;
+		DhcpEngine deEngine;
+		VERIFY(BuildClientMessages(DHCPMessageType_DISCOVER, 0, &vbDiscovers, &vstDiscoverSizes) &&
+			BuildClientMessages(DHCPMessageType_REQUEST, ValueToAddr(BENCH_SERVER_VALUE), &vbRequests, &vstRequestSizes) &&
+			InitializeBenchEngine(&deEngine, 0));
+		ProcessAll(&deEngine, vbDiscovers, vstDiscoverSizes);
+		return TimeEngine(&deEngine, vbRequests, vstRequestSizes, qwIterations, DHCPMessageType_ACK);
+	} });
+
+	// Every REQUEST again, as retransmissions: the reply cache (room for the
+	// OFFERs and the ACKs) answers them without decoding the options or
+	// touching the lease table. Cycling through every client, both this and
+	// REQUEST->ACK mostly wait on cache misses.
+	pvbBenchmarks->push_back({ "DhcpEngine/REQUEST->ACK/retransmitted", [](const uint64_t qwIterations)
+	{
+		std::vector<uint8_t> vbDiscovers;
+		std::vector<size_t> vstDiscoverSizes;
+		std::vector<uint8_t> vbRequests;
+		std::vector<size_t> vstRequestSizes;
+		DhcpEngine deEngine;
+		VERIFY(BuildClientMessages(DHCPMessageType_DISCOVER, 0, &vbDiscovers, &vstDiscoverSizes) &&
+			BuildClientMessages(DHCPMessageType_REQUEST, ValueToAddr(BENCH_SERVER_VALUE), &vbRequests, &vstRequestSizes) &&
+			InitializeBenchEngine(&deEngine, 0) && deEngine.EnableReplyCache(2 * BENCH_CLIENT_COUNT));
+		ProcessAll(&deEngine, vbDiscovers, vstDiscoverSizes);
+		ProcessAll(&deEngine, vbRequests, vstRequestSizes);
+		return TimeEngine(&deEngine, vbRequests, vstRequestSizes, qwIterations, DHCPMessageType_ACK);
+	} });
+
+	// Same, with router, three DNS servers, a domain name and MTU in the reply
+	// template: the extra options are encoded once, not per reply
+	pvbBenchmarks->push_back({ "DhcpEngine/REQUEST->ACK/scope-options", [](const uint64_t qwIterations)
+	{
+		std::vector<uint8_t> vbDiscovers;
+		std::vector<size_t> vstDiscoverSizes;
+		std::vector<uint8_t> vbRequests;
+		std::vector<size_t> vstRequestSizes;
+		DhcpEngine deEngine;
+		DhcpScopeOptions dsoOptions;
+		DhcpReplyTemplate::ClearScopeOptions(&dsoOptions);
+		dsoOptions.dwRouter = ValueToAddr(BENCH_SERVER_VALUE);
+		dsoOptions.iDnsServerCount = DHCP_SCOPE_MAX_DNS_SERVERS;
+		for (unsigned int i = 0; i < dsoOptions.iDnsServerCount; i++)
+		{
+			dsoOptions.pdwDnsServers[i] = ValueToAddr(BENCH_SERVER_VALUE + i);
+		}
+		strcpy(dsoOptions.pcsDomainName, "bench.example");
+		dsoOptions.wInterfaceMtu = 1500;
+		VERIFY(BuildClientMessages(DHCPMessageType_DISCOVER, 0, &vbDiscovers, &vstDiscoverSizes) &&
+			BuildClientMessages(DHCPMessageType_REQUEST, ValueToAddr(BENCH_SERVER_VALUE), &vbRequests, &vstRequestSizes) &&
+			InitializeBenchEngine(&deEngine, &dsoOptions));
+		ProcessAll(&deEngine, vbDiscovers, vstDiscoverSizes);
+		return TimeEngine(&deEngine, vbRequests, vstRequestSizes, qwIterations, DHCPMessageType_ACK);
+	} });
+
+	// Lease churn on a virtual clock: every iteration is a new client doing
+	// DISCOVER and REQUEST while the clock advances one second per
+	// BENCH_CHURN_RATE clients and expired leases are reclaimed. Past about
+	// 65k iterations the /16 pool only keeps up because expiry returns
+	// addresses to it (run with --min-time to push a million leases through).
+	pvbBenchmarks->push_back({ "DhcpEngine/DORA+expiry/churn", [](const uint64_t qwIterations)
+	{
+		uint8_t pbDiscover[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+		uint8_t pbRequest[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+		DHCPClientMessageFields dcmf;
+		MakeClient(0, &dcmf, DHCPMessageType_DISCOVER);
+		const size_t stDiscoverSize = BuildDHCPClientMessage(dcmf, pbDiscover, sizeof(pbDiscover));
+		MakeClient(0, &dcmf, DHCPMessageType_REQUEST);
+		dcmf.dwServerIdentifier = ValueToAddr(BENCH_SERVER_VALUE);
+		const size_t stRequestSize = BuildDHCPClientMessage(dcmf, pbRequest, sizeof(pbRequest));
+		DhcpEngine deEngine;
+		VERIFY((0 != stDiscoverSize) && (0 != stRequestSize) && InitializeBenchEngine(&deEngine, 0));
+		DhcpRequestInfo driRequest = { 0xffffffff, 0, 0, 0, false };
+		uint8_t pbReply[DHCP_REPLY_SIZE];
+		DhcpReplyInfo driReply;
+		uint64_t qwReplies = 0;
+		uint64_t qwExpired = 0;
+		const Clock::time_point tpStart = Clock::now();
+		for (uint64_t q = 0; q < qwIterations; q++)
+		{
+			if (0 == q % BENCH_CHURN_RATE)
+			{
+				driRequest.qwNow++;
+				qwExpired += deEngine.ExpireLeases(0, driRequest.qwNow);
+			}
+			SetClient(pbDiscover, (uint32_t)q);
+			SetClient(pbRequest, (uint32_t)q);
+			if (deEngine.ProcessRequest(pbDiscover, stDiscoverSize, driRequest, pbReply, sizeof(pbReply), &driReply))
+			{
+				qwReplies += pbReply[sizeof(DHCPMessage) + 2];
+			}
+			if (deEngine.ProcessRequest(pbRequest, stRequestSize, driRequest, pbReply, sizeof(pbReply), &driReply))
+			{
+				qwReplies += pbReply[sizeof(DHCPMessage) + 2];
+			}
+		}
+		const double dNs = ElapsedNs(tpStart);
+		if ((uint64_t)(DHCPMessageType_OFFER + DHCPMessageType_ACK) * qwIterations != qwReplies)
+		{
+			fprintf(stderr, "Unexpected replies from the engine.\n");
+			exit(1);
+		}
+		qwSink = qwSink + qwExpired;
+		return dNs;
+	} });
+}
+
+static void AddAllocationBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	static const unsigned int piFillPercents[] = { 0, 50, 90, 99 };
+	for (size_t i = 0; i < 2 * ARRAY_LENGTH(piFillPercents); i++)
+	{
+		const unsigned int iFillPercent = piFillPercents[i % ARRAY_LENGTH(piFillPercents)];
+		const AddressPoolPolicy appPolicy = (i < ARRAY_LENGTH(piFillPercents)) ? AddressPool_ROUND_ROBIN : AddressPool_HASHED;
+		// A /16 pool with addresses taken at random; each operation claims a
+		// free address (for a new client hash) and releases it again so the fill level holds
+		pvbBenchmarks->push_back({ std::string((AddressPool_HASHED == appPolicy) ? "AddressPool::Allocate+MarkFree/hashed/fill:" : "AddressPool::Allocate+MarkFree/fill:") + std::to_string(iFillPercent), [iFillPercent, appPolicy](const uint64_t qwIterations)
+		{
+			AddressPool apPool;
+			VERIFY(apPool.Initialize(BENCH_MIN_VALUE, BENCH_MAX_VALUE));
+			apPool.SetPolicy(appPolicy);
+			const uint32_t dwTarget = (uint32_t)(((uint64_t)apPool.Size() * iFillPercent) / 100);
+			uint32_t dwRandom = 2463534242u;
+			while (apPool.Size() - apPool.FreeCount() < dwTarget)
+			{
+				apPool.MarkInUse(BENCH_MIN_VALUE + (NextRandom(&dwRandom) % apPool.Size()));
+			}
+			uint64_t qwAddrs = 0;
+			const Clock::time_point tpStart = Clock::now();
+			for (uint64_t q = 0; q < qwIterations; q++)
+			{
+				uint32_t dwAddrValue;
+				if (apPool.Allocate(NextRandom(&dwRandom), &dwAddrValue))
+				{
+					apPool.MarkFree(dwAddrValue);
+					qwAddrs += dwAddrValue;
+				}
+			}
+			const double dNs = ElapsedNs(tpStart);
+			qwSink = qwSink + qwAddrs;
+			return dNs;
+		} });
+	}
+}
+
+static void AddLeaseLookupBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	static const uint32_t pdwLeaseCounts[] = { 1000, 10000, 65000 };
+	for (size_t i = 0; i < ARRAY_LENGTH(pdwLeaseCounts); i++)
+	{
+		const uint32_t dwLeaseCount = pdwLeaseCounts[i];
+		// chaddr-sized identifiers, looked up in a scattered order
+		pvbBenchmarks->push_back({ "LeaseTable::FindByClientIdentifier/leases:" + std::to_string(dwLeaseCount), [dwLeaseCount](const uint64_t qwIterations)
+		{
+			std::vector<uint8_t> vbIdentifiers((size_t)dwLeaseCount * 16, 0);
+			LeaseTable ltLeases;
+			VERIFY(ltLeases.Initialize(BENCH_MIN_VALUE, BENCH_MIN_VALUE + dwLeaseCount - 1));
+			for (uint32_t j = 0; j < dwLeaseCount; j++)
+			{
+				uint8_t* const pb = &vbIdentifiers[(size_t)j * 16];
+				pb[0] = 0x02;
+				pb[3] = (uint8_t)(j >> 16);
+				pb[4] = (uint8_t)(j >> 8);
+				pb[5] = (uint8_t)j;
+				VERIFY(ltLeases.Add(BENCH_MIN_VALUE + j, pb, 16));
+			}
+			uint64_t qwFound = 0;
+			uint32_t dwRandom = 2463534242u;
+			const Clock::time_point tpStart = Clock::now();
+			for (uint64_t q = 0; q < qwIterations; q++)
+			{
+				const uint32_t j = NextRandom(&dwRandom) % dwLeaseCount;
+				qwFound += (uint64_t)ltLeases.FindByClientIdentifier(&vbIdentifiers[(size_t)j * 16], 16);
+			}
+			const double dNs = ElapsedNs(tpStart);
+			qwSink = qwSink + qwFound;
+			return dNs;
+		} });
+	}
+}
+
+static void AddScopeLookupBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	static const uint32_t pdwScopeCounts[] = { 10, 1000, 10000 };
+	for (size_t i = 0; i < ARRAY_LENGTH(pdwScopeCounts); i++)
+	{
+		const uint32_t dwScopeCount = pdwScopeCounts[i];
+		// Relayed /24s spread over 10.0.0.0/8 with a /16 covering some of
+		// them, looked up by a random address inside one of the /24s
+		pvbBenchmarks->push_back({ "ScopeTable::Find/scopes:" + std::to_string(dwScopeCount), [dwScopeCount](const uint64_t qwIterations)
+		{
+			ScopeTable sctSubnets;
+			VERIFY(sctSubnets.Insert(0x0a000000, 16, dwScopeCount));
+			for (uint32_t j = 0; j < dwScopeCount; j++)
+			{
+				VERIFY(sctSubnets.Insert(0x0a000000 | ((j * 40503u) & 0xffff00), 24, j));
+			}
+			uint64_t qwFound = 0;
+			uint32_t dwRandom = 2463534242u;
+			const Clock::time_point tpStart = Clock::now();
+			for (uint64_t q = 0; q < qwIterations; q++)
+			{
+				const uint32_t dwRandomValue = NextRandom(&dwRandom);
+				qwFound += (uint64_t)sctSubnets.Find(0x0a000000 | (((dwRandomValue % dwScopeCount) * 40503u) & 0xffff00) | (dwRandomValue >> 24));
+			}
+			const double dNs = ElapsedNs(tpStart);
+			qwSink = qwSink + qwFound;
+			return dNs;
+		} });
+	}
+}
+
+static void AddReservationLookupBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	static const uint32_t pdwReservationCounts[] = { 1000, 10000, 100000 };
+	for (size_t i = 0; i < ARRAY_LENGTH(pdwReservationCounts); i++)
+	{
+		const uint32_t dwReservationCount = pdwReservationCounts[i];
+		// Reserved MACs looked up in a scattered order; every other lookup is
+		// for a MAC without a reservation (the common case), which must miss
+		pvbBenchmarks->push_back({ "ReservationTable::Find/reservations:" + std::to_string(dwReservationCount), [dwReservationCount](const uint64_t qwIterations)
+		{
+			// Even MACs are reserved, odd ones are not
+			std::vector<uint8_t> vbMacs((size_t)dwReservationCount * 2 * 6, 0);
+			ReservationTable rtReservations;
+			for (uint32_t j = 0; j < 2 * dwReservationCount; j++)
+			{
+				uint8_t* const pb = &vbMacs[(size_t)j * 6];
+				pb[0] = 0x02;
+				pb[1] = (uint8_t)(j & 1);
+				pb[3] = (uint8_t)(j >> 17);
+				pb[4] = (uint8_t)(j >> 9);
+				pb[5] = (uint8_t)(j >> 1);
+				if (0 == (j & 1))
+				{
+					VERIFY(rtReservations.AddReservation(ReservationKey_HARDWARE_ADDRESS, pb, 6, ValueToAddr(BENCH_MIN_VALUE + j)));
+				}
+			}
+			VERIFY(rtReservations.Build());
+			uint64_t qwFound = 0;
+			uint32_t dwRandom = 2463534242u;
+			const Clock::time_point tpStart = Clock::now();
+			for (uint64_t q = 0; q < qwIterations; q++)
+			{
+				const uint32_t j = NextRandom(&dwRandom) % (2 * dwReservationCount);
+				uint32_t dwAddr;
+				qwFound += rtReservations.Find(ReservationKey_HARDWARE_ADDRESS, &vbMacs[(size_t)j * 6], 6, &dwAddr) ? dwAddr : 0;
+			}
+			const double dNs = ElapsedNs(tpStart);
+			qwSink = qwSink + qwFound;
+			return dNs;
+		} });
+	}
+}
+
+static void AddAdmissionBenchmarks(std::vector<Benchmark>* const pvbBenchmarks)
+{
+	// A flood of random chaddrs at 100k requests per virtual second: every
+	// one is counted in the sketch and charged to the link's bucket
+	pvbBenchmarks->push_back({ "AdmissionControl::Admit/random-chaddr", [](const uint64_t qwIterations)
+	{
+		AdmissionControl acAdmission;
+		VERIFY(acAdmission.Initialize());
+		const DhcpAdmissionLimits dalLimits = { 10, 20, 1000, 1000 };
+		uint8_t pbRequest[sizeof(DHCPMessage)];
+		memset(pbRequest, 0, sizeof(pbRequest));
+		DHCPMessage* const pdhcpmRequest = (DHCPMessage*)pbRequest;
+		uint32_t dwRandom = 2463534242u;
+		uint64_t qwAdmitted = 0;
+		const Clock::time_point tpStart = Clock::now();
+		for (uint64_t q = 0; q < qwIterations; q++)
+		{
+			const uint32_t dwChaddr = NextRandom(&dwRandom);
+			memcpy(&pdhcpmRequest->chaddr[2], &dwChaddr, sizeof(dwChaddr));
+			qwAdmitted += (Admission_ADMIT == acAdmission.Admit(*pdhcpmRequest, 1, q / 100000, dalLimits)) ? 1 : 0;
+		}
+		const double dNs = ElapsedNs(tpStart);
+		qwSink = qwSink + qwAdmitted;
+		return dNs;
+	} });
+
+	// One client flooding DISCOVERs through the engine: after its burst,
+	// each is dropped before the options are decoded or the shard is locked
+	pvbBenchmarks->push_back({ "DhcpEngine/DISCOVER/rate-limited", [](const uint64_t qwIterations)
+	{
+		uint8_t pbDiscover[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+		DHCPClientMessageFields dcmf;
+		MakeClient(0, &dcmf, DHCPMessageType_DISCOVER);
+		const size_t stDiscoverSize = BuildDHCPClientMessage(dcmf, pbDiscover, sizeof(pbDiscover));
+		DhcpEngine deEngine;
+		const DhcpAdmissionLimits dalLimits = { 10, 20, 0, 0 };
+		VERIFY((0 != stDiscoverSize) && InitializeBenchEngine(&deEngine, 0) && deEngine.EnableAdmissionControl(dalLimits));
+		DhcpRequestInfo driRequest = { 0xffffffff, 0, 0, 0, false };
+		uint8_t pbReply[DHCP_REPLY_SIZE];
+		DhcpReplyInfo driReply;
+		uint64_t qwReplies = 0;
+		const Clock::time_point tpStart = Clock::now();
+		for (uint64_t q = 0; q < qwIterations; q++)
+		{
+			qwReplies += deEngine.ProcessRequest(pbDiscover, stDiscoverSize, driRequest, pbReply, sizeof(pbReply), &driReply) ? 1 : 0;
+		}
+		const double dNs = ElapsedNs(tpStart);
+		// The burst and one second's worth of tokens
+		if (std::min<uint64_t>(qwIterations, 30) != qwReplies)
+		{
+			fprintf(stderr, "Unexpected replies from the engine.\n");
+			exit(1);
+		}
+		qwSink = qwSink + qwReplies;
+		return dNs;
+	} });
+}
+
+// Grows the iteration count until one run takes at least dMinTimeNs
+static uint64_t Calibrate(const BenchmarkFunction& rbfRun, const double dMinTimeNs)
+{
+	uint64_t qwIterations = 1;
+	for (;;)
+	{
+		const double dNs = rbfRun(qwIterations);
+		if (dMinTimeNs <= dNs)
+		{
+			return qwIterations;
+		}
+		// Aim 20% past the target, growing at most 10x per step
+		const double dScale = (dNs <= 0) ? 10.0 : std::min(10.0, std::max(1.5, 1.2 * dMinTimeNs / dNs));
+		qwIterations = (uint64_t)(qwIterations * dScale) + 1;
+	}
+}
+
+static void WriteJson(FILE* const pf, const std::vector<BenchmarkResult>& rvbrResults)
+{
+	char pcsDate[64];
+	const time_t tNow = time(0);
+	strftime(pcsDate, sizeof(pcsDate), "%Y-%m-%dT%H:%M:%S%z", localtime(&tNow));
+	fprintf(pf, "{\n  \"context\": {\n");
+	fprintf(pf, "    \"date\": \"%s\",\n", pcsDate);
+	fprintf(pf, "    \"executable\": \"DHCPLiteBench\",\n");
+	fprintf(pf, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#if defined(NDEBUG)
+	fprintf(pf, "    \"library_build_type\": \"release\"\n");
+#else  // defined(NDEBUG)
+	fprintf(pf, "    \"library_build_type\": \"debug\"\n");
+#endif  // defined(NDEBUG)
+	fprintf(pf, "  },\n  \"benchmarks\": [");
+	bool bFirst = true;
+	for (size_t i = 0; i < rvbrResults.size(); i++)
+	{
+		const BenchmarkResult& rbr = rvbrResults[i];
+		const size_t stRepetitions = rbr.vdNsPerOp.size();
+		for (size_t r = 0; r < stRepetitions; r++)
+		{
+			fprintf(pf, "%s\n    {\"name\": \"%s\", \"run_name\": \"%s\", \"run_type\": \"iteration\", \"repetitions\": %u, \"repetition_index\": %u, \"iterations\": %llu, \"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\"}",
+				bFirst ? "" : ",", rbr.strName.c_str(), rbr.strName.c_str(), (unsigned int)stRepetitions, (unsigned int)r, (unsigned long long)rbr.qwIterations, rbr.vdNsPerOp[r], rbr.vdNsPerOp[r]);
+			bFirst = false;
+		}
+		std::vector<double> vdSorted(rbr.vdNsPerOp);
+		std::sort(vdSorted.begin(), vdSorted.end());
+		double dSum = 0;
+		for (size_t r = 0; r < stRepetitions; r++)
+		{
+			dSum += vdSorted[r];
+		}
+		const double pdAggregates[] = { dSum / stRepetitions, vdSorted[stRepetitions / 2], vdSorted[0] };
+		const char* const ppcsAggregates[] = { "mean", "median", "min" };
+		for (size_t a = 0; a < ARRAY_LENGTH(pdAggregates); a++)
+		{
+			fprintf(pf, ",\n    {\"name\": \"%s_%s\", \"run_name\": \"%s\", \"run_type\": \"aggregate\", \"aggregate_name\": \"%s\", \"repetitions\": %u, \"iterations\": %llu, \"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\"}",
+				rbr.strName.c_str(), ppcsAggregates[a], rbr.strName.c_str(), ppcsAggregates[a], (unsigned int)stRepetitions, (unsigned long long)rbr.qwIterations, pdAggregates[a], pdAggregates[a]);
+		}
+	}
+	fprintf(pf, "\n  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* pcsFilter = "";
+	const char* pcsOutput = 0;
+	double dMinTime = 0.5;
+	unsigned int iRepetitions = 5;
+	for (int i = 1; i < argc; i++)
+	{
+		if ((0 == strcmp(argv[i], "--filter")) && (i + 1 < argc))
+		{
+			pcsFilter = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i], "--min-time")) && (i + 1 < argc))
+		{
+			dMinTime = atof(argv[++i]);
+		}
+		else if ((0 == strcmp(argv[i], "--repetitions")) && (i + 1 < argc))
+		{
+			iRepetitions = (unsigned int)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--out")) && (i + 1 < argc))
+		{
+			pcsOutput = argv[++i];
+		}
+		else
+		{
+			iRepetitions = 0;
+			break;
+		}
+	}
+	if ((0 == iRepetitions) || !(0 < dMinTime))
+	{
+		fprintf(stderr, "Usage: %s [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N] [--out FILE]\n", argv[0]);
+		return -1;
+	}
+
+	std::vector<Benchmark> vbBenchmarks;
+	AddOptionBenchmarks(&vbBenchmarks);
+	AddEngineBenchmarks(&vbBenchmarks);
+	AddAllocationBenchmarks(&vbBenchmarks);
+	AddLeaseLookupBenchmarks(&vbBenchmarks);
+	AddScopeLookupBenchmarks(&vbBenchmarks);
+	AddReservationLookupBenchmarks(&vbBenchmarks);
+	AddAdmissionBenchmarks(&vbBenchmarks);
+
+	std::vector<BenchmarkResult> vbrResults;
+	for (size_t i = 0; i < vbBenchmarks.size(); i++)
+	{
+		const Benchmark& rb = vbBenchmarks[i];
+		if (std::string::npos == rb.strName.find(pcsFilter))
+		{
+			continue;
+		}
+		BenchmarkResult br;
+		br.strName = rb.strName;
+		br.qwIterations = Calibrate(rb.bfRun, dMinTime * 1e9);
+		for (unsigned int r = 0; r < iRepetitions; r++)
+		{
+			br.vdNsPerOp.push_back(rb.bfRun(br.qwIterations) / br.qwIterations);
+		}
+		std::vector<double> vdSorted(br.vdNsPerOp);
+		std::sort(vdSorted.begin(), vdSorted.end());
+		fprintf(stderr, "%-52s %12.1f ns/op (median of %u, %llu iterations)\n", rb.strName.c_str(), vdSorted[vdSorted.size() / 2], iRepetitions, (unsigned long long)br.qwIterations);
+		vbrResults.push_back(br);
+	}
+
+	FILE* pf = stdout;
+	if ((0 != pcsOutput) && (0 == (pf = fopen(pcsOutput, "w"))))
+	{
+		fprintf(stderr, "Unable to open %s.\n", pcsOutput);
+		return -1;
+	}
+	WriteJson(pf, vbrResults);
+	if (stdout != pf)
+	{
+		fclose(pf);
+	}
+	return 0;
+}
@@ -0,0 +1,579 @@
+// DORA load generator: plays many synthetic DHCP clients against a server
+//
+// Usage: DHCPLiteLoadGen [--server ADDR] [--interface NAME] [--clients N] [--concurrency N]
+//                        [--timeout MS] [--retries N] [--renewals N] [--renew-unicast] [--rapid-commit]
+//                        [--unicast-replies] [--json FILE]
+//
+// Each client has its own chaddr and option 61 and runs DISCOVER/OFFER/
+// REQUEST/ACK, followed by --renewals REQUEST/ACK renewals. At most
+// --concurrency clients are waiting for a reply at any time; unanswered
+// messages are retransmitted after --timeout ms, doubling each time (RFC 2131
+// section 4.1), up to --retries times. With --rapid-commit the DISCOVER
+// carries option 80 and an ACK to it completes the join in two messages
+// (RFC 4039); an OFFER still leads to the usual REQUEST.
+//
+// Replies arrive on port 68, so run it as root on the server host (loopback)
+// or on the far end of a veth pair (--interface). By default a renewal is an
+// INIT-REBOOT style REQUEST whose ACK is broadcast; --renew-unicast sends a
+// RENEWING REQUEST (ciaddr set) whose ACK goes to the leased address, which
+// only reaches this host when the pool subnet is routed to it locally (for
+// example "ip route add local 192.0.2.0/24 dev veth1").
+//
+// --unicast-replies clears the broadcast flag and puts the hardware address of
+// --interface in every client's chaddr (option 61 still tells them apart), so
+// a server that unicasts to chaddr (DHCPLite --raw) sends each OFFER and ACK
+// to this host's MAC and the leased address; with the same local route, they
+// arrive here without being broadcast.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <vector>
+#include "ToolBox.h"
+#include "DHCPClientMessage.h"
+
+// Clients are numbered in the low 24 bits of the xid
+#define MAX_CLIENT_COUNT (1 << 24)
+#define CLIENT_INDEX_MASK (MAX_CLIENT_COUNT - 1)
+// Datagrams drained per recvmmsg
+#define RECEIVE_BATCH_SIZE (64)
+#define RECEIVE_BUFFER_SIZE (1500)
+
+enum ClientStates
+{
+	ClientState_IDLE,
+	ClientState_SELECTING,  // DISCOVER sent
+	ClientState_REQUESTING,  // REQUEST sent for an offer
+	ClientState_BOUND,
+	ClientState_RENEWING,  // Renewal REQUEST sent
+	ClientState_DONE,
+	ClientState_FAILED,
+};
+
+struct ClientInformation
+{
+	uint8_t bState;
+	uint8_t bGeneration;  // Bumped per transaction so late replies are recognized
+	uint16_t wAttempt;  // Transmissions of the current message - 1
+	uint32_t dwXid;
+	uint32_t dwLeasedAddr;  // Network order
+	uint32_t dwServerIdentifier;  // Network order
+	uint32_t dwRenewalsLeft;
+	int64_t qwMessageStartNs;  // First transmission of the current message
+	int64_t qwDoraStartNs;
+};
+
+struct Retransmission
+{
+	int64_t qwDeadlineNs;
+	uint32_t dwClient;
+	uint32_t dwXid;
+	uint16_t wAttempt;
+	bool operator>(const Retransmission& rr) const { return qwDeadlineNs > rr.qwDeadlineNs; }
+};
+
+typedef std::chrono::steady_clock Clock;
+static inline int64_t NowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+class LoadGenerator
+{
+public:
+	// Configuration, set before Run
+	struct sockaddr_in m_saServer;
+	uint32_t m_dwClientCount;
+	uint32_t m_dwConcurrency;
+	uint32_t m_dwTimeoutMs;
+	uint32_t m_dwRetries;
+	uint32_t m_dwRenewals;
+	bool m_bRenewUnicast;
+	bool m_bRapidCommit;
+	bool m_bUnicastReplies;
+	uint8_t m_pbHardwareAddr[6];  // chaddr of every client with m_bUnicastReplies
+
+	// Results
+	std::vector<int64_t> m_vqwDiscoverNs;  // DISCOVER -> OFFER
+	std::vector<int64_t> m_vqwRequestNs;  // REQUEST -> ACK
+	std::vector<int64_t> m_vqwRenewNs;  // Renewal REQUEST -> ACK
+	std::vector<int64_t> m_vqwDoraNs;  // DISCOVER -> ACK (through REQUEST or not)
+	uint64_t m_qwSent;
+	uint64_t m_qwRetransmits;
+	uint64_t m_qwNaks;
+	uint64_t m_qwIgnored;  // Late, duplicate or unexpected replies
+	uint32_t m_dwFailed;  // Clients that gave up after m_dwRetries
+	double m_dElapsedSeconds;
+
+	LoadGenerator();
+	bool Run(const int iSocket);
+
+private:
+	void StartTransaction(const uint32_t dwClient);
+	void Send(const uint32_t dwClient);
+	void HandleReply(const uint8_t* const pbReply, const size_t stSize);
+	void Finish(const uint32_t dwClient, const ClientStates csState);
+
+	int m_iSocket;
+	std::vector<ClientInformation> m_vciClients;
+	std::deque<uint32_t> m_dqReady;  // Clients waiting for a concurrency slot
+	std::priority_queue<Retransmission, std::vector<Retransmission>, std::greater<Retransmission> > m_pqRetransmissions;
+	uint32_t m_dwInFlight;
+	uint32_t m_dwFinished;
+};
+
+LoadGenerator::LoadGenerator()
+	: m_dwClientCount(1000), m_dwConcurrency(64), m_dwTimeoutMs(1000), m_dwRetries(3), m_dwRenewals(0), m_bRenewUnicast(false), m_bRapidCommit(false), m_bUnicastReplies(false),
+	m_qwSent(0), m_qwRetransmits(0), m_qwNaks(0), m_qwIgnored(0), m_dwFailed(0), m_dElapsedSeconds(0),
+	m_iSocket(-1), m_dwInFlight(0), m_dwFinished(0)
+{
+	memset(&m_saServer, 0, sizeof(m_saServer));
+	m_saServer.sin_family = AF_INET;
+	m_saServer.sin_port = htons(DHCP_SERVER_PORT);
+	m_saServer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	memset(m_pbHardwareAddr, 0, sizeof(m_pbHardwareAddr));
+}
+
+// A new xid for the client's next exchange (a DORA or a renewal)
+void LoadGenerator::StartTransaction(const uint32_t dwClient)
+{
+	ClientInformation& rci = m_vciClients[dwClient];
+	if (0 == ++rci.bGeneration)
+	{
+		rci.bGeneration = 1;  // An xid of 0 marks a finished exchange
+	}
+	rci.dwXid = (((uint32_t)rci.bGeneration) << 24) | dwClient;
+	rci.wAttempt = 0;
+	rci.qwMessageStartNs = NowNs();
+	if (ClientState_BOUND == rci.bState)
+	{
+		rci.bState = ClientState_RENEWING;
+	}
+	else
+	{
+		rci.bState = ClientState_SELECTING;
+		rci.qwDoraStartNs = rci.qwMessageStartNs;
+	}
+	m_dwInFlight++;
+	Send(dwClient);
+}
+
+void LoadGenerator::Send(const uint32_t dwClient)
+{
+	const ClientInformation& rci = m_vciClients[dwClient];
+	uint8_t pbClientIdentifier[7] = { 1, 0x02, 0x4c, 0x47, (uint8_t)(dwClient >> 16), (uint8_t)(dwClient >> 8), (uint8_t)dwClient };
+	char pcsHostName[16];
+	snprintf(pcsHostName, sizeof(pcsHostName), "lg%u", dwClient);
+	DHCPClientMessageFields dcmf;
+	memset(&dcmf, 0, sizeof(dcmf));
+	dcmf.dwXid = rci.dwXid;
+	memcpy(dcmf.pbChaddr, m_bUnicastReplies ? m_pbHardwareAddr : (pbClientIdentifier + 1), sizeof(dcmf.pbChaddr));
+	dcmf.pbClientIdentifier = pbClientIdentifier;
+	dcmf.stClientIdentifierSize = sizeof(pbClientIdentifier);
+	dcmf.pcsHostName = pcsHostName;
+	dcmf.bBroadcast = !m_bUnicastReplies;
+	switch (rci.bState)
+	{
+	case ClientState_SELECTING:
+		dcmf.dhcpmtMessageType = DHCPMessageType_DISCOVER;
+		dcmf.bRapidCommit = m_bRapidCommit;
+		break;
+	case ClientState_REQUESTING:
+		dcmf.dhcpmtMessageType = DHCPMessageType_REQUEST;
+		dcmf.dwRequestedAddr = rci.dwLeasedAddr;
+		dcmf.dwServerIdentifier = rci.dwServerIdentifier;
+		break;
+	case ClientState_RENEWING:
+		dcmf.dhcpmtMessageType = DHCPMessageType_REQUEST;
+		if (m_bRenewUnicast)
+		{
+			dcmf.dwCiaddr = rci.dwLeasedAddr;
+			dcmf.bBroadcast = false;
+		}
+		else
+		{
+			dcmf.dwRequestedAddr = rci.dwLeasedAddr;
+		}
+		break;
+	default:
+		ASSERT(!"Invalid ClientState");
+		return;
+	}
+	uint8_t pbMessage[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+	const size_t stSize = BuildDHCPClientMessage(dcmf, pbMessage, sizeof(pbMessage));
+	ASSERT(0 != stSize);
+	while ((ssize_t)stSize != sendto(m_iSocket, pbMessage, stSize, 0, (const struct sockaddr*)&m_saServer, sizeof(m_saServer)))
+	{
+		if ((EAGAIN != errno) && (ENOBUFS != errno) && (EINTR != errno))
+		{
+			break;  // Treated like a lost datagram
+		}
+	}
+	m_qwSent++;
+	// RFC 2131 section 4.1: exponential backoff between retransmissions
+	Retransmission r;
+	r.qwDeadlineNs = NowNs() + (((int64_t)m_dwTimeoutMs * 1000000) << std::min<uint16_t>(rci.wAttempt, 16));
+	r.dwClient = dwClient;
+	r.dwXid = rci.dwXid;
+	r.wAttempt = rci.wAttempt;
+	m_pqRetransmissions.push(r);
+}
+
+void LoadGenerator::Finish(const uint32_t dwClient, const ClientStates csState)
+{
+	m_vciClients[dwClient].bState = (uint8_t)csState;
+	m_dwInFlight--;
+	m_dwFinished++;
+}
+
+void LoadGenerator::HandleReply(const uint8_t* const pbReply, const size_t stSize)
+{
+	DHCPMessageTypes dhcpmtMessageType;
+	uint32_t dwXid;
+	uint32_t dwYiaddr;
+	uint32_t dwServerIdentifier;
+	if (!ParseDHCPServerReply(pbReply, stSize, &dhcpmtMessageType, &dwXid, &dwYiaddr, &dwServerIdentifier))
+	{
+		m_qwIgnored++;
+		return;
+	}
+	const uint32_t dwClient = dwXid & CLIENT_INDEX_MASK;
+	if ((m_dwClientCount <= dwClient) || (m_vciClients[dwClient].dwXid != dwXid))
+	{
+		m_qwIgnored++;
+		return;
+	}
+	ClientInformation& rci = m_vciClients[dwClient];
+	const int64_t qwNow = NowNs();
+	if ((ClientState_SELECTING == rci.bState) && (DHCPMessageType_OFFER == dhcpmtMessageType))
+	{
+		m_vqwDiscoverNs.push_back(qwNow - rci.qwMessageStartNs);
+		// REQUEST keeps the xid of the DISCOVER (RFC 2131 section 4.4.1)
+		rci.bState = ClientState_REQUESTING;
+		rci.dwLeasedAddr = dwYiaddr;
+		rci.dwServerIdentifier = dwServerIdentifier;
+		rci.wAttempt = 0;
+		rci.qwMessageStartNs = qwNow;
+		Send(dwClient);
+	}
+	else if (((ClientState_REQUESTING == rci.bState) || (ClientState_RENEWING == rci.bState) || ((ClientState_SELECTING == rci.bState) && m_bRapidCommit)) &&
+		(DHCPMessageType_ACK == dhcpmtMessageType))
+	{
+		if (ClientState_REQUESTING == rci.bState)
+		{
+			m_vqwRequestNs.push_back(qwNow - rci.qwMessageStartNs);
+			m_vqwDoraNs.push_back(qwNow - rci.qwDoraStartNs);
+		}
+		else if (ClientState_SELECTING == rci.bState)
+		{
+			// Rapid Commit: the DISCOVER was the whole exchange
+			rci.dwLeasedAddr = dwYiaddr;
+			rci.dwServerIdentifier = dwServerIdentifier;
+			m_vqwDoraNs.push_back(qwNow - rci.qwDoraStartNs);
+		}
+		else
+		{
+			m_vqwRenewNs.push_back(qwNow - rci.qwMessageStartNs);
+			rci.dwRenewalsLeft--;
+		}
+		rci.dwXid = 0;  // Anything else for this exchange is late
+		if (0 == rci.dwRenewalsLeft)
+		{
+			Finish(dwClient, ClientState_DONE);
+		}
+		else
+		{
+			rci.bState = ClientState_BOUND;
+			m_dwInFlight--;
+			m_dqReady.push_back(dwClient);
+		}
+	}
+	else if (((ClientState_REQUESTING == rci.bState) || (ClientState_RENEWING == rci.bState)) && (DHCPMessageType_NAK == dhcpmtMessageType))
+	{
+		// Back to INIT (RFC 2131 section 3.1)
+		m_qwNaks++;
+		rci.bState = ClientState_IDLE;
+		rci.dwXid = 0;
+		m_dwInFlight--;
+		m_dqReady.push_back(dwClient);
+	}
+	else
+	{
+		m_qwIgnored++;
+	}
+}
+
+bool LoadGenerator::Run(const int iSocket)
+{
+	ASSERT((1 <= m_dwClientCount) && (m_dwClientCount <= MAX_CLIENT_COUNT) && (1 <= m_dwConcurrency));
+	m_iSocket = iSocket;
+	ClientInformation ciInitial;
+	memset(&ciInitial, 0, sizeof(ciInitial));
+	ciInitial.bState = ClientState_IDLE;
+	ciInitial.dwRenewalsLeft = m_dwRenewals;
+	m_vciClients.assign(m_dwClientCount, ciInitial);
+	for (uint32_t i = 0; i < m_dwClientCount; i++)
+	{
+		m_dqReady.push_back(i);
+	}
+	m_vqwDiscoverNs.reserve(m_dwClientCount);
+	m_vqwRequestNs.reserve(m_dwClientCount);
+	m_vqwDoraNs.reserve(m_dwClientCount);
+	m_vqwRenewNs.reserve((size_t)m_dwClientCount * m_dwRenewals);
+
+	std::vector<uint8_t> vbBuffers((size_t)RECEIVE_BATCH_SIZE * RECEIVE_BUFFER_SIZE);
+	struct mmsghdr pmmh[RECEIVE_BATCH_SIZE];
+	struct iovec piov[RECEIVE_BATCH_SIZE];
+	const int64_t qwStartNs = NowNs();
+	while (m_dwFinished < m_dwClientCount)
+	{
+		while ((m_dwInFlight < m_dwConcurrency) && !m_dqReady.empty())
+		{
+			const uint32_t dwClient = m_dqReady.front();
+			m_dqReady.pop_front();
+			StartTransaction(dwClient);
+		}
+		int iTimeoutMs = 100;
+		if (!m_pqRetransmissions.empty())
+		{
+			const int64_t qwWaitNs = m_pqRetransmissions.top().qwDeadlineNs - NowNs();
+			iTimeoutMs = (qwWaitNs <= 0) ? 0 : (int)std::min<int64_t>(100, (qwWaitNs + 999999) / 1000000);
+		}
+		struct pollfd pfd;
+		pfd.fd = m_iSocket;
+		pfd.events = POLLIN;
+		if (0 < poll(&pfd, 1, iTimeoutMs))
+		{
+			for (;;)
+			{
+				for (unsigned int i = 0; i < RECEIVE_BATCH_SIZE; i++)
+				{
+					piov[i].iov_base = &vbBuffers[(size_t)i * RECEIVE_BUFFER_SIZE];
+					piov[i].iov_len = RECEIVE_BUFFER_SIZE;
+					memset(&pmmh[i], 0, sizeof(pmmh[i]));
+					pmmh[i].msg_hdr.msg_iov = &piov[i];
+					pmmh[i].msg_hdr.msg_iovlen = 1;
+				}
+				const int iReceived = recvmmsg(m_iSocket, pmmh, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, 0);
+				if (iReceived <= 0)
+				{
+					break;
+				}
+				for (int i = 0; i < iReceived; i++)
+				{
+					HandleReply((const uint8_t*)piov[i].iov_base, pmmh[i].msg_len);
+				}
+			}
+		}
+		const int64_t qwNow = NowNs();
+		while (!m_pqRetransmissions.empty() && (m_pqRetransmissions.top().qwDeadlineNs <= qwNow))
+		{
+			const Retransmission r = m_pqRetransmissions.top();
+			m_pqRetransmissions.pop();
+			ClientInformation& rci = m_vciClients[r.dwClient];
+			if ((rci.dwXid != r.dwXid) || (rci.wAttempt != r.wAttempt) ||
+				((ClientState_SELECTING != rci.bState) && (ClientState_REQUESTING != rci.bState) && (ClientState_RENEWING != rci.bState)))
+			{
+				continue;  // Answered since
+			}
+			if (m_dwRetries <= rci.wAttempt)
+			{
+				rci.dwXid = 0;
+				m_dwFailed++;
+				Finish(r.dwClient, ClientState_FAILED);
+				continue;
+			}
+			rci.wAttempt++;
+			m_qwRetransmits++;
+			Send(r.dwClient);
+		}
+	}
+	m_dElapsedSeconds = (NowNs() - qwStartNs) / 1e9;
+	return true;
+}
+
+// Nearest-rank percentile of an already sorted sample, in microseconds
+static double PercentileUs(const std::vector<int64_t>& rvqwSorted, const double dPercentile)
+{
+	if (rvqwSorted.empty())
+	{
+		return 0;
+	}
+	size_t stRank = (size_t)((dPercentile / 100.0) * rvqwSorted.size() + 0.999999);
+	stRank = std::max<size_t>(1, std::min(stRank, rvqwSorted.size()));
+	return rvqwSorted[stRank - 1] / 1000.0;
+}
+
+struct LatencyRow
+{
+	const char* pcsName;
+	std::vector<int64_t>* pvqwNs;
+};
+
+int main(int argc, char** argv)
+{
+	LoadGenerator lg;
+	const char* pcsInterface = 0;
+	const char* pcsJson = 0;
+	bool bUsage = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const bool bHasValue = (i + 1 < argc);
+		if ((0 == strcmp(argv[i], "--server")) && bHasValue)
+		{
+			bUsage |= (1 != inet_pton(AF_INET, argv[++i], &lg.m_saServer.sin_addr));
+		}
+		else if ((0 == strcmp(argv[i], "--interface")) && bHasValue)
+		{
+			pcsInterface = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i], "--clients")) && bHasValue)
+		{
+			lg.m_dwClientCount = (uint32_t)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--concurrency")) && bHasValue)
+		{
+			lg.m_dwConcurrency = (uint32_t)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--timeout")) && bHasValue)
+		{
+			lg.m_dwTimeoutMs = (uint32_t)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--retries")) && bHasValue)
+		{
+			lg.m_dwRetries = (uint32_t)strtoul(argv[++i], 0, 10);
+		}
+		else if ((0 == strcmp(argv[i], "--renewals")) && bHasValue)
+		{
+			lg.m_dwRenewals = (uint32_t)strtoul(argv[++i], 0, 10);
+		}
+		else if (0 == strcmp(argv[i], "--renew-unicast"))
+		{
+			lg.m_bRenewUnicast = true;
+		}
+		else if (0 == strcmp(argv[i], "--rapid-commit"))
+		{
+			lg.m_bRapidCommit = true;
+		}
+		else if (0 == strcmp(argv[i], "--unicast-replies"))
+		{
+			lg.m_bUnicastReplies = true;
+		}
+		else if ((0 == strcmp(argv[i], "--json")) && bHasValue)
+		{
+			pcsJson = argv[++i];
+		}
+		else
+		{
+			bUsage = true;
+		}
+	}
+	if (bUsage || (lg.m_bUnicastReplies && (0 == pcsInterface)) || (lg.m_dwClientCount < 1) || (MAX_CLIENT_COUNT < lg.m_dwClientCount) || (lg.m_dwConcurrency < 1) || (lg.m_dwTimeoutMs < 1) || (0xffff < lg.m_dwRetries))
+	{
+		fprintf(stderr, "Usage: %s [--server ADDR] [--interface NAME] [--clients 1-%d] [--concurrency N] [--timeout MS] [--retries N] [--renewals N] [--renew-unicast] [--rapid-commit] [--unicast-replies (needs --interface)] [--json FILE]\n", argv[0], MAX_CLIENT_COUNT);
+		return -1;
+	}
+
+	const int iSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (-1 == iSocket)
+	{
+		fprintf(stderr, "Unable to open client socket.\n");
+		return -1;
+	}
+	int iOption = 1;
+	int iBufferSize = 8 * 1024 * 1024;
+	setsockopt(iSocket, SOL_SOCKET, SO_REUSEADDR, &iOption, sizeof(iOption));
+	setsockopt(iSocket, SOL_SOCKET, SO_BROADCAST, &iOption, sizeof(iOption));
+	setsockopt(iSocket, SOL_SOCKET, SO_RCVBUF, &iBufferSize, sizeof(iBufferSize));
+	setsockopt(iSocket, SOL_SOCKET, SO_SNDBUF, &iBufferSize, sizeof(iBufferSize));
+	if ((0 != pcsInterface) && (0 != setsockopt(iSocket, SOL_SOCKET, SO_BINDTODEVICE, pcsInterface, (socklen_t)strlen(pcsInterface))))
+	{
+		fprintf(stderr, "Unable to bind to interface %s.\n", pcsInterface);
+		return -1;
+	}
+	if (lg.m_bUnicastReplies)
+	{
+		struct ifreq ifrInterface;
+		memset(&ifrInterface, 0, sizeof(ifrInterface));
+		strncpy(ifrInterface.ifr_name, pcsInterface, sizeof(ifrInterface.ifr_name) - 1);
+		if (0 != ioctl(iSocket, SIOCGIFHWADDR, &ifrInterface))
+		{
+			fprintf(stderr, "Unable to read the hardware address of %s.\n", pcsInterface);
+			return -1;
+		}
+		memcpy(lg.m_pbHardwareAddr, ifrInterface.ifr_hwaddr.sa_data, sizeof(lg.m_pbHardwareAddr));
+	}
+	struct sockaddr_in saClient;
+	memset(&saClient, 0, sizeof(saClient));
+	saClient.sin_family = AF_INET;
+	saClient.sin_port = htons(DHCP_CLIENT_PORT);
+	saClient.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (0 != bind(iSocket, (const struct sockaddr*)&saClient, sizeof(saClient)))
+	{
+		fprintf(stderr, "Unable to bind to client port %d (needs root).\n", DHCP_CLIENT_PORT);
+		return -1;
+	}
+
+	VERIFY(lg.Run(iSocket));
+	close(iSocket);
+
+	const uint64_t qwDoras = lg.m_vqwDoraNs.size();
+	const uint64_t qwRenewals = lg.m_vqwRenewNs.size();
+	printf("clients %u, concurrency %u, elapsed %.3f s\n", lg.m_dwClientCount, lg.m_dwConcurrency, lg.m_dElapsedSeconds);
+	printf("DORA completed %llu (%.1f/s), renewals %llu (%.1f/s), transactions %.1f/s, failed clients %u\n",
+		(unsigned long long)qwDoras, qwDoras / lg.m_dElapsedSeconds, (unsigned long long)qwRenewals, qwRenewals / lg.m_dElapsedSeconds,
+		(qwDoras + qwRenewals) / lg.m_dElapsedSeconds, lg.m_dwFailed);
+	printf("sent %llu (retransmits %llu), NAKs %llu, ignored replies %llu\n",
+		(unsigned long long)lg.m_qwSent, (unsigned long long)lg.m_qwRetransmits, (unsigned long long)lg.m_qwNaks, (unsigned long long)lg.m_qwIgnored);
+	LatencyRow plrRows[] =
+	{
+		{ "DISCOVER->OFFER", &lg.m_vqwDiscoverNs },
+		{ "REQUEST->ACK", &lg.m_vqwRequestNs },
+		{ "RENEW->ACK", &lg.m_vqwRenewNs },
+		{ "DORA", &lg.m_vqwDoraNs },
+	};
+	printf("%-16s %10s %10s %10s %10s %10s\n", "latency (us)", "p50", "p99", "p99.9", "max", "samples");
+	for (size_t i = 0; i < ARRAY_LENGTH(plrRows); i++)
+	{
+		std::vector<int64_t>& rvqw = *plrRows[i].pvqwNs;
+		std::sort(rvqw.begin(), rvqw.end());
+		printf("%-16s %10.1f %10.1f %10.1f %10.1f %10zu\n", plrRows[i].pcsName,
+			PercentileUs(rvqw, 50), PercentileUs(rvqw, 99), PercentileUs(rvqw, 99.9), PercentileUs(rvqw, 100), rvqw.size());
+	}
+
+	if (0 != pcsJson)
+	{
+		FILE* const pf = fopen(pcsJson, "w");
+		if (0 == pf)
+		{
+			fprintf(stderr, "Unable to open %s.\n", pcsJson);
+			return -1;
+		}
+		fprintf(pf, "{\n  \"clients\": %u,\n  \"concurrency\": %u,\n  \"elapsed_seconds\": %.6f,\n", lg.m_dwClientCount, lg.m_dwConcurrency, lg.m_dElapsedSeconds);
+		fprintf(pf, "  \"dora_completed\": %llu,\n  \"renewals_completed\": %llu,\n  \"transactions_per_second\": %.1f,\n",
+			(unsigned long long)qwDoras, (unsigned long long)qwRenewals, (qwDoras + qwRenewals) / lg.m_dElapsedSeconds);
+		fprintf(pf, "  \"failed_clients\": %u,\n  \"sent\": %llu,\n  \"retransmits\": %llu,\n  \"naks\": %llu,\n  \"ignored_replies\": %llu,\n  \"latency_us\": {",
+			lg.m_dwFailed, (unsigned long long)lg.m_qwSent, (unsigned long long)lg.m_qwRetransmits, (unsigned long long)lg.m_qwNaks, (unsigned long long)lg.m_qwIgnored);
+		for (size_t i = 0; i < ARRAY_LENGTH(plrRows); i++)
+		{
+			const std::vector<int64_t>& rvqw = *plrRows[i].pvqwNs;
+			fprintf(pf, "%s\n    \"%s\": {\"p50\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f, \"samples\": %zu}", (0 == i) ? "" : ",",
+				plrRows[i].pcsName, PercentileUs(rvqw, 50), PercentileUs(rvqw, 99), PercentileUs(rvqw, 99.9), PercentileUs(rvqw, 100), rvqw.size());
+		}
+		fprintf(pf, "\n  }\n}\n");
+		fclose(pf);
+	}
+	return (0 == lg.m_dwFailed) ? 0 : 1;
+}
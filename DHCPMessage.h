@@ -0,0 +1,59 @@
+#if !defined(DHCP_MESSAGE_HEADER)
+#define DHCP_MESSAGE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DHCP constants (see RFC 2131 section 4.1)
+#define DHCP_SERVER_PORT (67)
+#define DHCP_CLIENT_PORT (68)
+// Broadcast bit of the flags field (RFC 2131 section 2), in its first byte
+#define BROADCAST_FLAG (0x80)
+
+// RFC 2131 section 2
+enum op_values
+{
+	op_BOOTREQUEST = 1,
+	op_BOOTREPLY = 2,
+};
+
+// DHCP magic cookie values
+const uint8_t pbDHCPMagicCookie[] = { 99, 130, 83, 99 };
+
+// RFC 2131 section 2 (multi-byte fields are in network order)
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable : 4200)
+#endif  // defined(_MSC_VER)
+#pragma pack(push, 1)
+struct DHCPMessage
+{
+	uint8_t op;
+	uint8_t htype;
+	uint8_t hlen;
+	uint8_t hops;
+	uint32_t xid;
+	uint16_t secs;
+	uint16_t flags;
+	uint32_t ciaddr;
+	uint32_t yiaddr;
+	uint32_t siaddr;
+	uint32_t giaddr;
+	uint8_t chaddr[16];
+	uint8_t sname[64];
+	uint8_t file[128];
+	uint8_t magicCookie[4];
+	uint8_t options[];
+};
+
+#pragma pack(pop)
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif  // defined(_MSC_VER)
+// Options area of a reply: a client must accept 312 octets including the
+// magic cookie (RFC 2131 section 2), i.e. a 576 byte IP datagram
+#define DHCP_REPLY_MAX_OPTIONS_SIZE (312 - sizeof(pbDHCPMagicCookie))
+// Largest reply; replies are usually shorter (DhcpReplyInfo::stSize)
+#define DHCP_REPLY_SIZE (sizeof(DHCPMessage) + DHCP_REPLY_MAX_OPTIONS_SIZE)
+
+#endif  // !defined(DHCP_MESSAGE_HEADER)
@@ -0,0 +1,245 @@
+#include <string.h>
+#include "ToolBox.h"
+#include "DHCPOptions.h"
+
+#define OPTION_BIT(b) (((uint64_t)1) << ((b) % 64))
+
+bool DHCPOptionTable::Walk(const Region& rr, uint64_t* const pqwSeen, uint64_t* const pqwRepeated, OptionSlot* const pos, uint32_t* const pdwTotalSize)
+{
+	// RFC 2132 section 2
+	// code(1 byte):length(1 byte):data(length bytes), except PAD and END
+	size_t i = 0;
+	while (i < rr.stSize)
+	{
+		const uint8_t bCode = rr.pb[i];
+		if (option_PAD == bCode)
+		{
+			i++;
+			continue;
+		}
+		if (option_END == bCode)
+		{
+			return true;
+		}
+		if (rr.stSize <= i + 1)
+		{
+			return false;  // No room for the length byte
+		}
+		const uint8_t bLength = rr.pb[i + 1];
+		if (rr.stSize < i + 2 + bLength)
+		{
+			return false;  // Data runs past the end of the field
+		}
+		if (0 != (pqwSeen[bCode / 64] & OPTION_BIT(bCode)))
+		{
+			pqwRepeated[bCode / 64] |= OPTION_BIT(bCode);
+			pdwTotalSize[bCode] += bLength;
+		}
+		else
+		{
+			pqwSeen[bCode / 64] |= OPTION_BIT(bCode);
+			pos[bCode].pbData = rr.pb + i + 2;
+			pos[bCode].dwSize = bLength;
+			pdwTotalSize[bCode] = bLength;
+		}
+		i += 2 + bLength;
+	}
+	return true;
+}
+
+bool DHCPOptionTable::Concatenate(const Region* const prRegions, const size_t stRegionCount, const uint64_t* const pqwRepeated, const uint32_t* const pdwTotalSize)
+{
+	// RFC 3396 section 7: the values of every instance are joined in the order
+	// they appear (options, then file, then sname)
+	uint32_t pdwCursor[256];
+	uint32_t dwUsed = 0;
+	for (unsigned int iWord = 0; iWord < 4; iWord++)
+	{
+		for (unsigned int iBit = 0; iBit < 64; iBit++)
+		{
+			if (0 != (pqwRepeated[iWord] & (((uint64_t)1) << iBit)))
+			{
+				const unsigned int iCode = iWord * 64 + iBit;
+				if (sizeof(m_pbConcatenated) - dwUsed < pdwTotalSize[iCode])
+				{
+					return false;
+				}
+				pdwCursor[iCode] = dwUsed;
+				m_osSlots[iCode].pbData = m_pbConcatenated + dwUsed;
+				m_osSlots[iCode].dwSize = pdwTotalSize[iCode];
+				dwUsed += pdwTotalSize[iCode];
+			}
+		}
+	}
+	for (size_t r = 0; r < stRegionCount; r++)
+	{
+		// Bounds were checked by Walk
+		const Region& rr = prRegions[r];
+		size_t i = 0;
+		while ((i < rr.stSize) && (option_END != rr.pb[i]))
+		{
+			const uint8_t bCode = rr.pb[i];
+			if (option_PAD == bCode)
+			{
+				i++;
+				continue;
+			}
+			const uint8_t bLength = rr.pb[i + 1];
+			if (0 != (pqwRepeated[bCode / 64] & OPTION_BIT(bCode)))
+			{
+				memcpy(m_pbConcatenated + pdwCursor[bCode], rr.pb + i + 2, bLength);
+				pdwCursor[bCode] += bLength;
+			}
+			i += 2 + bLength;
+		}
+	}
+	return true;
+}
+
+bool DHCPOptionTable::Decode(const uint8_t* const pbOptions, const size_t stOptionsSize, const uint8_t* const pbFile, const size_t stFileSize, const uint8_t* const pbSname, const size_t stSnameSize)
+{
+	ASSERT(((0 == stOptionsSize) || (0 != pbOptions)) && (0 != pbFile) && (0 != pbSname));
+	uint64_t qwSeen[4] = { 0, 0, 0, 0 };
+	uint64_t qwRepeated[4] = { 0, 0, 0, 0 };
+	uint32_t pdwTotalSize[256];  // Only valid for options in qwSeen
+	Region rRegions[3];
+	size_t stRegionCount = 0;
+	rRegions[stRegionCount].pb = pbOptions;
+	rRegions[stRegionCount].stSize = stOptionsSize;
+	stRegionCount++;
+	memset(m_qwPresent, 0, sizeof(m_qwPresent));
+	if (!Walk(rRegions[0], qwSeen, qwRepeated, m_osSlots, pdwTotalSize))
+	{
+		return false;
+	}
+	// Option Overload - RFC 2132 section 9.3 (only meaningful in the options field)
+	if (0 != (qwSeen[option_OVERLOAD / 64] & OPTION_BIT(option_OVERLOAD)))
+	{
+		if ((0 != (qwRepeated[option_OVERLOAD / 64] & OPTION_BIT(option_OVERLOAD))) || (1 != m_osSlots[option_OVERLOAD].dwSize))
+		{
+			return false;
+		}
+		const uint8_t bOverload = m_osSlots[option_OVERLOAD].pbData[0];
+		if ((bOverload < overload_FILE) || (overload_BOTH < bOverload))
+		{
+			return false;
+		}
+		// RFC 2131 section 4.1: file is interpreted before sname
+		if (0 != (overload_FILE & bOverload))
+		{
+			rRegions[stRegionCount].pb = pbFile;
+			rRegions[stRegionCount].stSize = stFileSize;
+			stRegionCount++;
+		}
+		if (0 != (overload_SNAME & bOverload))
+		{
+			rRegions[stRegionCount].pb = pbSname;
+			rRegions[stRegionCount].stSize = stSnameSize;
+			stRegionCount++;
+		}
+		for (size_t r = 1; r < stRegionCount; r++)
+		{
+			if (!Walk(rRegions[r], qwSeen, qwRepeated, m_osSlots, pdwTotalSize))
+			{
+				return false;
+			}
+		}
+	}
+	if ((0 != (qwRepeated[0] | qwRepeated[1] | qwRepeated[2] | qwRepeated[3])) &&
+		!Concatenate(rRegions, stRegionCount, qwRepeated, pdwTotalSize))
+	{
+		return false;
+	}
+	memcpy(m_qwPresent, qwSeen, sizeof(m_qwPresent));
+	return true;
+}
+
+bool DHCPOptionTable::Find(const uint8_t bOption, const uint8_t** const ppbOptionData, unsigned int* const piOptionDataSize) const
+{
+	ASSERT((0 != ppbOptionData) && (0 != piOptionDataSize) && (option_PAD != bOption) && (option_END != bOption));
+	if (!IsPresent(bOption))
+	{
+		return false;
+	}
+	*ppbOptionData = m_osSlots[bOption].pbData;
+	*piOptionDataSize = m_osSlots[bOption].dwSize;
+	return true;
+}
+
+bool FindOptionData(const uint8_t bOption, const uint8_t* const pbOptions, const int iOptionsSize, const uint8_t** const ppbOptionData, unsigned int* const piOptionDataSize)
+{
+	ASSERT(((0 == iOptionsSize) || (0 != pbOptions)) && (0 != ppbOptionData) && (0 != piOptionDataSize) &&
+		(option_PAD != bOption) && (option_END != bOption));
+	// RFC 2132
+	int i = 0;
+	while (i < iOptionsSize)
+	{
+		const uint8_t bCode = pbOptions[i];
+		if (option_PAD == bCode)
+		{
+			i++;
+			continue;
+		}
+		if (option_END == bCode)
+		{
+			return false;
+		}
+		// code(1字节):Length(1字节):Data(Length字节)
+		if ((iOptionsSize <= i + 1) || (iOptionsSize < i + 2 + pbOptions[i + 1]))
+		{
+			return false;  // Invalid option data (not enough room for the length byte or data)
+		}
+		if (bOption == bCode)
+		{
+			*ppbOptionData = pbOptions + i + 2;
+			*piOptionDataSize = pbOptions[i + 1];
+			return true;
+		}
+		i += 2 + pbOptions[i + 1];
+	}
+	return false;
+}
+
+bool GetDHCPMessageType(const DHCPOptionTable& rdotOptions, DHCPMessageTypes* const pdhcpmtMessageType)
+{
+	ASSERT(0 != pdhcpmtMessageType);
+	const uint8_t* pbDHCPMessageTypeData;
+	unsigned int iDHCPMessageTypeDataSize;
+
+	if (!rdotOptions.Find(option_DHCPMESSAGETYPE, &pbDHCPMessageTypeData, &iDHCPMessageTypeDataSize))
+		return false;
+	/*
+	* 验证option的正确性
+	*/
+	if (iDHCPMessageTypeDataSize != 1)
+		return false;
+	if (*pbDHCPMessageTypeData < DHCPMessageType_DISCOVER)
+		return false;
+	if (*pbDHCPMessageTypeData > DHCPMessageType_INFORM)
+		return false;
+
+	*pdhcpmtMessageType = (DHCPMessageTypes)(*pbDHCPMessageTypeData);
+	return true;
+}
+
+bool FindRelayAgentSuboption(const uint8_t bSuboption, const uint8_t* const pbOptionData, const unsigned int iOptionDataSize, const uint8_t** const ppbSuboptionData, unsigned int* const piSuboptionDataSize)
+{
+	ASSERT(((0 == iOptionDataSize) || (0 != pbOptionData)) && (0 != ppbSuboptionData) && (0 != piSuboptionDataSize));
+	unsigned int i = 0;
+	while (i + 2 <= iOptionDataSize)
+	{
+		const unsigned int iSize = pbOptionData[i + 1];
+		if (iOptionDataSize < i + 2 + iSize)
+		{
+			return false;
+		}
+		if (bSuboption == pbOptionData[i])
+		{
+			*ppbSuboptionData = pbOptionData + i + 2;
+			*piSuboptionDataSize = iSize;
+			return true;
+		}
+		i += 2 + iSize;
+	}
+	return false;
+}
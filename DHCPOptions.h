@@ -0,0 +1,195 @@
+#if !defined(DHCP_OPTIONS_HEADER)
+#define DHCP_OPTIONS_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 2132 section 9.6
+enum option_values
+{
+	option_PAD = 0,
+	option_SUBNETMASK = 1,
+	option_ROUTER = 3,
+	option_DOMAINNAMESERVER = 6,
+	option_HOSTNAME = 12,
+	option_DOMAINNAME = 15,
+	option_INTERFACEMTU = 26,
+	option_REQUESTEDIPADDRESS = 50,
+	option_IPADDRESSLEASETIME = 51,
+	option_OVERLOAD = 52,
+	option_DHCPMESSAGETYPE = 53,
+	option_SERVERIDENTIFIER = 54,
+	option_RENEWALTIMEVALUE = 58,
+	option_REBINDINGTIMEVALUE = 59,
+	option_CLIENTIDENTIFIER = 61,
+	option_RAPIDCOMMIT = 80,  // RFC 4039
+	option_RELAYAGENTINFORMATION = 82,  // RFC 3046
+	option_END = 255,
+};
+enum DHCPMessageTypes
+{
+	DHCPMessageType_DISCOVER = 1,
+	DHCPMessageType_OFFER = 2,
+	DHCPMessageType_REQUEST = 3,
+	DHCPMessageType_DECLINE = 4,
+	DHCPMessageType_ACK = 5,
+	DHCPMessageType_NAK = 6,
+	DHCPMessageType_RELEASE = 7,
+	DHCPMessageType_INFORM = 8,
+};
+// Relay Agent Information sub-options - RFC 3046 section 2.0
+enum relay_agent_suboption_values
+{
+	relay_agent_suboption_LINKSELECTION = 5,  // RFC 3527
+};
+// Option Overload values - RFC 2132 section 9.3
+enum overload_values
+{
+	overload_FILE = 1,
+	overload_SNAME = 2,
+	overload_BOTH = 3,
+};
+
+// Room for options that appear more than once and must be concatenated
+// (RFC 3396); a request that needs more is rejected
+#define OPTION_CONCATENATION_BUFFER_SIZE (2048)
+
+// Result of a single pass over the options area (and the file/sname fields
+// when overloaded). Every option that was present has a slot holding its
+// data and length; presence is a 256-bit map, so resetting the table per
+// packet touches 32 bytes rather than all slots.
+class DHCPOptionTable
+{
+public:
+	// Returns false for malformed data (an option running past the end of its
+	// field, a bad overload value, or too much data to concatenate); the table
+	// is empty in that case. Running out of data without option_END is allowed.
+	bool Decode(const uint8_t* const pbOptions, const size_t stOptionsSize, const uint8_t* const pbFile, const size_t stFileSize, const uint8_t* const pbSname, const size_t stSnameSize);
+
+	bool IsPresent(const uint8_t bOption) const { return 0 != (m_qwPresent[bOption / 64] & (((uint64_t)1) << (bOption % 64))); }
+	bool Find(const uint8_t bOption, const uint8_t** const ppbOptionData, unsigned int* const piOptionDataSize) const;
+
+private:
+	struct OptionSlot
+	{
+		const uint8_t* pbData;
+		uint32_t dwSize;
+	};
+	struct Region
+	{
+		const uint8_t* pb;
+		size_t stSize;
+	};
+
+	static bool Walk(const Region& rr, uint64_t* const pqwSeen, uint64_t* const pqwRepeated, OptionSlot* const pos, uint32_t* const pdwTotalSize);
+	bool Concatenate(const Region* const prRegions, const size_t stRegionCount, const uint64_t* const pqwRepeated, const uint32_t* const pdwTotalSize);
+
+	uint64_t m_qwPresent[4];
+	OptionSlot m_osSlots[256];
+	uint8_t m_pbConcatenated[OPTION_CONCATENATION_BUFFER_SIZE];
+};
+
+// Single option scan of an options area (no overload or concatenation
+// handling); bounds-checked and always makes progress
+bool FindOptionData(const uint8_t bOption, const uint8_t* const pbOptions, const int iOptionsSize, const uint8_t** const ppbOptionData, unsigned int* const piOptionDataSize);
+
+bool GetDHCPMessageType(const DHCPOptionTable& rdotOptions, DHCPMessageTypes* const pdhcpmtMessageType);
+
+// Sub-option scan of Relay Agent Information option data (plain
+// code/length/data triples, no padding); false if absent or malformed
+bool FindRelayAgentSuboption(const uint8_t bSuboption, const uint8_t* const pbOptionData, const unsigned int iOptionDataSize, const uint8_t** const ppbSuboptionData, unsigned int* const piSuboptionDataSize);
+
+// Option encoder (RFC 2132 section 2), usable in constant expressions so
+// fixed option sequences are laid out by the compiler. Numbers are host
+// order values and are written in network order. An option that does not
+// fit (or has more than 255 data bytes) sets bOverflow and is not written.
+template <size_t N>
+struct DHCPOptionBlock
+{
+	uint8_t pb[N];
+	size_t stSize;
+	bool bOverflow;
+
+	constexpr DHCPOptionBlock() : pb(), stSize(0), bOverflow(false) {}
+
+	constexpr DHCPOptionBlock& Add(const uint8_t bOption, const uint8_t* const pbData, const size_t stDataSize)
+	{
+		if ((255 < stDataSize) || (N - stSize < 2 + stDataSize))
+		{
+			bOverflow = true;
+			return *this;
+		}
+		pb[stSize++] = bOption;
+		pb[stSize++] = (uint8_t)stDataSize;
+		for (size_t i = 0; i < stDataSize; i++)
+		{
+			pb[stSize++] = pbData[i];
+		}
+		return *this;
+	}
+	// Options whose presence is the whole message (e.g. Rapid Commit)
+	constexpr DHCPOptionBlock& AddFlag(const uint8_t bOption)
+	{
+		return Add(bOption, 0, 0);
+	}
+	constexpr DHCPOptionBlock& AddByte(const uint8_t bOption, const uint8_t bValue)
+	{
+		const uint8_t pbData[1] = { bValue };
+		return Add(bOption, pbData, sizeof(pbData));
+	}
+	constexpr DHCPOptionBlock& AddUInt16(const uint8_t bOption, const uint16_t wValue)
+	{
+		const uint8_t pbData[2] = { (uint8_t)(wValue >> 8), (uint8_t)wValue };
+		return Add(bOption, pbData, sizeof(pbData));
+	}
+	constexpr DHCPOptionBlock& AddUInt32(const uint8_t bOption, const uint32_t dwValue)
+	{
+		const uint8_t pbData[4] = { (uint8_t)(dwValue >> 24), (uint8_t)(dwValue >> 16), (uint8_t)(dwValue >> 8), (uint8_t)dwValue };
+		return Add(bOption, pbData, sizeof(pbData));
+	}
+	// Address lists (router, DNS servers): up to 63 values
+	constexpr DHCPOptionBlock& AddUInt32List(const uint8_t bOption, const uint32_t* const pdwValues, const size_t stCount)
+	{
+		uint8_t pbData[252] = {};
+		if (sizeof(pbData) / 4 < stCount)
+		{
+			bOverflow = true;
+			return *this;
+		}
+		for (size_t i = 0; i < stCount; i++)
+		{
+			pbData[(i * 4) + 0] = (uint8_t)(pdwValues[i] >> 24);
+			pbData[(i * 4) + 1] = (uint8_t)(pdwValues[i] >> 16);
+			pbData[(i * 4) + 2] = (uint8_t)(pdwValues[i] >> 8);
+			pbData[(i * 4) + 3] = (uint8_t)pdwValues[i];
+		}
+		return Add(bOption, pbData, stCount * 4);
+	}
+	// Copies options encoded elsewhere (e.g. a block built at compile time)
+	template <size_t M>
+	constexpr DHCPOptionBlock& Append(const DHCPOptionBlock<M>& rdob)
+	{
+		if (rdob.bOverflow || (N - stSize < rdob.stSize))
+		{
+			bOverflow = true;
+			return *this;
+		}
+		for (size_t i = 0; i < rdob.stSize; i++)
+		{
+			pb[stSize++] = rdob.pb[i];
+		}
+		return *this;
+	}
+	constexpr DHCPOptionBlock& End()
+	{
+		if (N == stSize)
+		{
+			bOverflow = true;
+			return *this;
+		}
+		pb[stSize++] = option_END;
+		return *this;
+	}
+};
+
+#endif  // !defined(DHCP_OPTIONS_HEADER)
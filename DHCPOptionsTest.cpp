@@ -0,0 +1,255 @@
+#include <string.h>
+#include <vector>
+#include "ToolBox.h"
+#include "DHCPMessage.h"
+#include "DHCPOptions.h"
+#include "UnitTest.h"
+
+// Every buffer is copied into a heap block of exactly its size, so a read
+// past the end shows up under a sanitizer or valgrind
+
+// An option the decoded table must (or must not) hold
+struct OptionExpectation
+{
+	uint8_t bOption;
+	bool bPresent;
+	std::vector<uint8_t> vbData;
+};
+
+struct DecodeCase
+{
+	const char* pcsName;
+	std::vector<uint8_t> vbOptions;
+	std::vector<uint8_t> vbFile;  // Padded (option_PAD) to the size of the file field
+	std::vector<uint8_t> vbSname;  // Padded to the size of the sname field
+	bool bDecodes;
+	std::vector<OptionExpectation> voeExpected;
+};
+
+static std::vector<uint8_t> Repeat(const std::vector<uint8_t>& rvb, const size_t stCount)
+{
+	std::vector<uint8_t> vb;
+	for (size_t i = 0; i < stCount; i++)
+	{
+		vb.insert(vb.end(), rvb.begin(), rvb.end());
+	}
+	return vb;
+}
+
+// stCount instances of option bOption, each with 255 bytes of data
+static std::vector<uint8_t> LongInstances(const uint8_t bOption, const size_t stCount)
+{
+	std::vector<uint8_t> vbInstance(2 + 255, 'x');
+	vbInstance[0] = bOption;
+	vbInstance[1] = 255;
+	return Repeat(vbInstance, stCount);
+}
+
+// A field of stSize bytes of option_PAD ending with rvbTail
+static std::vector<uint8_t> EndingWith(const size_t stSize, const std::vector<uint8_t>& rvbTail)
+{
+	std::vector<uint8_t> vb(stSize - rvbTail.size(), option_PAD);
+	vb.insert(vb.end(), rvbTail.begin(), rvbTail.end());
+	return vb;
+}
+
+static void CheckDecode(const DecodeCase& rdc)
+{
+	const DHCPMessage* const pdhcpm = 0;
+	const size_t stFileSize = sizeof(pdhcpm->file);
+	const size_t stSnameSize = sizeof(pdhcpm->sname);
+	CHECK_CASE(rdc.pcsName, (rdc.vbFile.size() <= stFileSize) && (rdc.vbSname.size() <= stSnameSize));
+	std::vector<uint8_t> vbOptions(rdc.vbOptions);
+	std::vector<uint8_t> vbFile(rdc.vbFile);
+	std::vector<uint8_t> vbSname(rdc.vbSname);
+	vbFile.resize(stFileSize, option_PAD);
+	vbSname.resize(stSnameSize, option_PAD);
+	DHCPOptionTable dotOptions;
+	const bool bDecoded = dotOptions.Decode(vbOptions.empty() ? 0 : &vbOptions[0], vbOptions.size(), &vbFile[0], vbFile.size(), &vbSname[0], vbSname.size());
+	CHECK_CASE(rdc.pcsName, rdc.bDecodes == bDecoded);
+	if (!bDecoded)
+	{
+		// A failed decode leaves the table empty
+		for (unsigned int i = 1; i < option_END; i++)
+		{
+			CHECK_CASE(rdc.pcsName, !dotOptions.IsPresent((uint8_t)i));
+		}
+		return;
+	}
+	for (size_t i = 0; i < rdc.voeExpected.size(); i++)
+	{
+		const OptionExpectation& roe = rdc.voeExpected[i];
+		const uint8_t* pbData = 0;
+		unsigned int iSize = 0;
+		const bool bFound = dotOptions.Find(roe.bOption, &pbData, &iSize);
+		CHECK_CASE(rdc.pcsName, roe.bPresent == bFound);
+		CHECK_CASE(rdc.pcsName, roe.bPresent == dotOptions.IsPresent(roe.bOption));
+		if (bFound && roe.bPresent)
+		{
+			CHECK_CASE(rdc.pcsName, roe.vbData.size() == iSize);
+			CHECK_CASE(rdc.pcsName, (roe.vbData.size() != iSize) || (0 == iSize) || (0 == memcmp(&roe.vbData[0], pbData, iSize)));
+		}
+	}
+}
+
+static void TestDecode()
+{
+	const DecodeCase pdcCases[] =
+	{
+		// Well-formed
+		{ "empty options", {}, {}, {}, true, { { option_DHCPMESSAGETYPE, false, {} } } },
+		{ "END only", { option_END }, {}, {}, true, { { option_DHCPMESSAGETYPE, false, {} } } },
+		{ "one option", { option_DHCPMESSAGETYPE, 1, 1, option_END }, {}, {}, true, { { option_DHCPMESSAGETYPE, true, { 1 } } } },
+		{ "no END", { option_DHCPMESSAGETYPE, 1, 3 }, {}, {}, true, { { option_DHCPMESSAGETYPE, true, { 3 } } } },
+		{ "PAD before and between", { option_PAD, option_PAD, option_DHCPMESSAGETYPE, 1, 1, option_PAD, option_HOSTNAME, 1, 'h' }, {}, {}, true,
+			{ { option_DHCPMESSAGETYPE, true, { 1 } }, { option_HOSTNAME, true, { 'h' } } } },
+		{ "zero-length option", { option_RAPIDCOMMIT, 0, option_END }, {}, {}, true, { { option_RAPIDCOMMIT, true, {} } } },
+		{ "bytes after END ignored", { option_DHCPMESSAGETYPE, 1, 1, option_END, option_HOSTNAME, 200 }, {}, {}, true,
+			{ { option_DHCPMESSAGETYPE, true, { 1 } }, { option_HOSTNAME, false, {} } } },
+		{ "option filling the area", LongInstances(option_HOSTNAME, 1), {}, {}, true, { { option_HOSTNAME, true, std::vector<uint8_t>(255, 'x') } } },
+		// Truncated
+		{ "code without length", { option_DHCPMESSAGETYPE }, {}, {}, false, {} },
+		{ "code without length after an option", { option_DHCPMESSAGETYPE, 1, 1, option_HOSTNAME }, {}, {}, false, {} },
+		{ "data one byte short", { option_DHCPMESSAGETYPE, 2, 1 }, {}, {}, false, {} },
+		{ "length 255 with one byte", { option_HOSTNAME, 255, 'h' }, {}, {}, false, {} },
+		{ "length 0 code at end", { option_RAPIDCOMMIT, 0, option_HOSTNAME }, {}, {}, false, {} },
+		// Option Overload (RFC 2132 section 9.3)
+		{ "file not overloaded is not read", { option_DHCPMESSAGETYPE, 1, 1, option_END }, { option_HOSTNAME, 200 }, { option_HOSTNAME, 1 }, true,
+			{ { option_HOSTNAME, false, {} } } },
+		{ "overload file", { option_OVERLOAD, 1, overload_FILE, option_END }, { option_HOSTNAME, 3, 'a', 'b', 'c', option_END }, { option_DOMAINNAME, 1, 'd' }, true,
+			{ { option_HOSTNAME, true, { 'a', 'b', 'c' } }, { option_DOMAINNAME, false, {} } } },
+		{ "overload sname", { option_OVERLOAD, 1, overload_SNAME }, { option_HOSTNAME, 1, 'h' }, { option_DOMAINNAME, 1, 'd', option_END }, true,
+			{ { option_HOSTNAME, false, {} }, { option_DOMAINNAME, true, { 'd' } } } },
+		{ "overload both", { option_OVERLOAD, 1, overload_BOTH }, { option_HOSTNAME, 1, 'h' }, { option_DOMAINNAME, 1, 'd' }, true,
+			{ { option_HOSTNAME, true, { 'h' } }, { option_DOMAINNAME, true, { 'd' } } } },
+		{ "overload value 0", { option_OVERLOAD, 1, 0 }, {}, {}, false, {} },
+		{ "overload value 4", { option_OVERLOAD, 1, 4 }, {}, {}, false, {} },
+		{ "overload length 2", { option_OVERLOAD, 2, overload_FILE, overload_FILE }, {}, {}, false, {} },
+		{ "overload length 0", { option_OVERLOAD, 0 }, {}, {}, false, {} },
+		{ "overload repeated", { option_OVERLOAD, 1, overload_FILE, option_OVERLOAD, 1, overload_FILE }, {}, {}, false, {} },
+		{ "overloaded file truncated", { option_OVERLOAD, 1, overload_FILE }, EndingWith(128, { option_HOSTNAME }), {}, false, {} },
+		{ "overloaded file data past end", { option_OVERLOAD, 1, overload_FILE }, EndingWith(128, { option_HOSTNAME, 2, 'h' }), {}, false, {} },
+		{ "overloaded sname truncated", { option_OVERLOAD, 1, overload_BOTH }, {}, EndingWith(64, { option_HOSTNAME }), false, {} },
+		{ "sname truncation ignored without overload", { option_OVERLOAD, 1, overload_FILE }, {}, EndingWith(64, { option_HOSTNAME }), true, { { option_HOSTNAME, false, {} } } },
+		// Concatenation (RFC 3396)
+		{ "concatenated in options", { option_HOSTNAME, 2, 'a', 'b', option_HOSTNAME, 1, 'c' }, {}, {}, true, { { option_HOSTNAME, true, { 'a', 'b', 'c' } } } },
+		{ "concatenated with PAD between", { option_HOSTNAME, 1, 'a', option_PAD, option_DHCPMESSAGETYPE, 1, 1, option_HOSTNAME, 1, 'b' }, {}, {}, true,
+			{ { option_HOSTNAME, true, { 'a', 'b' } }, { option_DHCPMESSAGETYPE, true, { 1 } } } },
+		{ "concatenated zero-length instance", { option_HOSTNAME, 1, 'a', option_HOSTNAME, 0 }, {}, {}, true, { { option_HOSTNAME, true, { 'a' } } } },
+		{ "concatenated options, file, sname in order", { option_OVERLOAD, 1, overload_BOTH, option_CLIENTIDENTIFIER, 1, 1 }, { option_CLIENTIDENTIFIER, 1, 2 }, { option_CLIENTIDENTIFIER, 2, 3, 4 }, true,
+			{ { option_CLIENTIDENTIFIER, true, { 1, 2, 3, 4 } } } },
+		{ "concatenated up to the buffer", LongInstances(option_CLIENTIDENTIFIER, OPTION_CONCATENATION_BUFFER_SIZE / 255), {}, {}, true,
+			{ { option_CLIENTIDENTIFIER, true, std::vector<uint8_t>((OPTION_CONCATENATION_BUFFER_SIZE / 255) * 255, 'x') } } },
+		{ "concatenated past the buffer", LongInstances(option_CLIENTIDENTIFIER, (OPTION_CONCATENATION_BUFFER_SIZE / 255) + 1), {}, {}, false, {} },
+		{ "concatenated instance truncated", { option_HOSTNAME, 1, 'a', option_HOSTNAME, 2, 'b' }, {}, {}, false, {} },
+	};
+	for (size_t i = 0; i < ARRAY_LENGTH(pdcCases); i++)
+	{
+		CheckDecode(pdcCases[i]);
+	}
+}
+
+static void TestFindOptionData()
+{
+	struct FindCase
+	{
+		const char* pcsName;
+		std::vector<uint8_t> vbOptions;
+		bool bFound;
+		std::vector<uint8_t> vbData;
+	};
+	const FindCase pfcCases[] =
+	{
+		{ "found", { option_PAD, option_DHCPMESSAGETYPE, 1, 5, option_END }, true, { 5 } },
+		{ "absent", { option_HOSTNAME, 1, 'h', option_END }, false, {} },
+		{ "after END", { option_END, option_DHCPMESSAGETYPE, 1, 5 }, false, {} },
+		{ "code without length", { option_HOSTNAME, 1, 'h', option_DHCPMESSAGETYPE }, false, {} },
+		{ "data past end", { option_DHCPMESSAGETYPE, 2, 5 }, false, {} },
+		{ "behind a truncated option", { option_HOSTNAME, 9, 'h', option_DHCPMESSAGETYPE, 1, 5 }, false, {} },
+		{ "only PAD", std::vector<uint8_t>(16, option_PAD), false, {} },
+	};
+	for (size_t i = 0; i < ARRAY_LENGTH(pfcCases); i++)
+	{
+		const FindCase& rfc = pfcCases[i];
+		std::vector<uint8_t> vbOptions(rfc.vbOptions);
+		const uint8_t* pbData = 0;
+		unsigned int iSize = 0;
+		const bool bFound = FindOptionData(option_DHCPMESSAGETYPE, &vbOptions[0], (int)vbOptions.size(), &pbData, &iSize);
+		CHECK_CASE(rfc.pcsName, rfc.bFound == bFound);
+		if (bFound && rfc.bFound)
+		{
+			CHECK_CASE(rfc.pcsName, (rfc.vbData.size() == iSize) && (0 == memcmp(&rfc.vbData[0], pbData, iSize)));
+		}
+	}
+}
+
+static void TestRelayAgentSuboptions()
+{
+	struct SuboptionCase
+	{
+		const char* pcsName;
+		std::vector<uint8_t> vbData;
+		bool bFound;
+		std::vector<uint8_t> vbSuboption;
+	};
+	const SuboptionCase pscCases[] =
+	{
+		{ "link selection", { 1, 2, 'c', 'i', relay_agent_suboption_LINKSELECTION, 4, 10, 0, 0, 0 }, true, { 10, 0, 0, 0 } },
+		{ "absent", { 1, 2, 'c', 'i' }, false, {} },
+		{ "truncated before it", { 1, 9, 'c', relay_agent_suboption_LINKSELECTION, 4, 10, 0, 0, 0 }, false, {} },
+		{ "its data truncated", { relay_agent_suboption_LINKSELECTION, 4, 10, 0, 0 }, false, {} },
+		{ "code without length", { 1, 0, relay_agent_suboption_LINKSELECTION }, false, {} },
+	};
+	for (size_t i = 0; i < ARRAY_LENGTH(pscCases); i++)
+	{
+		const SuboptionCase& rsc = pscCases[i];
+		std::vector<uint8_t> vbData(rsc.vbData);
+		const uint8_t* pbSuboption = 0;
+		unsigned int iSize = 0;
+		const bool bFound = FindRelayAgentSuboption(relay_agent_suboption_LINKSELECTION, &vbData[0], (unsigned int)vbData.size(), &pbSuboption, &iSize);
+		CHECK_CASE(rsc.pcsName, rsc.bFound == bFound);
+		if (bFound && rsc.bFound)
+		{
+			CHECK_CASE(rsc.pcsName, (rsc.vbSuboption.size() == iSize) && (0 == memcmp(&rsc.vbSuboption[0], pbSuboption, iSize)));
+		}
+	}
+}
+
+static void TestMessageType()
+{
+	struct MessageTypeCase
+	{
+		const char* pcsName;
+		std::vector<uint8_t> vbOptions;
+		bool bValid;
+	};
+	const MessageTypeCase pmtcCases[] =
+	{
+		{ "DISCOVER", { option_DHCPMESSAGETYPE, 1, DHCPMessageType_DISCOVER }, true },
+		{ "INFORM", { option_DHCPMESSAGETYPE, 1, DHCPMessageType_INFORM }, true },
+		{ "type 0", { option_DHCPMESSAGETYPE, 1, 0 }, false },
+		{ "type 9", { option_DHCPMESSAGETYPE, 1, DHCPMessageType_INFORM + 1 }, false },
+		{ "two bytes", { option_DHCPMESSAGETYPE, 2, DHCPMessageType_DISCOVER, 0 }, false },
+		{ "empty", { option_DHCPMESSAGETYPE, 0 }, false },
+		{ "missing", { option_HOSTNAME, 1, 'h' }, false },
+	};
+	const uint8_t pbField[128] = {};
+	for (size_t i = 0; i < ARRAY_LENGTH(pmtcCases); i++)
+	{
+		const MessageTypeCase& rmtc = pmtcCases[i];
+		std::vector<uint8_t> vbOptions(rmtc.vbOptions);
+		DHCPOptionTable dotOptions;
+		CHECK_CASE(rmtc.pcsName, dotOptions.Decode(&vbOptions[0], vbOptions.size(), pbField, sizeof(pbField), pbField, 64));
+		DHCPMessageTypes dhcpmtType;
+		CHECK_CASE(rmtc.pcsName, rmtc.bValid == GetDHCPMessageType(dotOptions, &dhcpmtType));
+	}
+}
+
+int main()
+{
+	TestDecode();
+	TestFindOptionData();
+	TestRelayAgentSuboptions();
+	TestMessageType();
+	return UNIT_TEST_RESULT();
+}
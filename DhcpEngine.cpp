@@ -0,0 +1,1130 @@
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "ToolBox.h"
+#include "DHCPOptions.h"
+#include "DhcpEngine.h"
+
+#define ADDR_BROADCAST ((uint32_t)0xffffffff)  // Same in either byte order
+
+// Addresses arrive in network order; the lease state uses host order values
+// so ranges can be compared and iterated. Byte access keeps this independent
+// of the host's endianness.
+static inline uint32_t AddrToValue(const uint32_t dwAddr)
+{
+	const uint8_t* const pb = (const uint8_t*)&dwAddr;
+	return (((uint32_t)pb[0]) << 24) | (((uint32_t)pb[1]) << 16) | (((uint32_t)pb[2]) << 8) | pb[3];
+}
+
+static inline uint32_t ValueToAddr(const uint32_t dwValue)
+{
+	uint32_t dwAddr;
+	uint8_t* const pb = (uint8_t*)&dwAddr;
+	pb[0] = (uint8_t)(dwValue >> 24);
+	pb[1] = (uint8_t)(dwValue >> 16);
+	pb[2] = (uint8_t)(dwValue >> 8);
+	pb[3] = (uint8_t)dwValue;
+	return dwAddr;
+}
+
+// Maps a client to its shard using the high bits of the hash (the lease
+// table's client index uses the low bits, so the two stay independent)
+static inline unsigned int ShardOfClient(const uint32_t dwClientHash, const unsigned int iShardCount)
+{
+	return (unsigned int)(((uint64_t)dwClientHash * iShardCount) >> 32);
+}
+
+DhcpEngine::DhcpEngine()
+	: m_psAnyInterfaceScope(0), m_iShardCount(0), m_prtReservations(0), m_adwClientRate(0), m_adwClientBurst(0), m_adwLinkRate(0), m_adwLinkBurst(0),
+	m_stServerHostNameLength(0), m_pfnEvent(0), m_pvEventContext(0), m_pfnProbe(0), m_pvProbeContext(0), m_pdmMetrics(0)
+{
+	m_pcsServerHostName[0] = '\0';
+}
+
+bool DhcpEngine::Initialize(const char* const pcsServerHostName, const unsigned int iShardCount)
+{
+	ASSERT((0 != pcsServerHostName) && (1 <= iShardCount) && m_vpsScopes.empty());
+	m_iShardCount = iShardCount;
+	m_stServerHostNameLength = strlen(pcsServerHostName);
+	if (sizeof(m_pcsServerHostName) <= m_stServerHostNameLength)
+	{
+		m_stServerHostNameLength = sizeof(m_pcsServerHostName) - 1;
+	}
+	memcpy(m_pcsServerHostName, pcsServerHostName, m_stServerHostNameLength);
+	m_pcsServerHostName[m_stServerHostNameLength] = '\0';
+	try
+	{
+		m_pqwLastExpiry.reset(new uint64_t[iShardCount]);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < iShardCount; i++)
+	{
+		m_pqwLastExpiry[i] = UINT64_MAX;  // Not run yet
+	}
+	return true;
+}
+
+bool DhcpEngine::AddScope(const DhcpScopeConfig& rdsc)
+{
+	ASSERT((0 != m_iShardCount) && (0 != rdsc.dwServerAddr) && (0 != rdsc.dwMask));
+	const uint32_t dwMinAddrValue = AddrToValue(rdsc.dwMinAddr);
+	const uint32_t dwMaxAddrValue = AddrToValue(rdsc.dwMaxAddr);
+	const uint32_t dwServerAddrValue = AddrToValue(rdsc.dwServerAddr);
+	ASSERT(dwMinAddrValue <= dwMaxAddrValue);
+	// The last slice takes the remainder
+	const uint32_t dwSliceSize = (dwMaxAddrValue - dwMinAddrValue + 1) / m_iShardCount;
+	if (0 == dwSliceSize)
+	{
+		return false;
+	}
+	const uint32_t dwMaskValue = AddrToValue(rdsc.dwMask);
+	unsigned int iPrefixLength = 0;
+	while ((iPrefixLength < 32) && (0 != (dwMaskValue & (0x80000000u >> iPrefixLength))))
+	{
+		iPrefixLength++;
+	}
+	if ((0 != iPrefixLength) && (dwMaskValue != (0xffffffffu << (32 - iPrefixLength))))
+	{
+		return false;  // Not a prefix, so relay agents' links cannot be matched against it
+	}
+	const uint32_t dwNetworkValue = dwMinAddrValue & dwMaskValue;
+	if ((dwMaxAddrValue & dwMaskValue) != dwNetworkValue)
+	{
+		return false;  // The range must be inside the subnet
+	}
+	// Leases are persisted and restored by address, so an address belongs to one scope only;
+	// and a relayed request names a subnet, so a subnet belongs to one scope only
+	for (size_t i = 0; i < m_vpsScopes.size(); i++)
+	{
+		if (((dwMinAddrValue <= m_vpsScopes[i]->dwMaxAddrValue) && (m_vpsScopes[i]->dwMinAddrValue <= dwMaxAddrValue)) ||
+			((dwNetworkValue == m_vpsScopes[i]->dwNetworkValue) && (iPrefixLength == m_vpsScopes[i]->iPrefixLength)))
+		{
+			return false;
+		}
+	}
+	if (DHCP_SCOPE_RELAYED == rdsc.iInterfaceIndex)
+	{
+		// Only reached through the subnet table
+	}
+	else if (0 == rdsc.iInterfaceIndex)
+	{
+		if (0 != m_psAnyInterfaceScope)
+		{
+			return false;
+		}
+	}
+	else if ((rdsc.iInterfaceIndex < m_vdwScopeOfInterface.size()) && (0 != m_vdwScopeOfInterface[rdsc.iInterfaceIndex]))
+	{
+		return false;  // One scope per interface keeps the lookup a single table read
+	}
+	Scope* psScope;
+	try
+	{
+		std::unique_ptr<Scope> psNew(new Scope);
+		psNew->plsShards.reset(new LeaseShard[m_iShardCount]);
+		if ((DHCP_SCOPE_RELAYED != rdsc.iInterfaceIndex) && (m_vdwScopeOfInterface.size() <= rdsc.iInterfaceIndex))
+		{
+			m_vdwScopeOfInterface.resize((size_t)rdsc.iInterfaceIndex + 1, 0);
+		}
+		m_vpsScopes.push_back(std::move(psNew));
+		psScope = m_vpsScopes.back().get();
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	psScope->iIndex = (unsigned int)(m_vpsScopes.size() - 1);
+	psScope->dwServerAddr = rdsc.dwServerAddr;
+	psScope->dwMask = rdsc.dwMask;
+	psScope->dwSubnetBroadcastAddr = ValueToAddr(dwNetworkValue | ~dwMaskValue);
+	psScope->dwMinAddrValue = dwMinAddrValue;
+	psScope->dwMaxAddrValue = dwMaxAddrValue;
+	psScope->dwNetworkValue = dwNetworkValue;
+	psScope->iPrefixLength = iPrefixLength;
+	psScope->iInterfaceIndex = rdsc.iInterfaceIndex;
+	psScope->bRapidCommit = rdsc.dsoOptions.bRapidCommit;
+	bool bSuccess = psScope->drtReply.Build(rdsc.dwServerAddr, rdsc.dwMask, rdsc.dsoOptions);
+	for (unsigned int i = 0; bSuccess && (i < m_iShardCount); i++)
+	{
+		const uint32_t dwSliceMinValue = dwMinAddrValue + (i * dwSliceSize);
+		const uint32_t dwSliceMaxValue = (m_iShardCount == i + 1) ? dwMaxAddrValue : (dwSliceMinValue + dwSliceSize - 1);
+		LeaseShard& rlsShard = psScope->plsShards[i];
+		bSuccess = rlsShard.ltLeases.Initialize(dwSliceMinValue, dwSliceMaxValue) && rlsShard.apPool.Initialize(dwSliceMinValue, dwSliceMaxValue);
+		rlsShard.apPool.SetPolicy(rdsc.dsoOptions.appAllocationPolicy);
+		if (bSuccess && rlsShard.apPool.Contains(dwServerAddrValue))
+		{
+			bSuccess = rlsShard.ltLeases.Add(dwServerAddrValue, 0, 0);  // Server entry is only entry without a client ID
+			rlsShard.apPool.MarkInUse(dwServerAddrValue);
+		}
+	}
+	// Last, as nothing can undo it (it fails without changing the table)
+	if (!bSuccess || !m_sctSubnets.Insert(dwNetworkValue, iPrefixLength, psScope->iIndex))
+	{
+		m_vpsScopes.pop_back();
+		return false;
+	}
+	if (0 == rdsc.iInterfaceIndex)
+	{
+		m_psAnyInterfaceScope = psScope;
+	}
+	else if (DHCP_SCOPE_RELAYED != rdsc.iInterfaceIndex)
+	{
+		m_vdwScopeOfInterface[rdsc.iInterfaceIndex] = psScope->iIndex + 1;
+	}
+	return true;
+}
+
+void DhcpEngine::ReportEvent(const unsigned int iWorkerIndex, const DhcpEngineEventType detType, const uint8_t* const pbClientHostName, const size_t stClientHostNameSize, const uint32_t dwAddr) const
+{
+	ReportLeaseEvent(iWorkerIndex, detType, pbClientHostName, stClientHostNameSize, dwAddr, 0, 0, 0);
+}
+
+void DhcpEngine::ReportLeaseEvent(const unsigned int iWorkerIndex, const DhcpEngineEventType detType, const uint8_t* const pbClientHostName, const size_t stClientHostNameSize, const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime) const
+{
+	if (0 != m_pfnEvent)
+	{
+		DhcpEngineEvent dee;
+		dee.detType = detType;
+		dee.iWorkerIndex = iWorkerIndex;
+		dee.pbClientHostName = pbClientHostName;
+		dee.stClientHostNameSize = stClientHostNameSize;
+		dee.dwAddr = dwAddr;
+		dee.pbClientIdentifier = pbClientIdentifier;
+		dee.stClientIdentifierSize = stClientIdentifierSize;
+		dee.qwExpireTime = qwExpireTime;
+		m_pfnEvent(dee, m_pvEventContext);
+	}
+}
+
+bool DhcpEngine::IsForThisServer(const Scope& rsScope, const DHCPOptionTable& rdotOptions)
+{
+	// RELEASE and DECLINE carry the server identifier (RFC 2131 table 5); without one, assume this server
+	const uint8_t* pbServerIdentifierData;
+	unsigned int iServerIdentifierDataSize;
+	if (!rdotOptions.Find(option_SERVERIDENTIFIER, &pbServerIdentifierData, &iServerIdentifierDataSize))
+	{
+		return true;
+	}
+	return (sizeof(rsScope.dwServerAddr) == iServerIdentifierDataSize) && (0 == memcmp(&rsScope.dwServerAddr, pbServerIdentifierData, sizeof(rsScope.dwServerAddr)));
+}
+
+DhcpEngine::Scope* DhcpEngine::ScopeOfRequest(const DhcpRequestInfo& rdri) const
+{
+	if ((rdri.iInterfaceIndex < m_vdwScopeOfInterface.size()) && (0 != m_vdwScopeOfInterface[rdri.iInterfaceIndex]))
+	{
+		return m_vpsScopes[m_vdwScopeOfInterface[rdri.iInterfaceIndex] - 1].get();
+	}
+	return m_psAnyInterfaceScope;
+}
+
+DhcpEngine::Scope* DhcpEngine::ScopeOfRelayedRequest(const DHCPMessage& rdhcpmRequest, const DHCPOptionTable& rdotOptions) const
+{
+	// The client is on the relay agent's link: giaddr, unless the agent names
+	// the link separately because giaddr is not on it (RFC 3527)
+	uint32_t dwLinkAddr = rdhcpmRequest.giaddr;
+	const uint8_t* pbRelayAgentInformationData;
+	unsigned int iRelayAgentInformationDataSize;
+	const uint8_t* pbLinkSelectionData;
+	unsigned int iLinkSelectionDataSize;
+	if (rdotOptions.Find(option_RELAYAGENTINFORMATION, &pbRelayAgentInformationData, &iRelayAgentInformationDataSize) &&
+		FindRelayAgentSuboption(relay_agent_suboption_LINKSELECTION, pbRelayAgentInformationData, iRelayAgentInformationDataSize, &pbLinkSelectionData, &iLinkSelectionDataSize) &&
+		(sizeof(dwLinkAddr) == iLinkSelectionDataSize))
+	{
+		memcpy(&dwLinkAddr, pbLinkSelectionData, sizeof(dwLinkAddr));
+	}
+	const int iScope = m_sctSubnets.Find(AddrToValue(dwLinkAddr));
+	return (-1 == iScope) ? 0 : m_vpsScopes[(size_t)iScope].get();
+}
+
+bool DhcpEngine::IsBroadcast(const Scope* const psScope, const uint32_t dwDestinationAddr)
+{
+	return (ADDR_BROADCAST == dwDestinationAddr) || ((0 != psScope) && (psScope->dwSubnetBroadcastAddr == dwDestinationAddr));
+}
+
+void DhcpEngine::SetMetrics(DhcpMetrics* const pdmMetrics)
+{
+	ASSERT(0 != m_iShardCount);
+	m_pdmMetrics = pdmMetrics;
+	for (size_t i = 0; i < m_vpsScopes.size(); i++)
+	{
+		const Scope& rsScope = *m_vpsScopes[i];
+		if (0 != m_pdmMetrics)
+		{
+			char pcsLabel[32];
+			const uint32_t dwNetworkValue = rsScope.dwNetworkValue;
+			snprintf(pcsLabel, sizeof(pcsLabel), "%u.%u.%u.%u/%u", dwNetworkValue >> 24, (dwNetworkValue >> 16) & 0xff, (dwNetworkValue >> 8) & 0xff, dwNetworkValue & 0xff, rsScope.iPrefixLength);
+			m_pdmMetrics->SetScopeLabel(rsScope.iIndex, pcsLabel);  // Keeps the index as the label when out of memory
+		}
+		for (unsigned int j = 0; j < m_iShardCount; j++)
+		{
+			std::lock_guard<std::mutex> lgShard(rsScope.plsShards[j].mtxLock);
+			PublishPoolUsage(rsScope, j);
+		}
+	}
+}
+
+bool DhcpEngine::EnableReplyCache(const size_t stEntryCount)
+{
+	ASSERT((0 != m_iShardCount) && (1 <= stEntryCount) && !m_prcReplyCaches);
+	std::unique_ptr<ReplyCache<DhcpReplyInfo>[]> prcReplyCaches;
+	try
+	{
+		prcReplyCaches.reset(new ReplyCache<DhcpReplyInfo>[m_iShardCount]);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < m_iShardCount; i++)
+	{
+		if (!prcReplyCaches[i].Initialize(stEntryCount))
+		{
+			return false;
+		}
+	}
+	m_prcReplyCaches = std::move(prcReplyCaches);
+	return true;
+}
+
+bool DhcpEngine::EnableAdmissionControl(const DhcpAdmissionLimits& rdal)
+{
+	ASSERT((0 != m_iShardCount) && !m_pacAdmission);
+	std::unique_ptr<AdmissionControl[]> pacAdmission;
+	try
+	{
+		pacAdmission.reset(new AdmissionControl[m_iShardCount]);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < m_iShardCount; i++)
+	{
+		if (!pacAdmission[i].Initialize())
+		{
+			return false;
+		}
+	}
+	SetAdmissionLimits(rdal);
+	m_pacAdmission = std::move(pacAdmission);
+	return true;
+}
+
+void DhcpEngine::SetAdmissionLimits(const DhcpAdmissionLimits& rdal)
+{
+	m_adwClientRate.store(rdal.dwClientRate, std::memory_order_relaxed);
+	m_adwClientBurst.store(rdal.dwClientBurst, std::memory_order_relaxed);
+	m_adwLinkRate.store(rdal.dwLinkRate, std::memory_order_relaxed);
+	m_adwLinkBurst.store(rdal.dwLinkBurst, std::memory_order_relaxed);
+}
+
+DhcpAdmissionLimits DhcpEngine::AdmissionLimits() const
+{
+	DhcpAdmissionLimits dal;
+	dal.dwClientRate = m_adwClientRate.load(std::memory_order_relaxed);
+	dal.dwClientBurst = m_adwClientBurst.load(std::memory_order_relaxed);
+	dal.dwLinkRate = m_adwLinkRate.load(std::memory_order_relaxed);
+	dal.dwLinkBurst = m_adwLinkBurst.load(std::memory_order_relaxed);
+	return dal;
+}
+
+bool DhcpEngine::SetReservations(const ReservationTable* const prtReservations)
+{
+	ASSERT((0 != m_iShardCount) && (0 == m_prtReservations));
+	if (0 == prtReservations)
+	{
+		return true;
+	}
+	// Checked first, so a failure leaves the pools as they were
+	for (size_t i = 0; i < prtReservations->ReservationCount(); i++)
+	{
+		const uint32_t dwAddrValue = AddrToValue(prtReservations->ReservedAddress(i));
+		const int iScope = m_sctSubnets.Find(dwAddrValue);
+		if (-1 != iScope)
+		{
+			const Scope& rsScope = *m_vpsScopes[(size_t)iScope];
+			if ((AddrToValue(rsScope.dwServerAddr) == dwAddrValue) || (rsScope.dwNetworkValue == dwAddrValue) || (AddrToValue(rsScope.dwSubnetBroadcastAddr) == dwAddrValue))
+			{
+				return false;
+			}
+		}
+	}
+	// Pools ignore addresses outside their slice
+	for (size_t i = 0; i < prtReservations->ReservationCount(); i++)
+	{
+		const uint32_t dwAddrValue = AddrToValue(prtReservations->ReservedAddress(i));
+		const int iScope = m_sctSubnets.Find(dwAddrValue);
+		if (-1 != iScope)
+		{
+			const Scope& rsScope = *m_vpsScopes[(size_t)iScope];
+			for (unsigned int j = 0; j < m_iShardCount; j++)
+			{
+				std::lock_guard<std::mutex> lgShard(rsScope.plsShards[j].mtxLock);
+				rsScope.plsShards[j].apPool.MarkInUse(dwAddrValue);
+			}
+		}
+	}
+	for (size_t i = 0; i < m_vpsScopes.size(); i++)
+	{
+		const Scope& rsScope = *m_vpsScopes[i];
+		for (unsigned int j = 0; j < m_iShardCount; j++)
+		{
+			LeaseShard& rlsShard = rsScope.plsShards[j];
+			std::lock_guard<std::mutex> lgShard(rlsShard.mtxLock);
+			for (size_t k = 0; k < prtReservations->ExclusionCount(); k++)
+			{
+				const ReservationExclusion& rre = prtReservations->Exclusion(k);
+				if ((rre.dwFirstAddrValue <= rsScope.dwMaxAddrValue) && (rsScope.dwMinAddrValue <= rre.dwLastAddrValue))
+				{
+					rlsShard.apPool.MarkRangeInUse(rre.dwFirstAddrValue, rre.dwLastAddrValue);
+				}
+			}
+			PublishPoolUsage(rsScope, j);
+		}
+	}
+	m_prtReservations = prtReservations;
+	return true;
+}
+
+bool DhcpEngine::FindReservation(const Scope& rsScope, const DHCPMessage& rdhcpmRequest, const uint8_t* const pbClientIdentifier, const unsigned int iClientIdentifierSize, uint32_t* const pdwAddr) const
+{
+	// The Client Identifier option first (pbClientIdentifier points at chaddr
+	// when there is none), then the hardware address
+	uint32_t dwAddr;
+	bool bFound = (pbClientIdentifier != rdhcpmRequest.chaddr) && m_prtReservations->Find(ReservationKey_CLIENT_IDENTIFIER, pbClientIdentifier, iClientIdentifierSize, &dwAddr);
+	if (!bFound && (1 <= rdhcpmRequest.hlen) && (rdhcpmRequest.hlen <= sizeof(rdhcpmRequest.chaddr)))
+	{
+		bFound = m_prtReservations->Find(ReservationKey_HARDWARE_ADDRESS, rdhcpmRequest.chaddr, rdhcpmRequest.hlen, &dwAddr);
+	}
+	// On another subnet the client is served like any other
+	if (!bFound || ((AddrToValue(dwAddr) & AddrToValue(rsScope.dwMask)) != rsScope.dwNetworkValue))
+	{
+		return false;
+	}
+	*pdwAddr = dwAddr;
+	return true;
+}
+
+void DhcpEngine::PublishPoolUsage(const Scope& rsScope, const unsigned int iShard) const
+{
+	// Caller holds the shard lock
+	if (0 != m_pdmMetrics)
+	{
+		const AddressPool& rapPool = rsScope.plsShards[iShard].apPool;
+		m_pdmMetrics->SetPoolUsage(rsScope.iIndex, iShard, rapPool.Size() - rapPool.FreeCount(), rapPool.Size());
+	}
+}
+
+int DhcpEngine::AdoptAddress(LeaseShard* const plsShard, const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const unsigned int iClientIdentifierSize)
+{
+	// Binds a free address of the shard's slice to a client the shard has no
+	// lease for (the caller sets the expiry); -1 if it is taken, outside the
+	// slice, or there is no memory for the lease
+	const uint32_t dwAddrValue = AddrToValue(dwAddr);
+	if (!plsShard->apPool.Contains(dwAddrValue) || !plsShard->apPool.IsFree(dwAddrValue) ||
+		!plsShard->ltLeases.Add(dwAddrValue, pbClientIdentifier, iClientIdentifierSize))
+	{
+		return -1;
+	}
+	plsShard->apPool.MarkInUse(dwAddrValue);
+	return (int)(plsShard->ltLeases.Size() - 1);
+}
+
+void DhcpEngine::CountDrop(const DhcpRequestInfo& rdri, const DhcpDropReason ddrReason) const
+{
+	// Every worker sees a broadcast, and before its client is known there is no owner to leave it to
+	if ((0 != m_pdmMetrics) && ((0 == rdri.iWorkerIndex) || !IsBroadcast(ScopeOfRequest(rdri), rdri.dwDestinationAddr)))
+	{
+		m_pdmMetrics->CountDrop(rdri.iWorkerIndex, ddrReason);
+	}
+}
+
+bool DhcpEngine::ProcessRequest(const uint8_t* const pbRequest, const size_t stRequestSize, const DhcpRequestInfo& rdri, uint8_t* const pbReply, const size_t stReplyBufferSize, DhcpReplyInfo* const pdri)
+{
+	ASSERT(
+		!m_vpsScopes.empty() &&
+		((0 == stRequestSize) ||
+			(0 != pbRequest)) &&
+		(rdri.iWorkerIndex < m_iShardCount) &&
+		(0 != pbReply) &&
+		(DHCP_REPLY_SIZE <= stReplyBufferSize) &&
+		(0 != pdri)
+	);
+	(void)stReplyBufferSize;
+	// Malformed requests are dropped silently: they come straight off the network
+	const DHCPMessage* const pdhcpmRequest = (const DHCPMessage*)pbRequest;
+	if ((sizeof(DHCPMessage) > stRequestSize) ||
+		(op_BOOTREQUEST != pdhcpmRequest->op) ||
+		(0 != memcmp(pbDHCPMagicCookie, pdhcpmRequest->magicCookie, sizeof(pbDHCPMagicCookie))))
+	{
+		CountDrop(rdri, DhcpDrop_MALFORMED);
+		return false;
+	}
+	// Floods are dropped first, from the fixed header alone, so they cost neither decoding nor a shard lock
+	if (m_pacAdmission)
+	{
+		const AdmissionVerdict avVerdict = m_pacAdmission[rdri.iWorkerIndex].Admit(*pdhcpmRequest, rdri.iInterfaceIndex, rdri.qwNow, AdmissionLimits());
+		if (Admission_ADMIT != avVerdict)
+		{
+			CountDrop(rdri, (Admission_CLIENT_LIMITED == avVerdict) ? DhcpDrop_CLIENT_RATE_LIMITED : DhcpDrop_LINK_RATE_LIMITED);
+			return false;
+		}
+	}
+	// A retransmission gets the reply its request got before, without a second look at the lease state
+	ReplyCache<DhcpReplyInfo>* const prcReplyCache = m_prcReplyCaches ? &m_prcReplyCaches[rdri.iWorkerIndex] : 0;
+	uint64_t qwRequestHash = 0;
+	if (0 != prcReplyCache)
+	{
+		qwRequestHash = ReplyCache<DhcpReplyInfo>::HashRequest(pbRequest, stRequestSize);
+		uint8_t bRequestMessageType;
+		const size_t stReplySize = prcReplyCache->Find(qwRequestHash, *pdhcpmRequest, stRequestSize, rdri.iInterfaceIndex, rdri.qwNow, pbReply, pdri, &bRequestMessageType);
+		if (0 != stReplySize)
+		{
+			if (0 != m_pdmMetrics)
+			{
+				// Only the worker that answered the original (the owner, for a broadcast) has it cached
+				m_pdmMetrics->CountReplyCacheLookup(rdri.iWorkerIndex, true);
+				m_pdmMetrics->CountReceived(rdri.iWorkerIndex, bRequestMessageType);
+				m_pdmMetrics->CountSent(rdri.iWorkerIndex, pbReply[sizeof(DHCPMessage) + DHCP_REPLY_MESSAGE_TYPE_OFFSET]);
+			}
+			return true;
+		}
+	}
+	// Decode every option (including overloaded file/sname fields) in one pass; later lookups are O(1)
+	DHCPOptionTable dotOptions;
+	if (!dotOptions.Decode(pdhcpmRequest->options, stRequestSize - sizeof(DHCPMessage), pdhcpmRequest->file, sizeof(pdhcpmRequest->file), pdhcpmRequest->sname, sizeof(pdhcpmRequest->sname)))
+	{
+		CountDrop(rdri, DhcpDrop_MALFORMED);
+		return false;
+	}
+	// Requests from a link without a scope are not for this server
+	const bool bRelayed = (0 != pdhcpmRequest->giaddr);
+	Scope* const psScope = bRelayed ? ScopeOfRelayedRequest(*pdhcpmRequest, dotOptions) : ScopeOfRequest(rdri);
+	if (0 == psScope)
+	{
+		CountDrop(rdri, DhcpDrop_NO_SCOPE);
+		return false;
+	}
+	DHCPMessageTypes dhcpmtMessageType;
+	if (!GetDHCPMessageType(dotOptions, &dhcpmtMessageType))
+	{
+		CountDrop(rdri, DhcpDrop_NO_MESSAGE_TYPE);
+		return false;
+	}
+	// Determine client host name
+	const uint8_t* pbClientHostName;
+	unsigned int iClientHostNameSize;
+	if (!dotOptions.Find(option_HOSTNAME, &pbClientHostName, &iClientHostNameSize) || (0 == iClientHostNameSize))
+	{
+		CountDrop(rdri, DhcpDrop_NO_HOSTNAME);
+		return false;
+	}
+	// Ignore attempts by the DHCP server to obtain a DHCP address (possible if its current address was obtained by auto-IP) because this would invalidate the scope's server address
+	if ((m_stServerHostNameLength == iClientHostNameSize) && (0 == memcmp(pbClientHostName, m_pcsServerHostName, iClientHostNameSize)))
+	{
+		CountDrop(rdri, DhcpDrop_OWN_REQUEST);
+		return false;
+	}
+
+	// Determine client identifier in proper RFC 2131 order (client identifier option then chaddr)
+	const uint8_t* pbRequestClientIdentifierData;
+	unsigned int iRequestClientIdentifierDataSize;
+	if (!dotOptions.Find(option_CLIENTIDENTIFIER, &pbRequestClientIdentifierData, &iRequestClientIdentifierDataSize) || (0 == iRequestClientIdentifierDataSize))
+	{
+		pbRequestClientIdentifierData = pdhcpmRequest->chaddr;
+		iRequestClientIdentifierDataSize = sizeof(pdhcpmRequest->chaddr);
+	}
+	// Pick the client's shard
+	const uint32_t dwClientHash = HashClientIdentifier(pbRequestClientIdentifierData, iRequestClientIdentifierDataSize);
+	const unsigned int iShard = ShardOfClient(dwClientHash, m_iShardCount);
+	if (IsBroadcast(psScope, rdri.dwDestinationAddr) && (iShard != rdri.iWorkerIndex))
+	{
+		return false;  // The owning worker answers (and counts it)
+	}
+	if (0 != m_pdmMetrics)
+	{
+		if (0 != prcReplyCache)
+		{
+			m_pdmMetrics->CountReplyCacheLookup(rdri.iWorkerIndex, false);
+		}
+		m_pdmMetrics->CountReceived(rdri.iWorkerIndex, dhcpmtMessageType);
+	}
+	// A reserved client's address comes from the reservation, never from the
+	// lease state (the table is read-only, so this needs no lock)
+	uint32_t dwReservedAddr = 0;
+	const bool bReserved = (0 != m_prtReservations) && FindReservation(*psScope, *pdhcpmRequest, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize, &dwReservedAddr);
+	LeaseShard& rlsShard = psScope->plsShards[iShard];
+	std::lock_guard<std::mutex> lgShard(rlsShard.mtxLock);
+	// Determine if we've seen this client before
+	bool bSeenClientBefore = false;
+	uint32_t dwClientPreviousOfferAddr = ADDR_BROADCAST;  // Invalid IP address for later comparison
+	int iIndex = rlsShard.ltLeases.FindByClientIdentifier(pbRequestClientIdentifierData, iRequestClientIdentifierDataSize);
+	if (-1 != iIndex)
+	{
+		dwClientPreviousOfferAddr = ValueToAddr(rlsShard.ltLeases.At((size_t)iIndex).dwAddrValue);
+		bSeenClientBefore = true;
+	}
+
+	// Server message handling
+	// RFC 2131 section 4.3
+	// The reply itself comes from the scope's template once the outcome is known
+	uint8_t bReplyMessageType = 0;
+	uint32_t dwReplyYiaddr = 0;
+	uint32_t dwReplyCiaddr = 0;
+	bool bReplyRapidCommit = false;
+	// Requested IP Address option (DISCOVER, REQUEST and DECLINE)
+	uint32_t dwRequestedIPAddress = ADDR_BROADCAST;  // Invalid IP address for later comparison
+	const uint8_t* pbRequestRequestedIPAddressData = 0;
+	unsigned int iRequestRequestedIPAddressDataSize = 0;
+	if (dotOptions.Find(option_REQUESTEDIPADDRESS, &pbRequestRequestedIPAddressData, &iRequestRequestedIPAddressDataSize) && (sizeof(dwRequestedIPAddress) == iRequestRequestedIPAddressDataSize))
+	{
+		memcpy(&dwRequestedIPAddress, pbRequestRequestedIPAddressData, sizeof(dwRequestedIPAddress));
+	}
+	bool bSendDHCPMessage = false;
+	bool bNoReplyExpected = false;  // RELEASE and DECLINE are not answered (RFC 2131 section 4.3)
+	DhcpDropReason ddrReason = DhcpDrop_IGNORED;  // Why a request that expects a reply got none
+	switch (dhcpmtMessageType)
+	{
+	case DHCPMessageType_DISCOVER:
+	{
+		// RFC 2131 section 4.3.1
+		// RFC 4039 section 3.1: with Rapid Commit the address is committed (and ACKed) right away
+		const bool bRapidCommit = psScope->bRapidCommit && dotOptions.IsPresent(option_RAPIDCOMMIT);
+		uint32_t dwOfferAddrValue;
+		bool bOfferAddrValueValid = false;
+		if (bReserved)
+		{
+			// Out of every pool, so nothing to claim and no lease to keep
+			dwOfferAddrValue = AddrToValue(dwReservedAddr);
+			bOfferAddrValueValid = true;
+		}
+		else if (bSeenClientBefore)
+		{
+			dwOfferAddrValue = AddrToValue(dwClientPreviousOfferAddr);
+			bOfferAddrValueValid = true;
+			// Keep the address at least until the client can answer the offer (a bound lease keeps its longer expiry)
+			if (rlsShard.ltLeases.ExpireTime((size_t)iIndex) < rdri.qwNow + DHCP_OFFER_HOLD_TIME)
+			{
+				rlsShard.ltLeases.SetExpireTime((size_t)iIndex, rdri.qwNow + DHCP_OFFER_HOLD_TIME);
+			}
+		}
+		else if ((ADDR_BROADCAST != dwRequestedIPAddress) && rlsShard.apPool.Contains(AddrToValue(dwRequestedIPAddress)) && rlsShard.apPool.IsFree(AddrToValue(dwRequestedIPAddress)))
+		{
+			// The address the client asked for (typically its previous one), as it is free
+			// UNSUPPORTED: Addresses in another shard's slice
+			dwOfferAddrValue = AddrToValue(dwRequestedIPAddress);
+			rlsShard.apPool.MarkInUse(dwOfferAddrValue);
+			bOfferAddrValueValid = true;
+		}
+		else
+		{
+			// Per the scope's policy: the next free address after the last one offered, or the one the client hashes to (fails in constant time when the pool is exhausted)
+			bOfferAddrValueValid = rlsShard.apPool.Allocate(dwClientHash, &dwOfferAddrValue);
+		}
+		if (bOfferAddrValueValid)
+		{
+			const uint32_t dwOfferAddr = ValueToAddr(dwOfferAddrValue);
+			// The lease table copies the client identifier (inline for the usual sizes, so no heap allocation)
+			if (bReserved || bSeenClientBefore || rlsShard.ltLeases.Add(dwOfferAddrValue, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize))
+			{
+				const size_t stLease = bSeenClientBefore ? (size_t)iIndex : (rlsShard.ltLeases.Size() - 1);
+				if (!bReserved && (0 != m_pfnProbe) && AwaitProbe(*psScope, &rlsShard, rdri, bRelayed, !bSeenClientBefore, dwOfferAddrValue))
+				{
+					// Held for the client like an offer; its retransmission gets the reply once the probe is over
+					if (!bSeenClientBefore)
+					{
+						rlsShard.ltLeases.SetExpireTime(stLease, rdri.qwNow + DHCP_OFFER_HOLD_TIME);
+					}
+					ddrReason = DhcpDrop_PROBE_PENDING;
+					break;
+				}
+				dwReplyYiaddr = dwOfferAddr;
+				bSendDHCPMessage = true;
+				if (bRapidCommit)
+				{
+					if (!bReserved)
+					{
+						rlsShard.ltLeases.SetExpireTime(stLease, rdri.qwNow + DHCP_LEASE_TIME);
+					}
+					bReplyMessageType = DHCPMessageType_ACK;
+					bReplyRapidCommit = true;
+					ReportLeaseEvent(rdri.iWorkerIndex, DhcpEngineEvent_ACK, pbClientHostName, iClientHostNameSize, dwOfferAddr, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize, rdri.qwNow + DHCP_LEASE_TIME);
+				}
+				else
+				{
+					if (!bReserved && !bSeenClientBefore)
+					{
+						rlsShard.ltLeases.SetExpireTime(stLease, rdri.qwNow + DHCP_OFFER_HOLD_TIME);
+					}
+					bReplyMessageType = DHCPMessageType_OFFER;
+					ReportEvent(rdri.iWorkerIndex, DhcpEngineEvent_OFFER, pbClientHostName, iClientHostNameSize, dwOfferAddr);
+				}
+			}
+			else
+			{
+				rlsShard.apPool.MarkFree(dwOfferAddrValue);
+				ddrReason = DhcpDrop_OUT_OF_MEMORY;
+				ReportEvent(rdri.iWorkerIndex, DhcpEngineEvent_OUT_OF_MEMORY, pbClientHostName, iClientHostNameSize, 0);
+			}
+		}
+		else
+		{
+			ddrReason = DhcpDrop_POOL_EXHAUSTED;
+			ReportEvent(rdri.iWorkerIndex, DhcpEngineEvent_POOL_EXHAUSTED, pbClientHostName, iClientHostNameSize, 0);
+		}
+	}
+	break;
+	case DHCPMessageType_REQUEST:
+	{
+		// RFC 2131 section 4.3.2
+		// A client without a lease here (lost in a restart, or offered by a
+		// server that is gone) keeps the address it asks for when that is free:
+		// the lease is created on the spot rather than NAKing it back to DISCOVER
+		// UNSUPPORTED: Addresses in another shard's slice
+		if (bReserved)
+		{
+			// Whatever the state: ACK the reserved address, NAK any other (unless another server was chosen)
+			const uint32_t dwClientAddr = (ADDR_BROADCAST != dwRequestedIPAddress) ? dwRequestedIPAddress : pdhcpmRequest->ciaddr;
+			if ((0 != dwClientAddr) && IsForThisServer(*psScope, dotOptions))
+			{
+				dwClientPreviousOfferAddr = dwReservedAddr;
+				bReplyMessageType = (dwReservedAddr == dwClientAddr) ? DHCPMessageType_ACK : DHCPMessageType_NAK;
+			}
+		}
+		else if (dotOptions.IsPresent(option_SERVERIDENTIFIER) && !IsForThisServer(*psScope, dotOptions))
+		{
+			// DHCPREQUEST generated during SELECTING state, for another server's
+			// offer: the client declined ours, so it is not answered, and the
+			// address held for it goes back to the pool (a bound lease has longer
+			// left to run and is kept)
+			if (bSeenClientBefore && (rlsShard.ltLeases.ExpireTime((size_t)iIndex) <= rdri.qwNow + DHCP_OFFER_HOLD_TIME))
+			{
+				rlsShard.ltLeases.Remove((size_t)iIndex);
+				rlsShard.apPool.MarkFree(AddrToValue(dwClientPreviousOfferAddr));
+			}
+		}
+		else if (dotOptions.IsPresent(option_SERVERIDENTIFIER))
+		{
+			// Response to OFFER
+			// DHCPREQUEST generated during SELECTING state
+			if (!bSeenClientBefore && (ADDR_BROADCAST != dwRequestedIPAddress))
+			{
+				iIndex = AdoptAddress(&rlsShard, dwRequestedIPAddress, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize);
+				if (-1 != iIndex)
+				{
+					dwClientPreviousOfferAddr = dwRequestedIPAddress;
+					bSeenClientBefore = true;
+				}
+			}
+			if (bSeenClientBefore)
+			{
+				// Already have an IP address for this client - ACK it
+				bReplyMessageType = DHCPMessageType_ACK;
+				// Will set other options below
+			}
+			else
+			{
+				// Haven't seen this client before - NAK it
+				bReplyMessageType = DHCPMessageType_NAK;
+				// Will clear invalid options and prepare to send message below
+			}
+		}
+		else
+		{
+			// Request to verify or extend (no server identifier)
+			if (((ADDR_BROADCAST != dwRequestedIPAddress) /*&& (0 == pdhcpmRequest->ciaddr)*/) ||  // DHCPREQUEST generated during INIT-REBOOT state - Some clients set ciaddr in this case, so deviate from the spec by allowing it
+				((ADDR_BROADCAST == dwRequestedIPAddress) && (0 != pdhcpmRequest->ciaddr)))  // Unicast -> DHCPREQUEST generated during RENEWING state / Broadcast -> DHCPREQUEST generated during REBINDING state
+			{
+				if (!bSeenClientBefore)
+				{
+					const uint32_t dwClientAddr = (ADDR_BROADCAST != dwRequestedIPAddress) ? dwRequestedIPAddress : pdhcpmRequest->ciaddr;
+					iIndex = AdoptAddress(&rlsShard, dwClientAddr, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize);
+					if (-1 != iIndex)
+					{
+						dwClientPreviousOfferAddr = dwClientAddr;
+						bSeenClientBefore = true;
+					}
+				}
+				if (bSeenClientBefore && ((dwClientPreviousOfferAddr == dwRequestedIPAddress) || (dwClientPreviousOfferAddr == pdhcpmRequest->ciaddr)))
+				{
+					// Already have an IP address for this client - ACK it
+					bReplyMessageType = DHCPMessageType_ACK;
+					// Will set other options below
+				}
+				else
+				{
+					// Requested address taken by another client, outside the scope (the client moved), or not this client's
+					// Haven't seen this client before or requested IP address is invalid
+					bReplyMessageType = DHCPMessageType_NAK;
+					// Will clear invalid options and prepare to send message below
+				}
+			}
+			// Otherwise invalid data - ignore the request
+		}
+		switch (bReplyMessageType)
+		{
+		case DHCPMessageType_ACK:
+			ASSERT(ADDR_BROADCAST != dwClientPreviousOfferAddr);
+			dwReplyCiaddr = dwClientPreviousOfferAddr;
+			dwReplyYiaddr = dwClientPreviousOfferAddr;
+			if (!bReserved)
+			{
+				rlsShard.ltLeases.SetExpireTime((size_t)iIndex, rdri.qwNow + DHCP_LEASE_TIME);
+			}
+			bSendDHCPMessage = true;
+			ReportLeaseEvent(rdri.iWorkerIndex, DhcpEngineEvent_ACK, pbClientHostName, iClientHostNameSize, dwClientPreviousOfferAddr, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize, rdri.qwNow + DHCP_LEASE_TIME);
+			break;
+		case DHCPMessageType_NAK:
+			// The NAK template has no lease time or subnet mask
+			bSendDHCPMessage = true;
+			ReportEvent(rdri.iWorkerIndex, DhcpEngineEvent_NAK, pbClientHostName, iClientHostNameSize, 0);
+			break;
+		default:
+			// Nothing to do
+			break;
+		}
+	}
+	break;
+	// 维护IP-MAC映射，及时删除映射或者临时禁用IP分配
+	case DHCPMessageType_DECLINE:
+	{
+		// RFC 2131 section 4.3.3
+		// The client found the address already in use, so it must not be offered again for a while
+		const uint32_t dwDeclinedAddr = dwRequestedIPAddress;
+		if ((ADDR_BROADCAST == dwDeclinedAddr) || !IsForThisServer(*psScope, dotOptions))
+		{
+			break;
+		}
+		const uint32_t dwDeclinedAddrValue = AddrToValue(dwDeclinedAddr);
+		const uint64_t qwQuarantineEnd = rdri.qwNow + DHCP_DECLINE_QUARANTINE_TIME;
+		if (bReserved)
+		{
+			// Nothing to quarantine: the address is never offered to anyone else
+			bNoReplyExpected = true;
+		}
+		else if (bSeenClientBefore && (dwClientPreviousOfferAddr == dwDeclinedAddr))
+		{
+			// The address stays in use in the pool; only the client binding goes
+			rlsShard.ltLeases.Quarantine((size_t)iIndex, qwQuarantineEnd);
+			bNoReplyExpected = true;
+			ReportLeaseEvent(rdri.iWorkerIndex, DhcpEngineEvent_DECLINE, pbClientHostName, iClientHostNameSize, dwDeclinedAddr, 0, 0, qwQuarantineEnd);
+		}
+		else if (rlsShard.apPool.Contains(dwDeclinedAddrValue) && rlsShard.apPool.IsFree(dwDeclinedAddrValue))
+		{
+			// Not bound to this client (e.g. offered before a restart), but still not safe to offer
+			// UNSUPPORTED: Addresses in another shard's slice
+			if (rlsShard.ltLeases.Add(dwDeclinedAddrValue, 0, 0))
+			{
+				rlsShard.apPool.MarkInUse(dwDeclinedAddrValue);
+				rlsShard.ltLeases.Quarantine(rlsShard.ltLeases.Size() - 1, qwQuarantineEnd);
+				bNoReplyExpected = true;
+				ReportLeaseEvent(rdri.iWorkerIndex, DhcpEngineEvent_DECLINE, pbClientHostName, iClientHostNameSize, dwDeclinedAddr, 0, 0, qwQuarantineEnd);
+			}
+			else
+			{
+				ddrReason = DhcpDrop_OUT_OF_MEMORY;
+				ReportEvent(rdri.iWorkerIndex, DhcpEngineEvent_OUT_OF_MEMORY, pbClientHostName, iClientHostNameSize, 0);
+			}
+		}
+	}
+	break;
+	// 维护IP-MAC映射，删除映射
+	case DHCPMessageType_RELEASE:
+		// RFC 2131 section 4.3.4
+		if (bReserved)
+		{
+			// The address stays reserved; there is no lease to end
+			bNoReplyExpected = true;
+		}
+		else if (bSeenClientBefore && (dwClientPreviousOfferAddr == pdhcpmRequest->ciaddr) && IsForThisServer(*psScope, dotOptions))
+		{
+			rlsShard.ltLeases.Remove((size_t)iIndex);
+			rlsShard.apPool.MarkFree(AddrToValue(dwClientPreviousOfferAddr));
+			bNoReplyExpected = true;
+			ReportLeaseEvent(rdri.iWorkerIndex, DhcpEngineEvent_RELEASE, pbClientHostName, iClientHostNameSize, dwClientPreviousOfferAddr, pbRequestClientIdentifierData, iRequestClientIdentifierDataSize, 0);
+		}
+		break;
+	case DHCPMessageType_INFORM:
+		// Unsupported DHCP message type - fail silently
+		break;
+	case DHCPMessageType_OFFER:
+	case DHCPMessageType_ACK:
+	case DHCPMessageType_NAK:
+		// Server-to-client message types - ignore
+		break;
+	default:
+		ASSERT(!"Invalid DHCPMessageType");
+		break;
+	}
+	if (bSendDHCPMessage)
+	{
+		ASSERT(0 != bReplyMessageType);  // Must have set a message type if we're going to be sending this message
+		// RFC 3046 section 2.2: the relay agent's information goes back to it unchanged
+		const uint8_t* pbRelayAgentInformationData = 0;
+		unsigned int iRelayAgentInformationDataSize = 0;
+		if (bRelayed)
+		{
+			dotOptions.Find(option_RELAYAGENTINFORMATION, &pbRelayAgentInformationData, &iRelayAgentInformationDataSize);
+		}
+		const size_t stReplySize = psScope->drtReply.Write(*pdhcpmRequest, bReplyMessageType, dwReplyYiaddr, dwReplyCiaddr, bReplyRapidCommit, pbRelayAgentInformationData, iRelayAgentInformationDataSize, pbReply);
+		DHCPMessage* const pdhcpmReply = (DHCPMessage*)pbReply;
+		// Determine how to send the reply
+		// RFC 2131 section 4.1
+		uint32_t dwAddr = 0;  // Invalid value
+		pdri->dwSourceAddr = psScope->dwServerAddr;
+		pdri->wDestinationPort = DHCP_CLIENT_PORT;
+		pdri->iInterfaceIndex = 0;
+		pdri->bToHardwareAddress = false;
+		if (!bRelayed)
+		{
+			// The client is on the link the request came in on, and a broadcast must go out there too
+			pdri->iInterfaceIndex = rdri.iInterfaceIndex;
+			switch (bReplyMessageType)
+			{
+			case DHCPMessageType_OFFER:
+				// Fall-through
+			case DHCPMessageType_ACK:
+			{
+				if (0 == pdhcpmRequest->ciaddr)
+				{
+					if (0 != (BROADCAST_FLAG & ((const uint8_t*)&pdhcpmRequest->flags)[0]))
+					{
+						dwAddr = ADDR_BROADCAST;
+					}
+					else
+					{
+						dwAddr = pdhcpmRequest->yiaddr;  // Already in network order
+						if (0 == dwAddr)
+						{
+							if (rdri.bUnicastToHardwareAddress && (1 == pdhcpmRequest->htype) && (6 == pdhcpmRequest->hlen))
+							{
+								// The transport writes the frame itself: to chaddr, for the offered address
+								dwAddr = dwReplyYiaddr;
+								pdri->bToHardwareAddress = true;
+							}
+							else
+							{
+								// Without it, broadcast the response and rely on other DHCP clients to ignore it
+								dwAddr = ADDR_BROADCAST;
+							}
+						}
+					}
+				}
+				else
+				{
+					dwAddr = pdhcpmRequest->ciaddr;  // Already in network order
+				}
+			}
+			break;
+			case DHCPMessageType_NAK:
+			{
+				dwAddr = ADDR_BROADCAST;
+			}
+			break;
+			default:
+				ASSERT(!"Invalid DHCPMessageType");
+				break;
+			}
+		}
+		else
+		{
+			dwAddr = pdhcpmRequest->giaddr;  // Already in network order
+			pdri->wDestinationPort = DHCP_SERVER_PORT;  // Relay agents listen on the server port
+			((uint8_t*)&pdhcpmReply->flags)[0] |= BROADCAST_FLAG;  // Indicate to the relay agent that it must broadcast
+		}
+		ASSERT(0 != dwAddr);
+		pdri->dwDestinationAddr = dwAddr;
+		pdri->stSize = stReplySize;
+		if (0 != prcReplyCache)
+		{
+			prcReplyCache->Insert(qwRequestHash, *pdhcpmRequest, stRequestSize, rdri.iInterfaceIndex, rdri.qwNow + DHCP_REPLY_CACHE_TIME, (uint8_t)dhcpmtMessageType, pbReply, stReplySize, *pdri);
+		}
+	}
+	if (0 != m_pdmMetrics)
+	{
+		if (bSendDHCPMessage)
+		{
+			m_pdmMetrics->CountSent(rdri.iWorkerIndex, bReplyMessageType);
+		}
+		else if (!bNoReplyExpected)
+		{
+			m_pdmMetrics->CountDrop(rdri.iWorkerIndex, ddrReason);
+		}
+		PublishPoolUsage(*psScope, iShard);
+	}
+	return bSendDHCPMessage;
+}
+
+size_t DhcpEngine::ExpireLeases(const unsigned int iShard, const uint64_t qwNow)
+{
+	ASSERT(iShard < m_iShardCount);
+	// Expiry times are whole seconds, so once a second is enough; workers call
+	// this per batch, and with thousands of scopes the walk is not free
+	if (m_pqwLastExpiry[iShard] == qwNow)
+	{
+		return 0;
+	}
+	m_pqwLastExpiry[iShard] = qwNow;
+	size_t stExpired = 0;
+	for (size_t i = 0; i < m_vpsScopes.size(); i++)
+	{
+		const Scope& rsScope = *m_vpsScopes[i];
+		LeaseShard& rlsShard = rsScope.plsShards[iShard];
+		ExpiryContext ec;
+		ec.pdeEngine = this;
+		ec.psScope = &rsScope;
+		ec.plsShard = &rlsShard;
+		ec.iShard = iShard;
+		std::lock_guard<std::mutex> lgShard(rlsShard.mtxLock);
+		const size_t stScopeExpired = rlsShard.ltLeases.ExpireLeases(qwNow, OnLeaseExpired, &ec);
+		if (0 != stScopeExpired)
+		{
+			PublishPoolUsage(rsScope, iShard);
+			stExpired += stScopeExpired;
+		}
+	}
+	if ((0 != m_pdmMetrics) && (0 != stExpired))
+	{
+		// Only the owning worker expires its shard, so iShard is also the writing worker
+		m_pdmMetrics->CountExpired(iShard, stExpired);
+	}
+	return stExpired;
+}
+
+bool DhcpEngine::AwaitProbe(const Scope& rsScope, LeaseShard* const plsShard, const DhcpRequestInfo& rdri, const bool bRelayed, const bool bFromPool, const uint32_t dwAddrValue) const
+{
+	ASSERT(0 != m_pfnProbe);
+	switch (plsShard->pcProbes.Find(dwAddrValue, rdri.qwNow))
+	{
+	case Probe_PENDING:
+		return true;
+	case Probe_FREE:
+		return false;
+	default:
+		break;
+	}
+	// Only an address that nobody had a moment ago can be taken by a host the
+	// server does not know of; a client's own lease was probed (or held) before
+	if (!bFromPool)
+	{
+		return false;
+	}
+	if (!plsShard->pcProbes.Start(dwAddrValue, rdri.qwNow, rdri.qwNow + DHCP_PROBE_TIMEOUT, rdri.qwNow + DHCP_PROBE_TIMEOUT + DHCP_PROBE_CACHE_TIME))
+	{
+		return false;  // Offered unprobed rather than not at all
+	}
+	DhcpProbe dpProbe;
+	dpProbe.dwAddr = ValueToAddr(dwAddrValue);
+	dpProbe.dwSourceAddr = rsScope.dwServerAddr;
+	dpProbe.iInterfaceIndex = bRelayed ? 0 : rdri.iInterfaceIndex;
+	dpProbe.iWorkerIndex = rdri.iWorkerIndex;
+	if (!m_pfnProbe(dpProbe, m_pvProbeContext))
+	{
+		plsShard->pcProbes.Remove(dwAddrValue);
+		return false;
+	}
+	return true;
+}
+
+void DhcpEngine::ReportProbeAnswer(const unsigned int iWorkerIndex, const uint32_t dwAddr, const uint64_t qwNow)
+{
+	const uint32_t dwAddrValue = AddrToValue(dwAddr);
+	const int iScope = m_sctSubnets.Find(dwAddrValue);
+	const Scope* const psScope = (-1 == iScope) ? 0 : m_vpsScopes[(size_t)iScope].get();
+	if ((0 == psScope) || (dwAddrValue < psScope->dwMinAddrValue) || (psScope->dwMaxAddrValue < dwAddrValue))
+	{
+		return;  // Not an address this server probes
+	}
+	// The shard serving the address started the probe
+	unsigned int iShard = 0;
+	while ((iShard < m_iShardCount) && !psScope->plsShards[iShard].apPool.Contains(dwAddrValue))
+	{
+		iShard++;
+	}
+	if (m_iShardCount == iShard)
+	{
+		return;
+	}
+	LeaseShard& rlsShard = psScope->plsShards[iShard];
+	std::lock_guard<std::mutex> lgShard(rlsShard.mtxLock);
+	if (Probe_PENDING != rlsShard.pcProbes.Find(dwAddrValue, qwNow))
+	{
+		return;  // Too late (the address may be offered already), or never probed
+	}
+	rlsShard.pcProbes.Remove(dwAddrValue);
+	const int iIndex = rlsShard.ltLeases.FindByAddrValue(dwAddrValue);
+	if (-1 != iIndex)
+	{
+		// The address stays in use in the pool; the waiting client's binding goes
+		const uint64_t qwQuarantineEnd = qwNow + DHCP_DECLINE_QUARANTINE_TIME;
+		rlsShard.ltLeases.Quarantine((size_t)iIndex, qwQuarantineEnd);
+		ReportLeaseEvent(iWorkerIndex, DhcpEngineEvent_CONFLICT, 0, 0, dwAddr, 0, 0, qwQuarantineEnd);
+	}
+}
+
+void DhcpEngine::OnLeaseExpired(const AddressInUseInformation& raiui, void* const pvContext)
+{
+	const ExpiryContext* const pec = (const ExpiryContext*)pvContext;
+	pec->plsShard->apPool.MarkFree(raiui.dwAddrValue);
+	// Quarantined addresses are the only expiring records without a client identifier
+	pec->pdeEngine->ReportLeaseEvent(pec->iShard, (0 == raiui.dwClientIdentifierSize) ? DhcpEngineEvent_QUARANTINE_ENDED : DhcpEngineEvent_EXPIRED, 0, 0, ValueToAddr(raiui.dwAddrValue), raiui.GetClientIdentifier(), raiui.dwClientIdentifierSize, 0);
+}
+
+bool DhcpEngine::RestoreLease(const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime)
+{
+	ASSERT((0 != m_iShardCount) && ((0 == stClientIdentifierSize) || (0 != pbClientIdentifier)));
+	const uint32_t dwAddrValue = AddrToValue(dwAddr);
+	// A scope's range is inside its subnet, so the subnet table finds the only candidate
+	const int iScope = m_sctSubnets.Find(dwAddrValue);
+	const Scope* const psScope = (-1 == iScope) ? 0 : m_vpsScopes[(size_t)iScope].get();
+	if ((0 == psScope) || (dwAddrValue < psScope->dwMinAddrValue) || (psScope->dwMaxAddrValue < dwAddrValue))
+	{
+		return false;  // The scope went away with its interface
+	}
+	unsigned int iShard = 0;
+	if (0 != stClientIdentifierSize)
+	{
+		if (MAX_CLIENT_IDENTIFIER_SIZE < stClientIdentifierSize)
+		{
+			return false;
+		}
+		iShard = ShardOfClient(HashClientIdentifier(pbClientIdentifier, (uint32_t)stClientIdentifierSize), m_iShardCount);
+	}
+	else
+	{
+		// A quarantined address has no client, so it goes to the shard serving it
+		while ((iShard < m_iShardCount) && !psScope->plsShards[iShard].apPool.Contains(dwAddrValue))
+		{
+			iShard++;
+		}
+		if (m_iShardCount == iShard)
+		{
+			return false;
+		}
+	}
+	LeaseShard& rlsShard = psScope->plsShards[iShard];
+	std::lock_guard<std::mutex> lgShard(rlsShard.mtxLock);
+	if (!rlsShard.apPool.Contains(dwAddrValue) || !rlsShard.apPool.IsFree(dwAddrValue) ||
+		((0 != stClientIdentifierSize) && (-1 != rlsShard.ltLeases.FindByClientIdentifier(pbClientIdentifier, (uint32_t)stClientIdentifierSize))))
+	{
+		return false;
+	}
+	if (!rlsShard.ltLeases.Add(dwAddrValue, pbClientIdentifier, (uint32_t)stClientIdentifierSize))
+	{
+		return false;
+	}
+	rlsShard.apPool.MarkInUse(dwAddrValue);
+	if (0 != stClientIdentifierSize)
+	{
+		rlsShard.ltLeases.SetExpireTime(rlsShard.ltLeases.Size() - 1, qwExpireTime);
+	}
+	else
+	{
+		rlsShard.ltLeases.Quarantine(rlsShard.ltLeases.Size() - 1, qwExpireTime);
+	}
+	PublishPoolUsage(*psScope, iShard);
+	return true;
+}
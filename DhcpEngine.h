@@ -0,0 +1,274 @@
+#if !defined(DHCP_ENGINE_HEADER)
+#define DHCP_ENGINE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "LeaseTable.h"
+#include "AddressPool.h"
+#include "DHCPMessage.h"
+#include "DhcpMetrics.h"
+#include "DhcpReplyTemplate.h"
+#include "ScopeTable.h"
+#include "ReplyCache.h"
+#include "AdmissionControl.h"
+#include "ReservationTable.h"
+#include "ProbeCache.h"
+
+class DHCPOptionTable;
+
+// Longest server host name the engine keeps (for ignoring its own requests)
+#define DHCP_ENGINE_MAX_HOSTNAME_LENGTH (256)
+// Lease time granted in ACKs (option 51), in seconds
+#define DHCP_LEASE_TIME (1 * 60 * 60)  // One hour
+// Renewal (T1) and rebinding (T2) times (options 58 and 59), at the RFC 2131 section 4.4.5 defaults
+#define DHCP_RENEWAL_TIME (DHCP_LEASE_TIME / 2)
+#define DHCP_REBINDING_TIME ((DHCP_LEASE_TIME * 7) / 8)
+// How long an offered address waits for the client's REQUEST before it returns to the pool
+#define DHCP_OFFER_HOLD_TIME (2 * 60)
+// How long a DECLINEd address (in use by some other host) is kept out of the pool
+#define DHCP_DECLINE_QUARANTINE_TIME (1 * 60 * 60)
+// How long a reply is resent to retransmissions of its request from the reply
+// cache; covers a client's first retransmission (after about 4 seconds, RFC
+// 2131 section 4.1) with room for its randomization and clock rounding
+#define DHCP_REPLY_CACHE_TIME (8)
+// How long a conflict probe waits for an answer; shorter than a client's first
+// retransmission (about 4 seconds), which is then answered
+#define DHCP_PROBE_TIMEOUT (2)
+// How long an address nobody answered a probe for is offered without another probe
+#define DHCP_PROBE_CACHE_TIME (5 * 60)
+
+// DhcpScopeConfig::iInterfaceIndex of a subnet only reached through relay agents
+#define DHCP_SCOPE_RELAYED (0xffffffffu)
+
+// One served subnet: the lease state, pool and reply template of each scope are separate
+struct DhcpScopeConfig
+{
+	uint32_t dwServerAddr;  // Network order; the server identifier on this subnet
+	uint32_t dwMask;  // Network order; with dwMinAddr, the subnet relayed requests are matched against
+	uint32_t dwMinAddr;  // Served range [dwMinAddr, dwMaxAddr], network order
+	uint32_t dwMaxAddr;
+	unsigned int iInterfaceIndex;  // Interface the subnet is attached to; 0 serves requests from any interface, DHCP_SCOPE_RELAYED none
+	DhcpScopeOptions dsoOptions;  // Sent in every OFFER and ACK besides the lease time and subnet mask
+};
+
+// What the transport knows about a received request
+struct DhcpRequestInfo
+{
+	uint32_t dwDestinationAddr;  // Network order (IP_PKTINFO); INADDR_BROADCAST when unknown
+	unsigned int iInterfaceIndex;  // Ingress interface (IP_PKTINFO); 0 when unknown
+	unsigned int iWorkerIndex;  // Receiving worker; always 0 with a single shard
+	uint64_t qwNow;  // Seconds on any clock that never goes backwards; lease expiry is measured against it
+	bool bUnicastToHardwareAddress;  // The transport can send to an address the client has not configured yet (RFC 2131 section 4.1)
+};
+
+// Where to send a reply
+struct DhcpReplyInfo
+{
+	uint32_t dwDestinationAddr;  // Network order
+	uint16_t wDestinationPort;  // DHCP_CLIENT_PORT, or DHCP_SERVER_PORT for a relay agent (RFC 2131 section 4.1)
+	uint32_t dwSourceAddr;  // Network order; the scope's server address
+	unsigned int iInterfaceIndex;  // Egress interface (the ingress one for a client on the link); 0 lets routing choose
+	bool bToHardwareAddress;  // Frame to the request's chaddr rather than resolving dwDestinationAddr (DhcpRequestInfo::bUnicastToHardwareAddress)
+	size_t stSize;
+};
+
+// Lease decisions reported to the host application, which owns all output
+enum DhcpEngineEventType
+{
+	DhcpEngineEvent_OFFER,
+	DhcpEngineEvent_ACK,
+	DhcpEngineEvent_NAK,
+	DhcpEngineEvent_POOL_EXHAUSTED,
+	DhcpEngineEvent_OUT_OF_MEMORY,
+	DhcpEngineEvent_EXPIRED,  // No host name: the lease table does not keep it
+	DhcpEngineEvent_RELEASE,
+	DhcpEngineEvent_DECLINE,
+	DhcpEngineEvent_QUARANTINE_ENDED,  // No host name
+	DhcpEngineEvent_CONFLICT,  // No host name; an address about to be offered answered a probe, and is quarantined
+};
+struct DhcpEngineEvent
+{
+	DhcpEngineEventType detType;
+	unsigned int iWorkerIndex;  // Worker whose thread reports the event (DhcpRequestInfo::iWorkerIndex)
+	const uint8_t* pbClientHostName;  // Not NUL-terminated; points into the request
+	size_t stClientHostNameSize;
+	uint32_t dwAddr;  // Network order; 0 when no address is involved
+	// Set for events that change a binding (ACK, RELEASE, DECLINE, EXPIRED) so it can be persisted
+	const uint8_t* pbClientIdentifier;  // 0 when there is no client
+	size_t stClientIdentifierSize;
+	uint64_t qwExpireTime;  // Clock of DhcpRequestInfo::qwNow; 0 when the binding ends
+};
+// Called on the processing thread with the client's shard locked
+typedef void (*PFN_DHCP_ENGINE_EVENT)(const DhcpEngineEvent& rdee, void* pvContext);
+
+// An address to check for another host before it is offered
+struct DhcpProbe
+{
+	uint32_t dwAddr;  // Network order
+	uint32_t dwSourceAddr;  // Network order; the scope's server address
+	unsigned int iInterfaceIndex;  // The client's link; 0 (relayed) lets routing choose
+	unsigned int iWorkerIndex;  // Worker whose thread starts the probe (DhcpRequestInfo::iWorkerIndex)
+};
+// Sends a probe (an ICMP echo request, say) without waiting for the answer,
+// which goes to DhcpEngine::ReportProbeAnswer; false if it could not be sent,
+// and the address is offered unprobed. Called on the processing thread with
+// the client's shard locked.
+typedef bool (*PFN_DHCP_ENGINE_PROBE)(const DhcpProbe& rdp, void* pvContext);
+
+// The DHCP protocol logic (RFC 2131/2132) without any I/O: a request goes in
+// as bytes, the reply comes out in a caller-supplied buffer along with its
+// destination. Each scope (served subnet) has its own lease state. A relayed
+// request is matched to its scope by the relay agent's link (giaddr, or the
+// RFC 3527 link selection sub-option) through a longest-prefix-match trie
+// over the scopes' subnets; any other by the interface it arrived on through
+// a table indexed by interface index. Within a scope, lease state is split into
+// shards by client identifier hash so several receive workers can share one
+// engine; a shard is owned by the worker with the same index and each
+// allocates from its own slice of the scope's range, so address allocation
+// never coordinates across shards.
+class DhcpEngine
+{
+public:
+	DhcpEngine();
+
+	bool Initialize(const char* const pcsServerHostName, const unsigned int iShardCount);
+	// Call after Initialize, before serving. Fails if the range holds fewer
+	// addresses than there are shards, is not inside the subnet (dwMask must
+	// be a prefix), overlaps another scope's range, the subnet or interface
+	// already has a scope, or the options do not fit in a reply.
+	bool AddScope(const DhcpScopeConfig& rdsc);
+	void SetEventHandler(const PFN_DHCP_ENGINE_EVENT pfnEvent, void* const pvContext) { m_pfnEvent = pfnEvent; m_pvEventContext = pvContext; }
+	// Counts requests, replies, drops and pool usage into pdmMetrics (sized
+	// for ShardCount() workers and ScopeCount() scopes); call after the
+	// scopes are added, before serving
+	void SetMetrics(DhcpMetrics* const pdmMetrics);
+	DhcpMetrics* Metrics() const { return m_pdmMetrics; }
+	// Gives each worker a cache of stEntryCount recent replies (rounded up to
+	// a power of 2), which answers retransmissions of their requests for
+	// DHCP_REPLY_CACHE_TIME seconds; call after Initialize, before serving
+	bool EnableReplyCache(const size_t stEntryCount);
+	// Gives each worker admission control (AdmissionControl.h), which drops
+	// requests from clients or links over rdal's limits before any other
+	// work; call after Initialize, before serving
+	bool EnableAdmissionControl(const DhcpAdmissionLimits& rdal);
+	// Any thread, while serving: each worker applies the new limits from its next request
+	void SetAdmissionLimits(const DhcpAdmissionLimits& rdal);
+	DhcpAdmissionLimits AdmissionLimits() const;
+	// Serves the reservations in prtReservations (built, and kept while
+	// serving): a reserved client gets its fixed address whenever it asks on
+	// the scope whose subnet holds it, and the reserved addresses and the
+	// excluded ranges leave the scopes' pools. Call after the scopes are
+	// added, before restoring leases or serving. Fails if an address reserved
+	// in a scope is its server, network or broadcast address.
+	bool SetReservations(const ReservationTable* const prtReservations);
+	// Probes every address fresh from a pool before offering it: the
+	// DISCOVER is not answered while the probe is pending (for up to
+	// DHCP_PROBE_TIMEOUT seconds), and the client's retransmission gets the
+	// offer. Call before serving; 0 turns probing off.
+	void SetProber(const PFN_DHCP_ENGINE_PROBE pfnProbe, void* const pvContext) { m_pfnProbe = pfnProbe; m_pvProbeContext = pvContext; }
+	// Any thread: dwAddr (network order) answered a probe. While the probe is
+	// pending, the address is quarantined like a DECLINEd one, and the client
+	// waiting for it gets another one when it retransmits.
+	void ReportProbeAnswer(const unsigned int iWorkerIndex, const uint32_t dwAddr, const uint64_t qwNow);
+
+	// Returns true if the reply written to pbReply (stReplyBufferSize must be
+	// at least DHCP_REPLY_SIZE) should be sent; malformed or ignored requests
+	// return false. Broadcasts are seen by every worker, so only the worker
+	// owning the client's shard answers them.
+	bool ProcessRequest(const uint8_t* const pbRequest, const size_t stRequestSize, const DhcpRequestInfo& rdri, uint8_t* const pbReply, const size_t stReplyBufferSize, DhcpReplyInfo* const pdri);
+
+	// Returns the addresses of leases in iShard (of every scope) that expired at or before
+	// qwNow (same clock as DhcpRequestInfo::qwNow) to the pool and returns
+	// how many there were. The owning worker calls this from its receive
+	// loop; the cost is proportional to the expired leases, not to the table.
+	size_t ExpireLeases(const unsigned int iShard, const uint64_t qwNow);
+
+	// Counts a request the transport dropped before it reached
+	// ProcessRequest; a broadcast is only counted by worker 0
+	void CountDrop(const DhcpRequestInfo& rdri, const DhcpDropReason ddrReason) const;
+
+	// Re-creates a lease saved before a restart (an empty client identifier
+	// restores a DECLINE quarantine). Fails if no scope serves the address, or
+	// it is taken or not served by the client's shard, which happens when the
+	// shard count changed.
+	bool RestoreLease(const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime);
+
+	unsigned int ShardCount() const { return m_iShardCount; }
+	unsigned int ScopeCount() const { return (unsigned int)m_vpsScopes.size(); }
+
+private:
+	struct LeaseShard
+	{
+		LeaseTable ltLeases;
+		AddressPool apPool;
+		ProbeCache pcProbes;  // Addresses being probed, or found free by a probe lately
+		std::mutex mtxLock;  // Only contended when a unicast request lands on a worker that does not own the client
+	};
+
+	struct Scope
+	{
+		std::unique_ptr<LeaseShard[]> plsShards;
+		unsigned int iIndex;  // In m_vpsScopes; labels the scope's metrics
+		uint32_t dwServerAddr;
+		uint32_t dwMask;
+		uint32_t dwSubnetBroadcastAddr;
+		uint32_t dwMinAddrValue;
+		uint32_t dwMaxAddrValue;
+		uint32_t dwNetworkValue;
+		unsigned int iPrefixLength;
+		unsigned int iInterfaceIndex;
+		bool bRapidCommit;
+		DhcpReplyTemplate drtReply;
+	};
+
+	struct ExpiryContext
+	{
+		const DhcpEngine* pdeEngine;
+		const Scope* psScope;
+		LeaseShard* plsShard;
+		unsigned int iShard;
+	};
+
+	void ReportEvent(const unsigned int iWorkerIndex, const DhcpEngineEventType detType, const uint8_t* const pbClientHostName, const size_t stClientHostNameSize, const uint32_t dwAddr) const;
+	void ReportLeaseEvent(const unsigned int iWorkerIndex, const DhcpEngineEventType detType, const uint8_t* const pbClientHostName, const size_t stClientHostNameSize, const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime) const;
+	Scope* ScopeOfRequest(const DhcpRequestInfo& rdri) const;
+	Scope* ScopeOfRelayedRequest(const DHCPMessage& rdhcpmRequest, const DHCPOptionTable& rdotOptions) const;
+	static bool IsForThisServer(const Scope& rsScope, const DHCPOptionTable& rdotOptions);
+	static bool IsBroadcast(const Scope* const psScope, const uint32_t dwDestinationAddr);
+	void PublishPoolUsage(const Scope& rsScope, const unsigned int iShard) const;
+	bool FindReservation(const Scope& rsScope, const DHCPMessage& rdhcpmRequest, const uint8_t* const pbClientIdentifier, const unsigned int iClientIdentifierSize, uint32_t* const pdwAddr) const;
+	bool AwaitProbe(const Scope& rsScope, LeaseShard* const plsShard, const DhcpRequestInfo& rdri, const bool bRelayed, const bool bFromPool, const uint32_t dwAddrValue) const;
+	static int AdoptAddress(LeaseShard* const plsShard, const uint32_t dwAddr, const uint8_t* const pbClientIdentifier, const unsigned int iClientIdentifierSize);
+	static void OnLeaseExpired(const AddressInUseInformation& raiui, void* const pvContext);
+
+	DhcpEngine(const DhcpEngine&);
+	DhcpEngine& operator=(const DhcpEngine&);
+
+	std::vector<std::unique_ptr<Scope>> m_vpsScopes;
+	std::vector<uint32_t> m_vdwScopeOfInterface;  // Indexed by interface index: scope index + 1, 0 for none
+	Scope* m_psAnyInterfaceScope;  // Serves interfaces without a scope of their own (iInterfaceIndex 0)
+	ScopeTable m_sctSubnets;  // Every scope's subnet, for relayed requests
+	unsigned int m_iShardCount;
+	std::unique_ptr<uint64_t[]> m_pqwLastExpiry;  // Per shard: when ExpireLeases last ran
+	std::unique_ptr<ReplyCache<DhcpReplyInfo>[]> m_prcReplyCaches;  // Per worker (only it touches it); 0 when disabled
+	std::unique_ptr<AdmissionControl[]> m_pacAdmission;  // Per worker (only it touches it); 0 when disabled
+	const ReservationTable* m_prtReservations;  // 0 when there are none
+	// DhcpAdmissionLimits, changed at any time; a worker may see a mix of old and new fields for one request
+	std::atomic<uint32_t> m_adwClientRate;
+	std::atomic<uint32_t> m_adwClientBurst;
+	std::atomic<uint32_t> m_adwLinkRate;
+	std::atomic<uint32_t> m_adwLinkBurst;
+	char m_pcsServerHostName[DHCP_ENGINE_MAX_HOSTNAME_LENGTH];
+	size_t m_stServerHostNameLength;
+	PFN_DHCP_ENGINE_EVENT m_pfnEvent;
+	void* m_pvEventContext;
+	PFN_DHCP_ENGINE_PROBE m_pfnProbe;  // 0 when probing is off
+	void* m_pvProbeContext;
+	DhcpMetrics* m_pdmMetrics;
+};
+
+#endif  // !defined(DHCP_ENGINE_HEADER)
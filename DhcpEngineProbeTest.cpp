@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "ToolBox.h"
+#include "DhcpEngine.h"
+#include "DhcpMetrics.h"
+#include "DHCPClientMessage.h"
+#include "UnitTest.h"
+
+// Conflict probing through DhcpEngine with a fake prober: the test records
+// the probes the engine asks for and plays the hosts that answer them
+// (ReportProbeAnswer), on the engine's virtual clock
+
+#define TEST_INTERFACE_INDEX (2)
+#define TEST_SERVER_VALUE (0x0a000001)  // 10.0.0.1
+#define TEST_MASK_VALUE (0xffffff00)
+#define TEST_START_TIME (100)
+
+// Network order address for a host order value
+static inline uint32_t ValueToAddr(const uint32_t dwValue)
+{
+	uint32_t dwAddr;
+	uint8_t* const pb = (uint8_t*)&dwAddr;
+	pb[0] = (uint8_t)(dwValue >> 24);
+	pb[1] = (uint8_t)(dwValue >> 16);
+	pb[2] = (uint8_t)(dwValue >> 8);
+	pb[3] = (uint8_t)dwValue;
+	return dwAddr;
+}
+
+struct RecordedEvent
+{
+	DhcpEngineEventType detType;
+	uint32_t dwAddr;
+	uint64_t qwExpireTime;
+};
+
+struct ProbeTest
+{
+	DhcpEngine deEngine;
+	DhcpMetrics dmMetrics;
+	uint64_t qwNow;
+	bool bFailProbes;  // The fake prober cannot send
+	std::vector<DhcpProbe> vdpProbes;  // Every probe asked for, sent or not
+	std::vector<RecordedEvent> vreEvents;
+};
+
+static bool FakeProbe(const DhcpProbe& rdp, void* pvContext)
+{
+	ProbeTest* const ppt = (ProbeTest*)pvContext;
+	ppt->vdpProbes.push_back(rdp);
+	return !ppt->bFailProbes;
+}
+
+static void RecordEvent(const DhcpEngineEvent& rdee, void* pvContext)
+{
+	ProbeTest* const ppt = (ProbeTest*)pvContext;
+	const RecordedEvent reEvent = { rdee.detType, rdee.dwAddr, rdee.qwExpireTime };
+	ppt->vreEvents.push_back(reEvent);
+}
+
+static size_t CountEvents(const ProbeTest& rpt, const DhcpEngineEventType detType, const uint32_t dwAddrValue)
+{
+	size_t stCount = 0;
+	for (size_t i = 0; i < rpt.vreEvents.size(); i++)
+	{
+		if ((detType == rpt.vreEvents[i].detType) && (ValueToAddr(dwAddrValue) == rpt.vreEvents[i].dwAddr))
+		{
+			stCount++;
+		}
+	}
+	return stCount;
+}
+
+// Serves 10.0.0.0/24 from [dwMinValue, dwMaxValue] on TEST_INTERFACE_INDEX, probing with FakeProbe
+static bool Initialize(ProbeTest* const ppt, const uint32_t dwMinValue, const uint32_t dwMaxValue)
+{
+	ppt->qwNow = TEST_START_TIME;
+	ppt->bFailProbes = false;
+	DhcpScopeConfig dscScope;
+	dscScope.dwServerAddr = ValueToAddr(TEST_SERVER_VALUE);
+	dscScope.dwMask = ValueToAddr(TEST_MASK_VALUE);
+	dscScope.dwMinAddr = ValueToAddr(dwMinValue);
+	dscScope.dwMaxAddr = ValueToAddr(dwMaxValue);
+	dscScope.iInterfaceIndex = TEST_INTERFACE_INDEX;
+	DhcpReplyTemplate::ClearScopeOptions(&dscScope.dsoOptions);
+	if (!ppt->deEngine.Initialize("probetest", 1) || !ppt->deEngine.AddScope(dscScope) || !ppt->dmMetrics.Initialize(1, 1))
+	{
+		return false;
+	}
+	ppt->deEngine.SetMetrics(&ppt->dmMetrics);
+	ppt->deEngine.SetEventHandler(RecordEvent, ppt);
+	ppt->deEngine.SetProber(FakeProbe, ppt);
+	return true;
+}
+
+// Sends a broadcast request from client bClient (its chaddr's last byte) at
+// the test's clock; true if the engine replied, with the reply's type and yiaddr
+static bool Send(ProbeTest* const ppt, const DHCPMessageTypes dhcpmtType, const uint8_t bClient, const uint32_t dwAddrValue, DHCPMessageTypes* const pdhcpmtReplyType, uint32_t* const pdwYiaddrValue)
+{
+	DHCPClientMessageFields dcmfFields;
+	memset(&dcmfFields, 0, sizeof(dcmfFields));
+	dcmfFields.dhcpmtMessageType = dhcpmtType;
+	dcmfFields.dwXid = 0x1000 + bClient;
+	const uint8_t pbChaddr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, bClient };
+	memcpy(dcmfFields.pbChaddr, pbChaddr, sizeof(pbChaddr));
+	dcmfFields.pcsHostName = "client";  // The engine ignores clients without one
+	dcmfFields.bBroadcast = true;
+	if (DHCPMessageType_REQUEST == dhcpmtType)
+	{
+		dcmfFields.dwRequestedAddr = ValueToAddr(dwAddrValue);
+		dcmfFields.dwServerIdentifier = ValueToAddr(TEST_SERVER_VALUE);
+	}
+	else if (DHCPMessageType_RELEASE == dhcpmtType)
+	{
+		dcmfFields.dwCiaddr = ValueToAddr(dwAddrValue);
+		dcmfFields.dwServerIdentifier = ValueToAddr(TEST_SERVER_VALUE);
+		dcmfFields.bBroadcast = false;
+	}
+	uint8_t pbRequest[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+	const size_t stRequestSize = BuildDHCPClientMessage(dcmfFields, pbRequest, sizeof(pbRequest));
+	CHECK(0 != stRequestSize);
+	DhcpRequestInfo driRequest = { 0xffffffff, TEST_INTERFACE_INDEX, 0, ppt->qwNow, false };
+	uint8_t pbReply[DHCP_REPLY_SIZE];
+	DhcpReplyInfo driReply;
+	if (!ppt->deEngine.ProcessRequest(pbRequest, stRequestSize, driRequest, pbReply, sizeof(pbReply), &driReply))
+	{
+		return false;
+	}
+	uint32_t dwXid;
+	uint32_t dwYiaddr;
+	uint32_t dwServerIdentifier;
+	CHECK(ParseDHCPServerReply(pbReply, driReply.stSize, pdhcpmtReplyType, &dwXid, &dwYiaddr, &dwServerIdentifier));
+	*pdwYiaddrValue = 0;
+	for (unsigned int i = 0; i < sizeof(dwYiaddr); i++)
+	{
+		*pdwYiaddrValue = (*pdwYiaddrValue << 8) | ((const uint8_t*)&dwYiaddr)[i];
+	}
+	return true;
+}
+
+// Whether a DISCOVER from bClient is answered at once with an OFFER of dwAddrValue
+static bool Offers(ProbeTest* const ppt, const uint8_t bClient, const uint32_t dwAddrValue)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return Send(ppt, DHCPMessageType_DISCOVER, bClient, 0, &dhcpmtType, &dwYiaddrValue) && (DHCPMessageType_OFFER == dhcpmtType) && (dwAddrValue == dwYiaddrValue);
+}
+
+// Whether a DISCOVER from bClient goes unanswered (waiting for a probe)
+static bool Waits(ProbeTest* const ppt, const uint8_t bClient)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return !Send(ppt, DHCPMessageType_DISCOVER, bClient, 0, &dhcpmtType, &dwYiaddrValue);
+}
+
+static bool Acks(ProbeTest* const ppt, const uint8_t bClient, const uint32_t dwAddrValue)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return Send(ppt, DHCPMessageType_REQUEST, bClient, dwAddrValue, &dhcpmtType, &dwYiaddrValue) && (DHCPMessageType_ACK == dhcpmtType) && (dwAddrValue == dwYiaddrValue);
+}
+
+static bool ProbedFor(const ProbeTest& rpt, const size_t stProbe, const uint32_t dwAddrValue)
+{
+	return (stProbe < rpt.vdpProbes.size()) && (ValueToAddr(dwAddrValue) == rpt.vdpProbes[stProbe].dwAddr);
+}
+
+static uint64_t ProbePendingDrops(const ProbeTest& rpt)
+{
+	std::string strText;
+	CHECK(rpt.dmMetrics.FormatPrometheus(&strText));
+	const char* const pcsName = "dhcplite_dropped_total{reason=\"probe_pending\"} ";
+	const size_t stAt = strText.find(pcsName);
+	return (std::string::npos == stAt) ? ~(uint64_t)0 : strtoull(strText.c_str() + stAt + strlen(pcsName), 0, 10);
+}
+
+static void TestPendingAndTimeout()
+{
+	ProbeTest ptTest;
+	CHECK(Initialize(&ptTest, 0x0a000002, 0x0a0000fe));
+	// A fresh address is probed from the scope's server address, out of the client's interface, and the DISCOVER waits
+	CHECK(Waits(&ptTest, 1));
+	CHECK(1 == ptTest.vdpProbes.size());
+	CHECK(ProbedFor(ptTest, 0, 0x0a000002));
+	CHECK((1 == ptTest.vdpProbes.size()) && (ValueToAddr(TEST_SERVER_VALUE) == ptTest.vdpProbes[0].dwSourceAddr) &&
+		(TEST_INTERFACE_INDEX == ptTest.vdpProbes[0].iInterfaceIndex) && (0 == ptTest.vdpProbes[0].iWorkerIndex));
+	// Retransmissions within the timeout keep waiting, without probing again
+	ptTest.qwNow += DHCP_PROBE_TIMEOUT - 1;
+	CHECK(Waits(&ptTest, 1));
+	CHECK(1 == ptTest.vdpProbes.size());
+	CHECK(2 == ProbePendingDrops(ptTest));
+	CHECK(0 == CountEvents(ptTest, DhcpEngineEvent_OFFER, 0x0a000002));
+	// Unanswered for the timeout: offered
+	ptTest.qwNow = TEST_START_TIME + DHCP_PROBE_TIMEOUT;
+	CHECK(Offers(&ptTest, 1, 0x0a000002));
+	CHECK(Acks(&ptTest, 1, 0x0a000002));
+	CHECK(1 == ptTest.vdpProbes.size());
+	CHECK(0 == CountEvents(ptTest, DhcpEngineEvent_CONFLICT, 0x0a000002));
+	// A client's own lease is never probed, even once the result is forgotten
+	ptTest.qwNow += DHCP_PROBE_CACHE_TIME + 60;
+	CHECK(Offers(&ptTest, 1, 0x0a000002));
+	CHECK(1 == ptTest.vdpProbes.size());
+	CHECK(2 == ProbePendingDrops(ptTest));
+}
+
+static void TestConflict()
+{
+	ProbeTest ptTest;
+	CHECK(Initialize(&ptTest, 0x0a000002, 0x0a0000fe));
+	CHECK(Waits(&ptTest, 1));
+	CHECK(ProbedFor(ptTest, 0, 0x0a000002));
+	// An answer while the probe is pending quarantines the address like a DECLINE
+	const uint64_t qwAnswerTime = ptTest.qwNow + 1;
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a000002), qwAnswerTime);
+	CHECK(1 == CountEvents(ptTest, DhcpEngineEvent_CONFLICT, 0x0a000002));
+	CHECK((1 == ptTest.vreEvents.size()) && (qwAnswerTime + DHCP_DECLINE_QUARANTINE_TIME == ptTest.vreEvents.back().qwExpireTime));
+	// A second answer to the same probe changes nothing
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a000002), qwAnswerTime);
+	CHECK(1 == ptTest.vreEvents.size());
+	// The client's retransmission gets another address, probed in turn
+	ptTest.qwNow = qwAnswerTime + 1;
+	CHECK(Waits(&ptTest, 1));
+	CHECK((2 == ptTest.vdpProbes.size()) && ProbedFor(ptTest, 1, 0x0a000003));
+	ptTest.qwNow += DHCP_PROBE_TIMEOUT;
+	CHECK(Offers(&ptTest, 1, 0x0a000003));
+	// An answer after the offer is too late: the offer stands
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a000003), ptTest.qwNow);
+	CHECK(0 == CountEvents(ptTest, DhcpEngineEvent_CONFLICT, 0x0a000003));
+	CHECK(Offers(&ptTest, 1, 0x0a000003));
+	CHECK(Acks(&ptTest, 1, 0x0a000003));
+	// Answers from addresses that were never probed, or are not served, are ignored
+	const size_t stEvents = ptTest.vreEvents.size();
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a000009), ptTest.qwNow);
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a010005), ptTest.qwNow);
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(TEST_SERVER_VALUE), ptTest.qwNow);
+	CHECK(stEvents == ptTest.vreEvents.size());
+	// The quarantined address is not offered to the next client, and comes back when the quarantine ends
+	CHECK(Waits(&ptTest, 2));
+	CHECK((3 == ptTest.vdpProbes.size()) && !ProbedFor(ptTest, 2, 0x0a000002));
+	ptTest.deEngine.ExpireLeases(0, qwAnswerTime + DHCP_DECLINE_QUARANTINE_TIME);
+	CHECK(1 == CountEvents(ptTest, DhcpEngineEvent_QUARANTINE_ENDED, 0x0a000002));
+}
+
+static void TestCachedResult()
+{
+	// One address, so every client gets the same one
+	ProbeTest ptTest;
+	CHECK(Initialize(&ptTest, 0x0a000002, 0x0a000002));
+	CHECK(Waits(&ptTest, 1));
+	ptTest.qwNow += DHCP_PROBE_TIMEOUT;
+	CHECK(Offers(&ptTest, 1, 0x0a000002));
+	CHECK(Acks(&ptTest, 1, 0x0a000002));
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	CHECK(!Send(&ptTest, DHCPMessageType_RELEASE, 1, 0x0a000002, &dhcpmtType, &dwYiaddrValue));
+	CHECK(1 == CountEvents(ptTest, DhcpEngineEvent_RELEASE, 0x0a000002));
+	// Found free a moment ago: another client is offered the address at once
+	ptTest.qwNow += 10;
+	CHECK(Offers(&ptTest, 2, 0x0a000002));
+	CHECK(1 == ptTest.vdpProbes.size());
+	// Once the result is forgotten (and the offer lapsed), the address is probed again
+	ptTest.qwNow = TEST_START_TIME + DHCP_PROBE_TIMEOUT + DHCP_PROBE_CACHE_TIME + DHCP_OFFER_HOLD_TIME;
+	ptTest.deEngine.ExpireLeases(0, ptTest.qwNow);
+	CHECK(Waits(&ptTest, 3));
+	CHECK((2 == ptTest.vdpProbes.size()) && ProbedFor(ptTest, 1, 0x0a000002));
+}
+
+static void TestProbeNotSent()
+{
+	ProbeTest ptTest;
+	CHECK(Initialize(&ptTest, 0x0a000002, 0x0a0000fe));
+	// A probe that cannot be sent does not hold up the offer, and leaves nothing pending
+	ptTest.bFailProbes = true;
+	CHECK(Offers(&ptTest, 1, 0x0a000002));
+	CHECK((1 == ptTest.vdpProbes.size()) && ProbedFor(ptTest, 0, 0x0a000002));
+	ptTest.deEngine.ReportProbeAnswer(0, ValueToAddr(0x0a000002), ptTest.qwNow);
+	CHECK(0 == CountEvents(ptTest, DhcpEngineEvent_CONFLICT, 0x0a000002));
+	CHECK(0 == ProbePendingDrops(ptTest));
+	// Probing goes on for the next client once probes can be sent again
+	ptTest.bFailProbes = false;
+	CHECK(Waits(&ptTest, 2));
+	CHECK((2 == ptTest.vdpProbes.size()) && ProbedFor(ptTest, 1, 0x0a000003));
+	CHECK(Offers(&ptTest, 1, 0x0a000002));
+}
+
+int main()
+{
+	TestPendingAndTimeout();
+	TestConflict();
+	TestCachedResult();
+	TestProbeNotSent();
+	return UNIT_TEST_RESULT();
+}
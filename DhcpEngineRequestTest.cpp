@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "ToolBox.h"
+#include "DhcpEngine.h"
+#include "DhcpMetrics.h"
+#include "DHCPClientMessage.h"
+#include "UnitTest.h"
+
+// REQUEST handling through DhcpEngine by client state (RFC 2131 section
+// 4.3.2): which requests are answered, and which leases they leave behind
+
+#define TEST_INTERFACE_INDEX (2)
+#define TEST_SERVER_VALUE (0x0a000001)  // 10.0.0.1
+#define TEST_OTHER_SERVER_VALUE (0x0a0000c8)  // 10.0.0.200
+#define TEST_MASK_VALUE (0xffffff00)
+#define TEST_START_TIME (100)
+
+// Network order address for a host order value
+static inline uint32_t ValueToAddr(const uint32_t dwValue)
+{
+	uint32_t dwAddr;
+	uint8_t* const pb = (uint8_t*)&dwAddr;
+	pb[0] = (uint8_t)(dwValue >> 24);
+	pb[1] = (uint8_t)(dwValue >> 16);
+	pb[2] = (uint8_t)(dwValue >> 8);
+	pb[3] = (uint8_t)dwValue;
+	return dwAddr;
+}
+
+struct RequestTest
+{
+	DhcpEngine deEngine;
+	DhcpMetrics dmMetrics;
+	uint64_t qwNow;
+	std::vector<DhcpEngineEventType> vdetEvents;
+};
+
+static void RecordEvent(const DhcpEngineEvent& rdee, void* pvContext)
+{
+	RequestTest* const prt = (RequestTest*)pvContext;
+	prt->vdetEvents.push_back(rdee.detType);
+}
+
+static size_t CountEvents(const RequestTest& rrt, const DhcpEngineEventType detType)
+{
+	size_t stCount = 0;
+	for (size_t i = 0; i < rrt.vdetEvents.size(); i++)
+	{
+		if (detType == rrt.vdetEvents[i])
+		{
+			stCount++;
+		}
+	}
+	return stCount;
+}
+
+// Serves 10.0.0.0/24 from [dwMinValue, dwMaxValue] on TEST_INTERFACE_INDEX, without probing
+static bool Initialize(RequestTest* const prt, const uint32_t dwMinValue, const uint32_t dwMaxValue)
+{
+	prt->qwNow = TEST_START_TIME;
+	DhcpScopeConfig dscScope;
+	dscScope.dwServerAddr = ValueToAddr(TEST_SERVER_VALUE);
+	dscScope.dwMask = ValueToAddr(TEST_MASK_VALUE);
+	dscScope.dwMinAddr = ValueToAddr(dwMinValue);
+	dscScope.dwMaxAddr = ValueToAddr(dwMaxValue);
+	dscScope.iInterfaceIndex = TEST_INTERFACE_INDEX;
+	DhcpReplyTemplate::ClearScopeOptions(&dscScope.dsoOptions);
+	if (!prt->deEngine.Initialize("requesttest", 1) || !prt->deEngine.AddScope(dscScope) || !prt->dmMetrics.Initialize(1, 1))
+	{
+		return false;
+	}
+	prt->deEngine.SetMetrics(&prt->dmMetrics);
+	prt->deEngine.SetEventHandler(RecordEvent, prt);
+	return true;
+}
+
+// Sends a broadcast DISCOVER (dwAddrValue 0) or REQUEST for dwAddrValue from
+// client bClient (its chaddr's last byte), naming the server dwServerValue (0
+// for none, as in INIT-REBOOT); true if the engine replied, with the reply's
+// type and yiaddr
+static bool Send(RequestTest* const prt, const DHCPMessageTypes dhcpmtType, const uint8_t bClient, const uint32_t dwAddrValue, const uint32_t dwServerValue, DHCPMessageTypes* const pdhcpmtReplyType, uint32_t* const pdwYiaddrValue)
+{
+	DHCPClientMessageFields dcmfFields;
+	memset(&dcmfFields, 0, sizeof(dcmfFields));
+	dcmfFields.dhcpmtMessageType = dhcpmtType;
+	dcmfFields.dwXid = 0x2000 + bClient;
+	const uint8_t pbChaddr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, bClient };
+	memcpy(dcmfFields.pbChaddr, pbChaddr, sizeof(pbChaddr));
+	dcmfFields.pcsHostName = "client";  // The engine ignores clients without one
+	dcmfFields.dwRequestedAddr = (0 == dwAddrValue) ? 0 : ValueToAddr(dwAddrValue);
+	dcmfFields.dwServerIdentifier = (0 == dwServerValue) ? 0 : ValueToAddr(dwServerValue);
+	dcmfFields.bBroadcast = true;
+	uint8_t pbRequest[DHCP_CLIENT_MESSAGE_MAX_SIZE];
+	const size_t stRequestSize = BuildDHCPClientMessage(dcmfFields, pbRequest, sizeof(pbRequest));
+	CHECK(0 != stRequestSize);
+	DhcpRequestInfo driRequest = { 0xffffffff, TEST_INTERFACE_INDEX, 0, prt->qwNow, false };
+	uint8_t pbReply[DHCP_REPLY_SIZE];
+	DhcpReplyInfo driReply;
+	if (!prt->deEngine.ProcessRequest(pbRequest, stRequestSize, driRequest, pbReply, sizeof(pbReply), &driReply))
+	{
+		return false;
+	}
+	uint32_t dwXid;
+	uint32_t dwYiaddr;
+	uint32_t dwServerIdentifier;
+	CHECK(ParseDHCPServerReply(pbReply, driReply.stSize, pdhcpmtReplyType, &dwXid, &dwYiaddr, &dwServerIdentifier));
+	*pdwYiaddrValue = 0;
+	for (unsigned int i = 0; i < sizeof(dwYiaddr); i++)
+	{
+		*pdwYiaddrValue = (*pdwYiaddrValue << 8) | ((const uint8_t*)&dwYiaddr)[i];
+	}
+	return true;
+}
+
+static bool Offers(RequestTest* const prt, const uint8_t bClient, const uint32_t dwAddrValue)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return Send(prt, DHCPMessageType_DISCOVER, bClient, 0, 0, &dhcpmtType, &dwYiaddrValue) && (DHCPMessageType_OFFER == dhcpmtType) && (dwAddrValue == dwYiaddrValue);
+}
+
+static bool Acks(RequestTest* const prt, const uint8_t bClient, const uint32_t dwAddrValue, const uint32_t dwServerValue)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return Send(prt, DHCPMessageType_REQUEST, bClient, dwAddrValue, dwServerValue, &dhcpmtType, &dwYiaddrValue) && (DHCPMessageType_ACK == dhcpmtType) && (dwAddrValue == dwYiaddrValue);
+}
+
+static bool Ignores(RequestTest* const prt, const uint8_t bClient, const uint32_t dwAddrValue, const uint32_t dwServerValue)
+{
+	DHCPMessageTypes dhcpmtType;
+	uint32_t dwYiaddrValue;
+	return !Send(prt, DHCPMessageType_REQUEST, bClient, dwAddrValue, dwServerValue, &dhcpmtType, &dwYiaddrValue);
+}
+
+static uint64_t IgnoredDrops(const RequestTest& rrt)
+{
+	std::string strText;
+	CHECK(rrt.dmMetrics.FormatPrometheus(&strText));
+	const char* const pcsName = "dhcplite_dropped_total{reason=\"ignored\"} ";
+	const size_t stAt = strText.find(pcsName);
+	return (std::string::npos == stAt) ? ~(uint64_t)0 : strtoull(strText.c_str() + stAt + strlen(pcsName), 0, 10);
+}
+
+static void TestOtherServerSelected()
+{
+	RequestTest rtTest;
+	CHECK(Initialize(&rtTest, 0x0a000002, 0x0a0000fe));
+	// A client that chose another server's offer over ours gets no answer, and our offer goes back to the pool
+	CHECK(Offers(&rtTest, 1, 0x0a000002));
+	CHECK(Ignores(&rtTest, 1, 0x0a000002, TEST_OTHER_SERVER_VALUE));
+	CHECK(1 == IgnoredDrops(rtTest));
+	// A client we hold nothing for is not bound to the address the other server offered it
+	CHECK(Ignores(&rtTest, 3, 0x0a000010, TEST_OTHER_SERVER_VALUE));
+	CHECK(2 == IgnoredDrops(rtTest));
+	CHECK(0 == CountEvents(rtTest, DhcpEngineEvent_ACK));
+	CHECK(0 == CountEvents(rtTest, DhcpEngineEvent_NAK));
+	// Both addresses are free for other clients
+	CHECK(Acks(&rtTest, 2, 0x0a000002, 0));
+	CHECK(Acks(&rtTest, 4, 0x0a000010, 0));
+	// Nor is a bound lease given up, or NAKed, when its client later chooses another server
+	CHECK(Ignores(&rtTest, 4, 0x0a000020, TEST_OTHER_SERVER_VALUE));
+	CHECK(0 == CountEvents(rtTest, DhcpEngineEvent_NAK));
+	CHECK(!Acks(&rtTest, 5, 0x0a000010, 0));
+	CHECK(Acks(&rtTest, 4, 0x0a000010, 0));
+}
+
+static void TestInitReboot()
+{
+	RequestTest rtTest;
+	CHECK(Initialize(&rtTest, 0x0a000002, 0x0a0000fe));
+	// Without a server identifier, a client we hold nothing for keeps the free address it asks for
+	CHECK(Acks(&rtTest, 1, 0x0a000030, 0));
+	CHECK(1 == CountEvents(rtTest, DhcpEngineEvent_ACK));
+	CHECK(Offers(&rtTest, 1, 0x0a000030));
+	// Another client asking for the same address is NAKed
+	CHECK(!Acks(&rtTest, 2, 0x0a000030, 0));
+	CHECK(1 == CountEvents(rtTest, DhcpEngineEvent_NAK));
+	// Naming this server (SELECTING) still works as before
+	CHECK(Offers(&rtTest, 3, 0x0a000002));
+	CHECK(Acks(&rtTest, 3, 0x0a000002, TEST_SERVER_VALUE));
+	CHECK(0 == IgnoredDrops(rtTest));
+}
+
+int main()
+{
+	TestOtherServerSelected();
+	TestInitReboot();
+	return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <new>
+#include "ToolBox.h"
+#include "DhcpMetrics.h"
+
+static const char* const ppcsMessageTypeNames[DHCP_METRICS_MESSAGE_TYPES] =
+{
+	"unknown", "DISCOVER", "OFFER", "REQUEST", "DECLINE", "ACK", "NAK", "RELEASE", "INFORM",
+};
+
+static const char* const ppcsDropReasonNames[DhcpDrop_COUNT] =
+{
+	"truncated", "malformed", "no_message_type", "no_hostname", "own_request", "pool_exhausted", "out_of_memory", "ignored", "no_scope",
+	"client_rate_limited", "link_rate_limited", "probe_pending",
+};
+
+// Bucket bounds of the exported Prometheus histogram (nanoseconds); each HDR
+// bucket is counted under the first bound at or above its upper end
+static const uint64_t pqwExportBounds[] =
+{
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000, 100000000, 1000000000,
+};
+
+static const double pdExportQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+DhcpMetrics::DhcpMetrics()
+	: m_iWorkerCount(0)
+{
+}
+
+bool DhcpMetrics::Initialize(const unsigned int iWorkerCount, const unsigned int iScopeCount)
+{
+	ASSERT((1 <= iWorkerCount) && (1 <= iScopeCount));
+	const size_t stPoolCount = (size_t)iScopeCount * iWorkerCount;
+	try
+	{
+		m_pwcWorkers.reset(new WorkerCounters[iWorkerCount]);
+		m_ppgPools.reset(new PoolGauge[stPoolCount]);
+		m_vstrScopeLabels.resize(iScopeCount);
+		for (unsigned int i = 0; i < iScopeCount; i++)
+		{
+			m_vstrScopeLabels[i] = std::to_string(i);
+		}
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < iWorkerCount; i++)
+	{
+		WorkerCounters& rwc = m_pwcWorkers[i];
+		for (size_t j = 0; j < ARRAY_LENGTH(rwc.paqwReceived); j++)
+		{
+			rwc.paqwReceived[j].store(0, std::memory_order_relaxed);
+			rwc.paqwSent[j].store(0, std::memory_order_relaxed);
+		}
+		for (size_t j = 0; j < ARRAY_LENGTH(rwc.paqwDropped); j++)
+		{
+			rwc.paqwDropped[j].store(0, std::memory_order_relaxed);
+		}
+		rwc.aqwExpired.store(0, std::memory_order_relaxed);
+		rwc.aqwReplyCacheLookups.store(0, std::memory_order_relaxed);
+		rwc.aqwReplyCacheHits.store(0, std::memory_order_relaxed);
+		rwc.aqwLatencySum.store(0, std::memory_order_relaxed);
+		for (size_t j = 0; j < ARRAY_LENGTH(rwc.paqwLatency); j++)
+		{
+			rwc.paqwLatency[j].store(0, std::memory_order_relaxed);
+		}
+	}
+	for (size_t i = 0; i < stPoolCount; i++)
+	{
+		m_ppgPools[i].adwInUse.store(0, std::memory_order_relaxed);
+		m_ppgPools[i].adwSize.store(0, std::memory_order_relaxed);
+	}
+	m_iWorkerCount = iWorkerCount;
+	return true;
+}
+
+unsigned int DhcpMetrics::BucketOfValue(const uint64_t qwValue)
+{
+	const uint64_t qwSubBuckets = ((uint64_t)1) << DHCP_METRICS_SUB_BUCKET_BITS;
+	if (qwValue < qwSubBuckets)
+	{
+		return (unsigned int)qwValue;
+	}
+	if ((((uint64_t)1) << DHCP_METRICS_MAX_VALUE_BITS) <= qwValue)
+	{
+		return DHCP_METRICS_HISTOGRAM_BUCKETS - 1;
+	}
+	unsigned int iExponent = DHCP_METRICS_SUB_BUCKET_BITS;
+	while ((qwValue >> (iExponent + 1)) != 0)
+	{
+		iExponent++;
+	}
+	// The top DHCP_METRICS_SUB_BUCKET_BITS + 1 bits pick the bucket
+	const unsigned int iShift = iExponent - DHCP_METRICS_SUB_BUCKET_BITS;
+	return ((iShift + 1) << DHCP_METRICS_SUB_BUCKET_BITS) + (unsigned int)((qwValue >> iShift) - qwSubBuckets);
+}
+
+uint64_t DhcpMetrics::BucketUpperBound(const unsigned int iBucket)
+{
+	ASSERT(iBucket < DHCP_METRICS_HISTOGRAM_BUCKETS);
+	const unsigned int iSubBuckets = 1 << DHCP_METRICS_SUB_BUCKET_BITS;
+	if (iBucket < iSubBuckets)
+	{
+		return iBucket;
+	}
+	const unsigned int iShift = (iBucket >> DHCP_METRICS_SUB_BUCKET_BITS) - 1;
+	const uint64_t qwSubBucket = iBucket & (iSubBuckets - 1);
+	return ((iSubBuckets + qwSubBucket + 1) << iShift) - 1;
+}
+
+void DhcpMetrics::CountExpired(const unsigned int iWorkerIndex, const size_t stExpired)
+{
+	std::atomic<uint64_t>& raqw = m_pwcWorkers[iWorkerIndex].aqwExpired;
+	raqw.store(raqw.load(std::memory_order_relaxed) + stExpired, std::memory_order_relaxed);
+}
+
+void DhcpMetrics::RecordLatency(const unsigned int iWorkerIndex, const uint64_t qwNanoseconds)
+{
+	WorkerCounters& rwc = m_pwcWorkers[iWorkerIndex];
+	Increment(rwc.paqwLatency[BucketOfValue(qwNanoseconds)]);
+	rwc.aqwLatencySum.store(rwc.aqwLatencySum.load(std::memory_order_relaxed) + qwNanoseconds, std::memory_order_relaxed);
+}
+
+bool DhcpMetrics::SetScopeLabel(const unsigned int iScope, const char* const pcsLabel)
+{
+	ASSERT((iScope < m_vstrScopeLabels.size()) && (0 != pcsLabel));
+	try
+	{
+		m_vstrScopeLabels[iScope] = pcsLabel;
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	return true;
+}
+
+void DhcpMetrics::SetPoolUsage(const unsigned int iScope, const unsigned int iShard, const uint32_t dwInUse, const uint32_t dwSize)
+{
+	PoolGauge& rpg = m_ppgPools[((size_t)iScope * m_iWorkerCount) + iShard];
+	rpg.adwInUse.store(dwInUse, std::memory_order_relaxed);
+	rpg.adwSize.store(dwSize, std::memory_order_relaxed);
+}
+
+void DhcpMetrics::SumLatency(uint64_t* const pqwBuckets, uint64_t* const pqwCount, uint64_t* const pqwSum) const
+{
+	*pqwCount = 0;
+	*pqwSum = 0;
+	for (unsigned int j = 0; j < DHCP_METRICS_HISTOGRAM_BUCKETS; j++)
+	{
+		pqwBuckets[j] = 0;
+		for (unsigned int i = 0; i < m_iWorkerCount; i++)
+		{
+			pqwBuckets[j] += m_pwcWorkers[i].paqwLatency[j].load(std::memory_order_relaxed);
+		}
+		*pqwCount += pqwBuckets[j];
+	}
+	for (unsigned int i = 0; i < m_iWorkerCount; i++)
+	{
+		*pqwSum += m_pwcWorkers[i].aqwLatencySum.load(std::memory_order_relaxed);
+	}
+}
+
+uint64_t DhcpMetrics::LatencyQuantile(const double dQuantile) const
+{
+	uint64_t pqwBuckets[DHCP_METRICS_HISTOGRAM_BUCKETS];
+	uint64_t qwCount;
+	uint64_t qwSum;
+	SumLatency(pqwBuckets, &qwCount, &qwSum);
+	if (0 == qwCount)
+	{
+		return 0;
+	}
+	// Rank of the quantile, rounded up so a quantile of 1 is the maximum
+	uint64_t qwRank = (uint64_t)(dQuantile * (double)qwCount);
+	if ((double)qwRank < dQuantile * (double)qwCount)
+	{
+		qwRank++;
+	}
+	uint64_t qwSeen = 0;
+	for (unsigned int j = 0; j < DHCP_METRICS_HISTOGRAM_BUCKETS; j++)
+	{
+		qwSeen += pqwBuckets[j];
+		if ((0 != pqwBuckets[j]) && (qwRank <= qwSeen))
+		{
+			return BucketUpperBound(j);
+		}
+	}
+	return BucketUpperBound(DHCP_METRICS_HISTOGRAM_BUCKETS - 1);
+}
+
+bool DhcpMetrics::FormatPrometheus(std::string* const pstrText) const
+{
+	ASSERT((0 != pstrText) && (0 != m_iWorkerCount));
+	char pcsLine[256];
+	try
+	{
+		pstrText->clear();
+		pstrText->append("# HELP dhcplite_received_total DHCP requests received, by message type.\n# TYPE dhcplite_received_total counter\n");
+		for (unsigned int j = 0; j < DHCP_METRICS_MESSAGE_TYPES; j++)
+		{
+			uint64_t qwTotal = 0;
+			for (unsigned int i = 0; i < m_iWorkerCount; i++)
+			{
+				qwTotal += m_pwcWorkers[i].paqwReceived[j].load(std::memory_order_relaxed);
+			}
+			snprintf(pcsLine, sizeof(pcsLine), "dhcplite_received_total{type=\"%s\"} %llu\n", ppcsMessageTypeNames[j], (unsigned long long)qwTotal);
+			pstrText->append(pcsLine);
+		}
+		pstrText->append("# HELP dhcplite_sent_total DHCP replies sent, by message type.\n# TYPE dhcplite_sent_total counter\n");
+		for (unsigned int j = 0; j < DHCP_METRICS_MESSAGE_TYPES; j++)
+		{
+			uint64_t qwTotal = 0;
+			for (unsigned int i = 0; i < m_iWorkerCount; i++)
+			{
+				qwTotal += m_pwcWorkers[i].paqwSent[j].load(std::memory_order_relaxed);
+			}
+			if ((0 != j) || (0 != qwTotal))
+			{
+				snprintf(pcsLine, sizeof(pcsLine), "dhcplite_sent_total{type=\"%s\"} %llu\n", ppcsMessageTypeNames[j], (unsigned long long)qwTotal);
+				pstrText->append(pcsLine);
+			}
+		}
+		pstrText->append("# HELP dhcplite_dropped_total Requests that got no reply, by reason.\n# TYPE dhcplite_dropped_total counter\n");
+		for (unsigned int j = 0; j < DhcpDrop_COUNT; j++)
+		{
+			uint64_t qwTotal = 0;
+			for (unsigned int i = 0; i < m_iWorkerCount; i++)
+			{
+				qwTotal += m_pwcWorkers[i].paqwDropped[j].load(std::memory_order_relaxed);
+			}
+			snprintf(pcsLine, sizeof(pcsLine), "dhcplite_dropped_total{reason=\"%s\"} %llu\n", ppcsDropReasonNames[j], (unsigned long long)qwTotal);
+			pstrText->append(pcsLine);
+		}
+		uint64_t qwExpired = 0;
+		for (unsigned int i = 0; i < m_iWorkerCount; i++)
+		{
+			qwExpired += m_pwcWorkers[i].aqwExpired.load(std::memory_order_relaxed);
+		}
+		snprintf(pcsLine, sizeof(pcsLine), "# HELP dhcplite_expired_total Leases and quarantines that ran out.\n# TYPE dhcplite_expired_total counter\ndhcplite_expired_total %llu\n", (unsigned long long)qwExpired);
+		pstrText->append(pcsLine);
+		uint64_t qwReplyCacheLookups = 0;
+		uint64_t qwReplyCacheHits = 0;
+		for (unsigned int i = 0; i < m_iWorkerCount; i++)
+		{
+			qwReplyCacheLookups += m_pwcWorkers[i].aqwReplyCacheLookups.load(std::memory_order_relaxed);
+			qwReplyCacheHits += m_pwcWorkers[i].aqwReplyCacheHits.load(std::memory_order_relaxed);
+		}
+		snprintf(pcsLine, sizeof(pcsLine), "# HELP dhcplite_reply_cache_lookups_total Requests looked up in the reply cache.\n# TYPE dhcplite_reply_cache_lookups_total counter\ndhcplite_reply_cache_lookups_total %llu\n", (unsigned long long)qwReplyCacheLookups);
+		pstrText->append(pcsLine);
+		snprintf(pcsLine, sizeof(pcsLine), "# HELP dhcplite_reply_cache_hits_total Retransmissions answered from the reply cache.\n# TYPE dhcplite_reply_cache_hits_total counter\ndhcplite_reply_cache_hits_total %llu\n", (unsigned long long)qwReplyCacheHits);
+		pstrText->append(pcsLine);
+		snprintf(pcsLine, sizeof(pcsLine), "# HELP dhcplite_reply_cache_hit_ratio Reply cache hits over lookups.\n# TYPE dhcplite_reply_cache_hit_ratio gauge\ndhcplite_reply_cache_hit_ratio %.4f\n", (0 != qwReplyCacheLookups) ? ((double)qwReplyCacheHits / qwReplyCacheLookups) : 0.0);
+		pstrText->append(pcsLine);
+		// The shards of a scope are summed: a line per scope and shard would not scale with the scopes
+		for (unsigned int k = 0; k < 2; k++)
+		{
+			pstrText->append((0 == k) ?
+				"# HELP dhcplite_pool_addresses Addresses served by each scope.\n# TYPE dhcplite_pool_addresses gauge\n" :
+				"# HELP dhcplite_pool_in_use Addresses leased, offered, quarantined or reserved, per scope.\n# TYPE dhcplite_pool_in_use gauge\n");
+			for (size_t j = 0; j < m_vstrScopeLabels.size(); j++)
+			{
+				uint64_t qwTotal = 0;
+				for (unsigned int i = 0; i < m_iWorkerCount; i++)
+				{
+					const PoolGauge& rpg = m_ppgPools[(j * m_iWorkerCount) + i];
+					qwTotal += ((0 == k) ? rpg.adwSize : rpg.adwInUse).load(std::memory_order_relaxed);
+				}
+				snprintf(pcsLine, sizeof(pcsLine), "%s{scope=\"%s\"} %llu\n", (0 == k) ? "dhcplite_pool_addresses" : "dhcplite_pool_in_use", m_vstrScopeLabels[j].c_str(), (unsigned long long)qwTotal);
+				pstrText->append(pcsLine);
+			}
+		}
+
+		uint64_t pqwBuckets[DHCP_METRICS_HISTOGRAM_BUCKETS];
+		uint64_t qwCount;
+		uint64_t qwSum;
+		SumLatency(pqwBuckets, &qwCount, &qwSum);
+		pstrText->append("# HELP dhcplite_processing_seconds Time to turn a request into a reply.\n# TYPE dhcplite_processing_seconds histogram\n");
+		uint64_t qwCumulative = 0;
+		unsigned int j = 0;
+		for (size_t k = 0; k < ARRAY_LENGTH(pqwExportBounds); k++)
+		{
+			for (; (j < DHCP_METRICS_HISTOGRAM_BUCKETS) && (BucketUpperBound(j) <= pqwExportBounds[k]); j++)
+			{
+				qwCumulative += pqwBuckets[j];
+			}
+			snprintf(pcsLine, sizeof(pcsLine), "dhcplite_processing_seconds_bucket{le=\"%g\"} %llu\n", (double)pqwExportBounds[k] / 1e9, (unsigned long long)qwCumulative);
+			pstrText->append(pcsLine);
+		}
+		snprintf(pcsLine, sizeof(pcsLine), "dhcplite_processing_seconds_bucket{le=\"+Inf\"} %llu\ndhcplite_processing_seconds_sum %.9f\ndhcplite_processing_seconds_count %llu\n",
+			(unsigned long long)qwCount, (double)qwSum / 1e9, (unsigned long long)qwCount);
+		pstrText->append(pcsLine);
+		// Exact to the HDR bucket, unlike quantiles estimated from the buckets above
+		pstrText->append("# HELP dhcplite_processing_quantile_seconds Processing time quantiles since start.\n# TYPE dhcplite_processing_quantile_seconds gauge\n");
+		for (size_t k = 0; k < ARRAY_LENGTH(pdExportQuantiles); k++)
+		{
+			snprintf(pcsLine, sizeof(pcsLine), "dhcplite_processing_quantile_seconds{quantile=\"%g\"} %.9f\n", pdExportQuantiles[k], (double)LatencyQuantile(pdExportQuantiles[k]) / 1e9);
+			pstrText->append(pcsLine);
+		}
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,107 @@
+#if !defined(DHCP_METRICS_HEADER)
+#define DHCP_METRICS_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Why a request got no reply
+enum DhcpDropReason
+{
+	DhcpDrop_TRUNCATED,  // Larger than the receive buffer (transport)
+	DhcpDrop_MALFORMED,  // Not a BOOTREQUEST, bad magic cookie or undecodable options
+	DhcpDrop_NO_MESSAGE_TYPE,
+	DhcpDrop_NO_HOSTNAME,
+	DhcpDrop_OWN_REQUEST,  // The server asking for its own address
+	DhcpDrop_POOL_EXHAUSTED,
+	DhcpDrop_OUT_OF_MEMORY,
+	DhcpDrop_IGNORED,  // Valid but not answerable (unexpected REQUEST, INFORM, server message types)
+	DhcpDrop_NO_SCOPE,  // Arrived on an interface no scope serves
+	DhcpDrop_CLIENT_RATE_LIMITED,  // Admission control: the chaddr is over its rate
+	DhcpDrop_LINK_RATE_LIMITED,  // Admission control: the relay agent or interface is over its rate
+	DhcpDrop_PROBE_PENDING,  // A DISCOVER whose offer waits for a conflict probe (answered on retransmission)
+	DhcpDrop_COUNT,
+};
+
+// Latency histogram layout (HDR style): values below 2^DHCP_METRICS_SUB_BUCKET_BITS
+// are exact, larger ones fall into 2^DHCP_METRICS_SUB_BUCKET_BITS linear
+// buckets per power of 2 (at most 1/16 = 6.25% relative error)
+#define DHCP_METRICS_SUB_BUCKET_BITS (4)
+#define DHCP_METRICS_MAX_VALUE_BITS (40)  // About 18 minutes in nanoseconds; larger values are clamped
+#define DHCP_METRICS_HISTOGRAM_BUCKETS ((DHCP_METRICS_MAX_VALUE_BITS - DHCP_METRICS_SUB_BUCKET_BITS + 1) << DHCP_METRICS_SUB_BUCKET_BITS)
+// Message type counters: DHCPMessageTypes 1-8, 0 for anything else
+#define DHCP_METRICS_MESSAGE_TYPES (9)
+
+// Counters and histograms for a running server. Every worker has its own
+// cache-line aligned block that only it writes (plain load/store of relaxed
+// atomics, no read-modify-write and no locks); readers sum the blocks at any
+// time without stopping the workers.
+class DhcpMetrics
+{
+public:
+	DhcpMetrics();
+
+	bool Initialize(const unsigned int iWorkerCount, const unsigned int iScopeCount);
+	// Names the scope in the pool gauges (e.g. its subnet); defaults to its index. Call before reading.
+	bool SetScopeLabel(const unsigned int iScope, const char* const pcsLabel);
+
+	// Writers: iWorkerIndex must only be used by one thread at a time
+	void CountReceived(const unsigned int iWorkerIndex, const unsigned int iMessageType) { Increment(m_pwcWorkers[iWorkerIndex].paqwReceived[MessageTypeIndex(iMessageType)]); }
+	void CountSent(const unsigned int iWorkerIndex, const unsigned int iMessageType) { Increment(m_pwcWorkers[iWorkerIndex].paqwSent[MessageTypeIndex(iMessageType)]); }
+	void CountDrop(const unsigned int iWorkerIndex, const DhcpDropReason ddrReason) { Increment(m_pwcWorkers[iWorkerIndex].paqwDropped[ddrReason]); }
+	void CountExpired(const unsigned int iWorkerIndex, const size_t stExpired);
+	void CountReplyCacheLookup(const unsigned int iWorkerIndex, const bool bHit)
+	{
+		Increment(m_pwcWorkers[iWorkerIndex].aqwReplyCacheLookups);
+		if (bHit)
+		{
+			Increment(m_pwcWorkers[iWorkerIndex].aqwReplyCacheHits);
+		}
+	}
+	void RecordLatency(const unsigned int iWorkerIndex, const uint64_t qwNanoseconds);
+	// Pool gauges, per scope and shard (any thread); exported per scope
+	void SetPoolUsage(const unsigned int iScope, const unsigned int iShard, const uint32_t dwInUse, const uint32_t dwSize);
+
+	// Readers (any thread)
+	bool FormatPrometheus(std::string* const pstrText) const;
+	// Value at or above fraction dQuantile of the recorded latencies (an HDR bucket's upper bound)
+	uint64_t LatencyQuantile(const double dQuantile) const;
+
+	static unsigned int BucketOfValue(const uint64_t qwValue);
+	static uint64_t BucketUpperBound(const unsigned int iBucket);
+
+private:
+	struct alignas(64) WorkerCounters
+	{
+		std::atomic<uint64_t> paqwReceived[DHCP_METRICS_MESSAGE_TYPES];
+		std::atomic<uint64_t> paqwSent[DHCP_METRICS_MESSAGE_TYPES];
+		std::atomic<uint64_t> paqwDropped[DhcpDrop_COUNT];
+		std::atomic<uint64_t> aqwExpired;
+		std::atomic<uint64_t> aqwReplyCacheLookups;
+		std::atomic<uint64_t> aqwReplyCacheHits;
+		std::atomic<uint64_t> aqwLatencySum;  // Nanoseconds
+		std::atomic<uint64_t> paqwLatency[DHCP_METRICS_HISTOGRAM_BUCKETS];
+	};
+	struct alignas(64) PoolGauge
+	{
+		std::atomic<uint32_t> adwInUse;
+		std::atomic<uint32_t> adwSize;
+	};
+
+	static unsigned int MessageTypeIndex(const unsigned int iMessageType) { return (iMessageType < DHCP_METRICS_MESSAGE_TYPES) ? iMessageType : 0; }
+	static void Increment(std::atomic<uint64_t>& raqw) { raqw.store(raqw.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+	void SumLatency(uint64_t* const pqwBuckets, uint64_t* const pqwCount, uint64_t* const pqwSum) const;
+
+	DhcpMetrics(const DhcpMetrics&);
+	DhcpMetrics& operator=(const DhcpMetrics&);
+
+	std::unique_ptr<WorkerCounters[]> m_pwcWorkers;
+	std::unique_ptr<PoolGauge[]> m_ppgPools;  // iScope * m_iWorkerCount + iShard
+	std::vector<std::string> m_vstrScopeLabels;
+	unsigned int m_iWorkerCount;
+};
+
+#endif  // !defined(DHCP_METRICS_HEADER)
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "ToolBox.h"
+#include "DHCPOptions.h"
+#include "DhcpEngine.h"
+#include "DhcpReplyTemplate.h"
+
+const char pcsServerName[] = "DHCPLite DHCP server";
+
+// Leading options of every OFFER and ACK, which depend only on compile-time
+// constants: the message type (a placeholder patched per reply) and the
+// lease, renewal and rebinding times
+static constexpr DHCPOptionBlock<21> LeaseOptions()
+{
+	DHCPOptionBlock<21> dob;
+	dob.AddByte(option_DHCPMESSAGETYPE, 0);
+	dob.AddUInt32(option_IPADDRESSLEASETIME, DHCP_LEASE_TIME);
+	dob.AddUInt32(option_RENEWALTIMEVALUE, DHCP_RENEWAL_TIME);
+	dob.AddUInt32(option_REBINDINGTIMEVALUE, DHCP_REBINDING_TIME);
+	return dob;
+}
+static constexpr DHCPOptionBlock<21> dobLeaseOptions = LeaseOptions();
+static_assert(!dobLeaseOptions.bOverflow && (sizeof(dobLeaseOptions.pb) == dobLeaseOptions.stSize), "Lease options must fill their block exactly");
+static_assert((option_DHCPMESSAGETYPE == dobLeaseOptions.pb[DHCP_REPLY_MESSAGE_TYPE_OFFSET - 2]) && (1 == dobLeaseOptions.pb[DHCP_REPLY_MESSAGE_TYPE_OFFSET - 1]), "The message type must come first");
+
+// Same byte access as the engine's AddrToValue: network order address -> host order value
+static inline uint32_t ValueOfAddr(const uint32_t dwAddr)
+{
+	const uint8_t* const pb = (const uint8_t*)&dwAddr;
+	return (((uint32_t)pb[0]) << 24) | (((uint32_t)pb[1]) << 16) | (((uint32_t)pb[2]) << 8) | pb[3];
+}
+
+DhcpReplyTemplate::DhcpReplyTemplate()
+	: m_stLeaseSize(0), m_stRapidCommitAckSize(0), m_stNakSize(0)
+{
+}
+
+void DhcpReplyTemplate::ClearScopeOptions(DhcpScopeOptions* const pdso)
+{
+	ASSERT(0 != pdso);
+	memset(pdso, 0, sizeof(*pdso));
+	pdso->appAllocationPolicy = AddressPool_ROUND_ROBIN;
+}
+
+void DhcpReplyTemplate::BuildHeader(uint8_t* const pbReply)
+{
+	// RFC 2131 section 4.3: hops, secs, siaddr and file stay 0; the rest is patched by Write
+	memset(pbReply, 0, DHCP_REPLY_SIZE);
+	DHCPMessage* const pdhcpmReply = (DHCPMessage*)pbReply;
+	pdhcpmReply->op = op_BOOTREPLY;
+	C_ASSERT(sizeof(pcsServerName) <= sizeof(pdhcpmReply->sname));
+	memcpy(pdhcpmReply->sname, pcsServerName, sizeof(pcsServerName));
+	memcpy(pdhcpmReply->magicCookie, pbDHCPMagicCookie, sizeof(pdhcpmReply->magicCookie));
+}
+
+bool DhcpReplyTemplate::Build(const uint32_t dwServerAddr, const uint32_t dwMask, const DhcpScopeOptions& rdso)
+{
+	ASSERT(rdso.iDnsServerCount <= DHCP_SCOPE_MAX_DNS_SERVERS);
+	// OFFER/ACK - RFC 2131 table 3
+	DHCPOptionBlock<DHCP_REPLY_MAX_OPTIONS_SIZE> dobLease;
+	dobLease.Append(dobLeaseOptions);
+	dobLease.AddUInt32(option_SERVERIDENTIFIER, ValueOfAddr(dwServerAddr));
+	dobLease.AddUInt32(option_SUBNETMASK, ValueOfAddr(dwMask));
+	if (0 != rdso.dwRouter)
+	{
+		dobLease.AddUInt32(option_ROUTER, ValueOfAddr(rdso.dwRouter));
+	}
+	if (0 != rdso.iDnsServerCount)
+	{
+		uint32_t pdwDnsServerValues[DHCP_SCOPE_MAX_DNS_SERVERS];
+		for (unsigned int i = 0; i < rdso.iDnsServerCount; i++)
+		{
+			pdwDnsServerValues[i] = ValueOfAddr(rdso.pdwDnsServers[i]);
+		}
+		dobLease.AddUInt32List(option_DOMAINNAMESERVER, pdwDnsServerValues, rdso.iDnsServerCount);
+	}
+	const size_t stDomainNameLength = strnlen(rdso.pcsDomainName, sizeof(rdso.pcsDomainName));
+	if (0 != stDomainNameLength)
+	{
+		dobLease.Add(option_DOMAINNAME, (const uint8_t*)rdso.pcsDomainName, stDomainNameLength);
+	}
+	if (0 != rdso.wInterfaceMtu)
+	{
+		dobLease.AddUInt16(option_INTERFACEMTU, rdso.wInterfaceMtu);
+	}
+	// Rapid Commit ACK - the same options and option 80
+	DHCPOptionBlock<DHCP_REPLY_MAX_OPTIONS_SIZE> dobRapidCommitAck = dobLease;
+	dobRapidCommitAck.AddFlag(option_RAPIDCOMMIT);
+	dobRapidCommitAck.End();
+	dobLease.End();
+	// NAK - only the message type and server identifier are allowed
+	DHCPOptionBlock<DHCP_REPLY_MAX_OPTIONS_SIZE> dobNak;
+	dobNak.AddByte(option_DHCPMESSAGETYPE, DHCPMessageType_NAK);
+	dobNak.AddUInt32(option_SERVERIDENTIFIER, ValueOfAddr(dwServerAddr));
+	dobNak.End();
+	if (dobLease.bOverflow || (rdso.bRapidCommit && dobRapidCommitAck.bOverflow) || dobNak.bOverflow)
+	{
+		return false;
+	}
+	BuildHeader(m_pbLease);
+	memcpy(((DHCPMessage*)m_pbLease)->options, dobLease.pb, dobLease.stSize);
+	m_stLeaseSize = sizeof(DHCPMessage) + dobLease.stSize;
+	if (rdso.bRapidCommit)
+	{
+		BuildHeader(m_pbRapidCommitAck);
+		memcpy(((DHCPMessage*)m_pbRapidCommitAck)->options, dobRapidCommitAck.pb, dobRapidCommitAck.stSize);
+		m_stRapidCommitAckSize = sizeof(DHCPMessage) + dobRapidCommitAck.stSize;
+	}
+	BuildHeader(m_pbNak);
+	memcpy(((DHCPMessage*)m_pbNak)->options, dobNak.pb, dobNak.stSize);
+	m_stNakSize = sizeof(DHCPMessage) + dobNak.stSize;
+	return true;
+}
+
+size_t DhcpReplyTemplate::Write(const DHCPMessage& rdhcpmRequest, const uint8_t bMessageType, const uint32_t dwYiaddr, const uint32_t dwCiaddr, const bool bRapidCommit, const uint8_t* const pbRelayAgentInformation, const size_t stRelayAgentInformationSize, uint8_t* const pbReply) const
+{
+	ASSERT((0 != m_stLeaseSize) && (0 != pbReply) &&
+		((DHCPMessageType_OFFER == bMessageType) || (DHCPMessageType_ACK == bMessageType) || (DHCPMessageType_NAK == bMessageType)) &&
+		(!bRapidCommit || ((DHCPMessageType_ACK == bMessageType) && (0 != m_stRapidCommitAckSize))));
+	const uint8_t* pbTemplate = m_pbLease;
+	size_t stSize = m_stLeaseSize;
+	if (DHCPMessageType_NAK == bMessageType)
+	{
+		pbTemplate = m_pbNak;
+		stSize = m_stNakSize;
+	}
+	else if (bRapidCommit)
+	{
+		pbTemplate = m_pbRapidCommitAck;
+		stSize = m_stRapidCommitAckSize;
+	}
+	memcpy(pbReply, pbTemplate, stSize);
+	if ((0 != pbRelayAgentInformation) && (stRelayAgentInformationSize <= 0xff) && (stSize + 2 + stRelayAgentInformationSize <= DHCP_REPLY_SIZE))
+	{
+		// Replaces the END option, which follows it
+		uint8_t* const pbOption = &pbReply[stSize - 1];
+		pbOption[0] = option_RELAYAGENTINFORMATION;
+		pbOption[1] = (uint8_t)stRelayAgentInformationSize;
+		memcpy(&pbOption[2], pbRelayAgentInformation, stRelayAgentInformationSize);
+		pbOption[2 + stRelayAgentInformationSize] = option_END;
+		stSize += 2 + stRelayAgentInformationSize;
+	}
+	DHCPMessage* const pdhcpmReply = (DHCPMessage*)pbReply;
+	pdhcpmReply->htype = rdhcpmRequest.htype;
+	pdhcpmReply->hlen = rdhcpmRequest.hlen;
+	pdhcpmReply->xid = rdhcpmRequest.xid;
+	pdhcpmReply->flags = rdhcpmRequest.flags;
+	pdhcpmReply->ciaddr = dwCiaddr;
+	pdhcpmReply->yiaddr = dwYiaddr;
+	pdhcpmReply->giaddr = rdhcpmRequest.giaddr;
+	memcpy(pdhcpmReply->chaddr, rdhcpmRequest.chaddr, sizeof(pdhcpmReply->chaddr));
+	pdhcpmReply->options[DHCP_REPLY_MESSAGE_TYPE_OFFSET] = bMessageType;
+	return stSize;
+}
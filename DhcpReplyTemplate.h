@@ -0,0 +1,60 @@
+#if !defined(DHCP_REPLY_TEMPLATE_HEADER)
+#define DHCP_REPLY_TEMPLATE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DHCPMessage.h"
+#include "AddressPool.h"
+
+#define DHCP_SCOPE_MAX_DNS_SERVERS (3)
+#define DHCP_SCOPE_MAX_DOMAIN_NAME_LENGTH (128)
+
+// Configuration a scope hands out along with the address (all optional)
+struct DhcpScopeOptions
+{
+	uint32_t dwRouter;  // Network order; 0 for none
+	uint32_t pdwDnsServers[DHCP_SCOPE_MAX_DNS_SERVERS];  // Network order
+	unsigned int iDnsServerCount;
+	char pcsDomainName[DHCP_SCOPE_MAX_DOMAIN_NAME_LENGTH + 1];  // Empty for none
+	uint16_t wInterfaceMtu;  // 0 for none
+	bool bRapidCommit;  // Answer a DISCOVER carrying Rapid Commit (option 80) with an ACK (RFC 4039)
+	AddressPoolPolicy appAllocationPolicy;  // How a new client's address is picked
+};
+
+// The message type is the first option of every reply, so its value is at a fixed offset
+#define DHCP_REPLY_MESSAGE_TYPE_OFFSET (2)
+
+// Fully encoded replies of one scope (header, server name, magic cookie and
+// every option), built once. Write copies the one for the message type and
+// patches the fields that differ between replies, so the extra options cost
+// nothing per packet.
+class DhcpReplyTemplate
+{
+public:
+	DhcpReplyTemplate();
+
+	// dwServerAddr and dwMask in network order; fails if the options do not
+	// fit in DHCP_REPLY_MAX_OPTIONS_SIZE
+	bool Build(const uint32_t dwServerAddr, const uint32_t dwMask, const DhcpScopeOptions& rdso);
+
+	// Writes the bMessageType reply (OFFER, ACK or NAK) to rdhcpmRequest into
+	// pbReply (DHCP_REPLY_SIZE bytes) and returns its size. Addresses are in
+	// network order. bRapidCommit adds the Rapid Commit option to an ACK
+	// (RFC 4039 section 4), for one that answers a DISCOVER. A relay agent's Relay Agent Information option data (0
+	// for none) is echoed as the last option (RFC 3046 section 2.2), if it fits.
+	size_t Write(const DHCPMessage& rdhcpmRequest, const uint8_t bMessageType, const uint32_t dwYiaddr, const uint32_t dwCiaddr, const bool bRapidCommit, const uint8_t* const pbRelayAgentInformation, const size_t stRelayAgentInformationSize, uint8_t* const pbReply) const;
+
+	static void ClearScopeOptions(DhcpScopeOptions* const pdso);
+
+private:
+	static void BuildHeader(uint8_t* const pbReply);
+
+	uint8_t m_pbLease[DHCP_REPLY_SIZE];  // OFFER and ACK
+	size_t m_stLeaseSize;
+	uint8_t m_pbRapidCommitAck[DHCP_REPLY_SIZE];  // The same with Rapid Commit
+	size_t m_stRapidCommitAckSize;
+	uint8_t m_pbNak[DHCP_REPLY_SIZE];
+	size_t m_stNakSize;
+};
+
+#endif  // !defined(DHCP_REPLY_TEMPLATE_HEADER)
@@ -0,0 +1,215 @@
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <system_error>
+#include "ToolBox.h"
+#include "EventLog.h"
+
+// How long the formatter sleeps when every ring is empty (milliseconds)
+#define EVENT_LOG_IDLE_INTERVAL (10)
+// Drop reports are written at most this often (milliseconds)
+#define EVENT_LOG_DROP_REPORT_INTERVAL (1000)
+// Formatted lines are collected in a buffer of this size before each write
+#define EVENT_LOG_BUFFER_SIZE (64 * 1024)
+// Longest line a format function may produce
+#define EVENT_LOG_MAX_LINE_SIZE (256)
+
+C_ASSERT(64 == sizeof(LogRecord));
+C_ASSERT(0 == (EVENT_LOG_RING_SIZE & (EVENT_LOG_RING_SIZE - 1)));
+
+static const char* const ppcsLevelPrefixes[LogLevel_OFF] = { "", "", "WARNING: ", "ERROR: " };
+
+EventLog::EventLog()
+	: m_iThreadCount(0), m_llLevel(LogLevel_OFF), m_pfnFormat(0), m_pfOutput(0), m_abStopping(false)
+{
+}
+
+EventLog::~EventLog()
+{
+	Stop();
+}
+
+bool EventLog::Start(const unsigned int iThreadCount, const LogLevel llLevel, const PFN_FORMAT_LOG_RECORD pfnFormat, FILE* const pfOutput)
+{
+	ASSERT((1 <= iThreadCount) && (0 != pfnFormat) && (0 != pfOutput) && !m_thFormatter.joinable());
+	if (LogLevel_OFF == llLevel)
+	{
+		return true;  // No rings and no thread; IsEnabled stays false
+	}
+	try
+	{
+		m_prRings.reset(new Ring[iThreadCount]);
+		for (unsigned int i = 0; i < iThreadCount; i++)
+		{
+			Ring& rr = m_prRings[i];
+			rr.plrRecords.reset(new LogRecord[EVENT_LOG_RING_SIZE]);
+			rr.adwTail.store(0, std::memory_order_relaxed);
+			rr.dwCachedHead = 0;
+			rr.aqwDropped.store(0, std::memory_order_relaxed);
+			rr.adwHead.store(0, std::memory_order_relaxed);
+			rr.dwDrainTail = 0;
+			rr.qwReportedDropped = 0;
+		}
+	}
+	catch (const std::bad_alloc)
+	{
+		m_prRings.reset();
+		return false;
+	}
+	m_iThreadCount = iThreadCount;
+	m_pfnFormat = pfnFormat;
+	m_pfOutput = pfOutput;
+	m_abStopping = false;
+	try
+	{
+		m_thFormatter = std::thread(&EventLog::Run, this);
+	}
+	catch (const std::system_error&)
+	{
+		m_prRings.reset();
+		return false;
+	}
+	m_llLevel = llLevel;
+	return true;
+}
+
+void EventLog::Write(const unsigned int iThread, const LogLevel llLevel, const uint16_t wEvent, const uint32_t dwArgument, const void* const pvText, const size_t stTextSize)
+{
+	ASSERT((iThread < m_iThreadCount) || !IsEnabled(llLevel));
+	if (!IsEnabled(llLevel))
+	{
+		return;
+	}
+	Ring& rr = m_prRings[iThread];
+	const uint32_t dwTail = rr.adwTail.load(std::memory_order_relaxed);
+	if (EVENT_LOG_RING_SIZE == dwTail - rr.dwCachedHead)
+	{
+		rr.dwCachedHead = rr.adwHead.load(std::memory_order_acquire);
+		if (EVENT_LOG_RING_SIZE == dwTail - rr.dwCachedHead)
+		{
+			// Only this thread writes the counter, so no read-modify-write is needed
+			rr.aqwDropped.store(rr.aqwDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	LogRecord& rlr = rr.plrRecords[dwTail & (EVENT_LOG_RING_SIZE - 1)];
+	rlr.qwTimestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	rlr.dwArgument = dwArgument;
+	rlr.wEvent = wEvent;
+	rlr.bLevel = (uint8_t)llLevel;
+	rlr.bTextSize = (uint8_t)((LOG_RECORD_MAX_TEXT_SIZE < stTextSize) ? LOG_RECORD_MAX_TEXT_SIZE : stTextSize);
+	if (0 != rlr.bTextSize)
+	{
+		memcpy(rlr.pcsText, pvText, rlr.bTextSize);
+	}
+	rr.adwTail.store(dwTail + 1, std::memory_order_release);
+}
+
+bool EventLog::Drain()
+{
+	for (unsigned int i = 0; i < m_iThreadCount; i++)
+	{
+		m_prRings[i].dwDrainTail = m_prRings[i].adwTail.load(std::memory_order_acquire);
+	}
+	char pcsBuffer[EVENT_LOG_BUFFER_SIZE];
+	size_t stBuffered = 0;
+	bool bWritten = false;
+	while (true)
+	{
+		// Oldest record at the head of any ring (there are few rings, so a scan beats a heap)
+		Ring* prOldest = 0;
+		uint64_t qwOldest = 0;
+		for (unsigned int i = 0; i < m_iThreadCount; i++)
+		{
+			Ring& rr = m_prRings[i];
+			const uint32_t dwHead = rr.adwHead.load(std::memory_order_relaxed);
+			if (dwHead != rr.dwDrainTail)
+			{
+				const uint64_t qwTimestamp = rr.plrRecords[dwHead & (EVENT_LOG_RING_SIZE - 1)].qwTimestamp;
+				if ((0 == prOldest) || (qwTimestamp < qwOldest))
+				{
+					prOldest = &rr;
+					qwOldest = qwTimestamp;
+				}
+			}
+		}
+		if (0 == prOldest)
+		{
+			break;
+		}
+		const uint32_t dwHead = prOldest->adwHead.load(std::memory_order_relaxed);
+		const LogRecord& rlr = prOldest->plrRecords[dwHead & (EVENT_LOG_RING_SIZE - 1)];
+		if (sizeof(pcsBuffer) - stBuffered < EVENT_LOG_MAX_LINE_SIZE)
+		{
+			fwrite(pcsBuffer, 1, stBuffered, m_pfOutput);
+			stBuffered = 0;
+		}
+		const char* const pcsPrefix = (rlr.bLevel < ARRAY_LENGTH(ppcsLevelPrefixes)) ? ppcsLevelPrefixes[rlr.bLevel] : "";
+		const size_t stPrefix = strlen(pcsPrefix);
+		memcpy(&pcsBuffer[stBuffered], pcsPrefix, stPrefix);
+		stBuffered += stPrefix;
+		size_t stLine = m_pfnFormat(rlr, &pcsBuffer[stBuffered], EVENT_LOG_MAX_LINE_SIZE - stPrefix - 1);
+		if (EVENT_LOG_MAX_LINE_SIZE - stPrefix - 2 < stLine)
+		{
+			stLine = EVENT_LOG_MAX_LINE_SIZE - stPrefix - 2;  // snprintf returns the untruncated length
+		}
+		stBuffered += stLine;
+		pcsBuffer[stBuffered++] = '\n';
+		// Hands the slot back to the writer
+		prOldest->adwHead.store(dwHead + 1, std::memory_order_release);
+		bWritten = true;
+	}
+	if (bWritten)
+	{
+		fwrite(pcsBuffer, 1, stBuffered, m_pfOutput);
+		fflush(m_pfOutput);
+	}
+	return bWritten;
+}
+
+void EventLog::ReportDrops()
+{
+	for (unsigned int i = 0; i < m_iThreadCount; i++)
+	{
+		Ring& rr = m_prRings[i];
+		const uint64_t qwDropped = rr.aqwDropped.load(std::memory_order_relaxed);
+		if (rr.qwReportedDropped != qwDropped)
+		{
+			fprintf(m_pfOutput, "WARNING: %llu log records from thread %u dropped (ring full)\n", (unsigned long long)(qwDropped - rr.qwReportedDropped), i);
+			fflush(m_pfOutput);
+			rr.qwReportedDropped = qwDropped;
+		}
+	}
+}
+
+void EventLog::Run()
+{
+	std::chrono::steady_clock::time_point tpLastReport = std::chrono::steady_clock::now();
+	while (!m_abStopping)
+	{
+		if (!Drain())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(EVENT_LOG_IDLE_INTERVAL));
+		}
+		const std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+		if (std::chrono::milliseconds(EVENT_LOG_DROP_REPORT_INTERVAL) <= tpNow - tpLastReport)
+		{
+			ReportDrops();
+			tpLastReport = tpNow;
+		}
+	}
+	Drain();
+	ReportDrops();
+}
+
+void EventLog::Stop()
+{
+	if (m_thFormatter.joinable())
+	{
+		m_abStopping = true;
+		m_thFormatter.join();
+	}
+	m_llLevel = LogLevel_OFF;
+	m_prRings.reset();
+	m_iThreadCount = 0;
+}
@@ -0,0 +1,92 @@
+#if !defined(EVENT_LOG_HEADER)
+#define EVENT_LOG_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+enum LogLevel
+{
+	LogLevel_DEBUG,
+	LogLevel_INFO,
+	LogLevel_WARNING,
+	LogLevel_ERROR,
+	LogLevel_OFF,  // Above every level: nothing is logged
+};
+
+// Longest text a record carries (e.g. a client host name); longer text is cut
+#define LOG_RECORD_MAX_TEXT_SIZE (48)
+// Records per thread ring (a power of 2)
+#define EVENT_LOG_RING_SIZE (4096)
+
+// What a writer hands over: an event code and its arguments, not a formatted
+// line. The formatter thread turns it into text.
+struct LogRecord
+{
+	uint64_t qwTimestamp;  // Steady clock nanoseconds; orders records of different threads
+	uint32_t dwArgument;  // Event specific (e.g. an address)
+	uint16_t wEvent;  // Event code, meaningful to the format function
+	uint8_t bLevel;  // LogLevel
+	uint8_t bTextSize;
+	char pcsText[LOG_RECORD_MAX_TEXT_SIZE];  // Not NUL-terminated
+};
+
+// Writes the line for rlr (without the newline) and returns its length
+typedef size_t (*PFN_FORMAT_LOG_RECORD)(const LogRecord& rlr, char* const pcsBuffer, const size_t stBufferSize);
+
+// Asynchronous logger. Each writing thread owns a single-producer ring of
+// fixed-size binary records, so Write is a copy and a release store: no
+// locks, no formatting and no I/O on the caller's thread. A background
+// thread merges the rings in timestamp order, formats the records and writes
+// them out. When a ring is full the record is dropped and counted; the
+// formatter reports the drops at most once per second.
+class EventLog
+{
+public:
+	EventLog();
+	~EventLog();
+
+	// Writers are numbered [0, iThreadCount); records below llLevel are not kept
+	bool Start(const unsigned int iThreadCount, const LogLevel llLevel, const PFN_FORMAT_LOG_RECORD pfnFormat, FILE* const pfOutput);
+	// Writes out everything queued and stops the formatter
+	void Stop();
+
+	// The check callers make before building a record; false when stopped
+	bool IsEnabled(const LogLevel llLevel) const { return m_llLevel <= llLevel; }
+	// Only thread iThread may write with iThread
+	void Write(const unsigned int iThread, const LogLevel llLevel, const uint16_t wEvent, const uint32_t dwArgument, const void* const pvText, const size_t stTextSize);
+
+private:
+	struct alignas(64) Ring
+	{
+		// Writer side
+		std::atomic<uint32_t> adwTail;
+		uint32_t dwCachedHead;  // Last head the writer saw; saves reading the formatter's cache line
+		std::atomic<uint64_t> aqwDropped;
+		// Formatter side
+		alignas(64) std::atomic<uint32_t> adwHead;
+		uint32_t dwDrainTail;  // Tail when the current drain began
+		uint64_t qwReportedDropped;
+		std::unique_ptr<LogRecord[]> plrRecords;
+	};
+
+	void Run();
+	bool Drain();
+	void ReportDrops();
+
+	EventLog(const EventLog&);
+	EventLog& operator=(const EventLog&);
+
+	std::unique_ptr<Ring[]> m_prRings;
+	unsigned int m_iThreadCount;
+	LogLevel m_llLevel;
+	PFN_FORMAT_LOG_RECORD m_pfnFormat;
+	FILE* m_pfOutput;
+	std::atomic<bool> m_abStopping;
+	std::thread m_thFormatter;
+};
+
+#endif  // !defined(EVENT_LOG_HEADER)
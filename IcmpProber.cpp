@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <new>
+#include "ToolBox.h"
+#include "InternetChecksum.h"
+#include "IcmpProber.h"
+
+#define ICMP_ECHO_REPLY_TYPE (0)
+#define ICMP_ECHO_REQUEST_TYPE (8)
+#define ICMP_ECHO_HEADER_SIZE (8)
+// The echo data is the probed address, which the answer must come from
+#define ICMP_ECHO_SIZE (ICMP_ECHO_HEADER_SIZE + 4)
+#define IPV4_MIN_HEADER_SIZE (20)
+// Receive buffer: an IPv4 header with options and the echo reply (any more data is cut off)
+#define ICMP_ANSWER_BUFFER_SIZE (60 + ICMP_ECHO_SIZE)
+
+IcmpProber::IcmpProber()
+	: m_iWorkerCount(0), m_wIdentifier(0)
+{
+}
+
+IcmpProber::~IcmpProber()
+{
+	Close();
+}
+
+bool IcmpProber::Open(const unsigned int iWorkerCount)
+{
+	ASSERT((0 == m_iWorkerCount) && (1 <= iWorkerCount) && (iWorkerCount <= 0xffff));
+	try
+	{
+		m_piSockets.reset(new int[iWorkerCount]);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	m_iWorkerCount = iWorkerCount;
+	for (unsigned int i = 0; i < iWorkerCount; i++)
+	{
+		m_piSockets[i] = -1;
+	}
+	m_wIdentifier = (uint16_t)getpid();
+	for (unsigned int i = 0; i < iWorkerCount; i++)
+	{
+		// Echo replies to this process and worker (identifier and sequence number as one word)
+		struct sock_filter psfFilter[] =
+		{
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),  // IPv4 header length
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),  // ICMP type
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO_REPLY_TYPE, 0, 3),
+			BPF_STMT(BPF_LD | BPF_W | BPF_IND, 4),  // Identifier and sequence number
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ((uint32_t)m_wIdentifier << 16) | i, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		};
+		struct sock_fprog sfpFilter;
+		sfpFilter.len = (unsigned short)ARRAY_LENGTH(psfFilter);
+		sfpFilter.filter = psfFilter;
+		m_piSockets[i] = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+		if ((-1 == m_piSockets[i]) ||
+			(0 != setsockopt(m_piSockets[i], SOL_SOCKET, SO_ATTACH_FILTER, &sfpFilter, sizeof(sfpFilter))))
+		{
+			Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void IcmpProber::Close()
+{
+	for (unsigned int i = 0; i < m_iWorkerCount; i++)
+	{
+		if (-1 != m_piSockets[i])
+		{
+			VERIFY(0 == close(m_piSockets[i]));
+		}
+	}
+	m_piSockets.reset();
+	m_iWorkerCount = 0;
+}
+
+bool IcmpProber::SendProbe(const DhcpProbe& rdp, void* pvContext)
+{
+	const IcmpProber* const pipProber = (const IcmpProber*)pvContext;
+	ASSERT((0 != pipProber) && (rdp.iWorkerIndex < pipProber->m_iWorkerCount));
+	uint8_t pbEcho[ICMP_ECHO_SIZE];
+	pbEcho[0] = ICMP_ECHO_REQUEST_TYPE;
+	pbEcho[1] = 0;  // Code
+	WriteNetworkWord(&pbEcho[2], 0);
+	WriteNetworkWord(&pbEcho[4], pipProber->m_wIdentifier);
+	WriteNetworkWord(&pbEcho[6], (uint16_t)rdp.iWorkerIndex);
+	memcpy(&pbEcho[ICMP_ECHO_HEADER_SIZE], &rdp.dwAddr, sizeof(rdp.dwAddr));
+	WriteNetworkWord(&pbEcho[2], InternetChecksum(pbEcho, sizeof(pbEcho), 0));
+	struct sockaddr_in saAddr;
+	memset(&saAddr, 0, sizeof(saAddr));
+	saAddr.sin_family = AF_INET;
+	saAddr.sin_addr.s_addr = rdp.dwAddr;
+	struct iovec ioEcho;
+	ioEcho.iov_base = pbEcho;
+	ioEcho.iov_len = sizeof(pbEcho);
+	// Out of the client's interface, from the scope's server address, like the reply will be
+	uint8_t pbControl[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	memset(pbControl, 0, sizeof(pbControl));
+	struct msghdr mhEcho;
+	memset(&mhEcho, 0, sizeof(mhEcho));
+	mhEcho.msg_name = &saAddr;
+	mhEcho.msg_namelen = sizeof(saAddr);
+	mhEcho.msg_iov = &ioEcho;
+	mhEcho.msg_iovlen = 1;
+	mhEcho.msg_control = pbControl;
+	mhEcho.msg_controllen = sizeof(pbControl);
+	struct cmsghdr* const pcmh = CMSG_FIRSTHDR(&mhEcho);
+	pcmh->cmsg_level = IPPROTO_IP;
+	pcmh->cmsg_type = IP_PKTINFO;
+	pcmh->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+	struct in_pktinfo ipiInfo;
+	memset(&ipiInfo, 0, sizeof(ipiInfo));
+	ipiInfo.ipi_ifindex = (int)rdp.iInterfaceIndex;
+	ipiInfo.ipi_spec_dst.s_addr = rdp.dwSourceAddr;
+	memcpy(CMSG_DATA(pcmh), &ipiInfo, sizeof(ipiInfo));
+	// A full socket buffer fails with EAGAIN rather than blocking
+	return sizeof(pbEcho) == sendmsg(pipProber->m_piSockets[rdp.iWorkerIndex], &mhEcho, MSG_DONTWAIT);
+}
+
+void IcmpProber::ReadAnswers(const unsigned int iWorkerIndex, DhcpEngine* const pdeEngine, const uint64_t qwNow)
+{
+	ASSERT((iWorkerIndex < m_iWorkerCount) && (0 != pdeEngine));
+	uint8_t pbAnswer[ICMP_ANSWER_BUFFER_SIZE];
+	while (true)
+	{
+		const ssize_t sstSize = recv(m_piSockets[iWorkerIndex], pbAnswer, sizeof(pbAnswer), MSG_DONTWAIT);
+		if (-1 == sstSize)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			return;  // EAGAIN: nothing more queued
+		}
+		// The filter let through only echo replies to this worker; the data must name the sender
+		const size_t stHeaderSize = (size_t)(pbAnswer[0] & 0x0f) * 4;
+		if ((IPV4_MIN_HEADER_SIZE <= stHeaderSize) && (stHeaderSize + ICMP_ECHO_SIZE <= (size_t)sstSize) &&
+			(0 == memcmp(&pbAnswer[12], &pbAnswer[stHeaderSize + ICMP_ECHO_HEADER_SIZE], sizeof(uint32_t))))
+		{
+			uint32_t dwAddr;
+			memcpy(&dwAddr, &pbAnswer[12], sizeof(dwAddr));
+			pdeEngine->ReportProbeAnswer(iWorkerIndex, dwAddr, qwNow);
+		}
+	}
+}
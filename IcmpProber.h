@@ -0,0 +1,42 @@
+#if !defined(ICMP_PROBER_HEADER)
+#define ICMP_PROBER_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include "DhcpEngine.h"
+
+// Conflict probes with ICMP echo requests (Linux), for
+// DhcpEngine::SetProber. Each worker has a non-blocking raw ICMP socket:
+// SendProbe queues an echo request and returns at once, and the worker
+// collects the replies with ReadAnswers whenever it wakes, so a probe never
+// holds up the receive loop. The echo identifier names this process and the
+// sequence number the worker, and a classic BPF filter keeps every other ICMP
+// message out of a worker's socket.
+class IcmpProber
+{
+public:
+	IcmpProber();
+	~IcmpProber();
+
+	// Fails without CAP_NET_RAW
+	bool Open(const unsigned int iWorkerCount);
+	void Close();
+
+	int Descriptor(const unsigned int iWorkerIndex) const { return m_piSockets[iWorkerIndex]; }
+
+	// PFN_DHCP_ENGINE_PROBE; pvContext is the IcmpProber
+	static bool SendProbe(const DhcpProbe& rdp, void* pvContext);
+	// Reports the answers to iWorkerIndex's probes received so far to pdeEngine; never blocks
+	void ReadAnswers(const unsigned int iWorkerIndex, DhcpEngine* const pdeEngine, const uint64_t qwNow);
+
+private:
+	IcmpProber(const IcmpProber&);
+	IcmpProber& operator=(const IcmpProber&);
+
+	std::unique_ptr<int[]> m_piSockets;  // Per worker
+	unsigned int m_iWorkerCount;
+	uint16_t m_wIdentifier;
+};
+
+#endif  // !defined(ICMP_PROBER_HEADER)
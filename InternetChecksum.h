@@ -0,0 +1,42 @@
+#if !defined(INTERNET_CHECKSUM_HEADER)
+#define INTERNET_CHECKSUM_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Helpers for the packets built and parsed by hand (PacketRing, IcmpProber)
+
+// 16-bit fields in network byte order, at any alignment
+static inline uint16_t ReadNetworkWord(const uint8_t* const pb)
+{
+	return (uint16_t)((pb[0] << 8) | pb[1]);
+}
+
+static inline void WriteNetworkWord(uint8_t* const pb, const uint16_t w)
+{
+	pb[0] = (uint8_t)(w >> 8);
+	pb[1] = (uint8_t)w;
+}
+
+// RFC 1071: ones' complement of the ones' complement sum of 16-bit words,
+// added to dwSum (e.g. a pseudo header's words). Over data that includes its
+// own correct checksum, the result is 0.
+static inline uint16_t InternetChecksum(const uint8_t* const pbData, const size_t stSize, uint32_t dwSum)
+{
+	size_t i = 0;
+	for (; i + 1 < stSize; i += 2)
+	{
+		dwSum += ReadNetworkWord(&pbData[i]);
+	}
+	if (i < stSize)
+	{
+		dwSum += (uint32_t)pbData[i] << 8;
+	}
+	while (0 != (dwSum >> 16))
+	{
+		dwSum = (dwSum & 0xffff) + (dwSum >> 16);
+	}
+	return (uint16_t)~dwSum;
+}
+
+#endif  // !defined(INTERNET_CHECKSUM_HEADER)
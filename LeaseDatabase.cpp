@@ -0,0 +1,360 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <system_error>
+#include "ToolBox.h"
+#include "LeaseTable.h"
+#include "LeaseDatabase.h"
+
+#define LEASE_DATABASE_MAGIC "DHCPLDB"  // 8 bytes with the NUL
+#define LEASE_DATABASE_VERSION (2)  // 2: several ranges
+// How often the writer appends queued changes to the log (milliseconds)
+#define LEASE_DATABASE_FLUSH_INTERVAL (200)
+// Log size that triggers a compaction
+#define LEASE_DATABASE_COMPACT_SIZE (1024 * 1024)
+
+C_ASSERT(64 == sizeof(LeaseRecord));
+
+LeaseDatabase::LeaseDatabase()
+	: m_iMapFile(-1), m_iLogFile(-1), m_pbMap(0), m_stMapSize(0), m_plrRecords(0), m_stLogSize(0), m_bStopping(false)
+{
+}
+
+LeaseDatabase::~LeaseDatabase()
+{
+	Close();
+}
+
+uint32_t LeaseDatabase::Checksum(const LeaseRecord& rlr)
+{
+	LeaseRecord lr = rlr;
+	lr.dwChecksum = 0;
+	return HashClientIdentifier((const uint8_t*)&lr, sizeof(lr));
+}
+
+LeaseRecord* LeaseDatabase::RecordOfAddrValue(const uint32_t dwAddrValue) const
+{
+	// Binary search for the last range starting at or below the address
+	size_t stLow = 0;
+	size_t stHigh = m_vmrRanges.size();
+	while (stLow < stHigh)
+	{
+		const size_t stMiddle = (stLow + stHigh) / 2;
+		if (m_vmrRanges[stMiddle].dwMinAddrValue <= dwAddrValue)
+		{
+			stLow = stMiddle + 1;
+		}
+		else
+		{
+			stHigh = stMiddle;
+		}
+	}
+	if ((0 == stLow) || (m_vmrRanges[stLow - 1].dwMaxAddrValue < dwAddrValue))
+	{
+		return 0;
+	}
+	const MappedRange& rmr = m_vmrRanges[stLow - 1];
+	return &m_plrRecords[rmr.stFirstRecord + (dwAddrValue - rmr.dwMinAddrValue)];
+}
+
+void LeaseDatabase::Apply(const LeaseRecord& rlr)
+{
+	// Records for addresses outside the ranges come from a log written before the ranges changed
+	LeaseRecord* const plr = RecordOfAddrValue(rlr.dwAddrValue);
+	if (0 != plr)
+	{
+		*plr = rlr;
+	}
+}
+
+bool LeaseDatabase::Open(const char* const pcsPath, const LeaseRange* const plrRanges, const size_t stRangeCount)
+{
+	ASSERT((0 != pcsPath) && (0 != plrRanges) && (1 <= stRangeCount) && (0 == m_pbMap));
+	std::string strLogPath;
+	try
+	{
+		strLogPath = std::string(pcsPath) + ".log";
+		m_vmrRanges.resize(stRangeCount);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < stRangeCount; i++)
+	{
+		ASSERT(plrRanges[i].dwMinAddrValue <= plrRanges[i].dwMaxAddrValue);
+		m_vmrRanges[i].dwMinAddrValue = plrRanges[i].dwMinAddrValue;
+		m_vmrRanges[i].dwMaxAddrValue = plrRanges[i].dwMaxAddrValue;
+	}
+	std::sort(m_vmrRanges.begin(), m_vmrRanges.end(), [](const MappedRange& rmrA, const MappedRange& rmrB) { return rmrA.dwMinAddrValue < rmrB.dwMinAddrValue; });
+	// Records follow in address order; the checksum tells whether a file was written for the same ranges
+	size_t stRecordCount = 0;
+	uint32_t pdwRangeValues[2];
+	uint32_t dwRangeChecksum = 0;
+	for (size_t i = 0; i < m_vmrRanges.size(); i++)
+	{
+		MappedRange& rmr = m_vmrRanges[i];
+		if ((0 != i) && (rmr.dwMinAddrValue <= m_vmrRanges[i - 1].dwMaxAddrValue))
+		{
+			m_vmrRanges.clear();
+			return false;
+		}
+		rmr.stFirstRecord = stRecordCount;
+		stRecordCount += (size_t)(rmr.dwMaxAddrValue - rmr.dwMinAddrValue) + 1;
+		pdwRangeValues[0] = rmr.dwMinAddrValue ^ dwRangeChecksum;
+		pdwRangeValues[1] = rmr.dwMaxAddrValue;
+		dwRangeChecksum = HashClientIdentifier((const uint8_t*)pdwRangeValues, sizeof(pdwRangeValues));
+	}
+	const size_t stMapSize = sizeof(LeaseDatabaseHeader) + (stRecordCount * sizeof(LeaseRecord));
+	m_iMapFile = open(pcsPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	m_iLogFile = open(strLogPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	struct stat sMapFile;
+	if ((-1 == m_iMapFile) || (-1 == m_iLogFile) || (0 != fstat(m_iMapFile, &sMapFile)))
+	{
+		Close();
+		return false;
+	}
+	// A file of another size belongs to other ranges; ftruncate zero-fills what it adds
+	const bool bResized = ((size_t)sMapFile.st_size != stMapSize);
+	if (bResized && (0 != ftruncate(m_iMapFile, (off_t)stMapSize)))
+	{
+		Close();
+		return false;
+	}
+	void* const pvMap = mmap(0, stMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_iMapFile, 0);
+	if (MAP_FAILED == pvMap)
+	{
+		Close();
+		return false;
+	}
+	m_pbMap = (uint8_t*)pvMap;
+	m_stMapSize = stMapSize;
+	m_plrRecords = (LeaseRecord*)(m_pbMap + sizeof(LeaseDatabaseHeader));
+	LeaseDatabaseHeader* const pldh = (LeaseDatabaseHeader*)m_pbMap;
+	C_ASSERT(sizeof(LEASE_DATABASE_MAGIC) == sizeof(pldh->pcsMagic));
+	if (bResized ||
+		(0 != memcmp(pldh->pcsMagic, LEASE_DATABASE_MAGIC, sizeof(pldh->pcsMagic))) ||
+		(LEASE_DATABASE_VERSION != pldh->dwVersion) ||
+		(sizeof(LeaseRecord) != pldh->dwRecordSize) ||
+		(m_vmrRanges.size() != pldh->dwRangeCount) ||
+		(dwRangeChecksum != pldh->dwRangeChecksum))
+	{
+		// New file, or written for other ranges: start over
+		memset(m_pbMap, 0, m_stMapSize);
+		memcpy(pldh->pcsMagic, LEASE_DATABASE_MAGIC, sizeof(pldh->pcsMagic));
+		pldh->dwVersion = LEASE_DATABASE_VERSION;
+		pldh->dwRecordSize = sizeof(LeaseRecord);
+		pldh->dwRangeCount = (uint32_t)m_vmrRanges.size();
+		pldh->dwRangeChecksum = dwRangeChecksum;
+	}
+	// Fold in changes made since the last compaction so they are not replayed again
+	if (!ReplayLog() || !Compact())
+	{
+		Close();
+		return false;
+	}
+	m_bStopping = false;
+	try
+	{
+		m_thWriter = std::thread(&LeaseDatabase::RunWriter, this);
+	}
+	catch (const std::system_error&)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool LeaseDatabase::ReplayLog()
+{
+	if (-1 == lseek(m_iLogFile, 0, SEEK_SET))
+	{
+		return false;
+	}
+	LeaseRecord plrBuffer[256];
+	size_t stBuffered = 0;
+	while (true)
+	{
+		const ssize_t ssRead = read(m_iLogFile, (uint8_t*)plrBuffer + stBuffered, sizeof(plrBuffer) - stBuffered);
+		if (-1 == ssRead)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			return false;
+		}
+		stBuffered += (size_t)ssRead;
+		const size_t stRecords = stBuffered / sizeof(LeaseRecord);
+		for (size_t i = 0; i < stRecords; i++)
+		{
+			if (Checksum(plrBuffer[i]) != plrBuffer[i].dwChecksum)
+			{
+				return true;  // Torn write from a crash; nothing after it was synced
+			}
+			Apply(plrBuffer[i]);
+		}
+		if (0 == ssRead)
+		{
+			return true;  // A partial record at the end is a torn write too
+		}
+		stBuffered -= stRecords * sizeof(LeaseRecord);
+		memmove(plrBuffer, &plrBuffer[stRecords], stBuffered);
+	}
+}
+
+size_t LeaseDatabase::ForEachLease(const PFN_LEASE_RECORD pfnRecord, void* const pvContext) const
+{
+	ASSERT((0 != m_plrRecords) && (0 != pfnRecord));
+	size_t stLeases = 0;
+	for (size_t i = 0; i < m_vmrRanges.size(); i++)
+	{
+		const MappedRange& rmr = m_vmrRanges[i];
+		const size_t stRecordCount = (size_t)(rmr.dwMaxAddrValue - rmr.dwMinAddrValue) + 1;
+		for (size_t j = 0; j < stRecordCount; j++)
+		{
+			const LeaseRecord& rlr = m_plrRecords[rmr.stFirstRecord + j];
+			if ((LeaseRecordState_FREE != rlr.bState) && (rmr.dwMinAddrValue + j == rlr.dwAddrValue))
+			{
+				pfnRecord(rlr, pvContext);
+				stLeases++;
+			}
+		}
+	}
+	return stLeases;
+}
+
+void LeaseDatabase::Record(const uint32_t dwAddrValue, const LeaseRecordState lrsState, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime)
+{
+	ASSERT((0 == stClientIdentifierSize) || (0 != pbClientIdentifier));
+	if (LEASE_RECORD_MAX_CLIENT_IDENTIFIER_SIZE < stClientIdentifierSize)
+	{
+		return;  // Such a client gets a NAK after a restart and starts over
+	}
+	LeaseRecord lr;
+	memset(&lr, 0, sizeof(lr));
+	lr.dwAddrValue = dwAddrValue;
+	lr.qwExpireTime = qwExpireTime;
+	lr.bState = (uint8_t)lrsState;
+	lr.bClientIdentifierSize = (uint8_t)stClientIdentifierSize;
+	if (0 != stClientIdentifierSize)
+	{
+		memcpy(lr.pbClientIdentifier, pbClientIdentifier, stClientIdentifierSize);
+	}
+	lr.dwChecksum = Checksum(lr);
+	std::lock_guard<std::mutex> lgQueue(m_mtxQueue);
+	try
+	{
+		m_vlrQueue.push_back(lr);
+	}
+	catch (const std::bad_alloc)
+	{
+		// Lost change: the lease is served correctly but not remembered across a restart
+	}
+}
+
+bool LeaseDatabase::WriteBatch(const std::vector<LeaseRecord>& rvlrBatch)
+{
+	const uint8_t* pb = (const uint8_t*)&rvlrBatch[0];
+	size_t stRemaining = rvlrBatch.size() * sizeof(LeaseRecord);
+	bool bSuccess = true;
+	while (bSuccess && (0 != stRemaining))
+	{
+		const ssize_t ssWritten = write(m_iLogFile, pb, stRemaining);
+		if (-1 == ssWritten)
+		{
+			bSuccess = (EINTR == errno);
+			continue;
+		}
+		pb += ssWritten;
+		stRemaining -= (size_t)ssWritten;
+		m_stLogSize += (size_t)ssWritten;
+	}
+	bSuccess = bSuccess && (0 == fdatasync(m_iLogFile));
+	// The mapping is updated either way; if the log failed, compacting syncs it instead
+	for (size_t i = 0; i < rvlrBatch.size(); i++)
+	{
+		Apply(rvlrBatch[i]);
+	}
+	return bSuccess;
+}
+
+bool LeaseDatabase::Compact()
+{
+	// Once the mapping is on disk the log holds nothing it does not
+	if (0 != msync(m_pbMap, m_stMapSize, MS_SYNC))
+	{
+		return false;
+	}
+	if (0 != ftruncate(m_iLogFile, 0))
+	{
+		return false;
+	}
+	m_stLogSize = 0;
+	return true;
+}
+
+void LeaseDatabase::RunWriter()
+{
+	std::vector<LeaseRecord> vlrBatch;
+	std::unique_lock<std::mutex> ulQueue(m_mtxQueue);
+	while (true)
+	{
+		m_cvQueue.wait_for(ulQueue, std::chrono::milliseconds(LEASE_DATABASE_FLUSH_INTERVAL), [this] { return m_bStopping; });
+		vlrBatch.swap(m_vlrQueue);
+		const bool bStopping = m_bStopping;
+		ulQueue.unlock();
+		bool bCompact = bStopping;
+		if (!vlrBatch.empty())
+		{
+			bCompact = !WriteBatch(vlrBatch) || bCompact || (LEASE_DATABASE_COMPACT_SIZE <= m_stLogSize);
+			vlrBatch.clear();
+		}
+		if (bCompact)
+		{
+			Compact();  // On failure the log keeps growing and the next batch tries again
+		}
+		ulQueue.lock();
+		if (bStopping && m_vlrQueue.empty())
+		{
+			break;
+		}
+	}
+}
+
+void LeaseDatabase::Close()
+{
+	if (m_thWriter.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lgQueue(m_mtxQueue);
+			m_bStopping = true;
+		}
+		m_cvQueue.notify_one();
+		m_thWriter.join();
+	}
+	if (0 != m_pbMap)
+	{
+		VERIFY(0 == munmap(m_pbMap, m_stMapSize));
+		m_pbMap = 0;
+		m_plrRecords = 0;
+	}
+	if (-1 != m_iLogFile)
+	{
+		VERIFY(0 == close(m_iLogFile));
+		m_iLogFile = -1;
+	}
+	if (-1 != m_iMapFile)
+	{
+		VERIFY(0 == close(m_iMapFile));
+		m_iMapFile = -1;
+	}
+}
@@ -0,0 +1,109 @@
+#if !defined(LEASE_DATABASE_HEADER)
+#define LEASE_DATABASE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Longest client identifier a record holds; leases with longer ones are not persisted
+#define LEASE_RECORD_MAX_CLIENT_IDENTIFIER_SIZE (46)
+
+enum LeaseRecordState
+{
+	LeaseRecordState_FREE,  // Zero, so a new file starts out empty
+	LeaseRecordState_BOUND,
+	LeaseRecordState_QUARANTINED,  // DECLINEd; no client identifier
+};
+
+// Fixed-size record used both in the mapped file (one per address of the
+// served range) and in the change log. Each record is the full state of its
+// address, so replaying a record twice is harmless.
+struct LeaseRecord
+{
+	uint32_t dwAddrValue;  // Host order
+	uint32_t dwChecksum;  // Over the rest of the record; catches a torn write at the end of the log
+	uint64_t qwExpireTime;  // Seconds since the Unix epoch: monotonic clocks restart with the machine
+	uint8_t bState;  // LeaseRecordState
+	uint8_t bClientIdentifierSize;
+	uint8_t pbClientIdentifier[LEASE_RECORD_MAX_CLIENT_IDENTIFIER_SIZE];
+};
+
+// A range of addresses (host order values) the database keeps a record for each of
+struct LeaseRange
+{
+	uint32_t dwMinAddrValue;
+	uint32_t dwMaxAddrValue;
+};
+
+typedef void (*PFN_LEASE_RECORD)(const LeaseRecord& rlr, void* const pvContext);
+
+// Lease persistence (POSIX). The current state is a memory-mapped file of
+// fixed records indexed by address (the ranges of all scopes, one after the
+// other), so loading it is a single pass over memory. Changes are queued by Record (no I/O on the caller's thread) and a
+// background writer appends them to <file>.log, syncs the log, and applies
+// them to the mapping. Once the log grows past a threshold the writer syncs
+// the mapping and truncates the log (compaction); after a crash, Open
+// replays whatever the log still holds.
+class LeaseDatabase
+{
+public:
+	LeaseDatabase();
+	~LeaseDatabase();
+
+	// Maps pcsPath (starting over if it was written for other ranges), folds
+	// in the log, and starts the writer. The ranges must not overlap.
+	bool Open(const char* const pcsPath, const LeaseRange* const plrRanges, const size_t stRangeCount);
+	// Calls pfnRecord for every address that is not free and returns the count
+	size_t ForEachLease(const PFN_LEASE_RECORD pfnRecord, void* const pvContext) const;
+	// Queues the new state of an address; safe from any thread
+	void Record(const uint32_t dwAddrValue, const LeaseRecordState lrsState, const uint8_t* const pbClientIdentifier, const size_t stClientIdentifierSize, const uint64_t qwExpireTime);
+	// Writes everything queued, compacts, and unmaps
+	void Close();
+
+private:
+	struct LeaseDatabaseHeader
+	{
+		char pcsMagic[8];
+		uint32_t dwVersion;
+		uint32_t dwRecordSize;
+		uint32_t dwRangeCount;
+		uint32_t dwRangeChecksum;  // Over the sorted ranges
+		uint8_t pbReserved[40];
+	};
+	// A range and where its records start in the mapping
+	struct MappedRange
+	{
+		uint32_t dwMinAddrValue;
+		uint32_t dwMaxAddrValue;
+		size_t stFirstRecord;
+	};
+
+	static uint32_t Checksum(const LeaseRecord& rlr);
+	LeaseRecord* RecordOfAddrValue(const uint32_t dwAddrValue) const;
+	void Apply(const LeaseRecord& rlr);
+	bool ReplayLog();
+	bool WriteBatch(const std::vector<LeaseRecord>& rvlrBatch);
+	bool Compact();
+	void RunWriter();
+
+	LeaseDatabase(const LeaseDatabase&);
+	LeaseDatabase& operator=(const LeaseDatabase&);
+
+	int m_iMapFile;
+	int m_iLogFile;
+	uint8_t* m_pbMap;
+	size_t m_stMapSize;
+	LeaseRecord* m_plrRecords;  // In the mapping, after the header
+	std::vector<MappedRange> m_vmrRanges;  // Sorted by address
+	size_t m_stLogSize;  // Only touched by the writer once it runs
+	std::mutex m_mtxQueue;
+	std::condition_variable m_cvQueue;
+	std::vector<LeaseRecord> m_vlrQueue;
+	bool m_bStopping;
+	std::thread m_thWriter;
+};
+
+#endif  // !defined(LEASE_DATABASE_HEADER)
@@ -0,0 +1,392 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "ToolBox.h"
+#include "LeaseTable.h"
+
+// Initial client index size (slots); kept at most half full
+#define CLIENT_INDEX_INITIAL_SIZE (64)
+
+uint32_t HashClientIdentifier(const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize)
+{
+	ASSERT((0 == dwClientIdentifierSize) || (0 != pbClientIdentifier));
+	// FNV-1a followed by a final avalanche so the low bits (used to pick the
+	// slot) depend on every byte - chaddr values are mostly zero padding
+	uint32_t dwHash = 2166136261u;
+	for (uint32_t i = 0; i < dwClientIdentifierSize; i++)
+	{
+		dwHash ^= pbClientIdentifier[i];
+		dwHash *= 16777619u;
+	}
+	dwHash ^= dwHash >> 16;
+	dwHash *= 0x85ebca6bu;
+	dwHash ^= dwHash >> 13;
+	dwHash *= 0xc2b2ae35u;
+	dwHash ^= dwHash >> 16;
+	return dwHash;
+}
+
+ClientIdentifierArena::ClientIdentifierArena()
+	: m_pbChunkCurrent(0), m_stChunkRemaining(0)
+{
+	for (size_t i = 0; i < CLASS_COUNT; i++)
+	{
+		m_ppbFreeLists[i] = 0;
+	}
+}
+
+ClientIdentifierArena::~ClientIdentifierArena()
+{
+	for (size_t i = 0; i < m_vpbChunks.size(); i++)
+	{
+		free(m_vpbChunks[i]);
+	}
+}
+
+size_t ClientIdentifierArena::SizeClass(const uint32_t dwSize)
+{
+	ASSERT((0 != dwSize) && (dwSize <= MAX_CLIENT_IDENTIFIER_SIZE));
+	size_t stClass = 0;
+	while ((((uint32_t)1) << (MIN_CLASS_SHIFT + stClass)) < dwSize)
+	{
+		stClass++;
+	}
+	return stClass;
+}
+
+uint8_t* ClientIdentifierArena::Allocate(const uint32_t dwSize)
+{
+	const size_t stClass = SizeClass(dwSize);
+	uint8_t* pb = m_ppbFreeLists[stClass];
+	if (0 != pb)
+	{
+		memcpy(&m_ppbFreeLists[stClass], pb, sizeof(uint8_t*));
+		return pb;
+	}
+	const size_t stBlockSize = ((size_t)1) << (MIN_CLASS_SHIFT + stClass);
+	if (m_stChunkRemaining < stBlockSize)
+	{
+		// Blocks are powers of 2 no larger than a chunk, so the tail of the old
+		// chunk is only wasted when a large class needs a new chunk
+		uint8_t* const pbChunk = (uint8_t*)malloc(CHUNK_SIZE);
+		if (0 == pbChunk)
+		{
+			return 0;
+		}
+		try
+		{
+			m_vpbChunks.push_back(pbChunk);
+		}
+		catch (const std::bad_alloc)
+		{
+			free(pbChunk);
+			return 0;
+		}
+		m_pbChunkCurrent = pbChunk;
+		m_stChunkRemaining = CHUNK_SIZE;
+	}
+	pb = m_pbChunkCurrent;
+	m_pbChunkCurrent += stBlockSize;
+	m_stChunkRemaining -= stBlockSize;
+	return pb;
+}
+
+void ClientIdentifierArena::Free(uint8_t* const pb, const uint32_t dwSize)
+{
+	ASSERT(0 != pb);
+	const size_t stClass = SizeClass(dwSize);
+	memcpy(pb, &m_ppbFreeLists[stClass], sizeof(uint8_t*));
+	m_ppbFreeLists[stClass] = pb;
+}
+
+LeaseTable::LeaseTable()
+	: m_stClientIndexCount(0), m_dwMinAddrValue(1), m_dwMaxAddrValue(0)
+{
+}
+
+bool LeaseTable::Initialize(const uint32_t dwMinAddrValue, const uint32_t dwMaxAddrValue)
+{
+	ASSERT(dwMinAddrValue <= dwMaxAddrValue);
+	try
+	{
+		m_vAddrIndex.assign((size_t)(dwMaxAddrValue - dwMinAddrValue) + 1, 0);
+		m_vClientIndex.assign(CLIENT_INDEX_INITIAL_SIZE, ClientIndexSlot());
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	if (!m_twExpiry.Initialize(dwMaxAddrValue - dwMinAddrValue + 1))
+	{
+		return false;
+	}
+	m_vLeases.clear();
+	m_stClientIndexCount = 0;
+	m_dwMinAddrValue = dwMinAddrValue;
+	m_dwMaxAddrValue = dwMaxAddrValue;
+	return true;
+}
+
+int LeaseTable::FindByClientIdentifier(const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize) const
+{
+	ASSERT((0 != pbClientIdentifier) && (0 != dwClientIdentifierSize) && !m_vClientIndex.empty());
+	const uint32_t dwHash = HashClientIdentifier(pbClientIdentifier, dwClientIdentifierSize);
+	const size_t stMask = m_vClientIndex.size() - 1;
+	for (size_t i = dwHash & stMask; ; i = (i + 1) & stMask)
+	{
+		const ClientIndexSlot& rcis = m_vClientIndex[i];
+		if (0 == rcis.dwLeaseIndexPlusOne)
+		{
+			return -1;
+		}
+		if (dwHash == rcis.dwHash)
+		{
+			const AddressInUseInformation& raiui = m_vLeases[rcis.dwLeaseIndexPlusOne - 1];
+			if ((dwClientIdentifierSize == raiui.dwClientIdentifierSize) && (0 == memcmp(pbClientIdentifier, raiui.GetClientIdentifier(), dwClientIdentifierSize)))
+			{
+				return (int)(rcis.dwLeaseIndexPlusOne - 1);
+			}
+		}
+	}
+}
+
+int LeaseTable::FindByAddrValue(const uint32_t dwAddrValue) const
+{
+	if ((dwAddrValue < m_dwMinAddrValue) || (m_dwMaxAddrValue < dwAddrValue))
+	{
+		// Not in the served range, so never handed out
+		return -1;
+	}
+	return (int)m_vAddrIndex[dwAddrValue - m_dwMinAddrValue] - 1;
+}
+
+bool LeaseTable::Add(const uint32_t dwAddrValue, const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize)
+{
+	ASSERT((0 == dwClientIdentifierSize) || (0 != pbClientIdentifier));
+	ASSERT(-1 == FindByAddrValue(dwAddrValue));
+	if (MAX_CLIENT_IDENTIFIER_SIZE < dwClientIdentifierSize)
+	{
+		return false;
+	}
+	AddressInUseInformation aiui;
+	aiui.dwAddrValue = dwAddrValue;
+	aiui.dwClientIdentifierSize = dwClientIdentifierSize;
+	if (dwClientIdentifierSize <= INLINE_CLIENT_IDENTIFIER_SIZE)
+	{
+		memset(aiui.ClientIdentifier.pbInline, 0, sizeof(aiui.ClientIdentifier.pbInline));
+		memcpy(aiui.ClientIdentifier.pbInline, pbClientIdentifier, dwClientIdentifierSize);
+	}
+	else
+	{
+		aiui.ClientIdentifier.pbExternal = m_ciaArena.Allocate(dwClientIdentifierSize);
+		if (0 == aiui.ClientIdentifier.pbExternal)
+		{
+			return false;
+		}
+		memcpy(aiui.ClientIdentifier.pbExternal, pbClientIdentifier, dwClientIdentifierSize);
+	}
+	const uint32_t dwLeaseIndex = (uint32_t)m_vLeases.size();
+	try
+	{
+		m_vLeases.push_back(aiui);
+	}
+	catch (const std::bad_alloc)
+	{
+		if (INLINE_CLIENT_IDENTIFIER_SIZE < dwClientIdentifierSize)
+		{
+			m_ciaArena.Free(aiui.ClientIdentifier.pbExternal, dwClientIdentifierSize);
+		}
+		return false;
+	}
+	if (0 != dwClientIdentifierSize)
+	{
+		if (!InsertClientIndex(HashClientIdentifier(pbClientIdentifier, dwClientIdentifierSize), dwLeaseIndex))
+		{
+			if (INLINE_CLIENT_IDENTIFIER_SIZE < dwClientIdentifierSize)
+			{
+				m_ciaArena.Free(aiui.ClientIdentifier.pbExternal, dwClientIdentifierSize);
+			}
+			m_vLeases.pop_back();
+			return false;
+		}
+	}
+	if (InRange(dwAddrValue))
+	{
+		m_vAddrIndex[dwAddrValue - m_dwMinAddrValue] = dwLeaseIndex + 1;
+	}
+	return true;
+}
+
+void LeaseTable::Remove(const size_t i)
+{
+	ASSERT(i < m_vLeases.size());
+	AddressInUseInformation& raiui = m_vLeases[i];
+	if (0 != raiui.dwClientIdentifierSize)
+	{
+		RemoveClientIndex(FindClientIndexSlot(HashClientIdentifier(raiui.GetClientIdentifier(), raiui.dwClientIdentifierSize), (uint32_t)i));
+		if (INLINE_CLIENT_IDENTIFIER_SIZE < raiui.dwClientIdentifierSize)
+		{
+			m_ciaArena.Free(raiui.ClientIdentifier.pbExternal, raiui.dwClientIdentifierSize);
+		}
+	}
+	if (InRange(raiui.dwAddrValue))
+	{
+		m_vAddrIndex[raiui.dwAddrValue - m_dwMinAddrValue] = 0;
+		m_twExpiry.Cancel(raiui.dwAddrValue - m_dwMinAddrValue);
+	}
+	// Keep the records dense by moving the last one into the hole
+	const size_t stLast = m_vLeases.size() - 1;
+	if (i != stLast)
+	{
+		raiui = m_vLeases[stLast];
+		if (0 != raiui.dwClientIdentifierSize)
+		{
+			m_vClientIndex[FindClientIndexSlot(HashClientIdentifier(raiui.GetClientIdentifier(), raiui.dwClientIdentifierSize), (uint32_t)stLast)].dwLeaseIndexPlusOne = (uint32_t)i + 1;
+		}
+		if (InRange(raiui.dwAddrValue))
+		{
+			m_vAddrIndex[raiui.dwAddrValue - m_dwMinAddrValue] = (uint32_t)i + 1;
+		}
+	}
+	m_vLeases.pop_back();
+}
+
+void LeaseTable::Quarantine(const size_t i, const uint64_t qwExpireTime)
+{
+	ASSERT(i < m_vLeases.size());
+	AddressInUseInformation& raiui = m_vLeases[i];
+	if (0 != raiui.dwClientIdentifierSize)
+	{
+		RemoveClientIndex(FindClientIndexSlot(HashClientIdentifier(raiui.GetClientIdentifier(), raiui.dwClientIdentifierSize), (uint32_t)i));
+		if (INLINE_CLIENT_IDENTIFIER_SIZE < raiui.dwClientIdentifierSize)
+		{
+			m_ciaArena.Free(raiui.ClientIdentifier.pbExternal, raiui.dwClientIdentifierSize);
+		}
+		raiui.dwClientIdentifierSize = 0;
+	}
+	SetExpireTime(i, qwExpireTime);
+}
+
+void LeaseTable::SetExpireTime(const size_t i, const uint64_t qwExpireTime)
+{
+	ASSERT(i < m_vLeases.size());
+	const AddressInUseInformation& raiui = m_vLeases[i];
+	ASSERT(InRange(raiui.dwAddrValue));
+	m_twExpiry.Schedule(raiui.dwAddrValue - m_dwMinAddrValue, qwExpireTime);
+}
+
+uint64_t LeaseTable::ExpireTime(const size_t i) const
+{
+	ASSERT(i < m_vLeases.size());
+	const AddressInUseInformation& raiui = m_vLeases[i];
+	if (!InRange(raiui.dwAddrValue) || !m_twExpiry.IsScheduled(raiui.dwAddrValue - m_dwMinAddrValue))
+	{
+		return 0;
+	}
+	return m_twExpiry.ExpireTime(raiui.dwAddrValue - m_dwMinAddrValue);
+}
+
+size_t LeaseTable::ExpireLeases(const uint64_t qwNow, const PFN_LEASE_EXPIRED pfnExpired, void* const pvContext)
+{
+	ExpiryContext ec;
+	ec.pltTable = this;
+	ec.pfnExpired = pfnExpired;
+	ec.pvContext = pvContext;
+	return m_twExpiry.Advance(qwNow, OnTimerExpired, &ec);
+}
+
+void LeaseTable::OnTimerExpired(const uint32_t dwId, void* const pvContext)
+{
+	const ExpiryContext* const pec = (const ExpiryContext*)pvContext;
+	LeaseTable* const plt = pec->pltTable;
+	ASSERT(0 != plt->m_vAddrIndex[dwId]);
+	const size_t i = plt->m_vAddrIndex[dwId] - 1;
+	if (0 != pec->pfnExpired)
+	{
+		pec->pfnExpired(plt->m_vLeases[i], pec->pvContext);
+	}
+	plt->Remove(i);
+}
+
+bool LeaseTable::InsertClientIndex(const uint32_t dwHash, const uint32_t dwLeaseIndex)
+{
+	if ((m_stClientIndexCount + 1) * 2 > m_vClientIndex.size())
+	{
+		if (!GrowClientIndex())
+		{
+			return false;
+		}
+	}
+	const size_t stMask = m_vClientIndex.size() - 1;
+	size_t i = dwHash & stMask;
+	while (0 != m_vClientIndex[i].dwLeaseIndexPlusOne)
+	{
+		i = (i + 1) & stMask;
+	}
+	m_vClientIndex[i].dwHash = dwHash;
+	m_vClientIndex[i].dwLeaseIndexPlusOne = dwLeaseIndex + 1;
+	m_stClientIndexCount++;
+	return true;
+}
+
+size_t LeaseTable::FindClientIndexSlot(const uint32_t dwHash, const uint32_t dwLeaseIndex) const
+{
+	const size_t stMask = m_vClientIndex.size() - 1;
+	size_t i = dwHash & stMask;
+	while (dwLeaseIndex + 1 != m_vClientIndex[i].dwLeaseIndexPlusOne)
+	{
+		ASSERT(0 != m_vClientIndex[i].dwLeaseIndexPlusOne);
+		i = (i + 1) & stMask;
+	}
+	return i;
+}
+
+void LeaseTable::RemoveClientIndex(const size_t stSlot)
+{
+	// Backward shift deletion: pull later entries of the probe run into the
+	// hole so lookups never need tombstones
+	const size_t stMask = m_vClientIndex.size() - 1;
+	size_t i = stSlot;
+	for (size_t j = (i + 1) & stMask; 0 != m_vClientIndex[j].dwLeaseIndexPlusOne; j = (j + 1) & stMask)
+	{
+		// An entry can move back to i only if its home slot is not in (i, j]
+		const size_t stHome = m_vClientIndex[j].dwHash & stMask;
+		if (((j - stHome) & stMask) >= ((j - i) & stMask))
+		{
+			m_vClientIndex[i] = m_vClientIndex[j];
+			i = j;
+		}
+	}
+	m_vClientIndex[i].dwHash = 0;
+	m_vClientIndex[i].dwLeaseIndexPlusOne = 0;
+	m_stClientIndexCount--;
+}
+
+bool LeaseTable::GrowClientIndex()
+{
+	std::vector<ClientIndexSlot> vClientIndex;
+	try
+	{
+		vClientIndex.assign(m_vClientIndex.size() * 2, ClientIndexSlot());
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	const size_t stMask = vClientIndex.size() - 1;
+	for (size_t i = 0; i < m_vClientIndex.size(); i++)
+	{
+		const ClientIndexSlot& rcis = m_vClientIndex[i];
+		if (0 != rcis.dwLeaseIndexPlusOne)
+		{
+			size_t j = rcis.dwHash & stMask;
+			while (0 != vClientIndex[j].dwLeaseIndexPlusOne)
+			{
+				j = (j + 1) & stMask;
+			}
+			vClientIndex[j] = rcis;
+		}
+	}
+	m_vClientIndex.swap(vClientIndex);
+	return true;
+}
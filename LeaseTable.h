@@ -0,0 +1,139 @@
+#if !defined(LEASE_TABLE_HEADER)
+#define LEASE_TABLE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "TimingWheel.h"
+
+// Client identifiers up to this size (chaddr is 16 bytes, a typical option 61
+// value is 7) are stored in the lease record itself
+#define INLINE_CLIENT_IDENTIFIER_SIZE (24)
+// Longest client identifier accepted (RFC 3396 concatenation allows more than
+// the 255 bytes of a single option)
+#define MAX_CLIENT_IDENTIFIER_SIZE (1024)
+
+struct AddressInUseInformation
+{
+	uint32_t dwAddrValue;
+	uint32_t dwClientIdentifierSize;  // 0 for the server's own address and quarantined addresses
+	union
+	{
+		uint8_t pbInline[INLINE_CLIENT_IDENTIFIER_SIZE];
+		uint8_t* pbExternal;  // Owned by the lease table's ClientIdentifierArena
+	} ClientIdentifier;
+	// The expiry time is kept by the lease table's timing wheel (keyed by address)
+
+	const uint8_t* GetClientIdentifier() const
+	{
+		return (dwClientIdentifierSize <= INLINE_CLIENT_IDENTIFIER_SIZE) ? ClientIdentifier.pbInline : ClientIdentifier.pbExternal;
+	}
+};
+
+// Slab allocator for client identifiers too long to store inline: power of 2
+// size classes carved out of large chunks, with a free list per class
+class ClientIdentifierArena
+{
+public:
+	ClientIdentifierArena();
+	~ClientIdentifierArena();
+
+	uint8_t* Allocate(const uint32_t dwSize);
+	void Free(uint8_t* const pb, const uint32_t dwSize);
+	size_t BytesReserved() const { return m_vpbChunks.size() * CHUNK_SIZE; }
+
+private:
+	enum
+	{
+		CHUNK_SIZE = 64 * 1024,
+		MIN_CLASS_SHIFT = 5,  // 32 bytes
+		MAX_CLASS_SHIFT = 10,  // MAX_CLIENT_IDENTIFIER_SIZE
+		CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1,
+	};
+	static size_t SizeClass(const uint32_t dwSize);
+
+	ClientIdentifierArena(const ClientIdentifierArena&);
+	ClientIdentifierArena& operator=(const ClientIdentifierArena&);
+
+	std::vector<uint8_t*> m_vpbChunks;
+	uint8_t* m_pbChunkCurrent;
+	size_t m_stChunkRemaining;
+	uint8_t* m_ppbFreeLists[CLASS_COUNT];  // Next pointer is stored in the free block
+};
+
+// Hash used for the client identifier index (and anything else that needs to
+// spread clients evenly)
+uint32_t HashClientIdentifier(const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize);
+
+// Called for each lease that expires, just before it is removed
+typedef void (*PFN_LEASE_EXPIRED)(const AddressInUseInformation& raiui, void* const pvContext);
+
+// Lease store with two indexes:
+// - client identifier -> lease (open addressing, linear probing, hashed key)
+// - address value -> lease (direct table over [dwMinAddrValue, dwMaxAddrValue])
+// Both lookups are O(1), as are Add and Remove. Client identifiers are copied
+// into the lease record (or the arena), so callers can pass packet data
+// directly. Leases in the served range can be given an expiry time; leases
+// without one (like the server's own address) never expire. A quarantined
+// address is a record without a client identifier that does expire.
+class LeaseTable
+{
+public:
+	LeaseTable();
+
+	// Sizes the address index for the served range (host order values)
+	bool Initialize(const uint32_t dwMinAddrValue, const uint32_t dwMaxAddrValue);
+
+	// Return the lease index or -1 if there is no such lease
+	int FindByClientIdentifier(const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize) const;
+	int FindByAddrValue(const uint32_t dwAddrValue) const;
+
+	// Adds a lease to both indexes; entries without a client identifier (the
+	// server's own address) are only indexed by address
+	bool Add(const uint32_t dwAddrValue, const uint8_t* const pbClientIdentifier, const uint32_t dwClientIdentifierSize);
+
+	// Removes a lease from both indexes; the last lease moves into its index
+	void Remove(const size_t i);
+	// Unbinds the lease's client but keeps its address taken until qwExpireTime
+	void Quarantine(const size_t i, const uint64_t qwExpireTime);
+
+	// Times use the caller's clock (seconds for DhcpEngine); 0 means none set
+	void SetExpireTime(const size_t i, const uint64_t qwExpireTime);
+	uint64_t ExpireTime(const size_t i) const;
+	// Removes every lease whose expiry time is at or before qwNow and returns the count
+	size_t ExpireLeases(const uint64_t qwNow, const PFN_LEASE_EXPIRED pfnExpired, void* const pvContext);
+
+	size_t Size() const { return m_vLeases.size(); }
+	const AddressInUseInformation& At(const size_t i) const { return m_vLeases[i]; }
+
+private:
+	struct ClientIndexSlot
+	{
+		uint32_t dwHash;
+		uint32_t dwLeaseIndexPlusOne;  // 0 for an empty slot
+	};
+	struct ExpiryContext
+	{
+		LeaseTable* pltTable;
+		PFN_LEASE_EXPIRED pfnExpired;
+		void* pvContext;
+	};
+
+	bool InsertClientIndex(const uint32_t dwHash, const uint32_t dwLeaseIndex);
+	bool GrowClientIndex();
+	size_t FindClientIndexSlot(const uint32_t dwHash, const uint32_t dwLeaseIndex) const;
+	void RemoveClientIndex(const size_t stSlot);
+	bool InRange(const uint32_t dwAddrValue) const { return (m_dwMinAddrValue <= dwAddrValue) && (dwAddrValue <= m_dwMaxAddrValue); }
+	static void OnTimerExpired(const uint32_t dwId, void* const pvContext);
+
+	std::vector<AddressInUseInformation> m_vLeases;
+	ClientIdentifierArena m_ciaArena;
+	std::vector<ClientIndexSlot> m_vClientIndex;  // Size is a power of 2
+	size_t m_stClientIndexCount;
+	std::vector<uint32_t> m_vAddrIndex;  // Lease index + 1, 0 for a free address
+	TimingWheel m_twExpiry;  // Timer id is the address offset in the range
+	uint32_t m_dwMinAddrValue;
+	uint32_t m_dwMaxAddrValue;
+};
+
+#endif  // !defined(LEASE_TABLE_HEADER)
@@ -0,0 +1,313 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ToolBox.h"
+#include "InternetChecksum.h"
+#include "PacketRing.h"
+
+// RX ring: blocks are handed over when full or after PACKET_RING_BLOCK_TIMEOUT
+// milliseconds, which bounds the latency a quiet link adds to a request
+#define PACKET_RING_BLOCK_SIZE (1 << 16)
+#define PACKET_RING_RX_BLOCK_COUNT (16)
+#define PACKET_RING_BLOCK_TIMEOUT (1)
+// TX ring: PACKET_RING_TX_FRAME_SIZE slots, enough for several receive blocks' replies
+#define PACKET_RING_TX_BLOCK_COUNT (4)
+#define PACKET_RING_TX_FRAME_COUNT ((PACKET_RING_BLOCK_SIZE / PACKET_RING_TX_FRAME_SIZE) * PACKET_RING_TX_BLOCK_COUNT)
+// Where the kernel expects a transmitted frame in its slot (PACKET_TX_HAS_OFF not set)
+#define PACKET_RING_TX_DATA_OFFSET (TPACKET_ALIGN(sizeof(struct tpacket3_hdr)))
+#define ETHERNET_HEADER_SIZE (14)
+#define IPV4_HEADER_SIZE (20)
+#define UDP_HEADER_SIZE (8)
+#define IPV4_TTL (64)
+
+C_ASSERT(48 == PACKET_RING_TX_DATA_OFFSET);
+C_ASSERT(PACKET_RING_HEADERS_SIZE == ETHERNET_HEADER_SIZE + IPV4_HEADER_SIZE + UDP_HEADER_SIZE);
+C_ASSERT(0 == PACKET_RING_BLOCK_SIZE % PACKET_RING_TX_FRAME_SIZE);
+
+PacketRing::PacketRing()
+	: m_iSocket(-1), m_iInterfaceIndex(0), m_pbMap(0), m_stMapSize(0), m_iRxBlock(0), m_dwRxPacketsLeft(0), m_pbRxPacket(0), m_bRxBlockHeld(false),
+	m_iTxSlot(0), m_iTxQueued(0), m_wIdentification(0)
+{
+	memset(m_pbHardwareAddr, 0, sizeof(m_pbHardwareAddr));
+}
+
+PacketRing::~PacketRing()
+{
+	Close();
+}
+
+bool PacketRing::Open(const unsigned int iInterfaceIndex, const uint16_t wPort)
+{
+	ASSERT((-1 == m_iSocket) && (0 != iInterfaceIndex));
+	// Protocol 0 receives nothing until bind, so the filter and rings are in place first
+	m_iSocket = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (-1 == m_iSocket)
+	{
+		return false;
+	}
+	m_iInterfaceIndex = iInterfaceIndex;
+	struct ifreq ifrInterface;
+	memset(&ifrInterface, 0, sizeof(ifrInterface));
+	if ((0 == if_indextoname(iInterfaceIndex, ifrInterface.ifr_name)) ||
+		(0 != ioctl(m_iSocket, SIOCGIFHWADDR, &ifrInterface)) ||
+		(ARPHRD_ETHER != ifrInterface.ifr_hwaddr.sa_family))
+	{
+		Close();
+		return false;
+	}
+	memcpy(m_pbHardwareAddr, ifrInterface.ifr_hwaddr.sa_data, sizeof(m_pbHardwareAddr));
+	// Unfragmented IPv4 UDP datagrams to wPort that were not sent from this host
+	struct sock_filter psfFilter[] =
+	{
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_PKTTYPE)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 9, 0),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),  // EtherType
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 7),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ETHERNET_HEADER_SIZE + 9),  // Protocol
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 5),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, ETHERNET_HEADER_SIZE + 6),  // More fragments and fragment offset
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 3, 0),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, ETHERNET_HEADER_SIZE),  // IPv4 header length
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, ETHERNET_HEADER_SIZE + 2),  // UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, wPort, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	};
+	struct sock_fprog sfpFilter;
+	sfpFilter.len = (unsigned short)ARRAY_LENGTH(psfFilter);
+	sfpFilter.filter = psfFilter;
+	const int iVersion = TPACKET_V3;
+	const int iLoss = 1;  // A malformed TX frame is skipped rather than stalling the ring
+	if ((0 != setsockopt(m_iSocket, SOL_SOCKET, SO_ATTACH_FILTER, &sfpFilter, sizeof(sfpFilter))) ||
+		(0 != setsockopt(m_iSocket, SOL_PACKET, PACKET_VERSION, &iVersion, sizeof(iVersion))) ||
+		(0 != setsockopt(m_iSocket, SOL_PACKET, PACKET_LOSS, &iLoss, sizeof(iLoss))) ||
+		!MapRings())
+	{
+		Close();
+		return false;
+	}
+	struct sockaddr_ll sllInterface;
+	memset(&sllInterface, 0, sizeof(sllInterface));
+	sllInterface.sll_family = AF_PACKET;
+	sllInterface.sll_protocol = htons(ETH_P_IP);
+	sllInterface.sll_ifindex = (int)iInterfaceIndex;
+	if (0 != bind(m_iSocket, (const struct sockaddr*)&sllInterface, sizeof(sllInterface)))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool PacketRing::MapRings()
+{
+	struct tpacket_req3 tpr3Rx;
+	memset(&tpr3Rx, 0, sizeof(tpr3Rx));
+	tpr3Rx.tp_block_size = PACKET_RING_BLOCK_SIZE;
+	tpr3Rx.tp_block_nr = PACKET_RING_RX_BLOCK_COUNT;
+	tpr3Rx.tp_frame_size = TPACKET_ALIGNMENT << 7;  // Only checked for consistency: V3 packs frames of any size
+	tpr3Rx.tp_frame_nr = (PACKET_RING_BLOCK_SIZE / tpr3Rx.tp_frame_size) * PACKET_RING_RX_BLOCK_COUNT;
+	tpr3Rx.tp_retire_blk_tov = PACKET_RING_BLOCK_TIMEOUT;
+	// The TX ring takes fixed slots and none of the RX block options
+	struct tpacket_req3 tpr3Tx;
+	memset(&tpr3Tx, 0, sizeof(tpr3Tx));
+	tpr3Tx.tp_block_size = PACKET_RING_BLOCK_SIZE;
+	tpr3Tx.tp_block_nr = PACKET_RING_TX_BLOCK_COUNT;
+	tpr3Tx.tp_frame_size = PACKET_RING_TX_FRAME_SIZE;
+	tpr3Tx.tp_frame_nr = PACKET_RING_TX_FRAME_COUNT;
+	if ((0 != setsockopt(m_iSocket, SOL_PACKET, PACKET_RX_RING, &tpr3Rx, sizeof(tpr3Rx))) ||
+		(0 != setsockopt(m_iSocket, SOL_PACKET, PACKET_TX_RING, &tpr3Tx, sizeof(tpr3Tx))))
+	{
+		return false;
+	}
+	// One mapping for both rings, RX first
+	const size_t stMapSize = (size_t)PACKET_RING_BLOCK_SIZE * (PACKET_RING_RX_BLOCK_COUNT + PACKET_RING_TX_BLOCK_COUNT);
+	void* const pvMap = mmap(0, stMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iSocket, 0);
+	if (MAP_FAILED == pvMap)
+	{
+		return false;
+	}
+	m_pbMap = (uint8_t*)pvMap;
+	m_stMapSize = stMapSize;
+	m_iRxBlock = 0;
+	m_dwRxPacketsLeft = 0;
+	m_pbRxPacket = 0;
+	m_bRxBlockHeld = false;
+	m_iTxSlot = 0;
+	m_iTxQueued = 0;
+	return true;
+}
+
+void PacketRing::Close()
+{
+	if (0 != m_pbMap)
+	{
+		VERIFY(0 == munmap(m_pbMap, m_stMapSize));
+		m_pbMap = 0;
+		m_stMapSize = 0;
+	}
+	if (-1 != m_iSocket)
+	{
+		VERIFY(0 == close(m_iSocket));
+		m_iSocket = -1;
+	}
+}
+
+void PacketRing::ReleaseBlock()
+{
+	ASSERT(m_bRxBlockHeld);
+	struct tpacket_block_desc* const ptbd = (struct tpacket_block_desc*)(m_pbMap + ((size_t)m_iRxBlock * PACKET_RING_BLOCK_SIZE));
+	// Every read of the block happens before the kernel may overwrite it
+	__atomic_store_n(&ptbd->hdr.bh1.block_status, (uint32_t)TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	m_bRxBlockHeld = false;
+	m_dwRxPacketsLeft = 0;
+	m_iRxBlock = (m_iRxBlock + 1) % PACKET_RING_RX_BLOCK_COUNT;
+}
+
+// The UDP pseudo header (addresses, protocol, length) summed without building it
+uint32_t PacketRing::PseudoHeaderSum(const uint8_t* const pbIp, const uint16_t wUdpSize)
+{
+	return (uint32_t)ReadNetworkWord(&pbIp[12]) + ReadNetworkWord(&pbIp[14]) + ReadNetworkWord(&pbIp[16]) + ReadNetworkWord(&pbIp[18]) + IPPROTO_UDP + wUdpSize;
+}
+
+bool PacketRing::Receive(PacketRingDatagram* const pprdDatagram)
+{
+	ASSERT((0 != m_pbMap) && (0 != pprdDatagram));
+	while (true)
+	{
+		if (0 == m_dwRxPacketsLeft)
+		{
+			if (m_bRxBlockHeld)
+			{
+				ReleaseBlock();
+			}
+			const struct tpacket_block_desc* const ptbd = (const struct tpacket_block_desc*)(m_pbMap + ((size_t)m_iRxBlock * PACKET_RING_BLOCK_SIZE));
+			// Reads of the block's packets must not be reordered before this
+			if (0 == (TP_STATUS_USER & __atomic_load_n(&ptbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)))
+			{
+				return false;
+			}
+			m_bRxBlockHeld = true;
+			m_dwRxPacketsLeft = ptbd->hdr.bh1.num_pkts;
+			m_pbRxPacket = (const uint8_t*)ptbd + ptbd->hdr.bh1.offset_to_first_pkt;
+			continue;  // A block may be retired empty
+		}
+		const struct tpacket3_hdr* const ptph = (const struct tpacket3_hdr*)m_pbRxPacket;
+		m_pbRxPacket += ptph->tp_next_offset;
+		m_dwRxPacketsLeft--;
+
+		// The filter only passes IPv4 UDP to the port; the lengths are still the sender's to get wrong
+		const uint8_t* const pbFrame = (const uint8_t*)ptph + ptph->tp_mac;
+		const size_t stFrameSize = ptph->tp_snaplen;
+		if ((stFrameSize != ptph->tp_len) || (stFrameSize < ETHERNET_HEADER_SIZE + IPV4_HEADER_SIZE + UDP_HEADER_SIZE))
+		{
+			continue;
+		}
+		const uint8_t* const pbIp = pbFrame + ETHERNET_HEADER_SIZE;
+		const size_t stIpHeaderSize = (size_t)(pbIp[0] & 0x0f) * 4;
+		const size_t stIpSize = ReadNetworkWord(&pbIp[2]);
+		if ((0x40 != (pbIp[0] & 0xf0)) || (stIpHeaderSize < IPV4_HEADER_SIZE) || (stIpSize < stIpHeaderSize + UDP_HEADER_SIZE) ||
+			(stFrameSize - ETHERNET_HEADER_SIZE < stIpSize) || (0 != InternetChecksum(pbIp, stIpHeaderSize, 0)))
+		{
+			continue;
+		}
+		const uint8_t* const pbUdp = pbIp + stIpHeaderSize;
+		const size_t stUdpSize = ReadNetworkWord(&pbUdp[4]);
+		if ((stUdpSize < UDP_HEADER_SIZE) || (stIpSize - stIpHeaderSize < stUdpSize))
+		{
+			continue;
+		}
+		// A checksum left to offload (a local sender) is not computed yet; 0 means none was sent
+		if ((0 == (ptph->tp_status & (TP_STATUS_CSUMNOTREADY | TP_STATUS_CSUM_VALID))) && (0 != ReadNetworkWord(&pbUdp[6])) &&
+			(0 != InternetChecksum(pbUdp, stUdpSize, PseudoHeaderSum(pbIp, (uint16_t)stUdpSize))))
+		{
+			continue;
+		}
+		pprdDatagram->pbPayload = pbUdp + UDP_HEADER_SIZE;
+		pprdDatagram->stPayloadSize = stUdpSize - UDP_HEADER_SIZE;
+		pprdDatagram->pbSourceHardwareAddr = pbFrame + PACKET_RING_HARDWARE_ADDRESS_SIZE;
+		memcpy(&pprdDatagram->dwSourceAddr, &pbIp[12], sizeof(pprdDatagram->dwSourceAddr));
+		memcpy(&pprdDatagram->dwDestinationAddr, &pbIp[16], sizeof(pprdDatagram->dwDestinationAddr));
+		pprdDatagram->wSourcePort = ReadNetworkWord(&pbUdp[0]);
+		return true;
+	}
+}
+
+uint8_t* PacketRing::TransmitBuffer()
+{
+	ASSERT(0 != m_pbMap);
+	uint8_t* const pbSlot = m_pbMap + ((size_t)PACKET_RING_BLOCK_SIZE * PACKET_RING_RX_BLOCK_COUNT) + ((size_t)m_iTxSlot * PACKET_RING_TX_FRAME_SIZE);
+	const struct tpacket3_hdr* const ptph = (const struct tpacket3_hdr*)pbSlot;
+	if (TP_STATUS_AVAILABLE != __atomic_load_n(&ptph->tp_status, __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+	return pbSlot + PACKET_RING_TX_DATA_OFFSET + PACKET_RING_HEADERS_SIZE;
+}
+
+void PacketRing::Transmit(const size_t stPayloadSize, const uint8_t* const pbDestinationHardwareAddr, const uint32_t dwSourceAddr, const uint32_t dwDestinationAddr, const uint16_t wSourcePort, const uint16_t wDestinationPort)
+{
+	ASSERT((0 != m_pbMap) && (stPayloadSize <= PACKET_RING_MAX_PAYLOAD_SIZE) && (0 != pbDestinationHardwareAddr));
+	uint8_t* const pbSlot = m_pbMap + ((size_t)PACKET_RING_BLOCK_SIZE * PACKET_RING_RX_BLOCK_COUNT) + ((size_t)m_iTxSlot * PACKET_RING_TX_FRAME_SIZE);
+	struct tpacket3_hdr* const ptph = (struct tpacket3_hdr*)pbSlot;
+	ASSERT(TP_STATUS_AVAILABLE == ptph->tp_status);
+	uint8_t* const pbFrame = pbSlot + PACKET_RING_TX_DATA_OFFSET;
+	memcpy(&pbFrame[0], pbDestinationHardwareAddr, PACKET_RING_HARDWARE_ADDRESS_SIZE);
+	memcpy(&pbFrame[PACKET_RING_HARDWARE_ADDRESS_SIZE], m_pbHardwareAddr, PACKET_RING_HARDWARE_ADDRESS_SIZE);
+	WriteNetworkWord(&pbFrame[12], ETH_P_IP);
+	uint8_t* const pbIp = pbFrame + ETHERNET_HEADER_SIZE;
+	pbIp[0] = 0x45;  // Version 4, no options
+	pbIp[1] = 0;
+	WriteNetworkWord(&pbIp[2], (uint16_t)(IPV4_HEADER_SIZE + UDP_HEADER_SIZE + stPayloadSize));
+	WriteNetworkWord(&pbIp[4], m_wIdentification++);
+	WriteNetworkWord(&pbIp[6], 0);
+	pbIp[8] = IPV4_TTL;
+	pbIp[9] = IPPROTO_UDP;
+	WriteNetworkWord(&pbIp[10], 0);
+	memcpy(&pbIp[12], &dwSourceAddr, sizeof(dwSourceAddr));
+	memcpy(&pbIp[16], &dwDestinationAddr, sizeof(dwDestinationAddr));
+	WriteNetworkWord(&pbIp[10], InternetChecksum(pbIp, IPV4_HEADER_SIZE, 0));
+	uint8_t* const pbUdp = pbIp + IPV4_HEADER_SIZE;
+	const uint16_t wUdpSize = (uint16_t)(UDP_HEADER_SIZE + stPayloadSize);
+	WriteNetworkWord(&pbUdp[0], wSourcePort);
+	WriteNetworkWord(&pbUdp[2], wDestinationPort);
+	WriteNetworkWord(&pbUdp[4], wUdpSize);
+	WriteNetworkWord(&pbUdp[6], 0);
+	const uint16_t wUdpChecksum = InternetChecksum(pbUdp, wUdpSize, PseudoHeaderSum(pbIp, wUdpSize));
+	WriteNetworkWord(&pbUdp[6], (0 == wUdpChecksum) ? 0xffff : wUdpChecksum);  // RFC 768: 0 means no checksum
+	ptph->tp_len = (uint32_t)(PACKET_RING_HEADERS_SIZE + stPayloadSize);
+	ptph->tp_snaplen = ptph->tp_len;
+	ptph->tp_next_offset = 0;
+	__atomic_store_n(&ptph->tp_status, (uint32_t)TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	m_iTxSlot = (m_iTxSlot + 1) % PACKET_RING_TX_FRAME_COUNT;
+	m_iTxQueued++;
+}
+
+bool PacketRing::Flush()
+{
+	ASSERT(-1 != m_iSocket);
+	if (0 == m_iTxQueued)
+	{
+		return true;
+	}
+	m_iTxQueued = 0;
+	// Blocking, so the kernel has released every slot it took when this returns
+	while (-1 == send(m_iSocket, 0, 0, 0))
+	{
+		if (EINTR != errno)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,80 @@
+#if !defined(PACKET_RING_HEADER)
+#define PACKET_RING_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ethernet, IPv4 (without options) and UDP headers in front of a transmitted payload
+#define PACKET_RING_HEADERS_SIZE (14 + 20 + 8)
+// Transmit frames are fixed-size slots of the TX ring
+#define PACKET_RING_TX_FRAME_SIZE (1024)
+// Largest payload Transmit frames (the slot less the ring's and the packet's headers)
+#define PACKET_RING_MAX_PAYLOAD_SIZE (PACKET_RING_TX_FRAME_SIZE - 48 - PACKET_RING_HEADERS_SIZE)
+#define PACKET_RING_HARDWARE_ADDRESS_SIZE (6)
+
+// A UDP datagram in the RX ring; valid until the next call to Receive
+struct PacketRingDatagram
+{
+	const uint8_t* pbPayload;
+	size_t stPayloadSize;
+	const uint8_t* pbSourceHardwareAddr;  // Ethernet source
+	uint32_t dwSourceAddr;  // Network order
+	uint32_t dwDestinationAddr;  // Network order
+	uint16_t wSourcePort;  // Host order
+};
+
+// IPv4/UDP over one Ethernet interface through an AF_PACKET socket with
+// memory-mapped TPACKET_V3 rings (Linux). The kernel writes received frames
+// into blocks of the RX ring, which Receive walks in place; Transmit builds
+// the Ethernet, IPv4 and UDP headers around a payload already written into a
+// TX ring slot, and Flush hands every queued slot to the kernel in one call.
+// A classic BPF filter keeps everything but unfragmented IPv4 UDP datagrams to
+// the port out of the ring. Not thread-safe: each worker opens its own.
+class PacketRing
+{
+public:
+	PacketRing();
+	~PacketRing();
+
+	// Fails if the interface is not Ethernet, or without CAP_NET_RAW
+	bool Open(const unsigned int iInterfaceIndex, const uint16_t wPort);
+	void Close();
+
+	int Descriptor() const { return m_iSocket; }
+	unsigned int InterfaceIndex() const { return m_iInterfaceIndex; }
+	const uint8_t* HardwareAddr() const { return m_pbHardwareAddr; }
+
+	// Returns false when the kernel has handed over no more datagrams; the
+	// blocks read so far go back to the kernel
+	bool Receive(PacketRingDatagram* const pprdDatagram);
+	// Room for a payload of up to PACKET_RING_MAX_PAYLOAD_SIZE bytes in the
+	// next TX slot; 0 while the kernel still owns every slot
+	uint8_t* TransmitBuffer();
+	// Frames the payload written to TransmitBuffer and queues it
+	void Transmit(const size_t stPayloadSize, const uint8_t* const pbDestinationHardwareAddr, const uint32_t dwSourceAddr, const uint32_t dwDestinationAddr, const uint16_t wSourcePort, const uint16_t wDestinationPort);
+	// Sends the queued frames and waits until their slots are free again
+	bool Flush();
+
+private:
+	bool MapRings();
+	void ReleaseBlock();
+	static uint32_t PseudoHeaderSum(const uint8_t* const pbIp, const uint16_t wUdpSize);
+
+	PacketRing(const PacketRing&);
+	PacketRing& operator=(const PacketRing&);
+
+	int m_iSocket;
+	unsigned int m_iInterfaceIndex;
+	uint8_t m_pbHardwareAddr[PACKET_RING_HARDWARE_ADDRESS_SIZE];
+	uint8_t* m_pbMap;  // RX blocks, then TX slots
+	size_t m_stMapSize;
+	unsigned int m_iRxBlock;  // Block being read
+	uint32_t m_dwRxPacketsLeft;  // In m_iRxBlock; 0 before it is handed over
+	const uint8_t* m_pbRxPacket;  // Next packet header in m_iRxBlock
+	bool m_bRxBlockHeld;  // m_iRxBlock is ours until released
+	unsigned int m_iTxSlot;  // Next slot to fill
+	unsigned int m_iTxQueued;  // Slots queued since the last Flush
+	uint16_t m_wIdentification;  // IPv4 identification of the next frame
+};
+
+#endif  // !defined(PACKET_RING_HEADER)
@@ -0,0 +1,137 @@
+#include <new>
+#include "ToolBox.h"
+#include "ProbeCache.h"
+
+ProbeCache::ProbeCache()
+	: m_stCount(0)
+{
+}
+
+ProbeState ProbeCache::Find(const uint32_t dwAddrValue, const uint64_t qwNow) const
+{
+	const size_t stSlot = FindSlot(dwAddrValue);
+	if ((m_vEntries.size() == stSlot) || (m_vEntries[stSlot].qwExpireTime <= qwNow))
+	{
+		return Probe_NONE;
+	}
+	return (qwNow < m_vEntries[stSlot].qwDeadline) ? Probe_PENDING : Probe_FREE;
+}
+
+bool ProbeCache::Start(const uint32_t dwAddrValue, const uint64_t qwNow, const uint64_t qwDeadline, const uint64_t qwExpireTime)
+{
+	ASSERT((0 != dwAddrValue) && (qwNow < qwDeadline) && (qwDeadline <= qwExpireTime));
+	size_t stSlot = FindSlot(dwAddrValue);
+	if (m_vEntries.size() == stSlot)
+	{
+		if ((m_stCount + 1) * 2 > m_vEntries.size())
+		{
+			if (!Rebuild(qwNow))
+			{
+				return false;
+			}
+		}
+		const size_t stMask = m_vEntries.size() - 1;
+		stSlot = HomeOf(dwAddrValue);
+		while (0 != m_vEntries[stSlot].dwAddrValue)
+		{
+			stSlot = (stSlot + 1) & stMask;
+		}
+		m_vEntries[stSlot].dwAddrValue = dwAddrValue;
+		m_stCount++;
+	}
+	m_vEntries[stSlot].qwDeadline = qwDeadline;
+	m_vEntries[stSlot].qwExpireTime = qwExpireTime;
+	return true;
+}
+
+void ProbeCache::Remove(const uint32_t dwAddrValue)
+{
+	const size_t stSlot = FindSlot(dwAddrValue);
+	if (m_vEntries.size() != stSlot)
+	{
+		RemoveSlot(stSlot);
+	}
+}
+
+size_t ProbeCache::FindSlot(const uint32_t dwAddrValue) const
+{
+	if (m_vEntries.empty())
+	{
+		return 0;
+	}
+	const size_t stMask = m_vEntries.size() - 1;
+	for (size_t i = HomeOf(dwAddrValue); 0 != m_vEntries[i].dwAddrValue; i = (i + 1) & stMask)
+	{
+		if (dwAddrValue == m_vEntries[i].dwAddrValue)
+		{
+			return i;
+		}
+	}
+	return m_vEntries.size();
+}
+
+void ProbeCache::RemoveSlot(const size_t stSlot)
+{
+	// Backward shift deletion, as in the lease table's client index
+	const size_t stMask = m_vEntries.size() - 1;
+	size_t i = stSlot;
+	for (size_t j = (i + 1) & stMask; 0 != m_vEntries[j].dwAddrValue; j = (j + 1) & stMask)
+	{
+		const size_t stHome = HomeOf(m_vEntries[j].dwAddrValue);
+		if (((j - stHome) & stMask) >= ((j - i) & stMask))
+		{
+			m_vEntries[i] = m_vEntries[j];
+			i = j;
+		}
+	}
+	m_vEntries[i].dwAddrValue = 0;
+	m_stCount--;
+}
+
+bool ProbeCache::Rebuild(const uint64_t qwNow)
+{
+	// Expired results go first; the table only doubles if the live ones still fill half of it
+	size_t stLive = 0;
+	for (size_t i = 0; i < m_vEntries.size(); i++)
+	{
+		if ((0 != m_vEntries[i].dwAddrValue) && (qwNow < m_vEntries[i].qwExpireTime))
+		{
+			stLive++;
+		}
+	}
+	size_t stSlotCount = MIN_SLOT_COUNT;
+	while ((stLive + 1) * 2 > stSlotCount)
+	{
+		stSlotCount *= 2;
+	}
+	std::vector<Entry> vEntries;
+	try
+	{
+		Entry eEmpty;
+		eEmpty.qwDeadline = 0;
+		eEmpty.qwExpireTime = 0;
+		eEmpty.dwAddrValue = 0;
+		vEntries.assign(stSlotCount, eEmpty);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	m_vEntries.swap(vEntries);
+	m_stCount = 0;
+	const size_t stMask = m_vEntries.size() - 1;
+	for (size_t i = 0; i < vEntries.size(); i++)
+	{
+		if ((0 != vEntries[i].dwAddrValue) && (qwNow < vEntries[i].qwExpireTime))
+		{
+			size_t j = HomeOf(vEntries[i].dwAddrValue);
+			while (0 != m_vEntries[j].dwAddrValue)
+			{
+				j = (j + 1) & stMask;
+			}
+			m_vEntries[j] = vEntries[i];
+			m_stCount++;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#if !defined(PROBE_CACHE_HEADER)
+#define PROBE_CACHE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+enum ProbeState
+{
+	Probe_NONE,  // Never probed, or the result expired
+	Probe_PENDING,  // Waiting for an answer
+	Probe_FREE,  // Nobody answered in time
+};
+
+// Conflict probes of one shard's addresses: a probe is pending until its
+// deadline, and an address nobody answered for by then stays known to be free
+// (and is not probed again) until the result expires. An answer removes the
+// address. Open addressing with linear probing keyed by address value, sized
+// for the probes in flight and cached rather than for the range, so a scope
+// that never probes allocates nothing; expired results are dropped when the
+// table would otherwise grow. Not thread-safe: the shard's lock guards it.
+class ProbeCache
+{
+public:
+	ProbeCache();
+
+	ProbeState Find(const uint32_t dwAddrValue, const uint64_t qwNow) const;
+	// Pending until qwDeadline, then free until qwExpireTime; fails when out of memory
+	bool Start(const uint32_t dwAddrValue, const uint64_t qwNow, const uint64_t qwDeadline, const uint64_t qwExpireTime);
+	void Remove(const uint32_t dwAddrValue);
+
+	size_t Size() const { return m_stCount; }
+
+private:
+	enum
+	{
+		MIN_SLOT_COUNT = 16,
+	};
+
+	struct Entry
+	{
+		uint64_t qwDeadline;
+		uint64_t qwExpireTime;
+		uint32_t dwAddrValue;  // 0 for an empty slot (never a served address)
+	};
+
+	size_t HomeOf(const uint32_t dwAddrValue) const { return (size_t)((dwAddrValue * 0x9e3779b1u) & (m_vEntries.size() - 1)); }
+	// The entry's slot, or m_vEntries.size() if the address has none
+	size_t FindSlot(const uint32_t dwAddrValue) const;
+	void RemoveSlot(const size_t stSlot);
+	bool Rebuild(const uint64_t qwNow);
+
+	std::vector<Entry> m_vEntries;  // Size is 0 or a power of 2
+	size_t m_stCount;
+};
+
+#endif  // !defined(PROBE_CACHE_HEADER)
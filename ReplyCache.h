@@ -0,0 +1,213 @@
+#if !defined(REPLY_CACHE_HEADER)
+#define REPLY_CACHE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <new>
+#include "ToolBox.h"
+#include "DHCPMessage.h"
+
+// Replies recently sent, so a client's retransmission (same xid, same client
+// identifier, same request but for secs) gets the encoded reply again
+// without decoding, a lease lookup or a new allocation. A fixed number of
+// entries allocated up front, in 8-way buckets: the 64-bit request hashes of
+// a bucket fill one cache line, so a miss (the common case) reads one line,
+// and a hit reads that line and then one contiguous entry (the rest of the
+// key, where to send the reply and the reply bytes). A new
+// reply replaces the least recently stored entry of its bucket. TInfo is
+// whatever else the caller needs to resend the reply (e.g. where to send it).
+template <typename TInfo>
+class ReplyCache
+{
+public:
+	ReplyCache() : m_stBucketMask(0), m_qwInsertCount(0) {}
+
+	// stEntryCount is rounded up to a power of 2 (at least one bucket)
+	bool Initialize(const size_t stEntryCount)
+	{
+		ASSERT((1 <= stEntryCount) && !m_pbkBuckets);
+		size_t stBucketCount = 1;
+		while (stBucketCount * WAY_COUNT < stEntryCount)
+		{
+			stBucketCount <<= 1;
+		}
+		try
+		{
+			m_pbkBuckets.reset(new Bucket[stBucketCount]);
+			m_peEntries.reset(new Entry[stBucketCount * WAY_COUNT]);
+		}
+		catch (const std::bad_alloc)
+		{
+			m_pbkBuckets.reset();
+			return false;
+		}
+		memset(m_pbkBuckets.get(), 0, stBucketCount * sizeof(Bucket));
+		for (size_t i = 0; i < stBucketCount * WAY_COUNT; i++)
+		{
+			m_peEntries[i].qwInsertNumber = 0;
+		}
+		m_stBucketMask = stBucketCount - 1;
+		return true;
+	}
+
+	// Identifies a request's retransmissions: the fixed header up to chaddr
+	// but secs (bytes 8-9, which a client may bump each time) and the options,
+	// so it covers the xid, the client identifier (option 61 or chaddr) and
+	// the message type. sname and file are left out: a client reusing an xid
+	// for a new request changes the options, not them. The caller checks the
+	// request holds a whole DHCPMessage. Four independent multiply-rotate lanes
+	// over 8-byte words, so the multiplies overlap; the last options block is
+	// read ending at the last byte, overlapping the one before, instead of
+	// being copied and padded. Never 0 (an empty way).
+	static uint64_t HashRequest(const uint8_t* const pbRequest, const size_t stRequestSize)
+	{
+		ASSERT(sizeof(DHCPMessage) <= stRequestSize);
+		uint8_t pbHeader[48];
+		C_ASSERT(offsetof(DHCPMessage, sname) + sizeof(DHCPMessage::magicCookie) == sizeof(pbHeader));
+		memcpy(pbHeader, pbRequest, offsetof(DHCPMessage, sname));
+		memcpy(&pbHeader[offsetof(DHCPMessage, sname)], &pbRequest[offsetof(DHCPMessage, magicCookie)], sizeof(DHCPMessage::magicCookie));
+		pbHeader[offsetof(DHCPMessage, secs)] = 0;
+		pbHeader[offsetof(DHCPMessage, secs) + 1] = 0;
+		uint64_t qwLane0 = MixWord(stRequestSize, &pbHeader[0]);
+		uint64_t qwLane1 = MixWord(0x9e3779b97f4a7c15ull, &pbHeader[8]);
+		uint64_t qwLane2 = MixWord(0xbf58476d1ce4e5b9ull, &pbHeader[16]);
+		uint64_t qwLane3 = MixWord(0x94d049bb133111ebull, &pbHeader[24]);
+		qwLane0 = MixWord(qwLane0, &pbHeader[32]);
+		qwLane1 = MixWord(qwLane1, &pbHeader[40]);
+		for (size_t i = sizeof(DHCPMessage); i < stRequestSize; i += 32)
+		{
+			// Requests are longer than 32 bytes, so the last block never starts before them
+			const uint8_t* const pbBlock = (i + 32 <= stRequestSize) ? &pbRequest[i] : &pbRequest[stRequestSize - 32];
+			qwLane0 = MixWord(qwLane0, &pbBlock[0]);
+			qwLane1 = MixWord(qwLane1, &pbBlock[8]);
+			qwLane2 = MixWord(qwLane2, &pbBlock[16]);
+			qwLane3 = MixWord(qwLane3, &pbBlock[24]);
+		}
+		uint64_t qwHash = qwLane0 ^ Rotate(qwLane1, 16) ^ Rotate(qwLane2, 32) ^ Rotate(qwLane3, 48);
+		qwHash = (qwHash ^ (qwHash >> 33)) * 0xff51afd7ed558ccdull;
+		return (qwHash ^ (qwHash >> 33)) | 1;
+	}
+
+	// Copies the reply cached for the request (HashRequest's qwRequestHash)
+	// into pbReply (DHCP_REPLY_SIZE bytes) and returns its size, if it was
+	// stored before qwNow reached its expiry time; 0 otherwise
+	size_t Find(const uint64_t qwRequestHash, const DHCPMessage& rdhcpmRequest, const size_t stRequestSize, const unsigned int iInterfaceIndex, const uint64_t qwNow, uint8_t* const pbReply, TInfo* const ptInfo, uint8_t* const pbRequestMessageType) const
+	{
+		const size_t stBucket = BucketOf(qwRequestHash);
+		const Bucket& rbk = m_pbkBuckets[stBucket];
+		for (unsigned int i = 0; i < WAY_COUNT; i++)
+		{
+			if (rbk.pqwRequestHashes[i] != qwRequestHash)
+			{
+				continue;
+			}
+			const Entry& re = m_peEntries[(stBucket * WAY_COUNT) + i];
+			if ((re.dwXid != rdhcpmRequest.xid) || (re.wRequestSize != stRequestSize) || (re.iInterfaceIndex != iInterfaceIndex) || (re.qwExpireTime <= qwNow))
+			{
+				return 0;
+			}
+			memcpy(pbReply, re.pbReply, offsetof(DHCPMessage, file));
+			memset(&pbReply[offsetof(DHCPMessage, file)], 0, sizeof(DHCPMessage::file));
+			memcpy(&pbReply[offsetof(DHCPMessage, magicCookie)], &re.pbReply[offsetof(DHCPMessage, file)], re.wReplySize - offsetof(DHCPMessage, magicCookie));
+			*ptInfo = re.tInfo;
+			*pbRequestMessageType = re.bRequestMessageType;
+			return re.wReplySize;
+		}
+		return 0;
+	}
+
+	void Insert(const uint64_t qwRequestHash, const DHCPMessage& rdhcpmRequest, const size_t stRequestSize, const unsigned int iInterfaceIndex, const uint64_t qwExpireTime, const uint8_t bRequestMessageType, const uint8_t* const pbReply, const size_t stReplySize, const TInfo& rtInfo)
+	{
+		ASSERT((0 != qwRequestHash) && (sizeof(DHCPMessage) <= stReplySize) && (stReplySize <= DHCP_REPLY_SIZE));
+		if (0xffff < stRequestSize)
+		{
+			return;  // Larger than any datagram, so never retransmitted
+		}
+		for (size_t i = offsetof(DHCPMessage, file); i < offsetof(DHCPMessage, magicCookie); i++)
+		{
+			if (0 != pbReply[i])
+			{
+				return;  // Only replies with an empty file field fit in a slot
+			}
+		}
+		// The same request again (its cached reply had expired), else the oldest way (empty ways are older than any)
+		const size_t stBucket = BucketOf(qwRequestHash);
+		Bucket& rbk = m_pbkBuckets[stBucket];
+		unsigned int iWay = 0;
+		for (unsigned int i = 0; i < WAY_COUNT; i++)
+		{
+			if (rbk.pqwRequestHashes[i] == qwRequestHash)
+			{
+				iWay = i;
+				break;
+			}
+			if (m_peEntries[(stBucket * WAY_COUNT) + i].qwInsertNumber < m_peEntries[(stBucket * WAY_COUNT) + iWay].qwInsertNumber)
+			{
+				iWay = i;
+			}
+		}
+		rbk.pqwRequestHashes[iWay] = qwRequestHash;
+		Entry& re = m_peEntries[(stBucket * WAY_COUNT) + iWay];
+		re.qwExpireTime = qwExpireTime;
+		re.qwInsertNumber = ++m_qwInsertCount;
+		re.dwXid = rdhcpmRequest.xid;
+		re.iInterfaceIndex = iInterfaceIndex;
+		re.wRequestSize = (uint16_t)stRequestSize;
+		re.wReplySize = (uint16_t)stReplySize;
+		re.bRequestMessageType = bRequestMessageType;
+		re.tInfo = rtInfo;
+		memcpy(re.pbReply, pbReply, offsetof(DHCPMessage, file));
+		memcpy(&re.pbReply[offsetof(DHCPMessage, file)], &pbReply[offsetof(DHCPMessage, magicCookie)], stReplySize - offsetof(DHCPMessage, magicCookie));
+	}
+
+	size_t EntryCount() const { return (m_stBucketMask + 1) * WAY_COUNT; }
+
+private:
+	enum
+	{
+		WAY_COUNT = 8,
+		// A reply is stored without its file field (always empty in this
+		// server's replies, and a quarter of one), so fewer lines are read
+		REPLY_SLOT_SIZE = DHCP_REPLY_SIZE - sizeof(DHCPMessage::file),
+	};
+
+	struct alignas(64) Bucket
+	{
+		uint64_t pqwRequestHashes[WAY_COUNT];  // 0 for an empty way
+	};
+
+	struct alignas(64) Entry
+	{
+		uint64_t qwExpireTime;
+		uint64_t qwInsertNumber;  // 0 for an empty way
+		uint32_t dwXid;
+		unsigned int iInterfaceIndex;  // Ingress; the same bytes on another link are another client
+		uint16_t wRequestSize;
+		uint16_t wReplySize;
+		uint8_t bRequestMessageType;
+		TInfo tInfo;
+		uint8_t pbReply[REPLY_SLOT_SIZE];
+	};
+
+	static uint64_t Rotate(const uint64_t qw, const unsigned int iBits) { return (qw << iBits) | (qw >> (64 - iBits)); }
+	static uint64_t MixWord(const uint64_t qwLane, const uint8_t* const pbWord)
+	{
+		uint64_t qwWord;
+		memcpy(&qwWord, pbWord, sizeof(qwWord));
+		return Rotate((qwLane ^ qwWord) * 0xc4ceb9fe1a85ec53ull, 29);
+	}
+	// The high half picks the bucket; the whole hash is compared within it
+	size_t BucketOf(const uint64_t qwRequestHash) const { return (size_t)(qwRequestHash >> 32) & m_stBucketMask; }
+
+	ReplyCache(const ReplyCache&);
+	ReplyCache& operator=(const ReplyCache&);
+
+	std::unique_ptr<Bucket[]> m_pbkBuckets;
+	std::unique_ptr<Entry[]> m_peEntries;  // WAY_COUNT per bucket
+	size_t m_stBucketMask;
+	uint64_t m_qwInsertCount;
+};
+
+#endif  // !defined(REPLY_CACHE_HEADER)
@@ -0,0 +1,290 @@
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include "ToolBox.h"
+#include "ReservationTable.h"
+
+static inline uint64_t MixKey(uint64_t qwKey)
+{
+	qwKey = (qwKey ^ (qwKey >> 33)) * 0xff51afd7ed558ccdull;
+	qwKey = (qwKey ^ (qwKey >> 33)) * 0xc4ceb9fe1a85ec53ull;
+	return qwKey ^ (qwKey >> 33);
+}
+
+// Addresses are kept in network order; exclusions are compared as host order values
+static inline uint32_t AddrToValue(const uint32_t dwAddr)
+{
+	const uint8_t* const pb = (const uint8_t*)&dwAddr;
+	return (((uint32_t)pb[0]) << 24) | (((uint32_t)pb[1]) << 16) | (((uint32_t)pb[2]) << 8) | pb[3];
+}
+
+static bool IsBefore(const ReservationExclusion& rre1, const ReservationExclusion& rre2)
+{
+	return rre1.dwFirstAddrValue < rre2.dwFirstAddrValue;
+}
+
+ReservationTable::ReservationTable()
+	: m_qwSeed(0), m_bBuilt(false)
+{
+}
+
+uint64_t ReservationTable::HashKey(const uint64_t qwSeed, const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize)
+{
+	// The type and size go in first (off the key's dependency chain), so
+	// only the key's words are mixed in sequence. Fixed-size reads only: the
+	// last word ends at the key's end (overlapping the one before), and a key
+	// shorter than a word is read as two overlapping halves (a MAC is one word).
+	uint64_t qwHash = MixKey(qwSeed ^ (((uint64_t)rktType) << 32) ^ stKeySize);
+	uint64_t qw;
+	if (sizeof(uint64_t) <= stKeySize)
+	{
+		size_t i = 0;
+		for (; i + sizeof(uint64_t) < stKeySize; i += sizeof(uint64_t))
+		{
+			memcpy(&qw, &pbKey[i], sizeof(qw));
+			qwHash = MixKey(qwHash ^ qw);
+		}
+		memcpy(&qw, &pbKey[stKeySize - sizeof(qw)], sizeof(qw));
+	}
+	else if (sizeof(uint32_t) <= stKeySize)
+	{
+		uint32_t dwLow;
+		uint32_t dwHigh;
+		memcpy(&dwLow, &pbKey[0], sizeof(dwLow));
+		memcpy(&dwHigh, &pbKey[stKeySize - sizeof(dwHigh)], sizeof(dwHigh));
+		qw = (((uint64_t)dwHigh) << 32) | dwLow;
+	}
+	else
+	{
+		qw = (((uint64_t)pbKey[0]) << 16) | (((uint64_t)pbKey[stKeySize / 2]) << 8) | pbKey[stKeySize - 1];
+	}
+	return MixKey(qwHash ^ qw);
+}
+
+size_t ReservationTable::SlotOf(const uint64_t qwHash, const uint32_t dwDisplacement) const
+{
+	// One multiplication: keys sharing a bucket (similar high bits) still land apart through the low ones
+	return (size_t)(((((qwHash ^ (dwDisplacement * 0x9e3779b97f4a7c15ull)) * 0xc4ceb9fe1a85ec53ull) >> 32) * m_vEntries.size()) >> 32);
+}
+
+bool ReservationTable::KeyEquals(const Entry& re, const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize) const
+{
+	return (re.bType == (uint8_t)rktType) && (re.wKeySize == stKeySize) && (0 == memcmp(&m_vbKeys[re.dwKeyOffset], pbKey, stKeySize));
+}
+
+bool ReservationTable::AddReservation(const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize, const uint32_t dwAddr)
+{
+	ASSERT(!m_bBuilt && ((0 == stKeySize) || (0 != pbKey)));
+	if ((0 == stKeySize) || (RESERVATION_MAX_KEY_SIZE < stKeySize) || (UINT32_MAX - RESERVATION_MAX_KEY_SIZE < m_vbKeys.size()))
+	{
+		return false;
+	}
+	Entry e;
+	e.qwHash = 0;
+	e.dwAddr = dwAddr;
+	e.dwKeyOffset = (uint32_t)m_vbKeys.size();
+	e.wKeySize = (uint16_t)stKeySize;
+	e.bType = (uint8_t)rktType;
+	try
+	{
+		m_vbKeys.insert(m_vbKeys.end(), pbKey, pbKey + stKeySize);
+		m_vEntries.push_back(e);
+	}
+	catch (const std::bad_alloc)
+	{
+		m_vbKeys.resize(e.dwKeyOffset);
+		return false;
+	}
+	return true;
+}
+
+bool ReservationTable::AddExclusion(const uint32_t dwFirstAddr, const uint32_t dwLastAddr)
+{
+	ASSERT(!m_bBuilt && (AddrToValue(dwFirstAddr) <= AddrToValue(dwLastAddr)));
+	ReservationExclusion re;
+	re.dwFirstAddrValue = AddrToValue(dwFirstAddr);
+	re.dwLastAddrValue = AddrToValue(dwLastAddr);
+	try
+	{
+		m_vreExclusions.push_back(re);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool ReservationTable::Place(std::vector<Entry>* const pvEntries)
+{
+	// Buckets with the most keys go first, while most slots are free: a
+	// bucket of k keys needs a displacement sending all k to free slots,
+	// which gets harder fast as the table fills. The last buckets have one
+	// key each and only need any free slot.
+	const size_t stEntryCount = m_vEntries.size();
+	const size_t stBucketCount = m_vdwDisplacements.size();
+	std::vector<uint32_t> vdwFirstOfBucket(stBucketCount + 1, 0);
+	std::vector<uint32_t> vdwMembers(stEntryCount);
+	std::vector<uint32_t> vdwOrder(stBucketCount);
+	std::vector<uint8_t> vbTaken(stEntryCount, 0);
+	pvEntries->assign(stEntryCount, Entry());
+	for (size_t i = 0; i < stEntryCount; i++)
+	{
+		vdwFirstOfBucket[BucketOf(m_vEntries[i].qwHash) + 1]++;
+	}
+	for (size_t i = 0; i < stBucketCount; i++)
+	{
+		vdwFirstOfBucket[i + 1] += vdwFirstOfBucket[i];
+		vdwOrder[i] = (uint32_t)i;
+	}
+	{
+		std::vector<uint32_t> vdwNext(vdwFirstOfBucket.begin(), vdwFirstOfBucket.end() - 1);
+		for (size_t i = 0; i < stEntryCount; i++)
+		{
+			vdwMembers[vdwNext[BucketOf(m_vEntries[i].qwHash)]++] = (uint32_t)i;
+		}
+	}
+	std::stable_sort(vdwOrder.begin(), vdwOrder.end(), [&vdwFirstOfBucket](const uint32_t dw1, const uint32_t dw2)
+	{
+		return vdwFirstOfBucket[dw2 + 1] - vdwFirstOfBucket[dw2] < vdwFirstOfBucket[dw1 + 1] - vdwFirstOfBucket[dw1];
+	});
+	std::vector<size_t> vstSlots;
+	for (size_t i = 0; i < stBucketCount; i++)
+	{
+		const uint32_t dwBucket = vdwOrder[i];
+		const uint32_t* const pdwMembers = &vdwMembers[vdwFirstOfBucket[dwBucket]];
+		const size_t stMemberCount = vdwFirstOfBucket[dwBucket + 1] - vdwFirstOfBucket[dwBucket];
+		if (0 == stMemberCount)
+		{
+			break;  // So are the rest
+		}
+		vstSlots.resize(stMemberCount);
+		uint32_t dwDisplacement = 0;
+		for (; dwDisplacement < MAX_DISPLACEMENT; dwDisplacement++)
+		{
+			size_t j = 0;
+			for (; j < stMemberCount; j++)
+			{
+				vstSlots[j] = SlotOf(m_vEntries[pdwMembers[j]].qwHash, dwDisplacement);
+				if ((0 != vbTaken[vstSlots[j]]) || (std::find(vstSlots.begin(), vstSlots.begin() + j, vstSlots[j]) != vstSlots.begin() + j))
+				{
+					break;
+				}
+			}
+			if (stMemberCount == j)
+			{
+				break;
+			}
+		}
+		if (MAX_DISPLACEMENT == dwDisplacement)
+		{
+			return false;
+		}
+		m_vdwDisplacements[dwBucket] = dwDisplacement;
+		for (size_t j = 0; j < stMemberCount; j++)
+		{
+			vbTaken[vstSlots[j]] = 1;
+			(*pvEntries)[vstSlots[j]] = m_vEntries[pdwMembers[j]];
+		}
+	}
+	return true;
+}
+
+bool ReservationTable::Build()
+{
+	ASSERT(!m_bBuilt);
+	try
+	{
+		// Exclusions: sorted, with overlapping and adjacent ranges merged
+		std::sort(m_vreExclusions.begin(), m_vreExclusions.end(), IsBefore);
+		size_t stMerged = 0;
+		for (size_t i = 0; i < m_vreExclusions.size(); i++)
+		{
+			if ((0 != stMerged) && ((UINT32_MAX == m_vreExclusions[stMerged - 1].dwLastAddrValue) || (m_vreExclusions[i].dwFirstAddrValue <= m_vreExclusions[stMerged - 1].dwLastAddrValue + 1)))
+			{
+				m_vreExclusions[stMerged - 1].dwLastAddrValue = std::max(m_vreExclusions[stMerged - 1].dwLastAddrValue, m_vreExclusions[i].dwLastAddrValue);
+			}
+			else
+			{
+				m_vreExclusions[stMerged++] = m_vreExclusions[i];
+			}
+		}
+		m_vreExclusions.resize(stMerged);
+		// An address belongs to one client
+		std::vector<uint32_t> vdwAddrs(m_vEntries.size());
+		for (size_t i = 0; i < m_vEntries.size(); i++)
+		{
+			vdwAddrs[i] = m_vEntries[i].dwAddr;
+		}
+		std::sort(vdwAddrs.begin(), vdwAddrs.end());
+		if (std::adjacent_find(vdwAddrs.begin(), vdwAddrs.end()) != vdwAddrs.end())
+		{
+			return false;
+		}
+		std::vector<Entry> vEntries;
+		for (unsigned int iTry = 0; iTry < MAX_SEED_TRIES; iTry++)
+		{
+			m_qwSeed = MixKey(0x9e3779b97f4a7c15ull * (iTry + 1));
+			for (size_t i = 0; i < m_vEntries.size(); i++)
+			{
+				Entry& re = m_vEntries[i];
+				re.qwHash = HashKey(m_qwSeed, (ReservationKeyType)re.bType, &m_vbKeys[re.dwKeyOffset], re.wKeySize);
+			}
+			// Keys with the same hash could never be told apart: either the
+			// same key twice, or (rarely) a collision that another seed avoids
+			std::vector<uint32_t> vdwByHash(m_vEntries.size());
+			for (size_t i = 0; i < m_vEntries.size(); i++)
+			{
+				vdwByHash[i] = (uint32_t)i;
+			}
+			const std::vector<Entry>& rvEntries = m_vEntries;
+			std::sort(vdwByHash.begin(), vdwByHash.end(), [&rvEntries](const uint32_t dw1, const uint32_t dw2) { return rvEntries[dw1].qwHash < rvEntries[dw2].qwHash; });
+			bool bCollision = false;
+			for (size_t i = 1; i < vdwByHash.size(); i++)
+			{
+				const Entry& re1 = m_vEntries[vdwByHash[i - 1]];
+				const Entry& re2 = m_vEntries[vdwByHash[i]];
+				if (re1.qwHash == re2.qwHash)
+				{
+					if (KeyEquals(re1, (ReservationKeyType)re2.bType, &m_vbKeys[re2.dwKeyOffset], re2.wKeySize))
+					{
+						return false;
+					}
+					bCollision = true;
+				}
+			}
+			if (bCollision)
+			{
+				continue;
+			}
+			m_vdwDisplacements.assign((m_vEntries.size() + BUCKET_KEYS - 1) / BUCKET_KEYS, 0);
+			if (Place(&vEntries))
+			{
+				m_vEntries.swap(vEntries);
+				m_bBuilt = true;
+				return true;
+			}
+		}
+	}
+	catch (const std::bad_alloc)
+	{
+	}
+	return false;
+}
+
+bool ReservationTable::Find(const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize, uint32_t* const pdwAddr) const
+{
+	ASSERT(m_bBuilt && (0 != pdwAddr));
+	if (m_vEntries.empty() || (RESERVATION_MAX_KEY_SIZE < stKeySize))
+	{
+		return false;
+	}
+	const uint64_t qwHash = HashKey(m_qwSeed, rktType, pbKey, stKeySize);
+	const Entry& re = m_vEntries[SlotOf(qwHash, m_vdwDisplacements[BucketOf(qwHash)])];
+	if ((re.qwHash != qwHash) || !KeyEquals(re, rktType, pbKey, stKeySize))
+	{
+		return false;
+	}
+	*pdwAddr = re.dwAddr;
+	return true;
+}
@@ -0,0 +1,90 @@
+#if !defined(RESERVATION_TABLE_HEADER)
+#define RESERVATION_TABLE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Longest key a reservation can have (a single option 61 value)
+#define RESERVATION_MAX_KEY_SIZE (255)
+
+// What a reservation's key is matched against
+enum ReservationKeyType
+{
+	ReservationKey_HARDWARE_ADDRESS,  // The first hlen bytes of chaddr
+	ReservationKey_CLIENT_IDENTIFIER,  // The Client Identifier option (61)
+};
+
+// An excluded range, [dwFirstAddrValue, dwLastAddrValue] in host order values
+struct ReservationExclusion
+{
+	uint32_t dwFirstAddrValue;
+	uint32_t dwLastAddrValue;
+};
+
+// Fixed addresses for known clients and ranges kept out of the dynamic pools,
+// compiled once at startup. Reservations go into a minimal perfect hash
+// (hash and displace): every key hashes to a bucket of a few keys, and each
+// bucket stores the displacement that sent its keys to slots no other key
+// took, so the n reservations fill exactly n slots and a lookup is one read
+// of the bucket's displacement and one of the slot, whatever the number of
+// reservations. The keys themselves are kept to reject clients that are not
+// reserved. Exclusions are sorted and merged so they can be cleared from the
+// pools' bitmaps a word at a time. Read-only (and so shared by every worker)
+// once built.
+class ReservationTable
+{
+public:
+	ReservationTable();
+
+	// Before Build; dwAddr in network order. Fails on an empty or too long
+	// key, or when out of memory.
+	bool AddReservation(const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize, const uint32_t dwAddr);
+	// Before Build; network order, dwFirstAddr <= dwLastAddr
+	bool AddExclusion(const uint32_t dwFirstAddr, const uint32_t dwLastAddr);
+	// Fails when a key or an address is reserved twice, or when out of memory
+	bool Build();
+
+	// The reserved address (network order) of the client with this key
+	bool Find(const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize, uint32_t* const pdwAddr) const;
+
+	size_t ReservationCount() const { return m_vEntries.size(); }
+	// Network order
+	uint32_t ReservedAddress(const size_t stReservation) const { return m_vEntries[stReservation].dwAddr; }
+	// Sorted, none overlapping or adjacent
+	size_t ExclusionCount() const { return m_vreExclusions.size(); }
+	const ReservationExclusion& Exclusion(const size_t stExclusion) const { return m_vreExclusions[stExclusion]; }
+
+private:
+	enum
+	{
+		BUCKET_KEYS = 4,  // Keys per bucket, on average
+		MAX_DISPLACEMENT = 1 << 30,  // Tries per bucket before another seed is picked (the last buckets take about n)
+		MAX_SEED_TRIES = 16,
+	};
+
+	struct Entry
+	{
+		uint64_t qwHash;
+		uint32_t dwAddr;  // Network order
+		uint32_t dwKeyOffset;  // In m_vbKeys
+		uint16_t wKeySize;
+		uint8_t bType;  // ReservationKeyType
+	};
+
+	static uint64_t HashKey(const uint64_t qwSeed, const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize);
+	size_t BucketOf(const uint64_t qwHash) const { return (size_t)(((qwHash >> 32) * m_vdwDisplacements.size()) >> 32); }
+	size_t SlotOf(const uint64_t qwHash, const uint32_t dwDisplacement) const;
+	bool KeyEquals(const Entry& re, const ReservationKeyType rktType, const uint8_t* const pbKey, const size_t stKeySize) const;
+	// false when a bucket could not be placed with this seed
+	bool Place(std::vector<Entry>* const pvEntries);
+
+	std::vector<Entry> m_vEntries;  // In slot order once built
+	std::vector<uint8_t> m_vbKeys;
+	std::vector<uint32_t> m_vdwDisplacements;  // Per bucket
+	std::vector<ReservationExclusion> m_vreExclusions;
+	uint64_t m_qwSeed;
+	bool m_bBuilt;
+};
+
+#endif  // !defined(RESERVATION_TABLE_HEADER)
@@ -0,0 +1,85 @@
+#include <new>
+#include "ToolBox.h"
+#include "ScopeTable.h"
+
+ScopeTable::ScopeTable()
+{
+}
+
+uint32_t ScopeTable::AddNode(const uint32_t dwEntry, const uint8_t bPrefixLength)
+{
+	// Every entry of a new node inherits what covered the entry it replaces
+	const uint32_t dwNode = (uint32_t)(m_vdwEntries.size() >> 8);
+	m_vdwEntries.resize(m_vdwEntries.size() + 256, dwEntry);
+	m_vbPrefixLengths.resize(m_vbPrefixLengths.size() + 256, bPrefixLength);
+	return dwNode;
+}
+
+void ScopeTable::Fill(const size_t stEntry, const uint32_t dwEntry, const uint8_t bPrefixLength)
+{
+	if (0 != (CHILD_FLAG & m_vdwEntries[stEntry]))
+	{
+		const size_t stChild = (size_t)(m_vdwEntries[stEntry] & ~CHILD_FLAG) << 8;
+		for (size_t i = 0; i < 256; i++)
+		{
+			Fill(stChild + i, dwEntry, bPrefixLength);
+		}
+	}
+	else if (m_vbPrefixLengths[stEntry] <= bPrefixLength)
+	{
+		// Longer prefixes already there stay: they are the better match
+		m_vdwEntries[stEntry] = dwEntry;
+		m_vbPrefixLengths[stEntry] = bPrefixLength;
+	}
+}
+
+bool ScopeTable::Insert(const uint32_t dwNetworkValue, const unsigned int iPrefixLength, const unsigned int iScope)
+{
+	ASSERT((iPrefixLength <= 32) && (iScope + 1 < CHILD_FLAG));
+	try
+	{
+		if (m_vdwEntries.empty())
+		{
+			AddNode(0, 0);
+		}
+		// A prefix adds at most three nodes; room for them up front makes the
+		// insert all or nothing (resizing within the capacity cannot throw)
+		const size_t stNeeded = m_vdwEntries.size() + (3 * 256);
+		if (m_vdwEntries.capacity() < stNeeded)
+		{
+			const size_t stCapacity = (stNeeded < 2 * m_vdwEntries.capacity()) ? (2 * m_vdwEntries.capacity()) : stNeeded;
+			m_vdwEntries.reserve(stCapacity);
+			m_vbPrefixLengths.reserve(stCapacity);
+		}
+		else if (m_vbPrefixLengths.capacity() < stNeeded)
+		{
+			m_vbPrefixLengths.reserve(m_vdwEntries.capacity());
+		}
+		// Walk (and build) the path down to the node whose stride holds the end of the prefix
+		size_t stNode = 0;
+		unsigned int iStrideEnd = 8;
+		while (iStrideEnd < iPrefixLength)
+		{
+			const size_t stEntry = (stNode << 8) | ((dwNetworkValue >> (32 - iStrideEnd)) & 0xff);
+			if (0 == (CHILD_FLAG & m_vdwEntries[stEntry]))
+			{
+				const uint32_t dwChild = AddNode(m_vdwEntries[stEntry], m_vbPrefixLengths[stEntry]);
+				m_vdwEntries[stEntry] = CHILD_FLAG | dwChild;
+			}
+			stNode = m_vdwEntries[stEntry] & ~CHILD_FLAG;
+			iStrideEnd += 8;
+		}
+		// The bits of the stride past the prefix are free, so it covers a run of entries
+		const size_t stCount = ((size_t)1) << (iStrideEnd - iPrefixLength);
+		const size_t stFirst = ((dwNetworkValue >> (32 - iStrideEnd)) & 0xff) & ~(stCount - 1);
+		for (size_t i = stFirst; i < stFirst + stCount; i++)
+		{
+			Fill((stNode << 8) | i, iScope + 1, (uint8_t)iPrefixLength);
+		}
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+#if !defined(SCOPE_TABLE_HEADER)
+#define SCOPE_TABLE_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Longest-prefix match from IPv4 subnets to scope numbers: a multibit trie
+// with 8-bit strides and controlled prefix expansion. A prefix that ends
+// inside a stride is written into every entry it covers, and an entry
+// either holds the scope of the longest prefix covering it or points to the
+// node below, so a lookup is at most four dependent reads (one per address
+// byte) whatever the number of subnets, with no backtracking. Nodes are
+// 1 KB and only exist below prefixes longer than /8, /16 or /24; a
+// thousand /24s inside one /16 take a few nodes.
+class ScopeTable
+{
+public:
+	ScopeTable();
+
+	// dwNetworkValue is a host order value (its bits past iPrefixLength are
+	// ignored); a later insert of the same prefix replaces the scope
+	bool Insert(const uint32_t dwNetworkValue, const unsigned int iPrefixLength, const unsigned int iScope);
+
+	// Scope of the longest prefix covering dwAddrValue (host order), or -1
+	int Find(const uint32_t dwAddrValue) const
+	{
+		if (m_vdwEntries.empty())
+		{
+			return -1;
+		}
+		uint32_t dwEntry = m_vdwEntries[dwAddrValue >> 24];
+		for (unsigned int iShift = 16; (0 != (CHILD_FLAG & dwEntry)); iShift -= 8)
+		{
+			// Nodes below a /32 do not exist, so this stops by the last byte
+			dwEntry = m_vdwEntries[((size_t)(dwEntry & ~CHILD_FLAG) << 8) | ((dwAddrValue >> iShift) & 0xff)];
+		}
+		return (int)dwEntry - 1;
+	}
+
+	size_t NodeCount() const { return m_vdwEntries.size() >> 8; }
+
+private:
+	enum
+	{
+		CHILD_FLAG = 0x80000000,  // Otherwise the entry is scope + 1, 0 for none
+	};
+
+	uint32_t AddNode(const uint32_t dwEntry, const uint8_t bPrefixLength);
+	void Fill(const size_t stEntry, const uint32_t dwEntry, const uint8_t bPrefixLength);
+
+	std::vector<uint32_t> m_vdwEntries;  // 256 per node; node 0 is the root
+	std::vector<uint8_t> m_vbPrefixLengths;  // Of the prefix each leaf entry came from (only needed to insert)
+};
+
+#endif  // !defined(SCOPE_TABLE_HEADER)
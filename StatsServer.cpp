@@ -0,0 +1,213 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string>
+#include <system_error>
+#include "ToolBox.h"
+#include "StatsServer.h"
+
+// How often the server thread checks for Stop (milliseconds)
+#define STATS_SERVER_STOP_POLL_INTERVAL (250)
+// How long a client gets to send its request and read the response (seconds)
+#define STATS_SERVER_CLIENT_TIMEOUT (2)
+
+// Whether the header lines of pcsRequest (up to the blank line) include field pcsName ("Name:")
+static bool HasHeaderField(const char* const pcsRequest, const char* const pcsName)
+{
+	const size_t stNameLength = strlen(pcsName);
+	for (const char* pcs = strchr(pcsRequest, '\n'); (0 != pcs) && ('\r' != pcs[1]) && ('\n' != pcs[1]); pcs = strchr(pcs + 1, '\n'))
+	{
+		if (0 == strncasecmp(pcs + 1, pcsName, stNameLength))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+StatsServer::StatsServer()
+	: m_pdmMetrics(0), m_pcsHandlerPath(0), m_pfnHandler(0), m_pvHandlerContext(0), m_bHandlerAcceptsChanges(false), m_iListener(-1), m_abStopping(false)
+{
+}
+
+StatsServer::~StatsServer()
+{
+	Stop();
+}
+
+bool StatsServer::Start(const DhcpMetrics* const pdmMetrics, const uint16_t wPort)
+{
+	ASSERT((0 != pdmMetrics) && (-1 == m_iListener));
+	m_pdmMetrics = pdmMetrics;
+	m_iListener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (-1 == m_iListener)
+	{
+		return false;
+	}
+	const int iReuseAddress = 1;
+	struct sockaddr_in saLocal;
+	memset(&saLocal, 0, sizeof(saLocal));
+	saLocal.sin_family = AF_INET;
+	saLocal.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Local only: the counters are not for the served network
+	saLocal.sin_port = htons(wPort);
+	if ((0 != setsockopt(m_iListener, SOL_SOCKET, SO_REUSEADDR, &iReuseAddress, sizeof(iReuseAddress))) ||
+		(0 != bind(m_iListener, (const struct sockaddr*)&saLocal, sizeof(saLocal))) ||
+		(0 != listen(m_iListener, 8)))
+	{
+		Stop();
+		return false;
+	}
+	m_abStopping = false;
+	try
+	{
+		m_thServer = std::thread(&StatsServer::Run, this);
+	}
+	catch (const std::system_error&)
+	{
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+void StatsServer::SetHandler(const char* const pcsPath, const PFN_STATS_SERVER_HANDLER pfnHandler, void* const pvContext, const bool bAcceptChanges)
+{
+	ASSERT((0 != pcsPath) && (0 != pfnHandler) && !m_thServer.joinable());
+	m_pcsHandlerPath = pcsPath;
+	m_pfnHandler = pfnHandler;
+	m_pvHandlerContext = pvContext;
+	m_bHandlerAcceptsChanges = bAcceptChanges;
+}
+
+void StatsServer::Run()
+{
+	std::string strBody;
+	while (!m_abStopping)
+	{
+		struct pollfd pfdListener;
+		pfdListener.fd = m_iListener;
+		pfdListener.events = POLLIN;
+		pfdListener.revents = 0;
+		if (poll(&pfdListener, 1, STATS_SERVER_STOP_POLL_INTERVAL) <= 0)
+		{
+			continue;  // Timeout or EINTR
+		}
+		const int iConnection = accept4(m_iListener, 0, 0, SOCK_CLOEXEC);
+		if (-1 == iConnection)
+		{
+			continue;
+		}
+		Answer(iConnection, &strBody);
+		VERIFY(0 == close(iConnection));
+	}
+}
+
+void StatsServer::Answer(const int iConnection, std::string* const pstrBody) const
+{
+	// A slow or silent client must not hold up the next scrape for long
+	struct timeval tvTimeout;
+	tvTimeout.tv_sec = STATS_SERVER_CLIENT_TIMEOUT;
+	tvTimeout.tv_usec = 0;
+	setsockopt(iConnection, SOL_SOCKET, SO_RCVTIMEO, &tvTimeout, sizeof(tvTimeout));
+	setsockopt(iConnection, SOL_SOCKET, SO_SNDTIMEO, &tvTimeout, sizeof(tvTimeout));
+	// Every path but the handler's serves the metrics, so only the request line, the end of the header and Origin matter
+	char pcsRequest[1024];
+	size_t stRequest = 0;
+	pcsRequest[0] = '\0';
+	bool bComplete = false;
+	while (!bComplete && (stRequest < sizeof(pcsRequest) - 1))
+	{
+		const ssize_t ssRead = recv(iConnection, pcsRequest + stRequest, sizeof(pcsRequest) - 1 - stRequest, 0);
+		if (ssRead <= 0)
+		{
+			break;
+		}
+		stRequest += (size_t)ssRead;
+		pcsRequest[stRequest] = '\0';
+		bComplete = (0 != strstr(pcsRequest, "\r\n\r\n")) || (0 != strstr(pcsRequest, "\n\n"));
+	}
+	char pcsHeader[160];
+	// "METHOD /path[?query] HTTP/1.x"; nothing but POST and PUT changes anything
+	const bool bHead = (0 == strncmp(pcsRequest, "HEAD ", 5));
+	const bool bRead = bHead || (0 == strncmp(pcsRequest, "GET ", 4));
+	const bool bChange = (0 == strncmp(pcsRequest, "POST ", 5)) || (0 == strncmp(pcsRequest, "PUT ", 4));
+	const char* const pcsPath = strchr(pcsRequest, ' ');
+	const size_t stPathLength = (0 != m_pcsHandlerPath) ? strlen(m_pcsHandlerPath) : 0;
+	const bool bHandlerPath = (0 != pcsPath) && (0 != stPathLength) && (0 == strncmp(pcsPath + 1, m_pcsHandlerPath, stPathLength)) &&
+		((' ' == pcsPath[1 + stPathLength]) || ('?' == pcsPath[1 + stPathLength]));
+	if (!bRead && !(bChange && bHandlerPath))
+	{
+		pstrBody->clear();
+		snprintf(pcsHeader, sizeof(pcsHeader), "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD%s\r\nContent-Length: 0\r\n\r\n", bHandlerPath ? ", POST, PUT" : "");
+	}
+	else if (bChange && (!m_bHandlerAcceptsChanges || !bComplete || HasHeaderField(pcsRequest, "Origin:")))
+	{
+		// Any web page can make a browser POST to a loopback port, but browsers name the page in Origin and curl
+		// does not; a header too long to check (a long URL can push Origin out of the buffer) is refused too
+		pstrBody->clear();
+		snprintf(pcsHeader, sizeof(pcsHeader), "HTTP/1.0 403 Forbidden\r\nContent-Length: 0\r\n\r\n");
+	}
+	else if (bHandlerPath)
+	{
+		char pcsQuery[sizeof(pcsRequest)] = "";
+		if ('?' == pcsPath[1 + stPathLength])
+		{
+			const char* const pcsQueryStart = pcsPath + 2 + stPathLength;
+			const size_t stQueryLength = strcspn(pcsQueryStart, " \r\n");
+			memcpy(pcsQuery, pcsQueryStart, stQueryLength);
+			pcsQuery[stQueryLength] = '\0';
+		}
+		pstrBody->clear();
+		const bool bHandled = m_pfnHandler(bChange, pcsQuery, pstrBody, m_pvHandlerContext);
+		snprintf(pcsHeader, sizeof(pcsHeader), "HTTP/1.0 %s\r\nContent-Type: text/plain\r\nContent-Length: %u\r\n\r\n", bHandled ? "200 OK" : "400 Bad Request", (unsigned int)pstrBody->size());
+	}
+	else if (m_pdmMetrics->FormatPrometheus(pstrBody))
+	{
+		snprintf(pcsHeader, sizeof(pcsHeader), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n\r\n", (unsigned int)pstrBody->size());
+	}
+	else
+	{
+		pstrBody->clear();
+		snprintf(pcsHeader, sizeof(pcsHeader), "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+	}
+	const char* const ppcsParts[2] = { pcsHeader, pstrBody->c_str() };
+	const size_t pstPartSizes[2] = { strlen(pcsHeader), bHead ? 0 : pstrBody->size() };
+	for (size_t i = 0; i < ARRAY_LENGTH(ppcsParts); i++)
+	{
+		size_t stSent = 0;
+		while (stSent < pstPartSizes[i])
+		{
+			const ssize_t ssSent = send(iConnection, ppcsParts[i] + stSent, pstPartSizes[i] - stSent, MSG_NOSIGNAL);
+			if (-1 == ssSent)
+			{
+				if (EINTR == errno)
+				{
+					continue;
+				}
+				return;
+			}
+			stSent += (size_t)ssSent;
+		}
+	}
+}
+
+void StatsServer::Stop()
+{
+	if (m_thServer.joinable())
+	{
+		m_abStopping = true;
+		m_thServer.join();
+	}
+	if (-1 != m_iListener)
+	{
+		VERIFY(0 == close(m_iListener));
+		m_iListener = -1;
+	}
+}
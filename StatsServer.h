@@ -0,0 +1,48 @@
+#if !defined(STATS_SERVER_HEADER)
+#define STATS_SERVER_HEADER
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "DhcpMetrics.h"
+
+// Writes the response to a request for the handler's path (pcsQuery is what
+// follows '?', or empty); bChange is true for POST and PUT, the only methods
+// that may change anything. false answers 400 Bad Request with the same body.
+typedef bool (*PFN_STATS_SERVER_HANDLER)(const bool bChange, const char* const pcsQuery, std::string* const pstrBody, void* const pvContext);
+
+// Serves DhcpMetrics in the Prometheus text format (POSIX). A background
+// thread listens on 127.0.0.1 and answers every connection with a single
+// HTTP/1.0 response, so both a Prometheus scrape and "curl" work. Formatting
+// only reads the workers' counters; it never blocks them.
+class StatsServer
+{
+public:
+	StatsServer();
+	~StatsServer();
+
+	bool Start(const DhcpMetrics* const pdmMetrics, const uint16_t wPort);
+	// Serves pcsPath (e.g. "/admission") with pfnHandler instead of the metrics; call before Start.
+	// GET and HEAD reach it always, POST and PUT only with bAcceptChanges (403 Forbidden otherwise).
+	void SetHandler(const char* const pcsPath, const PFN_STATS_SERVER_HANDLER pfnHandler, void* const pvContext, const bool bAcceptChanges);
+	void Stop();
+
+private:
+	void Run();
+	void Answer(const int iConnection, std::string* const pstrBody) const;
+
+	StatsServer(const StatsServer&);
+	StatsServer& operator=(const StatsServer&);
+
+	const DhcpMetrics* m_pdmMetrics;
+	const char* m_pcsHandlerPath;
+	PFN_STATS_SERVER_HANDLER m_pfnHandler;
+	void* m_pvHandlerContext;
+	bool m_bHandlerAcceptsChanges;
+	int m_iListener;
+	std::atomic<bool> m_abStopping;
+	std::thread m_thServer;
+};
+
+#endif  // !defined(STATS_SERVER_HEADER)
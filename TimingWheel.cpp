@@ -0,0 +1,171 @@
+#include <new>
+#include "ToolBox.h"
+#include "TimingWheel.h"
+
+TimingWheel::TimingWheel()
+	: m_qwNow(0), m_stCount(0)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(m_pdwHeads); i++)
+	{
+		m_pdwHeads[i] = NIL;
+	}
+	for (size_t i = 0; i < ARRAY_LENGTH(m_pqwOccupied); i++)
+	{
+		m_pqwOccupied[i] = 0;
+	}
+}
+
+bool TimingWheel::Initialize(const uint32_t dwCapacity)
+{
+	ASSERT(dwCapacity < NIL);
+	TimerNode tnUnscheduled;
+	tnUnscheduled.dwNext = NIL;
+	tnUnscheduled.dwPrev = NIL;
+	tnUnscheduled.qwExpireTime = 0;
+	tnUnscheduled.wSlot = NOT_SCHEDULED;
+	try
+	{
+		m_vtnNodes.assign(dwCapacity, tnUnscheduled);
+	}
+	catch (const std::bad_alloc)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < ARRAY_LENGTH(m_pdwHeads); i++)
+	{
+		m_pdwHeads[i] = NIL;
+	}
+	for (size_t i = 0; i < ARRAY_LENGTH(m_pqwOccupied); i++)
+	{
+		m_pqwOccupied[i] = 0;
+	}
+	m_qwNow = 0;
+	m_stCount = 0;
+	return true;
+}
+
+void TimingWheel::Insert(const uint32_t dwId, const uint64_t qwEarliest)
+{
+	TimerNode& rtn = m_vtnNodes[dwId];
+	const uint64_t qwExpireTime = (qwEarliest < rtn.qwExpireTime) ? rtn.qwExpireTime : qwEarliest;
+	const uint64_t qwDelta = qwExpireTime - m_qwNow;
+	unsigned int iLevel = 0;
+	while ((iLevel + 1 < LEVELS) && ((((uint64_t)1) << (SLOT_BITS * (iLevel + 1))) <= qwDelta))
+	{
+		iLevel++;
+	}
+	// Beyond the top level: park in the farthest slot and cascade again from there
+	const uint64_t qwPlacement = ((((uint64_t)1) << (SLOT_BITS * LEVELS)) <= qwDelta) ? (m_qwNow + (((uint64_t)1) << (SLOT_BITS * LEVELS)) - 1) : qwExpireTime;
+	const unsigned int iSlot = (unsigned int)((qwPlacement >> (SLOT_BITS * iLevel)) & (SLOTS - 1));
+	const unsigned int iHead = iLevel * SLOTS + iSlot;
+	rtn.wSlot = (uint16_t)iHead;
+	rtn.dwPrev = NIL;
+	rtn.dwNext = m_pdwHeads[iHead];
+	if (NIL != rtn.dwNext)
+	{
+		m_vtnNodes[rtn.dwNext].dwPrev = dwId;
+	}
+	m_pdwHeads[iHead] = dwId;
+	m_pqwOccupied[iLevel] |= ((uint64_t)1) << iSlot;
+}
+
+void TimingWheel::Unlink(const uint32_t dwId)
+{
+	TimerNode& rtn = m_vtnNodes[dwId];
+	ASSERT(NOT_SCHEDULED != rtn.wSlot);
+	if (NIL != rtn.dwPrev)
+	{
+		m_vtnNodes[rtn.dwPrev].dwNext = rtn.dwNext;
+	}
+	else
+	{
+		m_pdwHeads[rtn.wSlot] = rtn.dwNext;
+		if (NIL == rtn.dwNext)
+		{
+			m_pqwOccupied[rtn.wSlot / SLOTS] &= ~(((uint64_t)1) << (rtn.wSlot % SLOTS));
+		}
+	}
+	if (NIL != rtn.dwNext)
+	{
+		m_vtnNodes[rtn.dwNext].dwPrev = rtn.dwPrev;
+	}
+	rtn.wSlot = NOT_SCHEDULED;
+}
+
+void TimingWheel::Schedule(const uint32_t dwId, const uint64_t qwExpireTime)
+{
+	ASSERT(dwId < m_vtnNodes.size());
+	if (IsScheduled(dwId))
+	{
+		Unlink(dwId);
+	}
+	else
+	{
+		m_stCount++;
+	}
+	m_vtnNodes[dwId].qwExpireTime = qwExpireTime;
+	// The current tick has already been processed, so due times in the past fire on the next one
+	Insert(dwId, m_qwNow + 1);
+}
+
+void TimingWheel::Cancel(const uint32_t dwId)
+{
+	ASSERT(dwId < m_vtnNodes.size());
+	if (IsScheduled(dwId))
+	{
+		Unlink(dwId);
+		m_stCount--;
+	}
+}
+
+void TimingWheel::Cascade(const unsigned int iLevel)
+{
+	// Every timer in the current slot of iLevel is now close enough for a lower level
+	const unsigned int iHead = iLevel * SLOTS + (unsigned int)((m_qwNow >> (SLOT_BITS * iLevel)) & (SLOTS - 1));
+	while (NIL != m_pdwHeads[iHead])
+	{
+		const uint32_t dwId = m_pdwHeads[iHead];
+		Unlink(dwId);
+		// Cascading happens before the tick's level 0 slot is processed, so timers due now still fire on time
+		Insert(dwId, m_qwNow);
+	}
+}
+
+size_t TimingWheel::Advance(const uint64_t qwNow, const PFN_TIMER_EXPIRED pfnExpired, void* const pvContext)
+{
+	ASSERT(0 != pfnExpired);
+	size_t stExpired = 0;
+	while (m_qwNow < qwNow)
+	{
+		if (0 == m_pqwOccupied[0])
+		{
+			// Nothing can fire before level 0 wraps and the levels above cascade
+			const uint64_t qwLastBeforeWrap = m_qwNow | (SLOTS - 1);
+			if (m_qwNow < qwLastBeforeWrap)
+			{
+				m_qwNow = (qwNow < qwLastBeforeWrap) ? qwNow : qwLastBeforeWrap;
+				continue;
+			}
+		}
+		m_qwNow++;
+		for (unsigned int iLevel = 1; iLevel < LEVELS; iLevel++)
+		{
+			if (0 != (m_qwNow & ((((uint64_t)1) << (SLOT_BITS * iLevel)) - 1)))
+			{
+				break;
+			}
+			Cascade(iLevel);
+		}
+		const unsigned int iHead = (unsigned int)(m_qwNow & (SLOTS - 1));
+		while (NIL != m_pdwHeads[iHead])
+		{
+			const uint32_t dwId = m_pdwHeads[iHead];
+			Unlink(dwId);
+			ASSERT(m_vtnNodes[dwId].qwExpireTime <= m_qwNow);
+			m_stCount--;
+			stExpired++;
+			pfnExpired(dwId, pvContext);
+		}
+	}
+	return stExpired;
+}
@@ -0,0 +1,65 @@
+#if !defined(TIMING_WHEEL_HEADER)
+#define TIMING_WHEEL_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Called for each timer that expires; the timer is no longer scheduled, so
+// the callback may reschedule it or cancel others
+typedef void (*PFN_TIMER_EXPIRED)(const uint32_t dwId, void* const pvContext);
+
+// Hierarchical timing wheel (Varghese & Lauck) over timers identified by
+// [0, dwCapacity). Level 0 has one slot per tick; each level above covers 64
+// slots of the level below, and its slots are redistributed ("cascaded") into
+// the lower levels as time reaches them. Scheduling, cancelling and expiring
+// a timer are O(1); advancing over ticks with nothing due skips 64 ticks at a
+// time. Time is whatever the caller passes in (the clock is virtual), so a
+// test can advance hours in a single call.
+class TimingWheel
+{
+public:
+	TimingWheel();
+
+	bool Initialize(const uint32_t dwCapacity);
+
+	// Reschedules if already scheduled; times at or before Now() expire on the next tick
+	void Schedule(const uint32_t dwId, const uint64_t qwExpireTime);
+	void Cancel(const uint32_t dwId);
+	bool IsScheduled(const uint32_t dwId) const { return NOT_SCHEDULED != m_vtnNodes[dwId].wSlot; }
+	uint64_t ExpireTime(const uint32_t dwId) const { return m_vtnNodes[dwId].qwExpireTime; }
+
+	// Moves the clock forward to qwNow and returns how many timers expired
+	size_t Advance(const uint64_t qwNow, const PFN_TIMER_EXPIRED pfnExpired, void* const pvContext);
+	uint64_t Now() const { return m_qwNow; }
+	size_t Count() const { return m_stCount; }
+
+private:
+	enum
+	{
+		SLOT_BITS = 6,
+		SLOTS = 1 << SLOT_BITS,
+		LEVELS = 4,  // 2^24 ticks; later times wait in the top level
+		NIL = 0xffffffff,
+		NOT_SCHEDULED = 0xffff,
+	};
+	struct TimerNode
+	{
+		uint32_t dwNext;
+		uint32_t dwPrev;
+		uint64_t qwExpireTime;
+		uint16_t wSlot;  // Level * SLOTS + slot, or NOT_SCHEDULED
+	};
+
+	void Insert(const uint32_t dwId, const uint64_t qwEarliest);
+	void Unlink(const uint32_t dwId);
+	void Cascade(const unsigned int iLevel);
+
+	std::vector<TimerNode> m_vtnNodes;
+	uint32_t m_pdwHeads[LEVELS * SLOTS];
+	uint64_t m_pqwOccupied[LEVELS];  // One bit per non-empty slot
+	uint64_t m_qwNow;
+	size_t m_stCount;
+};
+
+#endif  // !defined(TIMING_WHEEL_HEADER)
@@ -0,0 +1,240 @@
+#include <vector>
+#include "ToolBox.h"
+#include "TimingWheel.h"
+#include "UnitTest.h"
+
+// Every timer must fire exactly at its tick: the callback records the clock
+// it fired at, and each test compares that with the time it was scheduled for
+
+#define TIMER_COUNT (4096)
+#define NOT_FIRED (~(uint64_t)0)
+
+struct FiredTimers
+{
+	const TimingWheel* ptwWheel;
+	std::vector<uint64_t> vqwFiredAt;  // Per timer
+	std::vector<uint32_t> vdwOrder;
+	uint64_t qwPeriod;  // Non-zero: each timer reschedules itself this far ahead
+	TimingWheel* ptwReschedule;
+};
+
+static void TimerExpired(const uint32_t dwId, void* const pvContext)
+{
+	FiredTimers* const pft = (FiredTimers*)pvContext;
+	CHECK(!pft->ptwWheel->IsScheduled(dwId));
+	CHECK(pft->ptwWheel->ExpireTime(dwId) <= pft->ptwWheel->Now());
+	pft->vqwFiredAt[dwId] = pft->ptwWheel->Now();
+	pft->vdwOrder.push_back(dwId);
+	if (0 != pft->qwPeriod)
+	{
+		pft->ptwReschedule->Schedule(dwId, pft->ptwWheel->Now() + pft->qwPeriod);
+	}
+}
+
+static void Reset(FiredTimers* const pft, const TimingWheel* const ptwWheel)
+{
+	pft->ptwWheel = ptwWheel;
+	pft->vqwFiredAt.assign(TIMER_COUNT, NOT_FIRED);
+	pft->vdwOrder.clear();
+	pft->qwPeriod = 0;
+	pft->ptwReschedule = 0;
+}
+
+// Deterministic pseudo-random numbers (so a failure reproduces)
+static uint64_t Next(uint64_t* const pqwState)
+{
+	*pqwState = (*pqwState * 6364136223846793005ULL) + 1442695040888963407ULL;
+	return *pqwState >> 17;
+}
+
+// Times on both sides of each level's span: 64 ticks, 4096, 2^18 and the top at 2^24
+static const uint64_t pqwBoundaries[] =
+{
+	1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 4159, 262143, 262144, 262145,
+	16777215, 16777216, 16777217, 33554432, 100000007,
+};
+
+static void TestBoundaries()
+{
+	// Advance straight to each due time: nothing may fire a tick early, and everything due must fire on it
+	for (size_t stStart = 0; stStart < 3; stStart++)
+	{
+		// Also from a clock that is not on a slot boundary, so placements straddle the levels
+		const uint64_t qwStart = (0 == stStart) ? 0 : ((1 == stStart) ? 37 : 4100);
+		TimingWheel twWheel;
+		CHECK(twWheel.Initialize(TIMER_COUNT));
+		FiredTimers ftFired;
+		Reset(&ftFired, &twWheel);
+		CHECK(0 == twWheel.Advance(qwStart, TimerExpired, &ftFired));
+		for (size_t i = 0; i < ARRAY_LENGTH(pqwBoundaries); i++)
+		{
+			twWheel.Schedule((uint32_t)i, qwStart + pqwBoundaries[i]);
+		}
+		CHECK(ARRAY_LENGTH(pqwBoundaries) == twWheel.Count());
+		for (size_t i = 0; i < ARRAY_LENGTH(pqwBoundaries); i++)
+		{
+			const uint64_t qwDue = qwStart + pqwBoundaries[i];
+			twWheel.Advance(qwDue - 1, TimerExpired, &ftFired);
+			CHECK(NOT_FIRED == ftFired.vqwFiredAt[i]);
+			CHECK(twWheel.IsScheduled((uint32_t)i));
+			CHECK(1 == twWheel.Advance(qwDue, TimerExpired, &ftFired));
+			CHECK(qwDue == ftFired.vqwFiredAt[i]);
+			CHECK(ARRAY_LENGTH(pqwBoundaries) - i - 1 == twWheel.Count());
+		}
+		CHECK(0 == twWheel.Count());
+	}
+}
+
+static void TestEveryTick()
+{
+	// Random due times within three levels, advancing one tick at a time, so every cascade is crossed
+	const uint64_t qwHorizon = 300000;
+	TimingWheel twWheel;
+	CHECK(twWheel.Initialize(TIMER_COUNT));
+	FiredTimers ftFired;
+	Reset(&ftFired, &twWheel);
+	std::vector<uint64_t> vqwDue(TIMER_COUNT);
+	uint64_t qwState = 1;
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		vqwDue[i] = 1 + (Next(&qwState) % qwHorizon);
+		twWheel.Schedule(i, vqwDue[i]);
+	}
+	size_t stExpired = 0;
+	for (uint64_t qwNow = 1; qwNow <= qwHorizon; qwNow++)
+	{
+		stExpired += twWheel.Advance(qwNow, TimerExpired, &ftFired);
+	}
+	CHECK(TIMER_COUNT == stExpired);
+	CHECK(0 == twWheel.Count());
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		CHECK(vqwDue[i] == ftFired.vqwFiredAt[i]);
+	}
+}
+
+static void TestLongSkip()
+{
+	// One call over hours of mostly empty slots (and past the top level) must still fire each timer on its tick, in order
+	TimingWheel twWheel;
+	CHECK(twWheel.Initialize(TIMER_COUNT));
+	FiredTimers ftFired;
+	Reset(&ftFired, &twWheel);
+	std::vector<uint64_t> vqwDue(TIMER_COUNT);
+	uint64_t qwState = 2;
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		// Spread over 2^12 to 2^30 ticks (beyond the top level's 2^24), roughly evenly per power of two
+		const unsigned int iBits = 12 + (unsigned int)(Next(&qwState) % 18);
+		vqwDue[i] = (((uint64_t)1) << iBits) + (Next(&qwState) % (((uint64_t)1) << iBits));
+		twWheel.Schedule(i, vqwDue[i]);
+	}
+	const uint64_t qwEnd = ((uint64_t)1) << 30;
+	CHECK(TIMER_COUNT == twWheel.Advance(qwEnd, TimerExpired, &ftFired));
+	CHECK(qwEnd == twWheel.Now());
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		CHECK(vqwDue[i] == ftFired.vqwFiredAt[i]);
+	}
+	for (size_t i = 1; i < ftFired.vdwOrder.size(); i++)
+	{
+		CHECK(vqwDue[ftFired.vdwOrder[i - 1]] <= vqwDue[ftFired.vdwOrder[i]]);
+	}
+	// An empty wheel skips without firing anything
+	CHECK(0 == twWheel.Advance(qwEnd + 1000000000ULL, TimerExpired, &ftFired));
+	CHECK(qwEnd + 1000000000ULL == twWheel.Now());
+}
+
+static void TestCancelAndReschedule()
+{
+	TimingWheel twWheel;
+	CHECK(twWheel.Initialize(TIMER_COUNT));
+	FiredTimers ftFired;
+	Reset(&ftFired, &twWheel);
+	std::vector<uint64_t> vqwDue(TIMER_COUNT);
+	uint64_t qwState = 3;
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		vqwDue[i] = 1 + (Next(&qwState) % 1000000);
+		twWheel.Schedule(i, vqwDue[i]);
+	}
+	// Cancel a quarter now, in every level
+	size_t stScheduled = TIMER_COUNT;
+	for (uint32_t i = 0; i < TIMER_COUNT; i += 4)
+	{
+		twWheel.Cancel(i);
+		CHECK(!twWheel.IsScheduled(i));
+		vqwDue[i] = NOT_FIRED;
+		stScheduled--;
+	}
+	twWheel.Cancel(0);  // Twice is harmless
+	CHECK(stScheduled == twWheel.Count());
+	// Move partway, so some timers have cascaded into lower levels, then cancel and move some of the rest
+	size_t stExpired = twWheel.Advance(300000, TimerExpired, &ftFired);
+	for (uint32_t i = 1; i < TIMER_COUNT; i += 4)
+	{
+		if (300000 < vqwDue[i])
+		{
+			twWheel.Cancel(i);
+			vqwDue[i] = NOT_FIRED;
+			stScheduled--;
+		}
+	}
+	for (uint32_t i = 2; i < TIMER_COUNT; i += 4)
+	{
+		if (300000 < vqwDue[i])
+		{
+			// Earlier for half, later for the other half
+			vqwDue[i] = (0 == (i & 4)) ? (300001 + (vqwDue[i] - 300000) / 2) : (vqwDue[i] + 5000000);
+			twWheel.Schedule(i, vqwDue[i]);
+			CHECK(vqwDue[i] == twWheel.ExpireTime(i));
+		}
+	}
+	CHECK(stScheduled - stExpired == twWheel.Count());
+	stExpired += twWheel.Advance(10000000, TimerExpired, &ftFired);
+	CHECK(stScheduled == stExpired);
+	CHECK(0 == twWheel.Count());
+	for (uint32_t i = 0; i < TIMER_COUNT; i++)
+	{
+		CHECK(vqwDue[i] == ftFired.vqwFiredAt[i]);
+	}
+}
+
+static void TestPastAndPeriodic()
+{
+	TimingWheel twWheel;
+	CHECK(twWheel.Initialize(TIMER_COUNT));
+	FiredTimers ftFired;
+	Reset(&ftFired, &twWheel);
+	twWheel.Advance(1000, TimerExpired, &ftFired);
+	// Due now or earlier: fires on the next tick
+	twWheel.Schedule(0, 1000);
+	twWheel.Schedule(1, 5);
+	twWheel.Schedule(2, 0);
+	CHECK(3 == twWheel.Advance(1001, TimerExpired, &ftFired));
+	CHECK((1001 == ftFired.vqwFiredAt[0]) && (1001 == ftFired.vqwFiredAt[1]) && (1001 == ftFired.vqwFiredAt[2]));
+	// A callback that reschedules its timer, crossing level 1 and level 2 cascades
+	Reset(&ftFired, &twWheel);
+	ftFired.qwPeriod = 4093;
+	ftFired.ptwReschedule = &twWheel;
+	twWheel.Schedule(3, 1001 + ftFired.qwPeriod);
+	for (uint64_t qwDue = 1001 + ftFired.qwPeriod; qwDue < 2000000; qwDue += ftFired.qwPeriod)
+	{
+		twWheel.Advance(qwDue - 1, TimerExpired, &ftFired);
+		CHECK(NOT_FIRED == ftFired.vqwFiredAt[3]);
+		CHECK(1 == twWheel.Advance(qwDue, TimerExpired, &ftFired));
+		CHECK(qwDue == ftFired.vqwFiredAt[3]);
+		CHECK(twWheel.IsScheduled(3) && (qwDue + ftFired.qwPeriod == twWheel.ExpireTime(3)));
+		ftFired.vqwFiredAt[3] = NOT_FIRED;
+	}
+}
+
+int main()
+{
+	TestBoundaries();
+	TestEveryTick();
+	TestLongSkip();
+	TestCancelAndReschedule();
+	TestPastAndPeriodic();
+	return UNIT_TEST_RESULT();
+}
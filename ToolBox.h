@@ -10,8 +10,10 @@
 // Do not use "new" or "delete" in any of the inlined code below (excluding templates)
 // so that we can avoid having those allocations tracked by ToolBoxDebug
 
+#if defined(_WIN32)
 #include <windows.h>
 #include <TCHAR.h>
+#endif  // defined(_WIN32)
 // Some environments do not have an assert.h file, but do have an ASSERT(...)
 // macro defined
 #if defined(ASSERT)
@@ -0,0 +1,33 @@
+#if !defined(UNIT_TEST_HEADER)
+#define UNIT_TEST_HEADER
+
+#include <stdio.h>
+
+// Checks for the unit tests (one executable per test, run by ctest): a failed
+// CHECK prints where it failed and the test goes on, so one run reports every
+// failure; main returns UNIT_TEST_RESULT()
+static unsigned int iUnitTestFailures = 0;
+
+#define CHECK(e) \
+	do \
+	{ \
+		if (!(e)) \
+		{ \
+			fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #e); \
+			iUnitTestFailures++; \
+		} \
+	} while (0)
+// Like CHECK, naming the table entry being checked
+#define CHECK_CASE(pcsCase, e) \
+	do \
+	{ \
+		if (!(e)) \
+		{ \
+			fprintf(stderr, "%s(%d): %s: CHECK(%s) failed\n", __FILE__, __LINE__, (pcsCase), #e); \
+			iUnitTestFailures++; \
+		} \
+	} while (0)
+
+#define UNIT_TEST_RESULT() ((0 == iUnitTestFailures) ? 0 : 1)
+
+#endif  // !defined(UNIT_TEST_HEADER)